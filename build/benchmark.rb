@@ -0,0 +1,197 @@
+#  Phusion Passenger - https://www.phusionpassenger.com/
+#  Copyright (c) 2010-2016 Phusion Holding B.V.
+#
+#  "Passenger", "Phusion Passenger" and "Union Station" are registered
+#  trademarks of Phusion Holding B.V.
+#
+#  Permission is hereby granted, free of charge, to any person obtaining a copy
+#  of this software and associated documentation files (the "Software"), to deal
+#  in the Software without restriction, including without limitation the rights
+#  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+#  copies of the Software, and to permit persons to whom the Software is
+#  furnished to do so, subject to the following conditions:
+#
+#  The above copyright notice and this permission notice shall be included in
+#  all copies or substantial portions of the Software.
+#
+#  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+#  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+#  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+#  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+#  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+#  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+#  THE SOFTWARE.
+
+### Core benchmark suite ###
+
+BENCHMARK_LOAD_GENERATOR_TARGET = "#{TEST_OUTPUT_DIR}benchmark/LoadGenerator"
+BENCHMARK_LOAD_GENERATOR_OBJECT = "#{TEST_OUTPUT_DIR}benchmark/LoadGenerator.o"
+
+define_cxx_object_compilation_task(
+  BENCHMARK_LOAD_GENERATOR_OBJECT,
+  "test/benchmark/LoadGenerator.cpp",
+  :include_paths => CXX_SUPPORTLIB_INCLUDE_PATHS
+)
+
+benchmark_libs = COMMON_LIBRARY.only(:base, :json)
+dependencies = [
+  BENCHMARK_LOAD_GENERATOR_OBJECT,
+  LIBBOOST_OXT,
+  benchmark_libs.link_objects
+].flatten.compact
+file(BENCHMARK_LOAD_GENERATOR_TARGET => dependencies) do
+  create_cxx_executable(BENCHMARK_LOAD_GENERATOR_TARGET,
+    [
+      BENCHMARK_LOAD_GENERATOR_OBJECT,
+      benchmark_libs.link_objects_as_string,
+      LIBBOOST_OXT_LINKARG
+    ],
+    :flags => [
+      PlatformInfo.portability_cxx_ldflags,
+      AGENT_LDFLAGS
+    ]
+  )
+end
+
+desc "Build the load generator for the Core benchmark suite"
+task 'benchmark:load_generator' => BENCHMARK_LOAD_GENERATOR_TARGET
+
+desc "Run the Core benchmark suite and write the results to benchmark.json " \
+  "(override with OUTPUT=...). See test/benchmark/suite.rb --help for the " \
+  "options that can be passed through BENCHMARK_ARGS"
+task :benchmark => [AGENT_TARGET, BENCHMARK_LOAD_GENERATOR_TARGET] do
+  output = string_option('OUTPUT', 'benchmark.json')
+  sh "#{PlatformInfo.ruby_command} test/benchmark/suite.rb" \
+    " --agent #{File.expand_path(AGENT_TARGET)}" \
+    " --load-generator #{File.expand_path(BENCHMARK_LOAD_GENERATOR_TARGET)}" \
+    " --output #{output} #{ENV['BENCHMARK_ARGS']}".strip
+end
+
+BENCHMARK_TRACE_POINTS_TARGET = "#{TEST_OUTPUT_DIR}benchmark/TracePointBenchmark"
+BENCHMARK_TRACE_POINTS_OBJECT = "#{TEST_OUTPUT_DIR}benchmark/TracePointBenchmark.o"
+
+define_cxx_object_compilation_task(
+  BENCHMARK_TRACE_POINTS_OBJECT,
+  "test/benchmark/TracePointBenchmark.cpp",
+  :include_paths => CXX_SUPPORTLIB_INCLUDE_PATHS
+)
+
+file(BENCHMARK_TRACE_POINTS_TARGET => [BENCHMARK_TRACE_POINTS_OBJECT, LIBBOOST_OXT]) do
+  create_cxx_executable(BENCHMARK_TRACE_POINTS_TARGET,
+    [
+      BENCHMARK_TRACE_POINTS_OBJECT,
+      LIBBOOST_OXT_LINKARG
+    ],
+    :flags => [
+      PlatformInfo.portability_cxx_ldflags,
+      AGENT_LDFLAGS
+    ]
+  )
+end
+
+desc "Measure the cost of oxt trace points (build with OPTIMIZE=yes for meaningful results)"
+task 'benchmark:trace_points' => BENCHMARK_TRACE_POINTS_TARGET do
+  sh "#{BENCHMARK_TRACE_POINTS_TARGET} #{ENV['ITERATIONS']}".strip
+end
+
+BENCHMARK_HASH_TARGET = "#{TEST_OUTPUT_DIR}benchmark/HashBenchmark"
+BENCHMARK_HASH_OBJECT = "#{TEST_OUTPUT_DIR}benchmark/HashBenchmark.o"
+
+define_cxx_object_compilation_task(
+  BENCHMARK_HASH_OBJECT,
+  "test/benchmark/HashBenchmark.cpp",
+  :include_paths => [
+    "src/agent",
+    *CXX_SUPPORTLIB_INCLUDE_PATHS
+  ],
+  :flags => LIBEV_CFLAGS
+)
+
+benchmark_hash_libs = COMMON_LIBRARY.only(:base, 'Utils/Hasher.o',
+  'MemoryKit/palloc.o', 'MemoryKit/mbuf.o', 'DataStructures/LString.o')
+file(BENCHMARK_HASH_TARGET => [BENCHMARK_HASH_OBJECT, LIBBOOST_OXT,
+  benchmark_hash_libs.link_objects].flatten) do
+  create_cxx_executable(BENCHMARK_HASH_TARGET,
+    [
+      BENCHMARK_HASH_OBJECT,
+      benchmark_hash_libs.link_objects_as_string,
+      LIBBOOST_OXT_LINKARG
+    ],
+    :flags => [
+      PlatformInfo.portability_cxx_ldflags,
+      AGENT_LDFLAGS
+    ]
+  )
+end
+
+desc "Measure hashing, header tables and turbocache key preparation (build with OPTIMIZE=yes for meaningful results)"
+task 'benchmark:hash' => BENCHMARK_HASH_TARGET do
+  sh "#{BENCHMARK_HASH_TARGET} #{ENV['ITERATIONS']}".strip
+end
+
+
+BENCHMARK_CGI_HEADERS_TARGET = "#{TEST_OUTPUT_DIR}benchmark/CgiHeaderBenchmark"
+BENCHMARK_CGI_HEADERS_OBJECT = "#{TEST_OUTPUT_DIR}benchmark/CgiHeaderBenchmark.o"
+
+define_cxx_object_compilation_task(
+  BENCHMARK_CGI_HEADERS_OBJECT,
+  "test/benchmark/CgiHeaderBenchmark.cpp",
+  :include_paths => [
+    "src/agent",
+    *CXX_SUPPORTLIB_INCLUDE_PATHS
+  ]
+)
+
+file(BENCHMARK_CGI_HEADERS_TARGET => [BENCHMARK_CGI_HEADERS_OBJECT, LIBBOOST_OXT,
+  benchmark_hash_libs.link_objects].flatten) do
+  create_cxx_executable(BENCHMARK_CGI_HEADERS_TARGET,
+    [
+      BENCHMARK_CGI_HEADERS_OBJECT,
+      benchmark_hash_libs.link_objects_as_string,
+      LIBBOOST_OXT_LINKARG
+    ],
+    :flags => [
+      PlatformInfo.portability_cxx_ldflags,
+      AGENT_LDFLAGS
+    ]
+  )
+end
+
+desc "Measure the conversion of request headers to session protocol variables (build with OPTIMIZE=yes for meaningful results)"
+task 'benchmark:cgi_headers' => BENCHMARK_CGI_HEADERS_TARGET do
+  sh "#{BENCHMARK_CGI_HEADERS_TARGET} #{ENV['ITERATIONS']}".strip
+end
+
+
+BENCHMARK_FD_SOURCE_CHANNEL_TARGET = "#{TEST_OUTPUT_DIR}benchmark/FdSourceChannelBenchmark"
+BENCHMARK_FD_SOURCE_CHANNEL_OBJECT = "#{TEST_OUTPUT_DIR}benchmark/FdSourceChannelBenchmark.o"
+
+define_cxx_object_compilation_task(
+  BENCHMARK_FD_SOURCE_CHANNEL_OBJECT,
+  "test/benchmark/FdSourceChannelBenchmark.cpp",
+  :include_paths => CXX_SUPPORTLIB_INCLUDE_PATHS,
+  :flags => [LIBEV_CFLAGS, LIBUV_CFLAGS]
+)
+
+benchmark_fd_source_channel_libs = COMMON_LIBRARY.only(:base, 'MemoryKit/mbuf.o',
+  'ServerKit/HttpHeaderScanner.o')
+file(BENCHMARK_FD_SOURCE_CHANNEL_TARGET => [BENCHMARK_FD_SOURCE_CHANNEL_OBJECT, LIBBOOST_OXT,
+  benchmark_fd_source_channel_libs.link_objects, LIBEV_TARGET].flatten.compact) do
+  create_cxx_executable(BENCHMARK_FD_SOURCE_CHANNEL_TARGET,
+    [
+      BENCHMARK_FD_SOURCE_CHANNEL_OBJECT,
+      benchmark_fd_source_channel_libs.link_objects_as_string,
+      LIBBOOST_OXT_LINKARG
+    ],
+    :flags => [
+      libev_libs,
+      PlatformInfo.portability_cxx_ldflags,
+      AGENT_LDFLAGS
+    ]
+  )
+end
+
+desc "Measure FdSourceChannel read throughput with and without scatter reads (build with OPTIMIZE=yes for meaningful results)"
+task 'benchmark:fd_source_channel' => BENCHMARK_FD_SOURCE_CHANNEL_TARGET do
+  sh "#{BENCHMARK_FD_SOURCE_CHANNEL_TARGET} #{ENV['SIZE']}".strip
+end
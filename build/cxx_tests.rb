@@ -37,6 +37,12 @@
     "test/cxx/Core/ApplicationPool/ProcessTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/PoolTest.o" =>
     "test/cxx/Core/ApplicationPool/PoolTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/AutoscalerTest.o" =>
+    "test/cxx/Core/ApplicationPool/AutoscalerTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/AffinityRingTest.o" =>
+    "test/cxx/Core/ApplicationPool/AffinityRingTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/RestartFileWatcherTest.o" =>
+    "test/cxx/Core/ApplicationPool/RestartFileWatcherTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/DirectSpawnerTest.o" =>
     "test/cxx/Core/SpawningKit/DirectSpawnerTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/SmartSpawnerTest.o" =>
@@ -46,6 +52,8 @@
     "test/cxx/Core/UnionStationTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/ResponseCacheTest.o" =>
     "test/cxx/Core/ResponseCacheTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/CgiHeaderNameTableTest.o" =>
+    "test/cxx/Core/CgiHeaderNameTableTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/ControllerTest.o" =>
     "test/cxx/Core/ControllerTest.cpp",
 
@@ -54,6 +62,10 @@
 
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/ChannelTest.o" =>
     "test/cxx/ServerKit/ChannelTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/FdSourceChannelTest.o" =>
+    "test/cxx/ServerKit/FdSourceChannelTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/SpliceTunnelTest.o" =>
+    "test/cxx/ServerKit/SpliceTunnelTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/FileBufferedChannelTest.o" =>
     "test/cxx/ServerKit/FileBufferedChannelTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/HeaderTableTest.o" =>
@@ -62,6 +74,8 @@
     "test/cxx/ServerKit/ServerTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/HttpServerTest.o" =>
     "test/cxx/ServerKit/HttpServerTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/HttpHeaderParserTest.o" =>
+    "test/cxx/ServerKit/HttpHeaderParserTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/CookieUtilsTest.o" =>
     "test/cxx/ServerKit/CookieUtilsTest.cpp",
 
@@ -105,6 +119,10 @@
     "test/cxx/UtilsTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Utils/StrIntUtilsTest.o" =>
     "test/cxx/Utils/StrIntUtilsTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/NumaTopologyTest.o" =>
+    "test/cxx/Utils/NumaTopologyTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/HasherTest.o" =>
+    "test/cxx/Utils/HasherTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/IOUtilsTest.o" =>
     "test/cxx/IOUtilsTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/TemplateTest.o" =>
@@ -12,7 +12,8 @@
 SCAN_FILES = Dir[
   "src/**/*.{c,cpp,h,hpp}",
   "test/oxt/**/*.{c,cpp,h,hpp}",
-  "test/cxx/**/*.{c,cpp,h,hpp}"
+  "test/cxx/**/*.{c,cpp,h,hpp}",
+  "test/benchmark/**/*.{c,cpp,h,hpp}"
 ]
 EXCLUDE_FILES = Dir[
   "src/cxx_supportlib/vendor-copy/**/*",
@@ -0,0 +1,185 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_APPLICATION_POOL2_AFFINITY_RING_H_
+#define _PASSENGER_APPLICATION_POOL2_AFFINITY_RING_H_
+
+#include <boost/cstdint.hpp>
+#include <boost/container/vector.hpp>
+#include <algorithm>
+#include <StaticString.h>
+#include <Utils/Hasher.h>
+
+/*
+ * Consistent hashing with bounded loads, used for affinity routing: requests
+ * with the same affinity key (e.g. a tenant ID) go to the same process, so
+ * that per-process caches stay warm.
+ *
+ * Every node (process) is placed on a hash ring at POINTS_PER_NODE points
+ * that are derived from its ID. A key belongs to the node of the first point
+ * at or after the key's hash. Because the points only depend on the node's
+ * own ID, adding or removing a node only moves the keys that belong to that
+ * node.
+ *
+ * To prevent a popular key from overloading its node, a node may not take a
+ * new request if its load is at or above the bound returned by
+ * `affinityLoadBound()`. The key then moves on to the next node on the ring
+ * that is below the bound.
+ */
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+
+
+class AffinityRing {
+public:
+	static const unsigned int POINTS_PER_NODE = 64;
+
+private:
+	struct Point {
+		boost::uint32_t hash;
+		unsigned int node;
+
+		bool operator<(const Point &other) const {
+			return hash < other.hash
+				|| (hash == other.hash && node < other.node);
+		}
+	};
+
+	boost::container::vector<Point> points;
+	unsigned int nodeCount;
+
+	unsigned int firstPointFor(boost::uint32_t key) const {
+		Point needle;
+		needle.hash = key;
+		needle.node = 0;
+		unsigned int i = std::lower_bound(points.begin(), points.end(), needle)
+			- points.begin();
+		if (i == points.size()) {
+			i = 0;
+		}
+		return i;
+	}
+
+public:
+	AffinityRing()
+		: nodeCount(0)
+		{ }
+
+	void clear() {
+		points.clear();
+		nodeCount = 0;
+	}
+
+	/**
+	 * Adds a node with the given number and ID. The ID determines the node's
+	 * position on the ring, so it must stay the same for as long as the node
+	 * exists. Call `finish()` after adding all nodes.
+	 */
+	void add(unsigned int node, const StaticString &id) {
+		for (boost::uint32_t i = 0; i < POINTS_PER_NODE; i++) {
+			Hasher hasher;
+			Point point;
+			hasher.update(id.data(), id.size());
+			hasher.update((const char *) &i, sizeof(i));
+			point.hash = hasher.finalize();
+			point.node = node;
+			points.push_back(point);
+		}
+		nodeCount++;
+	}
+
+	void finish() {
+		std::sort(points.begin(), points.end());
+	}
+
+	bool empty() const {
+		return points.empty();
+	}
+
+	unsigned int size() const {
+		return nodeCount;
+	}
+
+	/** Returns the node that the given key belongs to. The ring may not be empty. */
+	unsigned int owner(boost::uint32_t key) const {
+		return points[firstPointFor(key)].node;
+	}
+
+	/**
+	 * Walks the ring from the given key's position and returns the first node
+	 * for which `accept(node)` returns true, or -1 if there is none.
+	 */
+	template<typename Predicate>
+	int find(boost::uint32_t key, const Predicate &accept) const {
+		if (points.empty()) {
+			return -1;
+		}
+
+		unsigned int start = firstPointFor(key);
+		unsigned int i = start;
+		int rejected = -1;
+		do {
+			unsigned int node = points[i].node;
+			// Consecutive points often belong to the same node.
+			if ((int) node != rejected) {
+				if (accept(node)) {
+					return node;
+				}
+				rejected = node;
+			}
+			i++;
+			if (i == points.size()) {
+				i = 0;
+			}
+		} while (i != start);
+		return -1;
+	}
+};
+
+/**
+ * Returns the load at or above which a node may not take a new request,
+ * given the total load of all `nodeCount` nodes (excluding the new request).
+ * This is the average load after adding the new request, times `factor`,
+ * rounded up. Because it is above the average, at least one node is always
+ * below the bound.
+ */
+inline unsigned int
+affinityLoadBound(unsigned int totalLoad, unsigned int nodeCount, double factor = 1.25) {
+	double bound = factor * (totalLoad + 1) / nodeCount;
+	unsigned int result = (unsigned int) bound;
+	if (result < bound) {
+		result++;
+	}
+	return result;
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
+
+#endif /* _PASSENGER_APPLICATION_POOL2_AFFINITY_RING_H_ */
@@ -0,0 +1,229 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_APPLICATION_POOL2_AUTOSCALER_H_
+#define _PASSENGER_APPLICATION_POOL2_AUTOSCALER_H_
+
+#include <algorithm>
+
+/*
+ * The autoscaling policy of the application pool. Every time the pool has
+ * collected process and system metrics, it feeds the signals of each group
+ * into `evaluateAutoscaling()`, which decides whether the group's process
+ * limit should be raised or lowered by one. The policy is a pure function of
+ * its inputs and the given time, so that it can be tested with a simulated
+ * clock.
+ *
+ * A group is overloaded when requests wait in its queue for longer than the
+ * target queue time, or when its processes are highly utilized. It is
+ * underloaded when nothing is queued and its processes are mostly idle.
+ * Hysteresis prevents flapping: a group is only grown or shrunk after it has
+ * been overloaded or underloaded for several consecutive evaluations, and not
+ * within the cooldown period after the previous change.
+ */
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+
+struct AutoscalerConfig {
+	/** The average queue time, in microseconds, above which a group is overloaded. */
+	unsigned long long targetQueueTime;
+	/** Process utilization (0..1) at or above which a group is overloaded. */
+	double highUtilization;
+	/** Process utilization (0..1) at or below which a group may be underloaded. */
+	double lowUtilization;
+	/** Host CPU usage (0..100) at or above which groups are not grown. */
+	double maxHostCpuUsage;
+	/**
+	 * Free host memory, in percent of total, below which groups are not grown,
+	 * and are shrunk even if they're busy.
+	 */
+	double minHostMemoryFree;
+	/** The number of consecutive overloaded evaluations after which a group is grown. */
+	unsigned int growAfter;
+	/** The number of consecutive underloaded evaluations after which a group is shrunk. */
+	unsigned int shrinkAfter;
+	/** The minimum time between two changes to a group's limit, in microseconds. */
+	unsigned long long cooldown;
+
+	AutoscalerConfig()
+		: targetQueueTime(100000),
+		  highUtilization(0.85),
+		  lowUtilization(0.3),
+		  maxHostCpuUsage(90),
+		  minHostMemoryFree(10),
+		  growAfter(2),
+		  shrinkAfter(6),
+		  cooldown(10000000)
+		{ }
+};
+
+struct AutoscalerHostSignals {
+	/** Average CPU usage of the host (0..100), or -1 if unknown. */
+	double cpuUsage;
+	/** Free memory in percent of total memory, or -1 if unknown. */
+	double memoryFree;
+
+	AutoscalerHostSignals()
+		: cpuUsage(-1),
+		  memoryFree(-1)
+		{ }
+};
+
+struct AutoscalerGroupSignals {
+	/** The number of processes, including processes being spawned. */
+	unsigned int processCount;
+	/** The group's own process limits. `upperBound` may not be 0. */
+	unsigned int lowerBound;
+	unsigned int upperBound;
+	/** How long requests have recently been waiting in the group's queue, in microseconds. */
+	unsigned long long queueTime;
+	/** The number of requests in the group's queue. */
+	unsigned int queueSize;
+	/** The average utilization (0..1) of the group's processes. */
+	double utilization;
+
+	AutoscalerGroupSignals()
+		: processCount(0),
+		  lowerBound(0),
+		  upperBound(1),
+		  queueTime(0),
+		  queueSize(0),
+		  utilization(0)
+		{ }
+};
+
+/** Per-group autoscaler state. Owned by the Group, protected by the Pool lock. */
+struct AutoscalerGroupState {
+	/**
+	 * The process limit chosen by the autoscaler, or 0 if the group hasn't been
+	 * evaluated yet (in which case only the configured limits apply).
+	 */
+	unsigned int limit;
+	unsigned int overloadedStreak;
+	unsigned int underloadedStreak;
+	/** The time at which `limit` was last changed. */
+	unsigned long long lastChangeTime;
+	/** Queue latency counters at the previous evaluation. */
+	unsigned long long lastQueueLatencyCount;
+	unsigned long long lastQueueLatencySum;
+	unsigned long long grown;
+	unsigned long long shrunk;
+
+	AutoscalerGroupState()
+		: limit(0),
+		  overloadedStreak(0),
+		  underloadedStreak(0),
+		  lastChangeTime(0),
+		  lastQueueLatencyCount(0),
+		  lastQueueLatencySum(0),
+		  grown(0),
+		  shrunk(0)
+		{ }
+};
+
+enum AutoscaleDecision {
+	AD_HOLD,
+	AD_GROW,
+	AD_SHRINK
+};
+
+
+inline bool
+hostHasMemoryPressure(const AutoscalerConfig &config, const AutoscalerHostSignals &host) {
+	return host.memoryFree >= 0 && host.memoryFree < config.minHostMemoryFree;
+}
+
+inline bool
+hostIsSaturated(const AutoscalerConfig &config, const AutoscalerHostSignals &host) {
+	return (host.cpuUsage >= 0 && host.cpuUsage >= config.maxHostCpuUsage)
+		|| hostHasMemoryPressure(config, host);
+}
+
+/**
+ * Evaluates the autoscaling policy for a single group at time `now`, updating
+ * `state.limit` if the group's process limit should change.
+ */
+inline AutoscaleDecision
+evaluateAutoscaling(const AutoscalerConfig &config, const AutoscalerHostSignals &host,
+	const AutoscalerGroupSignals &group, AutoscalerGroupState &state,
+	unsigned long long now)
+{
+	unsigned int lowerBound = std::max(group.lowerBound, 1u);
+	unsigned int upperBound = std::max(group.upperBound, lowerBound);
+
+	if (state.limit == 0) {
+		// Start from the current size of the group.
+		state.limit = group.processCount;
+		state.lastChangeTime = now;
+	}
+	state.limit = std::max(lowerBound, std::min(state.limit, upperBound));
+
+	bool overloaded = group.queueTime > config.targetQueueTime
+		|| group.utilization >= config.highUtilization;
+	bool underloaded = group.queueSize == 0
+		&& group.queueTime <= config.targetQueueTime / 2
+		&& group.utilization <= config.lowUtilization;
+
+	if (hostHasMemoryPressure(config, host)) {
+		// Give memory back, no matter how busy the group is.
+		state.overloadedStreak = 0;
+		state.underloadedStreak++;
+	} else if (overloaded && !hostIsSaturated(config, host)) {
+		state.overloadedStreak++;
+		state.underloadedStreak = 0;
+	} else if (underloaded) {
+		state.overloadedStreak = 0;
+		state.underloadedStreak++;
+	} else {
+		state.overloadedStreak = 0;
+		state.underloadedStreak = 0;
+	}
+
+	if (now - state.lastChangeTime < config.cooldown) {
+		return AD_HOLD;
+	} else if (state.overloadedStreak >= config.growAfter && state.limit < upperBound) {
+		state.limit++;
+		state.overloadedStreak = 0;
+		state.lastChangeTime = now;
+		state.grown++;
+		return AD_GROW;
+	} else if (state.underloadedStreak >= config.shrinkAfter && state.limit > lowerBound) {
+		state.limit--;
+		state.underloadedStreak = 0;
+		state.lastChangeTime = now;
+		state.shrunk++;
+		return AD_SHRINK;
+	} else {
+		return AD_HOLD;
+	}
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
+
+#endif /* _PASSENGER_APPLICATION_POOL2_AUTOSCALER_H_ */
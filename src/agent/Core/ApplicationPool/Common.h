@@ -26,6 +26,10 @@
 #ifndef _PASSENGER_APPLICATION_POOL2_COMMON_H_
 #define _PASSENGER_APPLICATION_POOL2_COMMON_H_
 
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <ostream>
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/intrusive_ptr.hpp>
@@ -37,6 +41,7 @@
 #include <MemoryKit/palloc.h>
 #include <DataStructures/StringKeyTable.h>
 #include <Utils/VariantMap.h>
+#include <Utils/SystemTime.h>
 #include <Core/ApplicationPool/Options.h>
 #include <Core/SpawningKit/Config.h>
 #include <Core/UnionStation/Context.h>
@@ -186,14 +191,18 @@ struct GetCallback {
 };
 
 struct GetWaiter {
-	Options options;
+	RequestOptions options;
 	GetCallback callback;
+	/** The time at which this waiter was put on the wait list. */
+	unsigned long long enqueueTime;
 
-	GetWaiter(const Options &o, const GetCallback &cb)
+	GetWaiter(const RequestOptions &o, const GetCallback &cb, unsigned long long now = 0)
 		: options(o),
-		  callback(cb)
+		  callback(cb),
+		  enqueueTime(now != 0 ? now : SystemTime::getUsec())
 	{
-		options.persist(o);
+		options.persist();
+		options.detachFromUnionStationTransaction();
 	}
 };
 
@@ -210,6 +219,183 @@ void processAndLogNewSpawnException(SpawnException &e, const Options &options,
 	const SpawningKit::ConfigPtr &config);
 void recreateString(psg_pool_t *pool, StaticString &str);
 
+/**
+ * Keeps track of how long get() requests spent on a get wait list, in a
+ * small number of fixed buckets so that recording a sample is cheap
+ * enough to do while holding the Pool lock.
+ */
+struct QueueLatencyHistogram {
+	static const unsigned int BUCKET_COUNT = 8;
+
+	unsigned long long counts[BUCKET_COUNT];
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long max;
+
+	QueueLatencyHistogram()
+		: count(0),
+		  sum(0),
+		  max(0)
+	{
+		for (unsigned int i = 0; i < BUCKET_COUNT; i++) {
+			counts[i] = 0;
+		}
+	}
+
+	/**
+	 * Returns the exclusive upper bound, in microseconds, of the given bucket.
+	 * The last bucket has no upper bound, in which case 0 is returned.
+	 */
+	static unsigned long long bucketUpperBound(unsigned int bucket) {
+		static const unsigned long long bounds[BUCKET_COUNT] = {
+			1000, 5000, 10000, 50000, 100000, 500000, 1000000, 0
+		};
+		return bounds[bucket];
+	}
+
+	void record(unsigned long long usec) {
+		unsigned int i = 0;
+		while (i < BUCKET_COUNT - 1 && usec >= bucketUpperBound(i)) {
+			i++;
+		}
+		counts[i]++;
+		count++;
+		sum += usec;
+		if (usec > max) {
+			max = usec;
+		}
+	}
+
+	unsigned long long averageUsec() const {
+		if (count == 0) {
+			return 0;
+		} else {
+			return sum / count;
+		}
+	}
+
+	void inspectXml(std::ostream &stream) const {
+		stream << "<count>" << count << "</count>";
+		stream << "<average>" << averageUsec() << "</average>";
+		stream << "<max>" << max << "</max>";
+		stream << "<buckets>";
+		for (unsigned int i = 0; i < BUCKET_COUNT; i++) {
+			stream << "<bucket>";
+			if (bucketUpperBound(i) != 0) {
+				stream << "<less_than>" << bucketUpperBound(i) << "</less_than>";
+			}
+			stream << "<count>" << counts[i] << "</count>";
+			stream << "</bucket>";
+		}
+		stream << "</buckets>";
+	}
+
+	/** Returns a single-line human-readable summary, with times in milliseconds. */
+	string inspect() const {
+		stringstream stream;
+		for (unsigned int i = 0; i < BUCKET_COUNT; i++) {
+			if (i > 0) {
+				stream << ", ";
+			}
+			if (bucketUpperBound(i) != 0) {
+				stream << "<" << bucketUpperBound(i) / 1000 << "ms: ";
+			} else {
+				stream << ">=" << bucketUpperBound(i - 1) / 1000 << "ms: ";
+			}
+			stream << counts[i];
+		}
+		return stream.str();
+	}
+};
+
+/**
+ * The durations of the phases of spawning a process: forking it (directly, or
+ * by asking the preloader), loading the application, and reading the sockets
+ * that the application reported. Microseconds resolution.
+ */
+struct SpawnPhaseDurations {
+	unsigned long long fork;
+	unsigned long long appLoad;
+	unsigned long long socketReady;
+
+	SpawnPhaseDurations()
+		: fork(0),
+		  appLoad(0),
+		  socketReady(0)
+		{ }
+
+	unsigned long long total() const {
+		return fork + appLoad + socketReady;
+	}
+
+	template<typename Stream>
+	void inspectXml(Stream &stream) const {
+		stream << "<fork>" << fork << "</fork>";
+		stream << "<app_load>" << appLoad << "</app_load>";
+		stream << "<socket_ready>" << socketReady << "</socket_ready>";
+	}
+};
+
+/**
+ * Keeps track of the spawn phase durations of all processes spawned for a
+ * group, so that slow spawns can be attributed to a specific phase.
+ */
+struct SpawnPhaseStatistics {
+	unsigned long long count;
+	SpawnPhaseDurations sum;
+	SpawnPhaseDurations max;
+	SpawnPhaseDurations last;
+
+	SpawnPhaseStatistics()
+		: count(0)
+		{ }
+
+	void record(const SpawnPhaseDurations &durations) {
+		count++;
+		sum.fork += durations.fork;
+		sum.appLoad += durations.appLoad;
+		sum.socketReady += durations.socketReady;
+		max.fork = std::max(max.fork, durations.fork);
+		max.appLoad = std::max(max.appLoad, durations.appLoad);
+		max.socketReady = std::max(max.socketReady, durations.socketReady);
+		last = durations;
+	}
+
+	SpawnPhaseDurations average() const {
+		SpawnPhaseDurations result;
+		if (count > 0) {
+			result.fork = sum.fork / count;
+			result.appLoad = sum.appLoad / count;
+			result.socketReady = sum.socketReady / count;
+		}
+		return result;
+	}
+
+	void inspectXml(std::ostream &stream) const {
+		stream << "<count>" << count << "</count>";
+		stream << "<average>";
+		average().inspectXml(stream);
+		stream << "</average>";
+		stream << "<max>";
+		max.inspectXml(stream);
+		stream << "</max>";
+		stream << "<last>";
+		last.inspectXml(stream);
+		stream << "</last>";
+	}
+
+	/** Returns a single-line human-readable summary of the average
+	 * durations, in milliseconds. */
+	string inspect() const {
+		SpawnPhaseDurations avg = average();
+		stringstream stream;
+		stream << "fork " << avg.fork / 1000 << "ms, app load "
+			<< avg.appLoad / 1000 << "ms, socket ready "
+			<< avg.socketReady / 1000 << "ms";
+		return stream.str();
+	}
+};
+
 } // namespace ApplicationPool2
 } // namespace Passenger
 
@@ -49,6 +49,9 @@
 #include <Hooks.h>
 #include <Utils.h>
 #include <Core/ApplicationPool/Common.h>
+#include <Core/ApplicationPool/Autoscaler.h>
+#include <Core/ApplicationPool/AffinityRing.h>
+#include <Core/ApplicationPool/RestartFileWatcher.h>
 #include <Core/ApplicationPool/Context.h>
 #include <Core/ApplicationPool/BasicGroupInfo.h>
 #include <Core/ApplicationPool/Process.h>
@@ -90,12 +93,26 @@ public:
 	};
 
 	struct RouteResult {
+		enum AffinityResult {
+			/** The request has no affinity key, or is routed by sticky session. */
+			NO_AFFINITY,
+			/** Routed to the process that owns the affinity key. */
+			AFFINITY_HIT,
+			/** The owner was loaded too much; routed to the next process on the ring. */
+			AFFINITY_REDIRECTED,
+			/** No process on the ring could take the request; routed to the least busy one. */
+			AFFINITY_SPILLED
+		};
+
 		Process *process;
 		bool finished;
+		AffinityResult affinity;
 
-		RouteResult(Process *p, bool _finished = false)
+		RouteResult(Process *p, bool _finished = false,
+			AffinityResult _affinity = NO_AFFINITY)
 			: process(p),
-			  finished(_finished)
+			  finished(_finished),
+			  affinity(_affinity)
 			{ }
 	};
 
@@ -127,6 +144,11 @@ public:
 	Pool *pool;
 	time_t lastRestartFileMtime;
 	time_t lastRestartFileCheckTime;
+	/** Set if the pool's restart file watcher watches the directory of
+	 * `restartFile`. In that case, `needsRestart()` only checks the restart
+	 * files after the watcher has seen them change, instead of polling them.
+	 */
+	RestartFileWatcher::SubscriptionPtr restartFileSubscription;
 
 	/** Number of times a restart has been initiated so far. This is incremented immediately
 	 * in Group::restart(), and is used to abort the restarter thread that was active at the
@@ -162,12 +184,14 @@ public:
 	 * technically spawning anything.
 	 */
 	bool m_spawning: 1;
-	/** Whether a non-rolling restart is in progress (i.e. whether spawnThreadRealMain()
-	 * is at work). While it is in progress, it is not possible to signal the desire to
+	/** Whether a restart is in progress (i.e. whether finalizeRestart() is at work).
+	 * While it is in progress, it is not possible to signal the desire to
 	 * spawn new process. If spawning was already in progress when the restart was initiated,
 	 * then the spawning will abort as soon as possible.
 	 *
-	 * When rolling restarting is in progress, this flag is false.
+	 * A rolling restart sets this flag until the new spawner is in place. After that,
+	 * the flag is false while the old processes are being replaced; see
+	 * `rollingRestartBatchSize`.
 	 *
 	 * Invariant:
 	 *    if m_restarting: processesBeingSpawned == 0
@@ -187,6 +211,20 @@ public:
 	 */
 	bool detachedProcessesCheckerActive;
 	boost::condition_variable detachedProcessesCheckerCond;
+	/** Processes that have been disabled for out-of-band work, and whose
+	 * OOBW request has yet to be sent by the OOBW dispatcher thread.
+	 */
+	boost::container::vector<ProcessPtr> oobwQueue;
+	/** Whether the OOBW dispatcher thread is running. It sends the OOBW
+	 * requests in `oobwQueue` and waits for all of them in a single poll()
+	 * loop, and exits when there are no more requests.
+	 */
+	bool oobwDispatcherActive;
+	/** Set when a process requested out-of-band work, but it was deferred
+	 * because requests were waiting in `getWaitlist`. Tells `onSessionClose()`
+	 * to try again.
+	 */
+	bool oobwDeferred;
 	Callback shutdownCallback;
 	GroupPtr selfPointer;
 
@@ -201,7 +239,8 @@ public:
 
 	/****** Session management ******/
 
-	RouteResult route(const Options &options) const;
+	RouteResult route(const RequestOptions &options) const;
+	void recordAffinityResult(const RouteResult &result);
 	SessionPtr newSession(Process *process, unsigned long long now = 0);
 	static void _onSessionInitiateFailure(Session *session);
 	static void _onSessionClose(Session *session);
@@ -214,9 +253,27 @@ public:
 		unsigned int restartsInitiated);
 	void spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner, const Options &options,
 		unsigned int restartsInitiated);
+	void onSpawnNegotiated(GroupPtr self, SpawningKit::SpawnerPtr spawner, Options options,
+		unsigned int restartsInitiated, const SpawningKit::Result &result,
+		const SpawnException *e);
+	void spawnThreadContinue(GroupPtr self, SpawningKit::SpawnerPtr spawner, Options options,
+		unsigned int restartsInitiated, SpawningKit::Result result, ExceptionPtr exception);
+	bool finishSpawnLoopIteration(const ProcessPtr &process, const ExceptionPtr &exception,
+		unsigned int restartsInitiated);
 	void finalizeRestart(GroupPtr self, Options oldOptions, Options newOptions,
 		RestartMethod method, SpawningKit::FactoryPtr spawningKitFactory,
 		unsigned int restartsInitiated, boost::container::vector<Callback> postLockActions);
+	void startRollingRestart();
+	void abortRollingRestart(boost::container::vector<Callback> &postLockActions);
+	unsigned int countRollingRestartPendingProcesses() const;
+	bool rollingRestartNeedsSpawn() const;
+	void retireProcessesForRollingRestart(boost::container::vector<Callback> &postLockActions);
+	void lockAndFinishRetiringProcess(const ProcessPtr &process, DisableResult result, GroupPtr self);
+	void finishRetiringProcess(const ProcessPtr &process,
+		boost::container::vector<Callback> &postLockActions);
+	void watchRestartDir();
+	void unwatchRestartDir();
+	bool checkRestartFiles();
 
 	/****** Process list management ******/
 
@@ -224,6 +281,9 @@ public:
 	Process *findProcessWithStickySessionIdOrLowestBusyness(unsigned int id) const;
 	Process *findProcessWithLowestBusyness(const ProcessList &processes) const;
 	Process *findEnabledProcessWithLowestBusyness() const;
+	Process *findProcessWithAffinity(boost::uint32_t key,
+		RouteResult::AffinityResult &result) const;
+	void rebuildAffinityRing() const;
 
 	void addProcessToList(const ProcessPtr &process, ProcessList &destination);
 	void removeProcessFromList(const ProcessPtr &process, ProcessList &source);
@@ -238,22 +298,33 @@ public:
 
 	/****** Out-of-band work ******/
 
+	unsigned int oobwBudget() const;
 	bool oobwAllowed() const;
 	bool shouldInitiateOobw(Process *process) const;
-	void maybeInitiateOobw(Process *process);
+	Process *findNextOobwCandidate() const;
+	OXT_FORCE_INLINE void maybeInitiateOobw(Process *process);
 	void lockAndMaybeInitiateOobw(const ProcessPtr &process, DisableResult result, GroupPtr self);
 	void initiateOobw(const ProcessPtr &process);
-	void spawnThreadOOBWRequest(GroupPtr self, ProcessPtr process);
+	void oobwDispatcherMain(GroupPtr self);
+	bool sendOobwRequest(Socket *socket, Connection &connection);
+	void finishOobwRequest(const ProcessPtr &process);
 	void initiateNextOobwRequest();
 
+	/****** Memory-based process recycling ******/
+
+	bool exceedsMemoryLimits(const Process *process, unsigned long long now,
+		string &reason) const;
+	void detachProcessPendingMemoryRecycle(boost::container::vector<Callback> &postLockActions);
+
 	/****** Internal utilities ******/
 
 	static void runAllActions(const boost::container::vector<Callback> &actions);
 	static void interruptAndJoinAllThreads(GroupPtr self);
 	static void doCleanupSpawner(SpawningKit::SpawnerPtr spawner);
+	static void doCancelSpawns(SpawningKit::SpawnerPtr spawner);
 
 	void resetOptions(const Options &newOptions, Options *destination = NULL);
-	void mergeOptions(const Options &other);
+	void mergeOptions(const RequestOptions &other);
 
 	bool prepareHookScriptOptions(HookScriptOptions &hsOptions, const char *name);
 	void runAttachHooks(const ProcessPtr process) const;
@@ -267,7 +338,12 @@ public:
 	void wakeUpGarbageCollector();
 	bool anotherGroupIsWaitingForCapacity() const;
 	Group *findOtherGroupWaitingForCapacity() const;
-	bool pushGetWaiter(const Options &newOptions, const GetCallback &callback,
+	bool pushGetWaiter(const RequestOptions &newOptions, const GetCallback &callback,
+		boost::container::vector<Callback> &postLockActions);
+	unsigned long long getEarliestShedTime(unsigned long long deadline,
+		unsigned long long enqueueTime) const;
+	bool shouldShedGetWaiters(unsigned long long now) const;
+	void shedExpiredGetWaiters(unsigned long long now,
 		boost::container::vector<Callback> &postLockActions);
 	template<typename Lock> void assignSessionsToGetWaitersQuickly(Lock &lock);
 	void assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockActions);
@@ -366,6 +442,21 @@ public:
 	 */
 	boost::container::vector<int> enabledProcessBusynessLevels;
 
+	/**
+	 * A consistent hash ring of the enabled processes, for routing requests
+	 * that have an affinity key. The nodes are indices in `enabledProcesses`.
+	 * It is rebuilt lazily, the first time it is needed after
+	 * `enabledProcesses` has changed.
+	 */
+	mutable AffinityRing affinityRing;
+	mutable bool affinityRingOutdated;
+	/** The number of requests with an affinity key that were routed to the key's owner. */
+	unsigned long long affinityHits;
+	/** ...that were routed to another process because the owner was loaded too much. */
+	unsigned long long affinityRedirects;
+	/** ...that were routed to the least busy process because no other process could take them. */
+	unsigned long long affinitySpills;
+
 	/**
 	 * get() requests for this group that cannot be immediately satisfied are
 	 * put on this wait list, which must be processed as soon as the necessary
@@ -398,6 +489,46 @@ public:
 	 *       !enabledProcesses.empty() || m_spawning || restarting() || poolAtFullCapacity()
 	 */
 	deque<GetWaiter> getWaitlist;
+	/**
+	 * The last time (as returned by SystemTime::getUsec()) at which the getWaitlist
+	 * was seen empty. Used by adaptive request queue shedding to detect whether the
+	 * group is under sustained overload.
+	 */
+	unsigned long long lastGetWaitlistEmptyTime;
+	/**
+	 * A lower bound on the earliest time at which a waiter on the getWaitlist
+	 * may have to be shed, or 0 if no waiter is subject to shedding. Allows
+	 * `shedExpiredGetWaiters()` to skip scanning the wait list most of the time.
+	 */
+	unsigned long long nextGetWaiterShedTime;
+	/** How long get() requests spent on the getWaitlist before they were assigned a session. */
+	QueueLatencyHistogram queueLatency;
+	/** The number of waiters that were shed from the getWaitlist because their deadline passed. */
+	unsigned long long requestsShedByDeadline;
+	/** The number of waiters that were shed from the getWaitlist by adaptive request queue shedding. */
+	unsigned long long requestsShedAdaptively;
+	/**
+	 * Autoscaling state. If `autoscaler.limit` is non-zero, this group may not
+	 * have more processes than that, in addition to the configured limits.
+	 */
+	AutoscalerGroupState autoscaler;
+	/** The number of processes that were replaced because of their memory usage. */
+	unsigned long long processesRecycledForMemory;
+	/**
+	 * The number of processes that a rolling restart replaces at a time, or 0
+	 * if no rolling restart is replacing processes. Processes of the old version
+	 * have `rollingRestartPending` set. While they exist, up to this many new
+	 * processes may be spawned beyond the process limits; an old process is
+	 * disabled (and detached once it has finished its requests) for each new
+	 * process, after a whole batch of new processes has been attached.
+	 */
+	unsigned int rollingRestartBatchSize;
+	/** The number of new processes in the current batch that haven't replaced an old process yet. */
+	unsigned int rollingRestartReplacements;
+	/** The number of processes that were replaced by rolling restarts. */
+	unsigned long long processesReplacedByRollingRestart;
+	/** How long the phases of spawning this group's processes took. */
+	SpawnPhaseStatistics spawnPhases;
 	/**
 	 * Disable() commands that couldn't finish immediately will put their callbacks
 	 * in this queue. Note that there may be multiple DisableWaiters pointing to the
@@ -439,14 +570,15 @@ public:
 
 	/****** Session management ******/
 
-	SessionPtr get(const Options &newOptions, const GetCallback &callback,
+	SessionPtr get(const RequestOptions &newOptions, const GetCallback &callback,
 		boost::container::vector<Callback> &postLockActions);
 
 	/****** Spawning and restarting ******/
 
 	void restart(const Options &options, RestartMethod method = RM_DEFAULT);
 	bool restarting() const;
-	bool needsRestart(const Options &options);
+	bool rollingRestarting() const;
+	bool needsRestart(const RequestOptions &options);
 
 	SpawnResult spawn();
 	bool spawning() const;
@@ -476,6 +608,7 @@ public:
 	unsigned int capacityUsed() const;
 	bool isWaitingForCapacity() const;
 	bool garbageCollectable(unsigned long long now = 0) const;
+	ssize_t memorySavedBySharing() const;
 
 	void inspectXml(std::ostream &stream, bool includeSecrets = true) const;
 
@@ -483,6 +616,11 @@ public:
 
 	void requestOOBW(const ProcessPtr &process);
 
+	/****** Memory-based process recycling ******/
+
+	void recycleProcessesExceedingMemoryLimits(unsigned long long now,
+		boost::container::vector<Callback> &postLockActions);
+
 	/****** Miscellaneous ******/
 
 	void cleanupSpawner(boost::container::vector<Callback> &postLockActions);
@@ -117,6 +117,18 @@ Group::Group(Pool *_pool, const Options &_options)
 	lifeStatus.store(ALIVE, boost::memory_order_relaxed);
 	lastRestartFileMtime = 0;
 	lastRestartFileCheckTime = 0;
+	lastGetWaitlistEmptyTime = 0;
+	nextGetWaiterShedTime = 0;
+	requestsShedByDeadline = 0;
+	requestsShedAdaptively = 0;
+	processesRecycledForMemory = 0;
+	rollingRestartBatchSize = 0;
+	rollingRestartReplacements = 0;
+	processesReplacedByRollingRestart = 0;
+	affinityRingOutdated = true;
+	affinityHits = 0;
+	affinityRedirects = 0;
+	affinitySpills = 0;
 	alwaysRestartFileExists = false;
 	if (options.restartDir.empty()) {
 		restartFile = options.appRoot + "/tmp/restart.txt";
@@ -130,6 +142,8 @@ Group::Group(Pool *_pool, const Options &_options)
 	}
 
 	detachedProcessesCheckerActive = false;
+	oobwDispatcherActive = false;
+	oobwDeferred = false;
 }
 
 Group::~Group() {
@@ -176,8 +190,12 @@ Group::shutdown(const Callback &callback,
 
 	P_DEBUG("Begin shutting down group " << info.name);
 	shutdownCallback = callback;
+	// Abort spawns that are still negotiating, so that their processes
+	// are killed instead of being attached to a group that is gone.
+	postLockActions.push_back(boost::bind(doCancelSpawns, spawner));
 	detachAll(postLockActions);
 	startCheckingDetachedProcesses(true);
+	unwatchRestartDir();
 	interruptableThreads.interrupt_all();
 	postLockActions.push_back(boost::bind(doCleanupSpawner, spawner));
 	spawner.reset();
@@ -38,6 +38,18 @@ using namespace std;
 using namespace boost;
 
 
+static unsigned long long
+minNonZeroTime(unsigned long long a, unsigned long long b) {
+	if (a == 0) {
+		return b;
+	} else if (b == 0) {
+		return a;
+	} else {
+		return std::min(a, b);
+	}
+}
+
+
 /****************************
  *
  * Private methods
@@ -63,6 +75,11 @@ Group::doCleanupSpawner(SpawningKit::SpawnerPtr spawner) {
 	spawner->cleanup();
 }
 
+void
+Group::doCancelSpawns(SpawningKit::SpawnerPtr spawner) {
+	spawner->cancelAsyncSpawns();
+}
+
 /**
  * Persists options into this Group. Called at creation time and at restart time.
  * Values will be persisted into `destination`. Or if it's NULL, into `this->options`.
@@ -83,11 +100,14 @@ Group::resetOptions(const Options &newOptions, Options *destination) {
  * Merges some of the new options from the latest get() request into this Group.
  */
 void
-Group::mergeOptions(const Options &other) {
+Group::mergeOptions(const RequestOptions &other) {
+	const Options &groupOptions = other.getGroupOptions();
 	options.maxRequests      = other.maxRequests;
-	options.minProcesses     = other.minProcesses;
-	options.statThrottleRate = other.statThrottleRate;
-	options.maxPreloaderIdleTime = other.maxPreloaderIdleTime;
+	options.minProcesses     = groupOptions.minProcesses;
+	options.statThrottleRate = groupOptions.statThrottleRate;
+	options.maxPreloaderIdleTime = groupOptions.maxPreloaderIdleTime;
+	options.privateMemoryLimit = groupOptions.privateMemoryLimit;
+	options.privateMemoryGrowthLimit = groupOptions.privateMemoryGrowthLimit;
 }
 
 /* Given a hook name like "queue_full_error", we return HookScriptOptions filled in with this name and a spec
@@ -215,20 +235,36 @@ Group::findOtherGroupWaitingForCapacity() const {
 }
 
 bool
-Group::pushGetWaiter(const Options &newOptions, const GetCallback &callback,
+Group::pushGetWaiter(const RequestOptions &newOptions, const GetCallback &callback,
 	boost::container::vector<Callback> &postLockActions)
 {
+	unsigned int maxRequestQueueSize = newOptions.getGroupOptions().maxRequestQueueSize;
+	unsigned long long now = SystemTime::getUsec();
+
+	if (getWaitlist.empty()) {
+		lastGetWaitlistEmptyTime = now;
+	} else if (shouldShedGetWaiters(now)) {
+		// Make room for fresh requests before checking the queue size.
+		shedExpiredGetWaiters(now, postLockActions);
+	}
+
 	if (OXT_LIKELY(!testOverflowRequestQueue()
-		&& (newOptions.maxRequestQueueSize == 0
-		    || getWaitlist.size() < newOptions.maxRequestQueueSize)))
+		&& (maxRequestQueueSize == 0
+		    || getWaitlist.size() < maxRequestQueueSize)))
 	{
-		getWaitlist.push_back(GetWaiter(
-			newOptions.copyAndPersist().detachFromUnionStationTransaction(),
-			callback));
+		// Queue behind all waiters with an equal or higher priority.
+		deque<GetWaiter>::iterator it = getWaitlist.end();
+		while (it != getWaitlist.begin() && (it - 1)->options.priority < newOptions.priority) {
+			it--;
+		}
+		getWaitlist.insert(it, GetWaiter(newOptions, callback, now));
+
+		nextGetWaiterShedTime = minNonZeroTime(nextGetWaiterShedTime,
+			getEarliestShedTime(newOptions.deadline, now));
 		return true;
 	} else {
 		postLockActions.push_back(boost::bind(GetCallback::call,
-			callback, SessionPtr(), boost::make_shared<RequestQueueFullException>(newOptions.maxRequestQueueSize)));
+			callback, SessionPtr(), boost::make_shared<RequestQueueFullException>(maxRequestQueueSize)));
 
 		HookScriptOptions hsOptions;
 		if (prepareHookScriptOptions(hsOptions, "queue_full_error")) {
@@ -240,6 +276,85 @@ Group::pushGetWaiter(const Options &newOptions, const GetCallback &callback,
 	}
 }
 
+/**
+ * Returns the earliest time at which a waiter with the given deadline and
+ * enqueue time may have to be shed, or 0 if it is not subject to shedding.
+ * Relies on `lastGetWaitlistEmptyTime` never being later than the enqueue
+ * time of any waiter on the getWaitlist.
+ */
+unsigned long long
+Group::getEarliestShedTime(unsigned long long deadline, unsigned long long enqueueTime) const {
+	const Pool *pool = getPool();
+	if (pool->requestQueueShedTarget == 0) {
+		return deadline;
+	} else {
+		return minNonZeroTime(deadline, std::max(
+			enqueueTime + pool->requestQueueShedTarget,
+			lastGetWaitlistEmptyTime + pool->requestQueueShedInterval));
+	}
+}
+
+bool
+Group::shouldShedGetWaiters(unsigned long long now) const {
+	return nextGetWaiterShedTime != 0 && now >= nextGetWaiterShedTime;
+}
+
+/**
+ * Removes waiters from the getWaitlist that are no longer worth serving, and
+ * calls their callbacks with a RequestQueueTimeoutException. A waiter is shed
+ * when its deadline has passed, or when adaptive request queue shedding is
+ * enabled and it has been queued for too long.
+ *
+ * Adaptive shedding follows the CoDel idea: as long as the wait list regularly
+ * drains, waiters may be queued for up to `pool->requestQueueShedInterval`.
+ * But if the wait list has not been empty during that interval, then the group
+ * is under sustained overload and waiters are only allowed to be queued for
+ * `pool->requestQueueShedTarget`, so that the queue stops absorbing latency.
+ */
+void
+Group::shedExpiredGetWaiters(unsigned long long now,
+	boost::container::vector<Callback> &postLockActions)
+{
+	const Pool *pool = getPool();
+	unsigned long long maxQueueTime = 0;
+	unsigned long long nextShedTime = 0;
+
+	if (pool->requestQueueShedTarget != 0) {
+		if (now - lastGetWaitlistEmptyTime >= pool->requestQueueShedInterval) {
+			maxQueueTime = pool->requestQueueShedTarget;
+		} else {
+			maxQueueTime = pool->requestQueueShedInterval;
+		}
+	}
+
+	deque<GetWaiter>::iterator it = getWaitlist.begin();
+	while (it != getWaitlist.end()) {
+		unsigned long long waitTime = (now > it->enqueueTime) ? now - it->enqueueTime : 0;
+		bool deadlinePassed = it->options.deadline != 0 && now >= it->options.deadline;
+
+		if (deadlinePassed || (maxQueueTime != 0 && waitTime >= maxQueueTime)) {
+			if (deadlinePassed) {
+				requestsShedByDeadline++;
+			} else {
+				requestsShedAdaptively++;
+			}
+			postLockActions.push_back(boost::bind(GetCallback::call,
+				it->callback, SessionPtr(),
+				boost::make_shared<RequestQueueTimeoutException>(waitTime, deadlinePassed)));
+			it = getWaitlist.erase(it);
+		} else {
+			nextShedTime = minNonZeroTime(nextShedTime,
+				getEarliestShedTime(it->options.deadline, it->enqueueTime));
+			it++;
+		}
+	}
+
+	nextGetWaiterShedTime = nextShedTime;
+	if (getWaitlist.empty()) {
+		lastGetWaitlistEmptyTime = now;
+	}
+}
+
 template<typename Lock>
 void
 Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
@@ -250,9 +365,15 @@ Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
 	}
 
 	SmallVector<GetAction, 8> actions;
+	boost::container::vector<Callback> shedActions;
+	unsigned long long now = SystemTime::getUsec();
 	unsigned int i = 0;
 	bool done = false;
 
+	if (shouldShedGetWaiters(now)) {
+		shedExpiredGetWaiters(now, shedActions);
+	}
+
 	actions.reserve(getWaitlist.size());
 
 	while (!done && i < getWaitlist.size()) {
@@ -260,8 +381,10 @@ Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
 		RouteResult result = route(waiter.options);
 		if (result.process != NULL) {
 			GetAction action;
+			recordAffinityResult(result);
 			action.callback = waiter.callback;
-			action.session  = newSession(result.process);
+			action.session  = newSession(result.process, now);
+			queueLatency.record(now - std::min(now, waiter.enqueueTime));
 			getWaitlist.erase(getWaitlist.begin() + i);
 			actions.push_back(action);
 		} else {
@@ -272,8 +395,13 @@ Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
 		}
 	}
 
+	if (getWaitlist.empty()) {
+		lastGetWaitlistEmptyTime = now;
+	}
+
 	verifyInvariants();
 	lock.unlock();
+	runAllActions(shedActions);
 	SmallVector<GetAction, 50>::const_iterator it, end = actions.end();
 	for (it = actions.begin(); it != end; it++) {
 		it->callback(it->session, ExceptionPtr());
@@ -282,18 +410,29 @@ Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
 
 void
 Group::assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockActions) {
+	if (getWaitlist.empty()) {
+		return;
+	}
+
+	unsigned long long now = SystemTime::getUsec();
 	unsigned int i = 0;
 	bool done = false;
 
+	if (shouldShedGetWaiters(now)) {
+		shedExpiredGetWaiters(now, postLockActions);
+	}
+
 	while (!done && i < getWaitlist.size()) {
 		const GetWaiter &waiter = getWaitlist[i];
 		RouteResult result = route(waiter.options);
 		if (result.process != NULL) {
+			recordAffinityResult(result);
 			postLockActions.push_back(boost::bind(
 				GetCallback::call,
 				waiter.callback,
-				newSession(result.process),
+				newSession(result.process, now),
 				ExceptionPtr()));
+			queueLatency.record(now - std::min(now, waiter.enqueueTime));
 			getWaitlist.erase(getWaitlist.begin() + i);
 		} else {
 			done = result.finished;
@@ -302,6 +441,10 @@ Group::assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockAc
 			}
 		}
 	}
+
+	if (getWaitlist.empty()) {
+		lastGetWaitlistEmptyTime = now;
+	}
 }
 
 bool
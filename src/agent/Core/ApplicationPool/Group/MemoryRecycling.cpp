@@ -0,0 +1,174 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Group.h>
+
+/*************************************************************************
+ *
+ * Memory-based process recycling functions for ApplicationPool2::Group
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+/**
+ * Memory growth is only measured for processes whose metrics have been
+ * collected for at least this long (in microseconds), so that a process
+ * that is still warming up isn't mistaken for one that leaks memory.
+ */
+static const unsigned long long MEMORY_GROWTH_MIN_OBSERVATION_TIME = 10 * 60 * 1000000ULL;
+
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+/**
+ * Returns whether the given process uses more private memory than this group
+ * allows, or whether its private memory grows faster than allowed. If so,
+ * a description of the violated limit is stored in `reason`.
+ */
+bool
+Group::exceedsMemoryLimits(const Process *process, unsigned long long now,
+	string &reason) const
+{
+	if (!process->metrics.isValid()) {
+		return false;
+	}
+
+	size_t memory = process->metrics.realMemory();
+	if (options.privateMemoryLimit > 0
+	 && memory > (size_t) options.privateMemoryLimit * 1024)
+	{
+		reason = "uses " + toString(memory / 1024) + " MB of private memory (limit: "
+			+ toString(options.privateMemoryLimit) + " MB)";
+		return true;
+	}
+
+	if (options.privateMemoryGrowthLimit > 0) {
+		double rate = process->privateMemoryGrowthRate(now,
+			MEMORY_GROWTH_MIN_OBSERVATION_TIME);
+		if (rate > (double) options.privateMemoryGrowthLimit * 1024) {
+			reason = "private memory grows by " + toString((long long) (rate / 1024))
+				+ " MB per hour (limit: " + toString(options.privateMemoryGrowthLimit)
+				+ " MB per hour)";
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Called by the spawn loop after it has attached a new process. Detaches one
+ * process that is waiting to be replaced because of its memory usage, if any.
+ * Like `detach()`, this doesn't touch getWaitlist.
+ */
+void
+Group::detachProcessPendingMemoryRecycle(boost::container::vector<Callback> &postLockActions) {
+	foreach (const ProcessPtr &process, enabledProcesses) {
+		if (process->memoryRecyclePending) {
+			P_INFO("Replacement for process " << process->inspect() <<
+				" is ready; detaching it because of its memory usage");
+			processesRecycledForMemory++;
+			ProcessPtr p = process;
+			detach(p, postLockActions);
+			return;
+		}
+	}
+}
+
+
+/****************************
+ *
+ * Public methods
+ *
+ ****************************/
+
+
+/**
+ * Replaces enabled processes that exceed this group's memory limits. A
+ * replacement process is spawned first and the offending process is only
+ * detached once the replacement has been attached, so that the group's
+ * capacity doesn't drop. If the process limits don't leave room for a
+ * replacement, then offending processes are detached right away; they
+ * finish their current sessions, and the pool spawns new processes as
+ * demand requires.
+ *
+ * Called by the Pool after it has collected process metrics, with the lock held.
+ */
+void
+Group::recycleProcessesExceedingMemoryLimits(unsigned long long now,
+	boost::container::vector<Callback> &postLockActions)
+{
+	if (options.privateMemoryLimit == 0 && options.privateMemoryGrowthLimit == 0) {
+		return;
+	}
+	if (restarting() || rollingRestarting()) {
+		return;
+	}
+
+	vector<ProcessPtr> pending;
+	foreach (const ProcessPtr &process, enabledProcesses) {
+		string reason;
+		if (process->memoryRecyclePending) {
+			pending.push_back(process);
+		} else if (exceedsMemoryLimits(process.get(), now, reason)) {
+			P_WARN("Process " << process->inspect() << " " << reason <<
+				"; replacing it with a new process");
+			process->memoryRecyclePending = true;
+			pending.push_back(process);
+		}
+	}
+
+	if (pending.empty() || m_spawning) {
+		// If a process is being spawned, then the pending
+		// processes are detached once it has been attached.
+		return;
+	}
+	if (spawn() == SR_OK) {
+		return;
+	}
+
+	P_INFO("There is no room for spawning a replacement process in group " <<
+		getName() << "; detaching " << pending.size() << " " <<
+		Pool::maybePluralize(pending.size(), "process", "processes") <<
+		" because of their memory usage");
+	foreach (const ProcessPtr &process, pending) {
+		processesRecycledForMemory++;
+		getPool()->detachProcessUnlocked(process, postLockActions);
+	}
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
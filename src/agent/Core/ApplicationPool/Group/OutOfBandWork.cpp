@@ -39,6 +39,12 @@ using namespace std;
 using namespace boost;
 
 
+/** In microseconds. */
+static const unsigned long long OOBW_REQUEST_TIMEOUT = 1000 * 1000 * 60; // 1 min
+/** In milliseconds. */
+static const int OOBW_DISPATCHER_POLL_INTERVAL = 100;
+
+
 /****************************
  *
  * Private methods
@@ -46,6 +52,24 @@ using namespace boost;
  ****************************/
 
 
+/**
+ * Returns the number of processes in this group that may perform out-of-band
+ * work at the same time: `options.maxOutOfBandWorkInstances`, but no more than
+ * the pool's OOBW budget percentage of the processes (and at least 1). This
+ * keeps aggressive OOBW settings from disabling most of the group at once.
+ */
+unsigned int
+Group::oobwBudget() const {
+	unsigned int result = options.maxOutOfBandWorkInstances;
+	unsigned int percentage = getPool()->oobwBudget;
+	if (percentage > 0) {
+		unsigned int processes = enabledCount + disablingCount + disabledCount;
+		unsigned int limit = std::max(1u, processes * percentage / 100);
+		result = std::min(result, limit);
+	}
+	return result;
+}
+
 /** Returns whether it is allowed to perform a new OOBW in this group. */
 bool
 Group::oobwAllowed() const {
@@ -60,24 +84,43 @@ Group::oobwAllowed() const {
 			oobwInstances += 1;
 		}
 	}
-	return oobwInstances < options.maxOutOfBandWorkInstances;
+	return oobwInstances < oobwBudget();
 }
 
-/** Returns whether a new OOBW should be initiated for this process. */
+/** Returns whether the given process is eligible for a new OOBW. */
 bool
 Group::shouldInitiateOobw(Process *process) const {
 	return process->oobwStatus == Process::OOBW_REQUESTED
 		&& process->enabled != Process::DETACHED
-		&& process->isAlive()
-		&& oobwAllowed();
+		&& process->isAlive();
 }
 
-void
+/**
+ * Returns the process that should perform out-of-band work next, or NULL if
+ * no process is eligible. This is the one that has gone the longest without
+ * performing out-of-band work.
+ */
+Process *
+Group::findNextOobwCandidate() const {
+	const ProcessList *lists[] = { &enabledProcesses, &disablingProcesses, &disabledProcesses };
+	Process *result = NULL;
+
+	for (unsigned int i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+		foreach (const ProcessPtr &process, *lists[i]) {
+			if (shouldInitiateOobw(process.get())
+			 && (result == NULL || process->lastOobwTime < result->lastOobwTime))
+			{
+				result = process.get();
+			}
+		}
+	}
+	return result;
+}
+
+OXT_FORCE_INLINE void
 Group::maybeInitiateOobw(Process *process) {
-	if (shouldInitiateOobw(process)) {
-		// We keep an extra reference to prevent premature destruction.
-		ProcessPtr p = process->shared_from_this();
-		initiateOobw(p);
+	if (OXT_UNLIKELY(process->oobwStatus == Process::OOBW_REQUESTED || oobwDeferred)) {
+		initiateNextOobwRequest();
 	}
 }
 
@@ -85,6 +128,7 @@ Group::maybeInitiateOobw(Process *process) {
 void
 Group::lockAndMaybeInitiateOobw(const ProcessPtr &process, DisableResult result, GroupPtr self) {
 	TRACE_POINT();
+	boost::container::vector<Callback> actions;
 
 	// Standard resource management boilerplate stuff...
 	Pool *pool = getPool();
@@ -97,17 +141,27 @@ Group::lockAndMaybeInitiateOobw(const ProcessPtr &process, DisableResult result,
 
 	if (result == DR_SUCCESS) {
 		if (process->enabled == Process::DISABLED) {
-			P_DEBUG("Process " << process->inspect() << " disabled; proceeding " <<
-				"with out-of-band work");
 			process->oobwStatus = Process::OOBW_REQUESTED;
-			if (shouldInitiateOobw(process.get())) {
-				initiateOobw(process);
-			} else {
+			if (!shouldInitiateOobw(process.get())) {
 				// We do not re-enable the process because it's likely that the
 				// administrator has explicitly changed the state.
 				P_DEBUG("Out-of-band work for process " << process->inspect() << " aborted "
 					"because the process no longer requests out-of-band work");
 				process->oobwStatus = Process::OOBW_NOT_ACTIVE;
+			} else if (getWaitlist.empty() && oobwAllowed()) {
+				P_DEBUG("Process " << process->inspect() << " disabled; proceeding " <<
+					"with out-of-band work");
+				initiateOobw(process);
+			} else {
+				// Requests started queueing while the process was being
+				// disabled. Let it serve them; the out-of-band work is
+				// performed later.
+				P_DEBUG("Out-of-band work for process " << process->inspect() << " deferred "
+					"because requests are waiting for a process");
+				oobwDeferred = true;
+				enable(process, actions);
+				assignSessionsToGetWaiters(actions);
+				pool->fullVerifyInvariants();
 			}
 		} else {
 			// We do not re-enable the process because it's likely that the
@@ -121,6 +175,9 @@ Group::lockAndMaybeInitiateOobw(const ProcessPtr &process, DisableResult result,
 			"because the process could not be disabled");
 		process->oobwStatus = Process::OOBW_NOT_ACTIVE;
 	}
+
+	lock.unlock();
+	runAllActions(actions);
 }
 
 void
@@ -161,69 +218,169 @@ Group::initiateOobw(const ProcessPtr &process) {
 	assert(process->sessions == 0);
 
 	P_DEBUG("Initiating OOBW request for process " << process->inspect());
-	interruptableThreads.create_thread(
-		boost::bind(&Group::spawnThreadOOBWRequest, this, shared_from_this(), process),
-		"OOBW request thread for process " + process->inspect(),
-		POOL_HELPER_THREAD_STACK_SIZE);
+	Pool::DebugSupportPtr debug = getPool()->debugSupport;
+	if (debug != NULL && debug->oobw) {
+		debug->debugger->send("OOBW request about to start");
+	}
+
+	oobwQueue.push_back(process);
+	if (!oobwDispatcherActive) {
+		interruptableThreads.create_thread(
+			boost::bind(&Group::oobwDispatcherMain, this, shared_from_this()),
+			"OOBW dispatcher: " + getName(),
+			POOL_HELPER_THREAD_STACK_SIZE);
+		oobwDispatcherActive = true;
+	}
+}
+
+struct OobwRequest {
+	ProcessPtr process;
+	Socket *socket;
+	Connection connection;
+	unsigned long long deadline;
+};
+
+static void
+checkinOobwConnections(boost::container::vector<OobwRequest> &requests) {
+	foreach (OobwRequest &request, requests) {
+		request.socket->checkinConnection(request.connection);
+	}
+	requests.clear();
 }
 
-// The 'self' parameter is for keeping the current Group object alive while this thread is running.
+/**
+ * Sends the OOBW requests that `initiateOobw()` queued, and waits for their
+ * responses. All out-of-band work of this group is handled by this one
+ * thread: it polls the connections of all requests in progress at the same
+ * time, instead of blocking a thread per request. The thread exits when
+ * there is nothing left to do.
+ *
+ * The 'self' parameter is for keeping the current Group object alive while
+ * this thread is running.
+ */
 void
-Group::spawnThreadOOBWRequest(GroupPtr self, ProcessPtr process) {
+Group::oobwDispatcherMain(GroupPtr self) {
 	TRACE_POINT();
 	this_thread::disable_interruption di;
 	this_thread::disable_syscall_interruption dsi;
 
-	Socket *socket;
-	Connection connection;
 	Pool *pool = getPool();
 	Pool::DebugSupportPtr debug = pool->debugSupport;
+	boost::container::vector<OobwRequest> requests;
+	boost::container::vector<struct pollfd> pollfds;
+	unsigned int i, j;
+	ScopeGuard guard(boost::bind(checkinOobwConnections, boost::ref(requests)));
 
-	UPDATE_TRACE_POINT();
-	P_DEBUG("Performing OOBW request for process " << process->inspect());
-	if (debug != NULL && debug->oobw) {
-		debug->debugger->send("OOBW request about to start");
-		debug->messages->recv("Proceed with OOBW request");
-	}
+	while (true) {
+		unsigned int firstNewRequest = requests.size();
 
-	UPDATE_TRACE_POINT();
-	{
-		// Standard resource management boilerplate stuff...
-		boost::unique_lock<boost::mutex> lock(pool->syncher);
-		if (OXT_UNLIKELY(!process->isAlive()
-			|| process->enabled == Process::DETACHED
-			|| !isAlive()))
+		UPDATE_TRACE_POINT();
 		{
-			return;
+			boost::unique_lock<boost::mutex> lock(pool->syncher);
+			if (OXT_UNLIKELY(!isAlive())) {
+				oobwQueue.clear();
+				oobwDispatcherActive = false;
+				return;
+			}
+
+			foreach (const ProcessPtr &process, oobwQueue) {
+				if (OXT_UNLIKELY(!process->isAlive()
+					|| process->enabled == Process::DETACHED))
+				{
+					continue;
+				}
+				if (process->enabled != Process::DISABLED) {
+					P_INFO("Out-of-Band Work canceled: process " << process->inspect() <<
+						" was concurrently re-enabled.");
+					process->oobwStatus = Process::OOBW_NOT_ACTIVE;
+					if (debug != NULL && debug->oobw) {
+						debug->debugger->send("OOBW request canceled");
+					}
+					continue;
+				}
+
+				assert(process->oobwStatus == Process::OOBW_IN_PROGRESS);
+				assert(process->sessions == 0);
+				OobwRequest request;
+				request.process = process;
+				request.socket = process->findSessionSocketWithLowestBusyness();
+				requests.push_back(request);
+			}
+			oobwQueue.clear();
+
+			if (requests.empty()) {
+				oobwDispatcherActive = false;
+				return;
+			}
 		}
 
-		if (process->enabled != Process::DISABLED) {
-			UPDATE_TRACE_POINT();
-			P_INFO("Out-of-Band Work canceled: process " << process->inspect() <<
-				" was concurrently re-enabled.");
-			if (debug != NULL && debug->oobw) {
-				debug->debugger->send("OOBW request canceled");
+		UPDATE_TRACE_POINT();
+		i = firstNewRequest;
+		while (i < requests.size()) {
+			ProcessPtr process = requests[i].process;
+			P_DEBUG("Performing OOBW request for process " << process->inspect());
+			if (sendOobwRequest(requests[i].socket, requests[i].connection)) {
+				requests[i].deadline = SystemTime::getUsec() + OOBW_REQUEST_TIMEOUT;
+				i++;
+			} else {
+				requests.erase(requests.begin() + i);
+				finishOobwRequest(process);
 			}
-			return;
 		}
 
-		assert(process->oobwStatus == Process::OOBW_IN_PROGRESS);
-		assert(process->sessions == 0);
-		socket = process->findSessionSocketWithLowestBusyness();
+		UPDATE_TRACE_POINT();
+		pollfds.resize(requests.size());
+		for (i = 0; i < requests.size(); i++) {
+			pollfds[i].fd = requests[i].connection.fd;
+			pollfds[i].events = POLLIN;
+			pollfds[i].revents = 0;
+		}
+		if (!requests.empty()) {
+			this_thread::restore_interruption ri(di);
+			this_thread::restore_syscall_interruption rsi(dsi);
+			// Wake up periodically to pick up newly queued requests.
+			syscalls::poll(&pollfds[0], pollfds.size(), OOBW_DISPATCHER_POLL_INTERVAL);
+		}
+
+		UPDATE_TRACE_POINT();
+		unsigned long long now = SystemTime::getUsec();
+		i = j = 0;
+		while (i < requests.size()) {
+			// We do not care what the actual response is ... just wait for it.
+			if (pollfds[j].revents != 0 || now >= requests[i].deadline) {
+				ProcessPtr process = requests[i].process;
+				if (pollfds[j].revents == 0) {
+					P_ERROR("*** ERROR: timeout waiting for the OOBW response of process "
+						<< process->inspect());
+				}
+				requests[i].socket->checkinConnection(requests[i].connection);
+				requests.erase(requests.begin() + i);
+				finishOobwRequest(process);
+			} else {
+				i++;
+			}
+			j++;
+		}
 	}
+}
 
-	UPDATE_TRACE_POINT();
-	unsigned long long timeout = 1000 * 1000 * 60; // 1 min
-	try {
-		this_thread::restore_interruption ri(di);
-		this_thread::restore_syscall_interruption rsi(dsi);
+/**
+ * Sends an OOBW request over a new connection to the given socket. Returns
+ * whether that succeeded. If it did, then the caller must check in the
+ * connection.
+ */
+bool
+Group::sendOobwRequest(Socket *socket, Connection &connection) {
+	TRACE_POINT();
+	unsigned long long timeout = OOBW_REQUEST_TIMEOUT;
 
+	try {
 		// Grab a connection. The connection is marked as fail in order to
 		// ensure it is closed / recycled after this request (otherwise we'd
 		// need to completely read the response).
 		connection = socket->checkoutConnection();
 		connection.fail = true;
-		ScopeGuard guard(boost::bind(&Socket::checkinConnection, socket, connection));
+		ScopeGuard guard(boost::bind(&Socket::checkinConnection, socket, boost::ref(connection)));
 
 		// This is copied from Core::Controller when it is sending data using the
 		// "session" protocol.
@@ -245,27 +402,38 @@ Group::spawnThreadOOBWRequest(GroupPtr self, ProcessPtr process) {
 		Uint32Message::generate(sizeField, dataSize);
 
 		gatheredWrite(connection.fd, &data[0], data.size(), &timeout);
-
-		// We do not care what the actual response is ... just wait for it.
-		UPDATE_TRACE_POINT();
-		waitUntilReadable(connection.fd, &timeout);
+		guard.clear();
+		return true;
 	} catch (const SystemException &e) {
 		P_ERROR("*** ERROR: " << e.what() << "\n" << e.backtrace());
+		return false;
 	} catch (const TimeoutException &e) {
 		P_ERROR("*** ERROR: " << e.what() << "\n" << e.backtrace());
+		return false;
+	}
+}
+
+void
+Group::finishOobwRequest(const ProcessPtr &process) {
+	TRACE_POINT();
+	Pool *pool = getPool();
+	Pool::DebugSupportPtr debug = pool->debugSupport;
+
+	if (debug != NULL && debug->oobw) {
+		debug->messages->recv("Proceed with OOBW request");
 	}
 
 	UPDATE_TRACE_POINT();
 	boost::container::vector<Callback> actions;
 	{
 		// Standard resource management boilerplate stuff...
-		Pool *pool = getPool();
 		boost::unique_lock<boost::mutex> lock(pool->syncher);
 		if (OXT_UNLIKELY(!process->isAlive() || !isAlive())) {
 			return;
 		}
 
 		process->oobwStatus = Process::OOBW_NOT_ACTIVE;
+		process->lastOobwTime = SystemTime::getUsec();
 		if (process->enabled == Process::DISABLED) {
 			enable(process, actions);
 			assignSessionsToGetWaiters(actions);
@@ -286,17 +454,33 @@ Group::spawnThreadOOBWRequest(GroupPtr self, ProcessPtr process) {
 	}
 }
 
+/**
+ * Initiates out-of-band work for as many of the processes that requested it as
+ * the OOBW budget allows, longest-waiting first. While requests are waiting in
+ * `getWaitlist`, out-of-band work is deferred until they have been served.
+ */
 void
 Group::initiateNextOobwRequest() {
-	ProcessList::const_iterator it, end = enabledProcesses.end();
-	for (it = enabledProcesses.begin(); it != end; it++) {
-		const ProcessPtr &process = *it;
-		if (shouldInitiateOobw(process.get())) {
-			// We keep an extra reference to processes to prevent premature destruction.
-			ProcessPtr p = process;
-			initiateOobw(p);
+	oobwDeferred = false;
+	while (true) {
+		Process *process = findNextOobwCandidate();
+		if (process == NULL) {
+			return;
+		}
+		if (!getWaitlist.empty()) {
+			P_DEBUG("Deferring out-of-band work for process " << process->inspect()
+				<< " because requests are waiting for a process");
+			oobwDeferred = true;
 			return;
 		}
+		if (!oobwAllowed()) {
+			// We try again when an out-of-band work request has finished.
+			return;
+		}
+
+		// We keep an extra reference to processes to prevent premature destruction.
+		ProcessPtr p = process->shared_from_this();
+		initiateOobw(p);
 	}
 }
 
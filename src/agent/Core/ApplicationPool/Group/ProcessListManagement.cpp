@@ -125,6 +125,74 @@ Group::findEnabledProcessWithLowestBusyness() const {
 	return enabledProcesses[leastBusyProcessIndex].get();
 }
 
+namespace {
+	/** Accepts the enabled processes that are below the load bound. */
+	struct AffinityCandidate {
+		const ProcessList &processes;
+		unsigned int loadBound;
+
+		AffinityCandidate(const ProcessList &_processes, unsigned int _loadBound)
+			: processes(_processes),
+			  loadBound(_loadBound)
+			{ }
+
+		bool operator()(unsigned int index) const {
+			const Process *process = processes[index].get();
+			return process->sessions < (int) loadBound && process->canBeRoutedTo();
+		}
+	};
+}
+
+/**
+ * Finds the enabled process to route a request with the given affinity key
+ * to, using consistent hashing with bounded loads. Returns the key's owner
+ * if it isn't loaded too much; otherwise the next process on the ring that
+ * isn't. If no process can take the request, returns the least busy
+ * process, which may not be routable.
+ */
+Process *
+Group::findProcessWithAffinity(boost::uint32_t key,
+	RouteResult::AffinityResult &result) const
+{
+	assert(enabledCount > 0);
+	if (affinityRingOutdated) {
+		rebuildAffinityRing();
+	}
+
+	unsigned int totalSessions = 0;
+	ProcessList::const_iterator it, end = enabledProcesses.end();
+	for (it = enabledProcesses.begin(); it != end; it++) {
+		totalSessions += (*it)->sessions;
+	}
+
+	int index = affinityRing.find(key, AffinityCandidate(enabledProcesses,
+		affinityLoadBound(totalSessions, enabledCount)));
+	if (index == -1) {
+		result = RouteResult::AFFINITY_SPILLED;
+		return findEnabledProcessWithLowestBusyness();
+	} else if ((unsigned int) index == affinityRing.owner(key)) {
+		result = RouteResult::AFFINITY_HIT;
+	} else {
+		result = RouteResult::AFFINITY_REDIRECTED;
+	}
+	return enabledProcesses[index].get();
+}
+
+/**
+ * Places the enabled processes on the affinity ring. Processes are identified
+ * by their GUPID, so that a process keeps its keys when other processes are
+ * added or removed.
+ */
+void
+Group::rebuildAffinityRing() const {
+	affinityRing.clear();
+	for (unsigned int i = 0; i < enabledProcesses.size(); i++) {
+		affinityRing.add(i, enabledProcesses[i]->getGupid());
+	}
+	affinityRing.finish();
+	affinityRingOutdated = false;
+}
+
 /**
  * Adds a process to the given list (enabledProcess, disablingProcesses, disabledProcesses)
  * and sets the process->enabled flag accordingly.
@@ -138,6 +206,7 @@ Group::addProcessToList(const ProcessPtr &process, ProcessList &destination) {
 	if (&destination == &enabledProcesses) {
 		process->enabled = Process::ENABLED;
 		enabledCount++;
+		affinityRingOutdated = true;
 		enabledProcessBusynessLevels.push_back(process->busyness());
 		if (process->isTotallyBusy()) {
 			nEnabledProcessesTotallyBusy++;
@@ -180,6 +249,7 @@ Group::removeProcessFromList(const ProcessPtr &process, ProcessList &source) {
 	case Process::ENABLED:
 		assert(&source == &enabledProcesses);
 		enabledCount--;
+		affinityRingOutdated = true;
 		if (process->isTotallyBusy()) {
 			nEnabledProcessesTotallyBusy--;
 		}
@@ -529,6 +599,8 @@ Group::detachAll(boost::container::vector<Callback> &postLockActions) {
 	disablingCount = 0;
 	disabledCount = 0;
 	nEnabledProcessesTotallyBusy = 0;
+	rollingRestartBatchSize = 0;
+	rollingRestartReplacements = 0;
 	clearDisableWaitlist(DR_NOOP, postLockActions);
 	startCheckingDetachedProcesses(false);
 }
@@ -53,17 +53,30 @@ using namespace boost;
  * If there are no enabled process, then waiting for one to spawn is too
  * expensive. The next best thing is to route to disabling processes
  * until more processes have been spawned.
+ *
+ * Among enabled processes, a request goes to the least busy process, unless
+ * it has a sticky session ID or an affinity key. Requests with an affinity
+ * key are routed with consistent hashing with bounded loads, see
+ * AffinityRing.h.
  */
 Group::RouteResult
-Group::route(const Options &options) const {
+Group::route(const RequestOptions &options) const {
 	if (OXT_LIKELY(enabledCount > 0)) {
-		if (options.stickySessionId == 0) {
+		if (options.stickySessionId == 0 && options.affinityKey == 0) {
 			Process *process = findEnabledProcessWithLowestBusyness();
 			if (process->canBeRoutedTo()) {
 				return RouteResult(process);
 			} else {
 				return RouteResult(NULL, true);
 			}
+		} else if (options.stickySessionId == 0) {
+			RouteResult::AffinityResult affinity;
+			Process *process = findProcessWithAffinity(options.affinityKey, affinity);
+			if (process->canBeRoutedTo()) {
+				return RouteResult(process, false, affinity);
+			} else {
+				return RouteResult(NULL, true);
+			}
 		} else {
 			Process *process = findProcessWithStickySessionIdOrLowestBusyness(
 				options.stickySessionId);
@@ -87,6 +100,23 @@ Group::route(const Options &options) const {
 	}
 }
 
+void
+Group::recordAffinityResult(const RouteResult &result) {
+	switch (result.affinity) {
+	case RouteResult::NO_AFFINITY:
+		break;
+	case RouteResult::AFFINITY_HIT:
+		affinityHits++;
+		break;
+	case RouteResult::AFFINITY_REDIRECTED:
+		affinityRedirects++;
+		break;
+	case RouteResult::AFFINITY_SPILLED:
+		affinitySpills++;
+		break;
+	}
+}
+
 SessionPtr
 Group::newSession(Process *process, unsigned long long now) {
 	bool wasTotallyBusy = process->isTotallyBusy();
@@ -253,14 +283,14 @@ Group::onSessionClose(Process *process, Session *session) {
 
 
 SessionPtr
-Group::get(const Options &newOptions, const GetCallback &callback,
+Group::get(const RequestOptions &newOptions, const GetCallback &callback,
 	boost::container::vector<Callback> &postLockActions)
 {
 	assert(isAlive());
 
 	if (OXT_LIKELY(!restarting())) {
 		if (OXT_UNLIKELY(needsRestart(newOptions))) {
-			restart(newOptions);
+			restart(newOptions.toOptions());
 		} else {
 			mergeOptions(newOptions);
 		}
@@ -328,6 +358,7 @@ Group::get(const Options &newOptions, const GetCallback &callback,
 			return SessionPtr();
 		} else {
 			P_DEBUG("Session checked out from process " << result.process->inspect());
+			recordAffinityResult(result);
 			return newSession(result.process, newOptions.currentTime);
 		}
 	}
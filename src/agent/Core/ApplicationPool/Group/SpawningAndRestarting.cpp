@@ -38,6 +38,12 @@ using namespace std;
 using namespace boost;
 
 
+/**
+ * A rolling restart replaces the old processes in about this many batches.
+ */
+static const unsigned int ROLLING_RESTART_BATCHES = 4;
+
+
 /****************************
  *
  * Private methods
@@ -89,7 +95,6 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 			shouldFail = message->name == "Fail spawn loop iteration " + iteration;
 		}
 
-		ProcessPtr process;
 		ExceptionPtr exception;
 		try {
 			UPDATE_TRACE_POINT();
@@ -100,7 +105,14 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 				processAndLogNewSpawnException(e, options, pool->getSpawningKitConfig());
 				throw e;
 			} else {
-				process = createProcessObject(spawner->spawn(options));
+				// The spawner negotiates with the new process on its
+				// negotiation loop, so this thread doesn't have to wait
+				// for the application to load. onSpawnNegotiated()
+				// continues the spawn loop.
+				spawner->asyncSpawn(options, boost::bind(&Group::onSpawnNegotiated,
+					this, shared_from_this(), spawner, options, restartsInitiated,
+					_1, _2));
+				return;
 			}
 		} catch (const thread_interrupted &) {
 			break;
@@ -110,97 +122,184 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 			// gdb can generate a backtrace.
 		}
 
-		UPDATE_TRACE_POINT();
-		ScopeGuard guard(boost::bind(Process::forceTriggerShutdownAndCleanup, process));
-		boost::unique_lock<boost::mutex> lock(pool->syncher);
+		done = finishSpawnLoopIteration(ProcessPtr(), exception, restartsInitiated);
+	}
 
-		if (!isAlive()) {
-			if (process != NULL) {
-				P_DEBUG("Group is being shut down so dropping process " <<
-					process->inspect() << " which we just spawned and exiting spawn loop");
-			} else {
-				P_DEBUG("The group is being shut down. A process failed "
-					"to be spawned anyway, so ignoring this error and exiting "
-					"spawn loop");
-			}
-			// We stop immediately because any previously assumed invariants
-			// may have been violated.
-			break;
-		} else if (restartsInitiated != this->restartsInitiated) {
-			if (process != NULL) {
-				P_DEBUG("A restart was issued for the group, so dropping process " <<
-					process->inspect() << " which we just spawned and exiting spawn loop");
-			} else {
-				P_DEBUG("A restart was issued for the group. A process failed "
-					"to be spawned anyway, so ignoring this error and exiting "
-					"spawn loop");
-			}
-			// We stop immediately because any previously assumed invariants
-			// may have been violated.
-			break;
+	if (debug != NULL && debug->spawning) {
+		debug->debugger->send("Spawn loop done");
+	}
+}
+
+/**
+ * Called on the spawner's negotiation loop once an asynchronous spawn has
+ * finished. Attaching the process requires the pool lock, which must not be
+ * taken on the negotiation loop, so the spawn loop continues on the pool's
+ * spawn continuation thread.
+ */
+void
+Group::onSpawnNegotiated(GroupPtr self, SpawningKit::SpawnerPtr spawner,
+	Options options, unsigned int restartsInitiated,
+	const SpawningKit::Result &result, const SpawnException *e)
+{
+	if (!isAlive()) {
+		// The group's shutdown is cancelling the spawns of this spawner.
+		// This one finished before it could be cancelled.
+		if (e == NULL) {
+			P_DEBUG("Group is being shut down so dropping process " <<
+				result["pid"].asInt() << " which we just spawned");
+			this_thread::disable_syscall_interruption dsi;
+			syscalls::kill(result["pid"].asInt(), SIGKILL);
 		}
+		return;
+	}
 
-		verifyInvariants();
-		assert(m_spawning);
-		assert(processesBeingSpawned > 0);
+	ExceptionPtr exception;
+	if (e != NULL) {
+		exception = copyException(*e);
+	}
+	getPool()->spawnContinuations.add(boost::bind(&Group::spawnThreadContinue,
+		this, self, spawner, options, restartsInitiated, result, exception));
+}
 
-		processesBeingSpawned--;
-		assert(processesBeingSpawned == 0);
+// The 'self' parameter is for keeping the current Group object alive while this continuation is pending.
+void
+Group::spawnThreadContinue(GroupPtr self, SpawningKit::SpawnerPtr spawner,
+	Options options, unsigned int restartsInitiated,
+	SpawningKit::Result result, ExceptionPtr exception)
+{
+	TRACE_POINT();
+	this_thread::disable_interruption di;
+	this_thread::disable_syscall_interruption dsi;
+
+	ProcessPtr process;
+	if (exception == NULL) {
+		try {
+			UPDATE_TRACE_POINT();
+			process = createProcessObject(result);
+		} catch (const tracable_exception &e) {
+			exception = copyException(e);
+		}
+	}
 
-		UPDATE_TRACE_POINT();
-		boost::container::vector<Callback> actions;
+	if (finishSpawnLoopIteration(process, exception, restartsInitiated)) {
+		Pool::DebugSupportPtr debug = getPool()->debugSupport;
+		if (debug != NULL && debug->spawning) {
+			debug->debugger->send("Spawn loop done");
+		}
+	} else {
+		spawnThreadRealMain(spawner, options, restartsInitiated);
+	}
+}
+
+/**
+ * Attaches the process that a spawn loop iteration has spawned, or handles
+ * the error that occurred. Returns whether the spawn loop is done.
+ */
+bool
+Group::finishSpawnLoopIteration(const ProcessPtr &process, const ExceptionPtr &exception,
+	unsigned int restartsInitiated)
+{
+	TRACE_POINT();
+	Pool *pool = getPool();
+	bool done = false;
+
+	UPDATE_TRACE_POINT();
+	ScopeGuard guard(boost::bind(Process::forceTriggerShutdownAndCleanup, process));
+	boost::unique_lock<boost::mutex> lock(pool->syncher);
+
+	if (!isAlive()) {
+		if (process != NULL) {
+			P_DEBUG("Group is being shut down so dropping process " <<
+				process->inspect() << " which we just spawned and exiting spawn loop");
+		} else {
+			P_DEBUG("The group is being shut down. A process failed "
+				"to be spawned anyway, so ignoring this error and exiting "
+				"spawn loop");
+		}
+		// We stop immediately because any previously assumed invariants
+		// may have been violated.
+		return true;
+	} else if (restartsInitiated != this->restartsInitiated) {
 		if (process != NULL) {
-			AttachResult result = attach(process, actions);
-			if (result == AR_OK) {
-				guard.clear();
-				if (getWaitlist.empty()) {
-					pool->assignSessionsToGetWaiters(actions);
-				} else {
-					assignSessionsToGetWaiters(actions);
-				}
-				P_DEBUG("New process count = " << enabledCount <<
-					", remaining get waiters = " << getWaitlist.size());
+			P_DEBUG("A restart was issued for the group, so dropping process " <<
+				process->inspect() << " which we just spawned and exiting spawn loop");
+		} else {
+			P_DEBUG("A restart was issued for the group. A process failed "
+				"to be spawned anyway, so ignoring this error and exiting "
+				"spawn loop");
+		}
+		// We stop immediately because any previously assumed invariants
+		// may have been violated.
+		return true;
+	}
+
+	verifyInvariants();
+	assert(m_spawning);
+	assert(processesBeingSpawned > 0);
+
+	processesBeingSpawned--;
+	assert(processesBeingSpawned == 0);
+
+	UPDATE_TRACE_POINT();
+	boost::container::vector<Callback> actions;
+	if (process != NULL) {
+		AttachResult result = attach(process, actions);
+		if (result == AR_OK) {
+			guard.clear();
+			spawnPhases.record(process->getSpawnPhaseDurations());
+			if (rollingRestartBatchSize > 0) {
+				retireProcessesForRollingRestart(actions);
 			} else {
-				done = true;
-				P_DEBUG("Unable to attach spawned process " << process->inspect());
-				if (result == AR_ANOTHER_GROUP_IS_WAITING_FOR_CAPACITY) {
-					pool->possiblySpawnMoreProcessesForExistingGroups();
-				}
+				detachProcessPendingMemoryRecycle(actions);
 			}
-		} else {
-			// TODO: sure this is the best thing? if there are
-			// processes currently alive we should just use them.
-			if (enabledCount == 0) {
-				enableAllDisablingProcesses(actions);
+			if (getWaitlist.empty()) {
+				pool->assignSessionsToGetWaiters(actions);
+			} else {
+				assignSessionsToGetWaiters(actions);
 			}
-			Pool::assignExceptionToGetWaiters(getWaitlist, exception, actions);
-			pool->assignSessionsToGetWaiters(actions);
+			P_DEBUG("New process count = " << enabledCount <<
+				", remaining get waiters = " << getWaitlist.size());
+		} else {
 			done = true;
+			P_DEBUG("Unable to attach spawned process " << process->inspect());
+			if (result == AR_ANOTHER_GROUP_IS_WAITING_FOR_CAPACITY) {
+				pool->possiblySpawnMoreProcessesForExistingGroups();
+			}
 		}
-
-		done = done
-			|| (processLowerLimitsSatisfied() && getWaitlist.empty())
-			|| processUpperLimitsReached()
-			|| pool->atFullCapacityUnlocked();
-		m_spawning = !done;
-		if (done) {
-			P_DEBUG("Spawn loop done");
-		} else {
-			processesBeingSpawned++;
-			P_DEBUG("Continue spawning");
+	} else {
+		if (rollingRestartBatchSize > 0) {
+			abortRollingRestart(actions);
 		}
-
-		UPDATE_TRACE_POINT();
-		pool->fullVerifyInvariants();
-		lock.unlock();
-		UPDATE_TRACE_POINT();
-		runAllActions(actions);
-		UPDATE_TRACE_POINT();
+		// TODO: sure this is the best thing? if there are
+		// processes currently alive we should just use them.
+		if (enabledCount == 0) {
+			enableAllDisablingProcesses(actions);
+		}
+		Pool::assignExceptionToGetWaiters(getWaitlist, exception, actions);
+		pool->assignSessionsToGetWaiters(actions);
+		done = true;
 	}
 
-	if (debug != NULL && debug->spawning) {
-		debug->debugger->send("Spawn loop done");
+	done = done
+		|| (processLowerLimitsSatisfied() && getWaitlist.empty()
+			&& !rollingRestartNeedsSpawn())
+		|| processUpperLimitsReached()
+		|| pool->atFullCapacityUnlocked();
+	m_spawning = !done;
+	if (done) {
+		P_DEBUG("Spawn loop done");
+	} else {
+		processesBeingSpawned++;
+		P_DEBUG("Continue spawning");
 	}
+
+	UPDATE_TRACE_POINT();
+	pool->fullVerifyInvariants();
+	lock.unlock();
+	UPDATE_TRACE_POINT();
+	runAllActions(actions);
+	UPDATE_TRACE_POINT();
+	return done;
 }
 
 // The 'self' parameter is for keeping the current Group object alive while this thread is running.
@@ -264,6 +363,9 @@ Group::finalizeRestart(GroupPtr self,
 	spawner    = newSpawner;
 
 	m_restarting = false;
+	if (method == RM_ROLLING) {
+		startRollingRestart();
+	}
 	if (shouldSpawn()) {
 		spawn();
 	} else if (isWaitingForCapacity()) {
@@ -287,6 +389,231 @@ Group::finalizeRestart(GroupPtr self,
 	}
 }
 
+/**
+ * Called by finalizeRestart() once the new spawner is in place. Marks the
+ * current processes as belonging to the old version, so that the spawn loop
+ * replaces them.
+ */
+void
+Group::startRollingRestart() {
+	unsigned int count = enabledCount + disablingCount + disabledCount;
+
+	foreach (const ProcessPtr &process, enabledProcesses) {
+		process->rollingRestartPending = true;
+	}
+	foreach (const ProcessPtr &process, disablingProcesses) {
+		process->rollingRestartPending = true;
+	}
+	foreach (const ProcessPtr &process, disabledProcesses) {
+		process->rollingRestartPending = true;
+	}
+
+	rollingRestartReplacements = 0;
+	if (count == 0) {
+		rollingRestartBatchSize = 0;
+	} else {
+		rollingRestartBatchSize = (count + ROLLING_RESTART_BATCHES - 1)
+			/ ROLLING_RESTART_BATCHES;
+		P_INFO("Rolling restarting group " << getName() << ": replacing " <<
+			count << " " << Pool::maybePluralize(count, "process", "processes") <<
+			", " << rollingRestartBatchSize << " at a time");
+	}
+}
+
+/**
+ * Called when a new process could not be spawned during a rolling restart.
+ * The old processes that haven't been replaced yet keep serving requests.
+ */
+void
+Group::abortRollingRestart(boost::container::vector<Callback> &postLockActions) {
+	P_ERROR("Rolling restart of group " << getName() << " aborted because a new "
+		"process could not be spawned. The remaining processes of the previous "
+		"version keep serving requests");
+
+	foreach (const ProcessPtr &process, enabledProcesses) {
+		process->rollingRestartPending = false;
+	}
+	foreach (const ProcessPtr &process, disabledProcesses) {
+		process->rollingRestartPending = false;
+	}
+
+	// Re-enable the processes that were being disabled because they were
+	// being replaced, but not those that are being disabled for out-of-band work.
+	ProcessList disabling = disablingProcesses;
+	foreach (const ProcessPtr &process, disabling) {
+		if (process->rollingRestartPending) {
+			process->rollingRestartPending = false;
+			if (process->oobwStatus == Process::OOBW_NOT_ACTIVE) {
+				enable(process, postLockActions);
+			}
+		}
+	}
+
+	rollingRestartBatchSize = 0;
+	rollingRestartReplacements = 0;
+}
+
+/**
+ * Returns the number of processes that the current rolling restart still has
+ * to replace, including those that are being disabled.
+ */
+unsigned int
+Group::countRollingRestartPendingProcesses() const {
+	unsigned int result = 0;
+	foreach (const ProcessPtr &process, enabledProcesses) {
+		result += process->rollingRestartPending;
+	}
+	foreach (const ProcessPtr &process, disablingProcesses) {
+		result += process->rollingRestartPending;
+	}
+	foreach (const ProcessPtr &process, disabledProcesses) {
+		result += process->rollingRestartPending;
+	}
+	return result;
+}
+
+/**
+ * Whether the current rolling restart has enabled old processes for which
+ * no replacement has been spawned yet.
+ */
+bool
+Group::rollingRestartNeedsSpawn() const {
+	if (rollingRestartBatchSize == 0) {
+		return false;
+	}
+
+	unsigned int oldProcesses = 0;
+	foreach (const ProcessPtr &process, enabledProcesses) {
+		oldProcesses += process->rollingRestartPending;
+	}
+	return oldProcesses > rollingRestartReplacements;
+}
+
+static bool
+retireBefore(const ProcessPtr &a, const ProcessPtr &b) {
+	if (a->memoryRecyclePending != b->memoryRecyclePending) {
+		return a->memoryRecyclePending;
+	} else {
+		return a->busyness() < b->busyness();
+	}
+}
+
+/**
+ * Called by the spawn loop after it has attached a new process during a
+ * rolling restart. Once a whole batch of new processes has been attached,
+ * disables as many old processes, so that they finish their current requests
+ * but don't get new ones. They are detached once they have been disabled.
+ * Like `detach()`, this doesn't touch getWaitlist.
+ */
+void
+Group::retireProcessesForRollingRestart(boost::container::vector<Callback> &postLockActions) {
+	vector<ProcessPtr> oldProcesses;
+	foreach (const ProcessPtr &process, enabledProcesses) {
+		if (process->rollingRestartPending) {
+			oldProcesses.push_back(process);
+		}
+	}
+
+	rollingRestartReplacements++;
+	if (rollingRestartReplacements < std::min<unsigned int>(rollingRestartBatchSize,
+		oldProcesses.size()))
+	{
+		P_DEBUG("Rolling restart of group " << getName() << ": " <<
+			rollingRestartReplacements << " of " << rollingRestartBatchSize <<
+			" new processes in this batch are ready");
+		return;
+	}
+
+	// Processes that were going to be replaced anyway go first. After
+	// that, the least busy processes, because they finish soonest.
+	std::sort(oldProcesses.begin(), oldProcesses.end(), retireBefore);
+	unsigned int count = std::min<unsigned int>(rollingRestartReplacements,
+		oldProcesses.size());
+	rollingRestartReplacements = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		const ProcessPtr &process = oldProcesses[i];
+		P_DEBUG("Rolling restart of group " << getName() << ": disabling process " <<
+			process->inspect() << " because a new process replaces it");
+		// Out-of-band work is pointless for a process that is going away.
+		process->oobwStatus = Process::OOBW_NOT_ACTIVE;
+		DisableResult result = disable(process,
+			boost::bind(&Group::lockAndFinishRetiringProcess, this,
+				_1, _2, shared_from_this()));
+		switch (result) {
+		case DR_SUCCESS:
+			finishRetiringProcess(process, postLockActions);
+			break;
+		case DR_DEFERRED:
+			// lockAndFinishRetiringProcess() will eventually be called.
+			break;
+		default:
+			P_WARN("Rolling restart of group " << getName() << ": unable to " <<
+				"disable process " << process->inspect() << "; detaching it");
+			finishRetiringProcess(process, postLockActions);
+			break;
+		}
+	}
+}
+
+// The 'self' parameter is for keeping the current Group object alive
+void
+Group::lockAndFinishRetiringProcess(const ProcessPtr &process, DisableResult result,
+	GroupPtr self)
+{
+	TRACE_POINT();
+
+	// Standard resource management boilerplate stuff...
+	Pool *pool = getPool();
+	boost::unique_lock<boost::mutex> lock(pool->syncher);
+	if (OXT_UNLIKELY(!process->isAlive() || !isAlive())) {
+		return;
+	}
+
+	if (result != DR_SUCCESS || process->enabled != Process::DISABLED) {
+		// The process was enabled or detached in the mean time.
+		return;
+	}
+
+	boost::container::vector<Callback> actions;
+	if (process->rollingRestartPending) {
+		finishRetiringProcess(process, actions);
+	} else {
+		// The rolling restart was aborted while this process was being disabled.
+		enable(process, actions);
+	}
+	pool->assignSessionsToGetWaiters(actions);
+	pool->possiblySpawnMoreProcessesForExistingGroups();
+	if (shouldSpawn()) {
+		spawn();
+	}
+
+	pool->fullVerifyInvariants();
+	lock.unlock();
+	runAllActions(actions);
+}
+
+/**
+ * Detaches an old process that a rolling restart has replaced. Like
+ * `detach()`, this doesn't touch getWaitlist.
+ */
+void
+Group::finishRetiringProcess(const ProcessPtr &process,
+	boost::container::vector<Callback> &postLockActions)
+{
+	ProcessPtr p = process; // Keep an extra reference just in case.
+	P_DEBUG("Rolling restart of group " << getName() << ": detaching replaced process " <<
+		p->inspect());
+	processesReplacedByRollingRestart++;
+	detach(p, postLockActions);
+
+	if (countRollingRestartPendingProcesses() == 0) {
+		P_INFO("Rolling restart of group " << getName() << " done");
+		rollingRestartBatchSize = 0;
+		rollingRestartReplacements = 0;
+	}
+}
+
 
 /****************************
  *
@@ -295,12 +622,27 @@ Group::finalizeRestart(GroupPtr self,
  ****************************/
 
 
+/**
+ * Restarts this group. A blocking restart detaches all processes right away;
+ * requests wait until a new process has been spawned. A rolling restart keeps
+ * the current processes and replaces them in batches, so that there is always
+ * at least as much capacity as before. With RM_DEFAULT, a rolling restart is
+ * performed if `pool->rollingRestarts` is set.
+ */
 void
 Group::restart(const Options &options, RestartMethod method) {
 	boost::container::vector<Callback> actions;
 
 	assert(isAlive());
-	P_DEBUG("Restarting group " << getName());
+	if (method == RM_DEFAULT) {
+		method = getPool()->rollingRestarts ? RM_ROLLING : RM_BLOCKING;
+	}
+	if (method == RM_ROLLING && enabledCount == 0) {
+		// There is no capacity to preserve.
+		method = RM_BLOCKING;
+	}
+	P_DEBUG((method == RM_ROLLING ? "Rolling restarting group " : "Restarting group ")
+		<< getName());
 
 	// If there is currently a restarter thread or a spawner thread active,
 	// the following tells them to abort their current work as soon as possible.
@@ -310,7 +652,14 @@ Group::restart(const Options &options, RestartMethod method) {
 	m_spawning   = false;
 	m_restarting = true;
 	uuid         = generateUuid(pool);
-	detachAll(actions);
+	if (method == RM_ROLLING) {
+		// The current processes keep serving requests. finalizeRestart()
+		// starts replacing them once the new spawner is in place.
+		rollingRestartBatchSize = 0;
+		rollingRestartReplacements = 0;
+	} else {
+		detachAll(actions);
+	}
 	getPool()->interruptableThreads.create_thread(
 		boost::bind(&Group::finalizeRestart, this, shared_from_this(),
 			this->options.copyAndPersist().clearPerRequestFields(),
@@ -327,8 +676,26 @@ Group::restarting() const {
 	return m_restarting;
 }
 
+/** Whether a rolling restart is replacing processes. */
+bool
+Group::rollingRestarting() const {
+	return rollingRestartBatchSize > 0;
+}
+
+/**
+ * Whether restart.txt has been created or touched since the last check, or
+ * always_restart.txt exists.
+ *
+ * If the pool's restart file watcher watches the restart directory, then the
+ * files are only checked after the watcher has seen them change, so the
+ * common case costs an atomic load. The watcher reports changes
+ * asynchronously, so with a `statThrottleRate` of 0 the files are still
+ * checked on every call. Otherwise, they are polled at most once
+ * every `statThrottleRate` seconds; each poll also tries to start watching
+ * the directory again.
+ */
 bool
-Group::needsRestart(const Options &options) {
+Group::needsRestart(const RequestOptions &options) {
 	if (m_restarting) {
 		return false;
 	} else {
@@ -343,6 +710,8 @@ Group::needsRestart(const Options &options) {
 
 		if (lastRestartFileCheckTime == 0) {
 			// First time we call needsRestart() for this group.
+			// Start watching before checking, so that no change is missed.
+			watchRestartDir();
 			if (syscalls::stat(restartFile.c_str(), &buf) == 0) {
 				lastRestartFileMtime = buf.st_mtime;
 			} else {
@@ -351,45 +720,35 @@ Group::needsRestart(const Options &options) {
 			lastRestartFileCheckTime = now;
 			return false;
 
-		} else if (lastRestartFileCheckTime <= now - (time_t) options.statThrottleRate) {
+		} else if (restartFileSubscription != NULL
+			&& !restartFileSubscription->lost.load(boost::memory_order_relaxed))
+		{
 			// Not first time we call needsRestart() for this group.
-			// Stat throttle time has passed.
-			bool restart;
-
-			lastRestartFileCheckTime = now;
-
-			if (lastRestartFileMtime > 0) {
-				// restart.txt existed before
-				if (syscalls::stat(restartFile.c_str(), &buf) == -1) {
-					// restart.txt no longer exists
-					lastRestartFileMtime = buf.st_mtime;
-					restart = false;
-				} else if (buf.st_mtime != lastRestartFileMtime) {
-					// restart.txt's mtime has changed
-					lastRestartFileMtime = buf.st_mtime;
-					restart = true;
-				} else {
-					restart = false;
-				}
+			// The watcher tells us when the restart files change.
+			bool changed = restartFileSubscription->changed.exchange(false,
+				boost::memory_order_acquire);
+			if (changed || options.getGroupOptions().statThrottleRate == 0) {
+				lastRestartFileCheckTime = now;
+				return checkRestartFiles();
+			} else if (alwaysRestartFileExists) {
+				// always_restart.txt existed before
+				alwaysRestartFileExists = syscalls::stat(
+					alwaysRestartFile.c_str(), &buf) == 0;
+				return alwaysRestartFileExists;
 			} else {
-				// restart.txt didn't exist before
-				if (syscalls::stat(restartFile.c_str(), &buf) == 0) {
-					// restart.txt now exists
-					lastRestartFileMtime = buf.st_mtime;
-					restart = true;
-				} else {
-					// restart.txt still doesn't exist
-					lastRestartFileMtime = 0;
-					restart = false;
-				}
+				return false;
 			}
 
-			if (!restart) {
-				alwaysRestartFileExists = restart =
-					syscalls::stat(alwaysRestartFile.c_str(), &buf) == 0;
+		} else if (lastRestartFileCheckTime <= now - (time_t) options.getGroupOptions().statThrottleRate) {
+			// Not first time we call needsRestart() for this group.
+			// Stat throttle time has passed.
+			lastRestartFileCheckTime = now;
+			if (restartFileSubscription != NULL) {
+				// The restart directory was removed or moved.
+				unwatchRestartDir();
 			}
-
-			return restart;
+			watchRestartDir();
+			return checkRestartFiles();
 
 		} else {
 			// Not first time we call needsRestart() for this group.
@@ -407,6 +766,63 @@ Group::needsRestart(const Options &options) {
 	}
 }
 
+/**
+ * Checks whether restart.txt has been created or touched since the last
+ * check, or whether always_restart.txt exists.
+ */
+bool
+Group::checkRestartFiles() {
+	struct stat buf;
+	bool restart;
+
+	if (lastRestartFileMtime > 0) {
+		// restart.txt existed before
+		if (syscalls::stat(restartFile.c_str(), &buf) == -1) {
+			// restart.txt no longer exists
+			lastRestartFileMtime = buf.st_mtime;
+			restart = false;
+		} else if (buf.st_mtime != lastRestartFileMtime) {
+			// restart.txt's mtime has changed
+			lastRestartFileMtime = buf.st_mtime;
+			restart = true;
+		} else {
+			restart = false;
+		}
+	} else {
+		// restart.txt didn't exist before
+		if (syscalls::stat(restartFile.c_str(), &buf) == 0) {
+			// restart.txt now exists
+			lastRestartFileMtime = buf.st_mtime;
+			restart = true;
+		} else {
+			// restart.txt still doesn't exist
+			lastRestartFileMtime = 0;
+			restart = false;
+		}
+	}
+
+	if (!restart) {
+		alwaysRestartFileExists = restart =
+			syscalls::stat(alwaysRestartFile.c_str(), &buf) == 0;
+	}
+
+	return restart;
+}
+
+void
+Group::watchRestartDir() {
+	restartFileSubscription = getPool()->restartFileWatcher.watch(
+		extractDirName(restartFile));
+}
+
+void
+Group::unwatchRestartDir() {
+	if (restartFileSubscription != NULL) {
+		getPool()->restartFileWatcher.unwatch(restartFileSubscription);
+		restartFileSubscription.reset();
+	}
+}
+
 /**
  * Attempts to increase the number of processes by one, while respecting the
  * resource limits. That is, this method will ensure that there are at least
@@ -452,6 +868,7 @@ Group::shouldSpawn() const {
 			!processLowerLimitsSatisfied()
 			|| allEnabledProcessesAreTotallyBusy()
 			|| !getWaitlist.empty()
+			|| rollingRestartNeedsSpawn()
 		);
 }
 
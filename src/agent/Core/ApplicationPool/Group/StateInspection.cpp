@@ -67,7 +67,8 @@ Group::processLowerLimitsSatisfied() const {
  */
 bool
 Group::processUpperLimitsReached() const {
-	return options.maxProcesses != 0 && capacityUsed() >= options.maxProcesses;
+	return (options.maxProcesses != 0 && capacityUsed() >= options.maxProcesses)
+		|| (autoscaler.limit != 0 && capacityUsed() >= autoscaler.limit);
 }
 
 /**
@@ -83,10 +84,18 @@ Group::allEnabledProcessesAreTotallyBusy() const {
 /**
  * Returns the number of processes in this group that should be part of the
  * ApplicationPool process limits calculations.
+ *
+ * During a rolling restart, up to `rollingRestartBatchSize` old processes
+ * don't count, so that their replacements can be spawned before they go away.
  */
 unsigned int
 Group::capacityUsed() const {
-	return enabledCount + disablingCount + disabledCount + processesBeingSpawned;
+	unsigned int result = enabledCount + disablingCount + disabledCount
+		+ processesBeingSpawned;
+	if (OXT_UNLIKELY(rollingRestartBatchSize > 0)) {
+		result -= std::min(rollingRestartBatchSize, countRollingRestartPendingProcesses());
+	}
+	return result;
 }
 
 /**
@@ -115,6 +124,37 @@ Group::garbageCollectable(unsigned long long now) const {
 	return false;
 }
 
+static void
+addMemorySavedBySharing(const ProcessList &processes, ssize_t &result) {
+	foreach (const ProcessPtr &process, processes) {
+		const ProcessMetrics &metrics = process->metrics;
+		if (metrics.isValid() && metrics.rss != -1 && metrics.pss != -1) {
+			if (result == -1) {
+				result = 0;
+			}
+			if (metrics.rss > metrics.pss) {
+				result += metrics.rss - metrics.pss;
+			}
+		}
+	}
+}
+
+/**
+ * Returns an estimate of how much memory (in KB) this group's processes save
+ * by sharing pages, e.g. with the preloader that they were forked from, or -1
+ * if unknown. This is the difference between the processes' resident set
+ * sizes, which count shared pages in full, and their proportional set sizes,
+ * which divide shared pages over the processes sharing them.
+ */
+ssize_t
+Group::memorySavedBySharing() const {
+	ssize_t result = -1;
+	addMemorySavedBySharing(enabledProcesses, result);
+	addMemorySavedBySharing(disablingProcesses, result);
+	addMemorySavedBySharing(disabledProcesses, result);
+	return result;
+}
+
 void
 Group::inspectXml(std::ostream &stream, bool includeSecrets) const {
 	ProcessList::const_iterator it;
@@ -130,6 +170,31 @@ Group::inspectXml(std::ostream &stream, bool includeSecrets) const {
 	stream << "<disabled_process_count>" << disabledCount << "</disabled_process_count>";
 	stream << "<capacity_used>" << capacityUsed() << "</capacity_used>";
 	stream << "<get_wait_list_size>" << getWaitlist.size() << "</get_wait_list_size>";
+	stream << "<queue_latency>";
+	queueLatency.inspectXml(stream);
+	stream << "</queue_latency>";
+	stream << "<requests_shed_by_deadline>" << requestsShedByDeadline << "</requests_shed_by_deadline>";
+	stream << "<requests_shed_adaptively>" << requestsShedAdaptively << "</requests_shed_adaptively>";
+	stream << "<processes_recycled_for_memory>" << processesRecycledForMemory << "</processes_recycled_for_memory>";
+	stream << "<processes_replaced_by_rolling_restart>" << processesReplacedByRollingRestart << "</processes_replaced_by_rolling_restart>";
+	if (affinityHits + affinityRedirects + affinitySpills > 0) {
+		stream << "<affinity>";
+		stream << "<hits>" << affinityHits << "</hits>";
+		stream << "<redirects>" << affinityRedirects << "</redirects>";
+		stream << "<spills>" << affinitySpills << "</spills>";
+		stream << "</affinity>";
+	}
+	stream << "<memory_saved_by_sharing>" << memorySavedBySharing() << "</memory_saved_by_sharing>";
+	stream << "<spawn_phases>";
+	spawnPhases.inspectXml(stream);
+	stream << "</spawn_phases>";
+	if (autoscaler.limit != 0) {
+		stream << "<autoscaler>";
+		stream << "<process_limit>" << autoscaler.limit << "</process_limit>";
+		stream << "<grown>" << autoscaler.grown << "</grown>";
+		stream << "<shrunk>" << autoscaler.shrunk << "</shrunk>";
+		stream << "</autoscaler>";
+	}
 	stream << "<disable_wait_list_size>" << disableWaitlist.size() << "</disable_wait_list_size>";
 	stream << "<processes_being_spawned>" << processesBeingSpawned << "</processes_being_spawned>";
 	if (m_spawning) {
@@ -138,6 +203,9 @@ Group::inspectXml(std::ostream &stream, bool includeSecrets) const {
 	if (restarting()) {
 		stream << "<restarting/>";
 	}
+	if (rollingRestarting()) {
+		stream << "<rolling_restarting/>";
+	}
 	if (includeSecrets) {
 		stream << "<secret>" << escapeForXml(getApiKey().toStaticString()) << "</secret>";
 		stream << "<api_key>" << escapeForXml(getApiKey().toStaticString()) << "</api_key>";
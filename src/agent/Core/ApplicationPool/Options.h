@@ -29,6 +29,9 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <functional>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/shared_array.hpp>
 #include <AppTypes.h>
 #include <DataStructures/HashedStaticString.h>
@@ -75,7 +78,23 @@ using namespace boost;
  */
 class Options {
 private:
+	friend class RequestOptions;
+
+	/**
+	 * Internal storage area for string fields, created by `persist()`.
+	 * It is never modified after creation, so copies of this Options
+	 * object (e.g. the per-request copies of a cached per-group Options
+	 * object) share it instead of copying the string data again.
+	 */
 	shared_array<char> storage;
+	size_t storageSize;
+	/**
+	 * Internal storage area for string fields that didn't live in
+	 * `storage` at the time `persist()` was called, typically per-request
+	 * fields such as `environmentVariables` or `hostName`.
+	 */
+	shared_array<char> overlayStorage;
+	size_t overlayStorageSize;
 
 	template<typename OptionsClass, typename StaticStringClass>
 	static vector<StaticStringClass *> getStringFields(OptionsClass &options) {
@@ -121,6 +140,23 @@ private:
 		return result;
 	}
 
+	static bool isInStorage(const StaticString &str, const shared_array<char> &data,
+		size_t size)
+	{
+		const char *begin = data.get();
+		return begin != NULL
+			&& std::less_equal<const char *>()(begin, str.data())
+			&& std::less<const char *>()(str.data() + str.size(), begin + size)
+			// Persisted strings are NULL-terminated.
+			&& str.data()[str.size()] == '\0';
+	}
+
+	bool isPersisted(const StaticString &str) const {
+		return str.empty()
+			|| isInStorage(str, storage, storageSize)
+			|| isInStorage(str, overlayStorage, overlayStorageSize);
+	}
+
 	static inline void
 	appendKeyValue(vector<string> &vec, const char *key, const StaticString &value) {
 		if (!value.empty()) {
@@ -303,6 +339,12 @@ public:
 	 */
 	bool loadShellEnvvars;
 
+	/** Whether a preloader should warm up (run the `preloader_warmup` event
+	 * hooks and compact its heap) before it forks its first process, in order
+	 * to make its memory more copy-on-write friendly.
+	 */
+	bool preloaderWarmup;
+
 	bool userSwitching;
 
 	/** Whether Union Station logging should be enabled. Enabling this option will
@@ -358,6 +400,19 @@ public:
 	 */
 	unsigned int maxOutOfBandWorkInstances;
 
+	/**
+	 * The amount of private memory (in MB) that a process may use. Processes
+	 * that use more are replaced by a new process. A value of 0 means unlimited.
+	 */
+	unsigned int privateMemoryLimit;
+
+	/**
+	 * The rate (in MB per hour) at which a process's private memory may grow
+	 * over its lifetime. Processes whose memory grows faster are replaced by
+	 * a new process. A value of 0 means unlimited.
+	 */
+	unsigned int privateMemoryGrowthLimit;
+
 	/**
 	 * The maximum number of requests that may live in the Group.getWaitlist queue.
 	 * A value of 0 means unlimited.
@@ -415,6 +470,13 @@ public:
 	 */
 	unsigned int stickySessionId;
 
+	/**
+	 * The hash of the request's affinity key (e.g. a tenant ID), for routing
+	 * requests with the same key to the same process. 0 means that the request
+	 * has no affinity key. Ignored if `stickySessionId` is set.
+	 */
+	boost::uint32_t affinityKey;
+
 	/**
 	 * A throttling rate for file stats. When set to a non-zero value N,
 	 * restart.txt and other files which are usually stat()ted on every
@@ -433,6 +495,23 @@ public:
 	 */
 	unsigned long long currentTime;
 
+	/**
+	 * The time (in microseconds, as returned by SystemTime::getUsec()) after
+	 * which the client is no longer interested in a response. If this request
+	 * is still on a get wait list by then, it is shed with a
+	 * RequestQueueTimeoutException instead of being assigned a session.
+	 * A value of 0 means no deadline.
+	 */
+	unsigned long long deadline;
+
+	/**
+	 * The priority class of this request. If a request has to be put on a
+	 * get wait list, then it is queued behind all waiters with an equal or
+	 * higher priority, but in front of waiters with a lower priority.
+	 * Defaults to 0.
+	 */
+	unsigned int priority;
+
 	/** When true, Pool::get() and Pool::asyncGet() will create the necessary
 	 * Group structure just as normally, and will even handle
 	 * restarting logic, but will not actually spawn any processes and will not
@@ -471,7 +550,9 @@ public:
 	 * One must still set appRoot manually, after having used this constructor.
 	 */
 	Options()
-		: logLevel(DEFAULT_LOG_LEVEL),
+		: storageSize(0),
+		  overlayStorageSize(0),
+		  logLevel(DEFAULT_LOG_LEVEL),
 		  startTimeout(90 * 1000),
 		  environment(DEFAULT_APP_ENV, sizeof(DEFAULT_APP_ENV) - 1),
 		  baseURI("/", 1),
@@ -486,6 +567,7 @@ public:
 		  forceMaxConcurrentRequestsPerProcess(-1),
 		  debugger(false),
 		  loadShellEnvvars(true),
+		  preloaderWarmup(false),
 		  userSwitching(true),
 		  analytics(false),
 		  raiseInternalError(false),
@@ -494,13 +576,18 @@ public:
 		  maxProcesses(0),
 		  maxPreloaderIdleTime(-1),
 		  maxOutOfBandWorkInstances(1),
+		  privateMemoryLimit(0),
+		  privateMemoryGrowthLimit(0),
 		  maxRequestQueueSize(100),
 		  abortWebsocketsOnProcessShutdown(true),
 
 		  stickySessionId(0),
+		  affinityKey(0),
 		  statThrottleRate(DEFAULT_STAT_THROTTLE_RATE),
 		  maxRequests(0),
 		  currentTime(0),
+		  deadline(0),
+		  priority(0),
 		  noop(false)
 		  /*********************************/
 	{
@@ -521,44 +608,93 @@ public:
 	 * Assign <em>other</em>'s string fields' values into this Option
 	 * object, and store the data in this Option object's internal storage
 	 * area.
+	 *
+	 * String data that already lives in <em>other</em>'s internal storage
+	 * areas is not copied: the storage areas are shared instead. So persisting
+	 * a copy of an already persisted Options object (e.g. a per-group Options
+	 * object on which a few per-request fields have been set) only copies the
+	 * string fields that have changed since.
 	 */
 	Options &persist(const Options &other) {
 		vector<StaticString *> strings = getStringFields<Options, StaticString>(*this);
 		const vector<const StaticString *> otherStrings =
 			getStringFields<const Options, const StaticString>(other);
+		shared_array<char> newStorage = other.storage;
+		size_t newStorageSize = other.storageSize;
+		shared_array<char> newOverlayStorage = other.overlayStorage;
+		size_t newOverlayStorageSize = other.overlayStorageSize;
+		bool allPersisted = true;
 		unsigned int i;
 		size_t otherLen = 0;
 		char *end;
 
 		assert(strings.size() == otherStrings.size());
 
-		// Calculate the desired length of the internal storage area.
-		// All strings are NULL-terminated.
-		for (i = 0; i < otherStrings.size(); i++) {
-			otherLen += otherStrings[i]->size() + 1;
+		for (i = 0; i < otherStrings.size() && allPersisted; i++) {
+			allPersisted = other.isPersisted(*otherStrings[i]);
 		}
 
-		shared_array<char> data(new char[otherLen]);
-		end = data.get();
-
-		// Copy string fields into the internal storage area.
-		for (i = 0; i < otherStrings.size(); i++) {
-			const char *pos = end;
-			StaticString *str = strings[i];
-			const StaticString *otherStr = otherStrings[i];
-
-			// Copy over the string data.
-			memcpy(end, otherStr->c_str(), otherStr->size());
-			end += otherStr->size();
-			*end = '\0';
-			end++;
+		if (!allPersisted) {
+			// Calculate the desired length of the new storage area.
+			// All strings are NULL-terminated. Strings in other's main
+			// storage area are shared; everything else is copied.
+			for (i = 0; i < otherStrings.size(); i++) {
+				const StaticString *otherStr = otherStrings[i];
+				if (!otherStr->empty() && !isInStorage(*otherStr, other.storage,
+					other.storageSize))
+				{
+					otherLen += otherStr->size() + 1;
+				}
+			}
 
-			// Point current object's field to the data in the
-			// internal storage area.
-			*str = StaticString(pos, end - pos - 1);
+			shared_array<char> data(new char[otherLen]);
+			if (newStorage.get() == NULL) {
+				newStorage = data;
+				newStorageSize = otherLen;
+				newOverlayStorage.reset();
+				newOverlayStorageSize = 0;
+			} else {
+				newOverlayStorage = data;
+				newOverlayStorageSize = otherLen;
+			}
+			end = data.get();
+
+			// Copy string fields into the new storage area.
+			for (i = 0; i < otherStrings.size(); i++) {
+				const char *pos = end;
+				StaticString *str = strings[i];
+				const StaticString *otherStr = otherStrings[i];
+
+				if (otherStr->empty()) {
+					*str = StaticString();
+				} else if (isInStorage(*otherStr, other.storage, other.storageSize)) {
+					*str = *otherStr;
+				} else {
+					// Copy over the string data.
+					memcpy(end, otherStr->data(), otherStr->size());
+					end += otherStr->size();
+					*end = '\0';
+					end++;
+
+					// Point current object's field to the data in the
+					// new storage area.
+					*str = StaticString(pos, end - pos - 1);
+				}
+			}
+		} else {
+			for (i = 0; i < otherStrings.size(); i++) {
+				if (otherStrings[i]->empty()) {
+					*strings[i] = StaticString();
+				} else {
+					*strings[i] = *otherStrings[i];
+				}
+			}
 		}
 
-		storage = data;
+		storage = newStorage;
+		storageSize = newStorageSize;
+		overlayStorage = newOverlayStorage;
+		overlayStorageSize = newOverlayStorageSize;
 
 		// Fix up HashedStaticStrings' hashes.
 		appRoot.setHash(other.appRoot.hash());
@@ -571,7 +707,10 @@ public:
 		hostName = StaticString();
 		uri      = StaticString();
 		stickySessionId = 0;
+		affinityKey     = 0;
 		currentTime     = 0;
+		deadline        = 0;
+		priority        = 0;
 		noop     = false;
 		return detachFromUnionStationTransaction();
 	}
@@ -624,6 +763,7 @@ public:
 			appendKeyValue (vec, "ust_router_password", ustRouterPassword);
 			appendKeyValue4(vec, "debugger",           debugger);
 			appendKeyValue4(vec, "analytics",          analytics);
+			appendKeyValue4(vec, "preloader_warmup",   preloaderWarmup);
 			appendKeyValue (vec, "api_key",            apiKey);
 
 			/*********************************/
@@ -633,6 +773,8 @@ public:
 			appendKeyValue3(vec, "max_processes",       maxProcesses);
 			appendKeyValue2(vec, "max_preloader_idle_time", maxPreloaderIdleTime);
 			appendKeyValue3(vec, "max_out_of_band_work_instances", maxOutOfBandWorkInstances);
+			appendKeyValue3(vec, "private_memory_limit", privateMemoryLimit);
+			appendKeyValue3(vec, "private_memory_growth_limit", privateMemoryGrowthLimit);
 		}
 		if ((fields & SPAWN_OPTIONS) || (fields & PER_GROUP_POOL_OPTIONS)) {
 			appendKeyValue (vec, "union_station_key",   unionStationKey);
@@ -713,6 +855,194 @@ public:
 	}
 };
 
+/**
+ * An immutable, reference counted Options object. The Controller keeps one
+ * per application group, and all requests for that group refer to it.
+ */
+typedef boost::shared_ptr<const Options> ConstOptionsPtr;
+
+/**
+ * The pool options for a single Pool::asyncGet() call. Consists of a reference
+ * to the immutable per-group Options, plus a small overlay with the fields that
+ * may differ between requests. Creating, copying and persisting a RequestOptions
+ * object does not copy the per-group Options, so neither setting up a request
+ * nor putting it on a get wait list copies the whole Options struct.
+ *
+ * The overlay fields are initialized from the per-group Options, and take
+ * precedence over them. All other fields are read from `getGroupOptions()`.
+ */
+class RequestOptions {
+private:
+	ConstOptionsPtr groupOptions;
+	/** Storage area for overlay string fields, created by `persist()`. */
+	shared_array<char> storage;
+	size_t storageSize;
+
+	void getStringFields(StaticString *result[4]) {
+		result[0] = &environmentVariables;
+		result[1] = &unionStationKey;
+		result[2] = &hostName;
+		result[3] = &uri;
+	}
+
+	bool isPersisted(const StaticString &str) const {
+		return str.empty()
+			|| groupOptions->isPersisted(str)
+			|| Options::isInStorage(str, storage, storageSize);
+	}
+
+public:
+	/*********** Overlay of per-request fields ***********
+	 * See the Options fields with the same names.
+	 */
+
+	/** Set from the request's !~PASSENGER_ENV_VARS header, if any. */
+	StaticString environmentVariables;
+	bool analytics;
+	StaticString unionStationKey;
+	StaticString hostName;
+	StaticString uri;
+	UnionStation::TransactionPtr transaction;
+	unsigned int stickySessionId;
+	boost::uint32_t affinityKey;
+	unsigned long maxRequests;
+	unsigned long long currentTime;
+	unsigned long long deadline;
+	unsigned int priority;
+	bool noop;
+
+	/*********************************/
+
+	RequestOptions()
+		: storageSize(0),
+		  analytics(false),
+		  stickySessionId(0),
+		  affinityKey(0),
+		  maxRequests(0),
+		  currentTime(0),
+		  deadline(0),
+		  priority(0),
+		  noop(false)
+		{ }
+
+	/**
+	 * Creates a RequestOptions object that refers to the given per-group
+	 * options, with the overlay fields initialized from them.
+	 */
+	explicit RequestOptions(const ConstOptionsPtr &_groupOptions)
+		: groupOptions(_groupOptions),
+		  storageSize(0),
+		  environmentVariables(_groupOptions->environmentVariables),
+		  analytics(_groupOptions->analytics),
+		  unionStationKey(_groupOptions->unionStationKey),
+		  hostName(_groupOptions->hostName),
+		  uri(_groupOptions->uri),
+		  stickySessionId(_groupOptions->stickySessionId),
+		  affinityKey(_groupOptions->affinityKey),
+		  maxRequests(_groupOptions->maxRequests),
+		  currentTime(_groupOptions->currentTime),
+		  deadline(_groupOptions->deadline),
+		  priority(_groupOptions->priority),
+		  noop(_groupOptions->noop)
+		{ }
+
+	/**
+	 * Creates a RequestOptions object that refers to a persisted copy of
+	 * `options`. For callers that don't keep per-group Options around,
+	 * such as unit tests and administrative tools.
+	 */
+	explicit RequestOptions(const Options &options) {
+		boost::shared_ptr<Options> copy = boost::make_shared<Options>(options);
+		copy->persist(options);
+		copy->detachFromUnionStationTransaction();
+		*this = RequestOptions(copy);
+		transaction = options.transaction;
+	}
+
+	bool hasGroupOptions() const {
+		return groupOptions != NULL;
+	}
+
+	const Options &getGroupOptions() const {
+		return *groupOptions;
+	}
+
+	const ConstOptionsPtr &getGroupOptionsPtr() const {
+		return groupOptions;
+	}
+
+	const HashedStaticString &getAppGroupName() const {
+		return groupOptions->getAppGroupName();
+	}
+
+	/**
+	 * Copies the overlay string fields that don't point into the per-group
+	 * Options' storage area into this object's own storage area, so that
+	 * this object no longer refers to the caller's memory.
+	 */
+	RequestOptions &persist() {
+		StaticString *strings[4];
+		size_t len = 0;
+		unsigned int i;
+		char *end;
+
+		getStringFields(strings);
+		for (i = 0; i < 4; i++) {
+			if (!isPersisted(*strings[i])) {
+				len += strings[i]->size() + 1;
+			}
+		}
+		if (len == 0) {
+			return *this;
+		}
+
+		shared_array<char> data(new char[len]);
+		end = data.get();
+		for (i = 0; i < 4; i++) {
+			StaticString *str = strings[i];
+			if (!isPersisted(*str)) {
+				const char *pos = end;
+				memcpy(end, str->data(), str->size());
+				end += str->size();
+				*end = '\0';
+				end++;
+				*str = StaticString(pos, end - pos - 1);
+			}
+		}
+		storage = data;
+		storageSize = len;
+		return *this;
+	}
+
+	RequestOptions &detachFromUnionStationTransaction() {
+		transaction.reset();
+		return *this;
+	}
+
+	/**
+	 * Returns a full Options object: a copy of the per-group options with
+	 * the overlay applied. The string fields are not persisted. Only needed
+	 * on slow paths, such as when creating or restarting a Group.
+	 */
+	Options toOptions() const {
+		Options result(*groupOptions);
+		result.environmentVariables = environmentVariables;
+		result.analytics = analytics;
+		result.unionStationKey = unionStationKey;
+		result.hostName = hostName;
+		result.uri = uri;
+		result.transaction = transaction;
+		result.stickySessionId = stickySessionId;
+		result.affinityKey = affinityKey;
+		result.maxRequests = maxRequests;
+		result.currentTime = currentTime;
+		result.deadline = deadline;
+		result.priority = priority;
+		result.noop = noop;
+		return result;
+	}
+};
+
 } // namespace ApplicationPool2
 } // namespace Passenger
 
@@ -53,6 +53,7 @@
 #include <Hooks.h>
 #include <Utils/Lock.h>
 #include <Utils/AnsiColorConstants.h>
+#include <Utils/BlockingQueue.h>
 #include <Utils/SystemTime.h>
 #include <Utils/MessagePassing.h>
 #include <Utils/VariantMap.h>
@@ -60,6 +61,8 @@
 #include <Utils/SystemMetricsCollector.h>
 #include <Core/UnionStation/StopwatchLog.h>
 #include <Core/ApplicationPool/Common.h>
+#include <Core/ApplicationPool/Autoscaler.h>
+#include <Core/ApplicationPool/RestartFileWatcher.h>
 #include <Core/ApplicationPool/Context.h>
 #include <Core/ApplicationPool/Process.h>
 #include <Core/ApplicationPool/Group.h>
@@ -161,7 +164,46 @@ public:
 	mutable boost::mutex syncher;
 	unsigned int max;
 	unsigned long long maxIdleTime;
+	/**
+	 * Adaptive request queue shedding parameters, in microseconds. If a group's
+	 * getWaitlist has not been empty during the last `requestQueueShedInterval`,
+	 * then waiters that have been queued for longer than `requestQueueShedTarget`
+	 * are shed. Otherwise, waiters are shed after `requestQueueShedInterval`.
+	 * Disabled if `requestQueueShedTarget` is 0.
+	 */
+	unsigned long long requestQueueShedTarget;
+	unsigned long long requestQueueShedInterval;
+	/**
+	 * Whether group process limits are adjusted automatically, every time
+	 * analytics have been collected. See Autoscaler.h.
+	 */
+	bool autoscaling;
+	AutoscalerConfig autoscalerConfig;
+	/**
+	 * The percentage of host memory that was free when analytics were
+	 * last collected, or -1 if unknown.
+	 */
+	double hostMemoryFree;
+	/**
+	 * While less than this percentage of host memory is free, `forceFreeCapacity()`
+	 * detaches the idle process that uses the most private memory, instead of
+	 * the least recently used one.
+	 */
+	double memoryPressureThreshold;
+	/**
+	 * Whether `Group::restart()` performs a rolling restart by default,
+	 * i.e. when it is called with `RM_DEFAULT`.
+	 */
+	bool rollingRestarts;
+	/**
+	 * The percentage of a group's processes that may perform out-of-band work
+	 * at the same time, in addition to `Options::maxOutOfBandWorkInstances`.
+	 * At least one process may always do so. 0 means no limit.
+	 */
+	unsigned int oobwBudget;
 	bool selfchecking;
+	/** Tells groups when their restart.txt may have changed. See `Group::needsRestart()`. */
+	RestartFileWatcher restartFileWatcher;
 
 	Context context;
 
@@ -281,7 +323,7 @@ public:
 	static void collectAnalytics(PoolPtr self);
 	static void collectPids(const ProcessList &processes, vector<pid_t> &pids);
 	static void updateProcessMetrics(const ProcessList &processes,
-		const ProcessMetricMap &allMetrics,
+		const ProcessMetricMap &allMetrics, unsigned long long now,
 		vector<ProcessPtr> &processesToDetach);
 	void prepareUnionStationProcessStateLogs(vector<UnionStationLogEntry> &logEntries,
 		const GroupPtr &group) const;
@@ -290,6 +332,17 @@ public:
 	void realCollectAnalytics();
 
 
+	/****** Autoscaling ******/
+
+	static AutoscalerHostSignals getAutoscalerHostSignals(const SystemMetrics &metrics);
+	AutoscalerGroupSignals getAutoscalerGroupSignals(const GroupPtr &group,
+		unsigned long long now);
+	void trimGroupToAutoscaledLimit(const GroupPtr &group,
+		boost::container::vector<Callback> &postLockActions);
+	void autoscale(const AutoscalerHostSignals &host, unsigned long long now,
+		boost::container::vector<Callback> &postLockActions);
+
+
 	/****** Garbage collection ******/
 
 	struct GarbageCollectorState {
@@ -312,6 +365,19 @@ public:
 	void wakeupGarbageCollector();
 
 
+	/****** Spawn continuations ******/
+
+	/**
+	 * Spawn loops whose spawn negotiation has finished continue on a single
+	 * pool thread, which takes them from this queue. See
+	 * `Group::onSpawnNegotiated()`.
+	 */
+	BlockingQueue<Callback> spawnContinuations;
+
+	void initializeSpawnContinuations();
+	static void processSpawnContinuations(PoolPtr self);
+
+
 	/****** General utilities ******/
 
 	static const char *maybeColorize(const InspectOptions &options, const char *color);
@@ -344,9 +410,9 @@ public:
 	};
 
 	const GroupPtr getGroup(const char *name);
-	Group *findMatchingGroup(const Options &options);
+	Group *findMatchingGroup(const RequestOptions &options);
 	GroupPtr createGroup(const Options &options);
-	GroupPtr createGroupAndAsyncGetFromIt(const Options &options,
+	GroupPtr createGroupAndAsyncGetFromIt(const RequestOptions &options,
 		const GetCallback &callback, boost::container::vector<Callback> &postLockActions);
 	void forceDetachGroup(const GroupPtr &group,
 		const Callback &callback,
@@ -369,6 +435,8 @@ public:
 	};
 
 	ProcessPtr findOldestIdleProcess(const Group *exclude = NULL) const;
+	ProcessPtr findIdleProcessWithMostPrivateMemory(const Group *exclude = NULL) const;
+	bool hostHasMemoryPressureUnlocked() const;
 	ProcessPtr findBestProcessToTrash() const;
 	ProcessPtr forceFreeCapacity(const Group *exclude,
 		boost::container::vector<Callback> &postLockActions);
@@ -449,10 +517,17 @@ public:
 
 	/****** Miscellaneous ******/
 
+	void asyncGet(const RequestOptions &options, const GetCallback &callback, bool lockNow = true, UnionStation::StopwatchLog **stopwatchLog = NULL);
 	void asyncGet(const Options &options, const GetCallback &callback, bool lockNow = true, UnionStation::StopwatchLog **stopwatchLog = NULL);
+	SessionPtr get(const RequestOptions &options, Ticket *ticket);
 	SessionPtr get(const Options &options, Ticket *ticket);
 	void setMax(unsigned int max);
 	void setMaxIdleTime(unsigned long long value);
+	void setRequestQueueShedding(unsigned long long target, unsigned long long interval);
+	void setAutoscaling(bool enabled, const AutoscalerConfig &config = AutoscalerConfig());
+	void setMemoryPressureThreshold(double percentage);
+	void setRollingRestarts(bool enabled);
+	void setOobwBudget(unsigned int percentage);
 	void enableSelfChecking(bool enabled);
 	bool isSpawning(bool lock = true) const;
 	bool authorizeByApiKey(const ApiKey &key, bool lock = true) const;
@@ -86,7 +86,7 @@ Pool::collectPids(const ProcessList &processes, vector<pid_t> &pids) {
 
 void
 Pool::updateProcessMetrics(const ProcessList &processes,
-	const ProcessMetricMap &allMetrics,
+	const ProcessMetricMap &allMetrics, unsigned long long now,
 	vector<ProcessPtr> &processesToDetach)
 {
 	foreach (const ProcessPtr &process, processes) {
@@ -94,6 +94,11 @@ Pool::updateProcessMetrics(const ProcessList &processes,
 			allMetrics.find(process->getPid());
 		if (metrics_it != allMetrics.end()) {
 			process->metrics = metrics_it->second;
+			if (process->initialMetricsTime == 0 && process->metrics.isValid()) {
+				process->initialRealMemory = process->metrics.realMemory();
+				process->initialMetricsTime = now;
+				process->initialSharedMemory = process->metrics.sharedMemory();
+			}
 		// If the process is missing from 'allMetrics' then either 'ps'
 		// failed or the process really is gone. We double check by sending
 		// it a signal.
@@ -201,15 +206,24 @@ Pool::realCollectAnalytics() {
 		vector<UnionStationLogEntry> logEntries;
 		vector<ProcessPtr> processesToDetach;
 		boost::container::vector<Callback> actions;
+		vector<GroupPtr> groupsToRecycle;
 		ScopedLock l(syncher);
 		GroupMap::ConstIterator g_it(groups);
+		unsigned long long now = SystemTime::getUsec();
+
+		if (systemMetrics.ramTotal > 0 && systemMetrics.ramFree() >= 0) {
+			hostMemoryFree = systemMetrics.ramFree() * 100.0 / systemMetrics.ramTotal;
+		} else {
+			hostMemoryFree = -1;
+		}
 
 		UPDATE_TRACE_POINT();
 		while (*g_it != NULL) {
 			const GroupPtr &group = g_it.getValue();
-			updateProcessMetrics(group->enabledProcesses, processMetrics, processesToDetach);
-			updateProcessMetrics(group->disablingProcesses, processMetrics, processesToDetach);
-			updateProcessMetrics(group->disabledProcesses, processMetrics, processesToDetach);
+			updateProcessMetrics(group->enabledProcesses, processMetrics, now, processesToDetach);
+			updateProcessMetrics(group->disablingProcesses, processMetrics, now, processesToDetach);
+			updateProcessMetrics(group->disabledProcesses, processMetrics, now, processesToDetach);
+			groupsToRecycle.push_back(group);
 			prepareUnionStationProcessStateLogs(logEntries, group);
 			prepareUnionStationSystemMetricsLogs(logEntries, group);
 			g_it.next();
@@ -222,6 +236,18 @@ Pool::realCollectAnalytics() {
 		UPDATE_TRACE_POINT();
 		processesToDetach.clear();
 
+		UPDATE_TRACE_POINT();
+		foreach (const GroupPtr &group, groupsToRecycle) {
+			if (group->isAlive()) {
+				group->recycleProcessesExceedingMemoryLimits(now, actions);
+			}
+		}
+
+		if (autoscaling) {
+			UPDATE_TRACE_POINT();
+			autoscale(getAutoscalerHostSignals(systemMetrics), now, actions);
+		}
+
 		l.unlock();
 		UPDATE_TRACE_POINT();
 		if (!logEntries.empty()) {
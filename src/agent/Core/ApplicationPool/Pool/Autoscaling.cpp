@@ -0,0 +1,175 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Pool.h>
+
+/*************************************************************************
+ *
+ * Autoscaling functions for ApplicationPool2::Pool
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+AutoscalerHostSignals
+Pool::getAutoscalerHostSignals(const SystemMetrics &metrics) {
+	AutoscalerHostSignals host;
+	host.cpuUsage = metrics.avgCpuUsage();
+	if (metrics.ramTotal > 0 && metrics.ramUsed >= 0) {
+		host.memoryFree = metrics.ramFree() * 100.0 / metrics.ramTotal;
+	}
+	return host;
+}
+
+/**
+ * Gathers the autoscaling signals of the given group. The queue time is the
+ * higher one of the average queue latency of the requests that were dequeued
+ * since the previous evaluation, and the time that the oldest request still
+ * in the queue has been waiting.
+ */
+AutoscalerGroupSignals
+Pool::getAutoscalerGroupSignals(const GroupPtr &group, unsigned long long now) {
+	AutoscalerGroupSignals signals;
+	AutoscalerGroupState &state = group->autoscaler;
+	const QueueLatencyHistogram &latency = group->queueLatency;
+
+	signals.processCount = group->capacityUsed();
+	signals.lowerBound = group->options.minProcesses;
+	if (group->options.maxProcesses != 0) {
+		signals.upperBound = std::min(group->options.maxProcesses, max);
+	} else {
+		signals.upperBound = max;
+	}
+
+	if (latency.count > state.lastQueueLatencyCount) {
+		signals.queueTime = (latency.sum - state.lastQueueLatencySum)
+			/ (latency.count - state.lastQueueLatencyCount);
+	}
+	state.lastQueueLatencyCount = latency.count;
+	state.lastQueueLatencySum = latency.sum;
+	foreach (const GetWaiter &waiter, group->getWaitlist) {
+		if (now > waiter.enqueueTime) {
+			signals.queueTime = std::max(signals.queueTime, now - waiter.enqueueTime);
+		}
+	}
+	signals.queueSize = group->getWaitlist.size();
+
+	if (!group->enabledProcesses.empty()) {
+		double total = 0;
+		foreach (const ProcessPtr &process, group->enabledProcesses) {
+			total += process->utilization();
+		}
+		signals.utilization = total / group->enabledProcesses.size();
+	}
+	return signals;
+}
+
+/**
+ * Detaches idle processes, least recently used first, until the group no
+ * longer has more processes than its autoscaled limit. Busy processes are
+ * left alone; they are detached in a later evaluation once they're idle.
+ */
+void
+Pool::trimGroupToAutoscaledLimit(const GroupPtr &group,
+	boost::container::vector<Callback> &postLockActions)
+{
+	while (group->autoscaler.limit != 0
+		&& group->getProcessCount() > group->autoscaler.limit
+		&& group->getProcessCount() > group->options.minProcesses)
+	{
+		ProcessPtr oldestIdleProcess;
+		foreach (const ProcessPtr &process, group->enabledProcesses) {
+			if (process->busyness() == 0
+			 && (oldestIdleProcess == NULL || process->lastUsed < oldestIdleProcess->lastUsed))
+			{
+				oldestIdleProcess = process;
+			}
+		}
+		if (oldestIdleProcess == NULL) {
+			break;
+		}
+		P_DEBUG("Autoscaler: detaching idle process " << oldestIdleProcess->inspect() <<
+			", group=" << group->getName());
+		detachProcessUnlocked(oldestIdleProcess, postLockActions);
+	}
+}
+
+/**
+ * Evaluates the autoscaling policy for all groups at time `now`, and grows or
+ * shrinks them accordingly. Must be called with the lock held.
+ */
+void
+Pool::autoscale(const AutoscalerHostSignals &host, unsigned long long now,
+	boost::container::vector<Callback> &postLockActions)
+{
+	GroupMap::ConstIterator g_it(groups);
+	vector<GroupPtr> groupsToEvaluate;
+
+	// Detaching processes may create groups, so don't iterate over
+	// the group map directly.
+	while (*g_it != NULL) {
+		groupsToEvaluate.push_back(g_it.getValue());
+		g_it.next();
+	}
+
+	foreach (const GroupPtr &group, groupsToEvaluate) {
+		if (!group->isAlive() || group->restarting() || group->rollingRestarting()) {
+			continue;
+		}
+
+		AutoscalerGroupSignals signals = getAutoscalerGroupSignals(group, now);
+		switch (evaluateAutoscaling(autoscalerConfig, host, signals,
+			group->autoscaler, now))
+		{
+		case AD_GROW:
+			P_INFO("Autoscaler: raising the process limit of group " << group->getName()
+				<< " to " << group->autoscaler.limit << " (queue time: "
+				<< signals.queueTime / 1000 << " ms, utilization: "
+				<< (int) (signals.utilization * 100) << "%)");
+			if (group->shouldSpawn()) {
+				group->spawn();
+			}
+			break;
+		case AD_SHRINK:
+			P_INFO("Autoscaler: lowering the process limit of group " << group->getName()
+				<< " to " << group->autoscaler.limit << " (queue time: "
+				<< signals.queueTime / 1000 << " ms, utilization: "
+				<< (int) (signals.utilization * 100) << "%)");
+			break;
+		default:
+			break;
+		}
+		trimGroupToAutoscaledLimit(group, postLockActions);
+	}
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
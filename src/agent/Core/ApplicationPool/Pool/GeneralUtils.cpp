@@ -152,10 +152,24 @@ Pool::assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockAct
 	bool done = false;
 	vector<GetWaiter>::iterator it, end = getWaitlist.end();
 	vector<GetWaiter> newWaitlist;
+	unsigned long long now = 0;
 
 	for (it = getWaitlist.begin(); it != end && !done; it++) {
 		GetWaiter &waiter = *it;
 
+		if (waiter.options.deadline != 0) {
+			if (now == 0) {
+				now = SystemTime::getUsec();
+			}
+			if (now >= waiter.options.deadline) {
+				postLockActions.push_back(boost::bind(GetCallback::call,
+					waiter.callback, SessionPtr(),
+					boost::make_shared<RequestQueueTimeoutException>(
+						now - std::min(now, waiter.enqueueTime), true)));
+				continue;
+			}
+		}
+
 		Group *group = findMatchingGroup(waiter.options);
 		if (group != NULL) {
 			SessionPtr session = group->get(waiter.options, waiter.callback,
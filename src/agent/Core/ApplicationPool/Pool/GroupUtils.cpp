@@ -57,7 +57,7 @@ Pool::getGroup(const char *name) {
 }
 
 Group *
-Pool::findMatchingGroup(const Options &options) {
+Pool::findMatchingGroup(const RequestOptions &options) {
 	GroupPtr *group;
 	if (groups.lookup(options.getAppGroupName(), &group)) {
 		return group->get();
@@ -76,10 +76,10 @@ Pool::createGroup(const Options &options) {
 }
 
 GroupPtr
-Pool::createGroupAndAsyncGetFromIt(const Options &options,
+Pool::createGroupAndAsyncGetFromIt(const RequestOptions &options,
 	const GetCallback &callback, boost::container::vector<Callback> &postLockActions)
 {
-	GroupPtr group = createGroup(options);
+	GroupPtr group = createGroup(options.toOptions());
 	SessionPtr session = group->get(options, callback,
 		postLockActions);
 	/* If !options.noop, then the callback should now have been put on the
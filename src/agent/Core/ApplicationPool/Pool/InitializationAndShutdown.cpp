@@ -56,6 +56,13 @@ Pool::Pool(const SpawningKit::FactoryPtr &spawningKitFactory,
 	lifeStatus   = ALIVE;
 	max          = 6;
 	maxIdleTime  = 60 * 1000000;
+	requestQueueShedTarget   = 0;
+	requestQueueShedInterval = 0;
+	autoscaling  = false;
+	hostMemoryFree = -1;
+	memoryPressureThreshold = 10;
+	rollingRestarts = false;
+	oobwBudget = 10;
 	selfchecking = true;
 	palloc       = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
 
@@ -79,6 +86,7 @@ Pool::initialize() {
 	LockGuard l(syncher);
 	initializeAnalyticsCollection();
 	initializeGarbageCollection();
+	initializeSpawnContinuations();
 }
 
 void
@@ -41,7 +41,7 @@ using namespace boost;
 // 'lockNow == false' may only be used during unit tests. Normally we
 // should never call the callback while holding the lock.
 void
-Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow, UnionStation::StopwatchLog **stopwatchLog) {
+Pool::asyncGet(const RequestOptions &options, const GetCallback &callback, bool lockNow, UnionStation::StopwatchLog **stopwatchLog) {
 	DynamicScopedLock lock(syncher, lockNow);
 
 	assert(lifeStatus == ALIVE || lifeStatus == PREPARED_FOR_SHUTDOWN);
@@ -118,15 +118,13 @@ Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow
 			 * become available.
 			 */
 			P_DEBUG("Could not free a process; putting request to top-level getWaitlist");
-			getWaitlist.push_back(GetWaiter(
-				options.copyAndPersist().detachFromUnionStationTransaction(),
-				callback));
+			getWaitlist.push_back(GetWaiter(options, callback));
 		} else {
 			/* Now that a process has been trashed we can create
 			 * the missing Group.
 			 */
 			P_DEBUG("Creating new Group");
-			GroupPtr group = createGroup(options);
+			GroupPtr group = createGroup(options.toOptions());
 			SessionPtr session = group->get(options, callback,
 				actions);
 			/* The Group is now spawning a process so the callback
@@ -164,9 +162,14 @@ Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow
 	}
 }
 
+void
+Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow, UnionStation::StopwatchLog **stopwatchLog) {
+	asyncGet(RequestOptions(options), callback, lockNow, stopwatchLog);
+}
+
 // TODO: 'ticket' should be a boost::shared_ptr for interruption-safety.
 SessionPtr
-Pool::get(const Options &options, Ticket *ticket) {
+Pool::get(const RequestOptions &options, Ticket *ticket) {
 	ticket->session.reset();
 	ticket->exception.reset();
 
@@ -191,6 +194,11 @@ Pool::get(const Options &options, Ticket *ticket) {
 	}
 }
 
+SessionPtr
+Pool::get(const Options &options, Ticket *ticket) {
+	return get(RequestOptions(options), ticket);
+}
+
 void
 Pool::setMax(unsigned int max) {
 	ScopedLock l(syncher);
@@ -227,6 +235,50 @@ Pool::setMaxIdleTime(unsigned long long value) {
 	wakeupGarbageCollector();
 }
 
+/**
+ * Configures adaptive request queue shedding. Both values are in microseconds.
+ * Setting `target` to 0 disables adaptive shedding. Requests with an explicit
+ * deadline are always shed once their deadline has passed.
+ */
+void
+Pool::setRequestQueueShedding(unsigned long long target, unsigned long long interval) {
+	LockGuard l(syncher);
+	requestQueueShedTarget   = target;
+	requestQueueShedInterval = std::max(target, interval);
+}
+
+void
+Pool::setAutoscaling(bool enabled, const AutoscalerConfig &config) {
+	LockGuard l(syncher);
+	autoscaling = enabled;
+	autoscalerConfig = config;
+	if (!enabled) {
+		GroupMap::ConstIterator g_it(groups);
+		while (*g_it != NULL) {
+			g_it.getValue()->autoscaler = AutoscalerGroupState();
+			g_it.next();
+		}
+	}
+}
+
+void
+Pool::setMemoryPressureThreshold(double percentage) {
+	LockGuard l(syncher);
+	memoryPressureThreshold = percentage;
+}
+
+void
+Pool::setRollingRestarts(bool enabled) {
+	LockGuard l(syncher);
+	rollingRestarts = enabled;
+}
+
+void
+Pool::setOobwBudget(unsigned int percentage) {
+	LockGuard l(syncher);
+	oobwBudget = percentage;
+}
+
 void
 Pool::enableSelfChecking(bool enabled) {
 	LockGuard l(syncher);
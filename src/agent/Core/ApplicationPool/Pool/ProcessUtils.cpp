@@ -73,6 +73,42 @@ Pool::findOldestIdleProcess(const Group *exclude) const {
 	return oldestIdleProcess;
 }
 
+ProcessPtr
+Pool::findIdleProcessWithMostPrivateMemory(const Group *exclude) const {
+	ProcessPtr largestIdleProcess;
+	size_t largestMemory = 0;
+
+	GroupMap::ConstIterator g_it(groups);
+	while (*g_it != NULL) {
+		const GroupPtr &group = g_it.getValue();
+		if (group.get() == exclude) {
+			g_it.next();
+			continue;
+		}
+		const ProcessList &processes = group->enabledProcesses;
+		ProcessList::const_iterator p_it, p_end = processes.end();
+		for (p_it = processes.begin(); p_it != p_end; p_it++) {
+			const ProcessPtr process = *p_it;
+			if (process->busyness() != 0 || !process->metrics.isValid()) {
+				continue;
+			}
+			size_t memory = process->metrics.realMemory();
+			if (largestIdleProcess == NULL || memory > largestMemory) {
+				largestIdleProcess = process;
+				largestMemory = memory;
+			}
+		}
+		g_it.next();
+	}
+
+	return largestIdleProcess;
+}
+
+bool
+Pool::hostHasMemoryPressureUnlocked() const {
+	return hostMemoryFree >= 0 && hostMemoryFree < memoryPressureThreshold;
+}
+
 ProcessPtr
 Pool::findBestProcessToTrash() const {
 	ProcessPtr oldestProcess;
@@ -103,7 +139,13 @@ ProcessPtr
 Pool::forceFreeCapacity(const Group *exclude,
 	boost::container::vector<Callback> &postLockActions)
 {
-	ProcessPtr process = findOldestIdleProcess(exclude);
+	ProcessPtr process;
+	if (hostHasMemoryPressureUnlocked()) {
+		process = findIdleProcessWithMostPrivateMemory(exclude);
+	}
+	if (process == NULL) {
+		process = findOldestIdleProcess(exclude);
+	}
 	if (process != NULL) {
 		P_DEBUG("Forcefully detaching process " << process->inspect() <<
 			" in order to free capacity in the pool");
@@ -99,6 +99,23 @@ Pool::inspectProcessList(const InspectOptions &options, stringstream &result,
 			distanceOfTimeInWords(process->lastUsed / 1000000).c_str());
 		result << buf << endl;
 
+		if (process->metrics.isValid() && process->metrics.sharedMemory() != -1
+		 && process->metrics.privateMemory() != -1)
+		{
+			result << "    Shared memory: " << process->metrics.sharedMemory() / 1024 << "M"
+				<< ", private memory: " << process->metrics.privateMemory() / 1024 << "M";
+			if (process->initialSharedMemory > 0) {
+				result << " (" << process->metrics.sharedMemory() * 100 / process->initialSharedMemory
+					<< "% of initially shared memory still shared)";
+			}
+			result << endl;
+		}
+
+		if (process->memoryRecyclePending && process->enabled == Process::ENABLED) {
+			result << "    Being replaced because of its memory usage..." << endl;
+		} else if (process->rollingRestartPending && process->enabled == Process::ENABLED) {
+			result << "    Being replaced by a rolling restart..." << endl;
+		}
 		if (process->enabled == Process::DISABLING) {
 			result << "    Disabling..." << endl;
 		} else if (process->enabled == Process::DISABLED) {
@@ -167,6 +184,8 @@ Pool::inspect(const InspectOptions &options, bool lock) const {
 		result << "  App root: " << group->options.appRoot << endl;
 		if (group->restarting()) {
 			result << "  (restarting...)" << endl;
+		} else if (group->rollingRestarting()) {
+			result << "  (rolling restarting...)" << endl;
 		}
 		if (group->spawning()) {
 			if (group->processesBeingSpawned == 0) {
@@ -178,6 +197,47 @@ Pool::inspect(const InspectOptions &options, bool lock) const {
 			}
 		}
 		result << "  Requests in queue: " << group->getWaitlist.size() << endl;
+		if (group->queueLatency.count > 0) {
+			result << "  Queue latency: " << group->queueLatency.inspect() << endl;
+		}
+		if (group->requestsShedByDeadline > 0 || group->requestsShedAdaptively > 0) {
+			result << "  Requests shed from queue: " << group->requestsShedByDeadline
+				<< " (deadline passed), " << group->requestsShedAdaptively
+				<< " (adaptive)" << endl;
+		}
+		if (group->spawnPhases.count > 0) {
+			result << "  Spawn time: " << group->spawnPhases.inspect()
+				<< " (average of " << group->spawnPhases.count << " "
+				<< maybePluralize(group->spawnPhases.count, "spawn", "spawns")
+				<< ")" << endl;
+		}
+		ssize_t memorySaved = group->memorySavedBySharing();
+		if (memorySaved > 0) {
+			result << "  Memory saved by sharing: " << memorySaved / 1024 << "M" << endl;
+		}
+		unsigned long long affinityRouted = group->affinityHits
+			+ group->affinityRedirects + group->affinitySpills;
+		if (affinityRouted > 0) {
+			result << "  Affinity hit rate: "
+				<< group->affinityHits * 100 / affinityRouted << "% ("
+				<< group->affinityHits << " hits, "
+				<< group->affinityRedirects << " redirected because of load, "
+				<< group->affinitySpills << " spilled to the least busy process)"
+				<< endl;
+		}
+		if (group->processesRecycledForMemory > 0) {
+			result << "  Processes replaced because of memory usage: "
+				<< group->processesRecycledForMemory << endl;
+		}
+		if (group->processesReplacedByRollingRestart > 0) {
+			result << "  Processes replaced by rolling restarts: "
+				<< group->processesReplacedByRollingRestart << endl;
+		}
+		if (group->autoscaler.limit != 0) {
+			result << "  Autoscaled process limit: " << group->autoscaler.limit
+				<< " (grown " << group->autoscaler.grown << "x, shrunk "
+				<< group->autoscaler.shrunk << "x)" << endl;
+		}
 		inspectProcessList(options, result, group.get(), group->enabledProcesses);
 		inspectProcessList(options, result, group.get(), group->disablingProcesses);
 		inspectProcessList(options, result, group.get(), group->disabledProcesses);
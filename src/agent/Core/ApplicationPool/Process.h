@@ -159,6 +159,9 @@ private:
 	 */
 	unsigned long long spawnEndTime;
 
+	/** How long each phase of spawning this process took. */
+	SpawnPhaseDurations spawnPhaseDurations;
+
 	/**
 	 * If true, then indicates that this Process does not refer to a real OS
 	 * process. The sockets in the socket list are fake and need not be deleted,
@@ -362,6 +365,10 @@ public:
 
 	/** Last time when a session was opened for this Process. */
 	unsigned long long lastUsed;
+	/** Last time when an out-of-band work request for this Process finished,
+	 * or 0 if it never performed out-of-band work. Processes that have gone
+	 * the longest without out-of-band work get to perform it first. */
+	unsigned long long lastOobwTime;
 	/** Number of sessions currently open.
 	 * @invariant session >= 0
 	 */
@@ -419,10 +426,25 @@ public:
 	/** Caches whether or not the OS process still exists. */
 	mutable bool m_osProcessExists: 1;
 	bool longRunningConnectionsAborted: 1;
+	/** Set when this process uses more memory than its group allows. It is
+	 * detached as soon as a replacement process has been attached. */
+	bool memoryRecyclePending: 1;
+	/** Set when this process belongs to the application version that is
+	 * being replaced by a rolling restart. */
+	bool rollingRestartPending: 1;
 	/** Time at which shutdown began. */
 	time_t shutdownStartTime;
 	/** Collected by Pool::collectAnalytics(). */
 	ProcessMetrics metrics;
+	/** The private memory (`metrics.realMemory()`, in KB) of this process when
+	 * its metrics were first collected, and the time at which that happened.
+	 * Used for measuring memory growth. */
+	size_t initialRealMemory;
+	unsigned long long initialMetricsTime;
+	/** The shared memory (`metrics.sharedMemory()`, in KB) of this process when
+	 * its metrics were first collected. Shows how quickly copy-on-write
+	 * sharing with the preloader breaks down. */
+	ssize_t initialSharedMemory;
 
 
 	Process(const BasicGroupInfo *groupInfo, const Json::Value &json)
@@ -436,6 +458,7 @@ public:
 		  refcount(1),
 		  index(-1),
 		  lastUsed(spawnEndTime),
+		  lastOobwTime(0),
 		  sessions(0),
 		  processed(0),
 		  lifeStatus(ALIVE),
@@ -443,10 +466,18 @@ public:
 		  oobwStatus(OOBW_NOT_ACTIVE),
 		  m_osProcessExists(true),
 		  longRunningConnectionsAborted(false),
-		  shutdownStartTime(0)
+		  memoryRecyclePending(false),
+		  rollingRestartPending(false),
+		  shutdownStartTime(0),
+		  initialRealMemory(0),
+		  initialMetricsTime(0),
+		  initialSharedMemory(-1)
 	{
 		initializeSocketsAndStringFields(json);
 		indexSessionSockets();
+		spawnPhaseDurations.fork = getJsonUint64Field(json, "spawn_fork_duration", 0);
+		spawnPhaseDurations.appLoad = getJsonUint64Field(json, "spawn_app_load_duration", 0);
+		spawnPhaseDurations.socketReady = getJsonUint64Field(json, "spawn_socket_ready_duration", 0);
 
 		const SpawningKit::Result *skResult = dynamic_cast<const SpawningKit::Result *>(&json);
 		if (skResult != NULL) {
@@ -629,6 +660,10 @@ public:
 		return spawnerCreationTime;
 	}
 
+	const SpawnPhaseDurations &getSpawnPhaseDurations() const {
+		return spawnPhaseDurations;
+	}
+
 	bool isDummy() const {
 		return dummy;
 	}
@@ -727,6 +762,40 @@ public:
 		return concurrency != 0 && sessions >= concurrency;
 	}
 
+	/**
+	 * How busy this process is, as a fraction (0..1): the higher one of the
+	 * fraction of its concurrency that is in use, and its CPU usage as last
+	 * measured by the ProcessMetricsCollector.
+	 */
+	double utilization() const {
+		double result = 0;
+		if (concurrency > 0) {
+			result = std::min(1.0, (double) sessions / concurrency);
+		}
+		if (metrics.isValid() && metrics.cpu != (boost::uint8_t) -1) {
+			result = std::max(result, std::min(1.0, metrics.cpu / 100.0));
+		}
+		return result;
+	}
+
+	/**
+	 * The average rate (in KB per hour) at which this process's private memory
+	 * has grown since its metrics were first collected, or -1 if it hasn't been
+	 * observed for at least `minObservationTime` microseconds yet.
+	 */
+	double privateMemoryGrowthRate(unsigned long long now,
+		unsigned long long minObservationTime) const
+	{
+		if (initialMetricsTime == 0 || !metrics.isValid()
+		 || now < initialMetricsTime + minObservationTime)
+		{
+			return -1;
+		} else {
+			double growth = (double) metrics.realMemory() - (double) initialRealMemory;
+			return growth * 3600000000.0 / (now - initialMetricsTime);
+		}
+	}
+
 	/**
 	 * Whether a get() request can be routed to this process, assuming that
 	 * the sticky session ID (if any) matches. This is only not the case
@@ -832,8 +901,14 @@ public:
 		stream << "<spawner_creation_time>" << spawnerCreationTime << "</spawner_creation_time>";
 		stream << "<spawn_start_time>" << spawnStartTime << "</spawn_start_time>";
 		stream << "<spawn_end_time>" << spawnEndTime << "</spawn_end_time>";
+		stream << "<spawn_phase_durations>";
+		spawnPhaseDurations.inspectXml(stream);
+		stream << "</spawn_phase_durations>";
 		stream << "<last_used>" << lastUsed << "</last_used>";
 		stream << "<last_used_desc>" << distanceOfTimeInWords(lastUsed / 1000000).c_str() << " ago</last_used_desc>";
+		if (lastOobwTime != 0) {
+			stream << "<last_oobw>" << lastOobwTime << "</last_oobw>";
+		}
 		stream << "<uptime>" << uptime() << "</uptime>";
 		if (!codeRevision.empty()) {
 			stream << "<code_revision>" << escapeForXml(codeRevision) << "</code_revision>";
@@ -875,6 +950,10 @@ public:
 			stream << "<private_dirty>" << metrics.privateDirty << "</private_dirty>";
 			stream << "<swap>" << metrics.swap << "</swap>";
 			stream << "<real_memory>" << metrics.realMemory() << "</real_memory>";
+			stream << "<shared_clean>" << metrics.sharedClean << "</shared_clean>";
+			stream << "<shared_dirty>" << metrics.sharedDirty << "</shared_dirty>";
+			stream << "<private_clean>" << metrics.privateClean << "</private_clean>";
+			stream << "<initial_shared_memory>" << initialSharedMemory << "</initial_shared_memory>";
 			stream << "<vmsize>" << metrics.vmsize << "</vmsize>";
 			stream << "<process_group_id>" << metrics.processGroupId << "</process_group_id>";
 			stream << "<command>" << escapeForXml(metrics.command) << "</command>";
@@ -0,0 +1,292 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_APPLICATION_POOL2_RESTART_FILE_WATCHER_H_
+#define _PASSENGER_APPLICATION_POOL2_RESTART_FILE_WATCHER_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <oxt/thread.hpp>
+#include <oxt/system_calls.hpp>
+#include <oxt/backtrace.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+#ifdef __linux__
+	#include <sys/inotify.h>
+#endif
+#include <Constants.h>
+#include <Logging.h>
+
+/*
+ * Watches application restart directories for changes to restart.txt and
+ * always_restart.txt, so that groups do not have to poll these files with
+ * stat() on the request path. A group subscribes to its restart directory
+ * and, when handling a request, only checks its subscription's `changed`
+ * flag. A background thread reads inotify events and sets the flags of the
+ * affected subscriptions.
+ *
+ * Watching is only supported on Linux. If a directory cannot be watched
+ * (because inotify is unavailable, the directory does not exist, or the
+ * inotify watch limit has been reached), `watch()` returns NULL, and the
+ * group keeps polling. If a watched directory is removed or moved, the
+ * subscription's `lost` flag is set, and the group goes back to polling too.
+ */
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+
+
+class RestartFileWatcher {
+public:
+	struct Subscription {
+		/** Set when restart.txt or always_restart.txt may have changed. */
+		boost::atomic<bool> changed;
+		/** Set when the directory is no longer being watched. */
+		boost::atomic<bool> lost;
+
+		Subscription()
+			: changed(false),
+			  lost(false)
+			{ }
+
+		void markChanged(bool markLost = false) {
+			if (markLost) {
+				this->lost.store(true, boost::memory_order_relaxed);
+			}
+			changed.store(true, boost::memory_order_release);
+		}
+	};
+
+	typedef boost::shared_ptr<Subscription> SubscriptionPtr;
+
+private:
+	struct Watch {
+		string dir;
+		vector<SubscriptionPtr> subscriptions;
+	};
+
+	typedef map<int, Watch> WatchMap;
+
+	boost::mutex syncher;
+	WatchMap watches;
+	int fd;
+	bool initialized;
+	oxt::thread *thread;
+
+	static bool isRestartFileName(const char *name) {
+		return strcmp(name, "restart.txt") == 0
+			|| strcmp(name, "always_restart.txt") == 0;
+	}
+
+	static void markAllChanged(Watch &watch, bool lost) {
+		vector<SubscriptionPtr>::iterator it, end = watch.subscriptions.end();
+		for (it = watch.subscriptions.begin(); it != end; it++) {
+			(*it)->markChanged(lost);
+		}
+	}
+
+	#ifdef __linux__
+		void initialize() {
+			initialized = true;
+			fd = inotify_init1(IN_CLOEXEC);
+			if (fd == -1) {
+				int e = errno;
+				P_WARN("Cannot initialize inotify: " << strerror(e) << " (errno=" << e
+					<< "); checking restart.txt by polling");
+				return;
+			}
+			thread = new oxt::thread(boost::bind(&RestartFileWatcher::threadMain, this),
+				"Restart file watcher", POOL_HELPER_THREAD_STACK_SIZE);
+		}
+
+		void threadMain() {
+			TRACE_POINT();
+			union {
+				struct inotify_event event;
+				char data[sizeof(struct inotify_event) * 64 + NAME_MAX + 1];
+			} buf;
+
+			while (true) {
+				UPDATE_TRACE_POINT();
+				ssize_t ret = oxt::syscalls::read(fd, buf.data, sizeof(buf.data));
+				if (ret == -1) {
+					int e = errno;
+					if (e == EINTR || e == EAGAIN) {
+						continue;
+					}
+					P_WARN("Cannot read from inotify: " << strerror(e) << " (errno=" << e
+						<< "); checking restart.txt by polling");
+					lostAllWatches();
+					return;
+				}
+
+				boost::lock_guard<boost::mutex> l(syncher);
+				ssize_t pos = 0;
+				while (pos < ret) {
+					const struct inotify_event *event =
+						(const struct inotify_event *) (buf.data + pos);
+					processEvent(event);
+					pos += sizeof(struct inotify_event) + event->len;
+				}
+			}
+		}
+
+		void processEvent(const struct inotify_event *event) {
+			if (event->mask & IN_Q_OVERFLOW) {
+				// Events were lost, so anything may have changed.
+				WatchMap::iterator it, end = watches.end();
+				for (it = watches.begin(); it != end; it++) {
+					markAllChanged(it->second, false);
+				}
+				return;
+			}
+
+			WatchMap::iterator it = watches.find(event->wd);
+			if (it == watches.end()) {
+				// The watch was removed by unwatch().
+				return;
+			}
+
+			if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+				P_DEBUG("Restart directory " << it->second.dir << " is no longer watched; "
+					"checking restart.txt by polling");
+				markAllChanged(it->second, true);
+				if (!(event->mask & IN_IGNORED)) {
+					inotify_rm_watch(fd, event->wd);
+				}
+				watches.erase(it);
+			} else if (event->len > 0 && isRestartFileName(event->name)) {
+				markAllChanged(it->second, false);
+			}
+		}
+
+		void lostAllWatches() {
+			boost::lock_guard<boost::mutex> l(syncher);
+			WatchMap::iterator it, end = watches.end();
+			for (it = watches.begin(); it != end; it++) {
+				markAllChanged(it->second, true);
+			}
+			watches.clear();
+			close(fd);
+			fd = -1;
+		}
+	#endif
+
+public:
+	RestartFileWatcher()
+		: fd(-1),
+		  initialized(false),
+		  thread(NULL)
+		{ }
+
+	~RestartFileWatcher() {
+		if (thread != NULL) {
+			thread->interrupt_and_join();
+			delete thread;
+		}
+		if (fd != -1) {
+			close(fd);
+		}
+	}
+
+	/**
+	 * Starts watching the given directory, and returns a subscription whose
+	 * `changed` flag is set whenever restart.txt or always_restart.txt in
+	 * that directory is created, modified, touched, moved or removed. Returns
+	 * NULL if the directory cannot be watched.
+	 */
+	SubscriptionPtr watch(const string &dir) {
+		#ifdef __linux__
+			boost::lock_guard<boost::mutex> l(syncher);
+			if (!initialized) {
+				initialize();
+			}
+			if (fd == -1) {
+				return SubscriptionPtr();
+			}
+
+			int wd = inotify_add_watch(fd, dir.c_str(), IN_CREATE | IN_ATTRIB
+				| IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE
+				| IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+			if (wd == -1) {
+				int e = errno;
+				P_DEBUG("Cannot watch restart directory " << dir << ": " << strerror(e)
+					<< " (errno=" << e << "); checking restart.txt by polling");
+				return SubscriptionPtr();
+			}
+
+			SubscriptionPtr subscription = boost::make_shared<Subscription>();
+			Watch &watch = watches[wd];
+			watch.dir = dir;
+			watch.subscriptions.push_back(subscription);
+			return subscription;
+		#else
+			return SubscriptionPtr();
+		#endif
+	}
+
+	void unwatch(const SubscriptionPtr &subscription) {
+		#ifdef __linux__
+			boost::lock_guard<boost::mutex> l(syncher);
+			WatchMap::iterator it, end = watches.end();
+			for (it = watches.begin(); it != end; it++) {
+				vector<SubscriptionPtr> &subscriptions = it->second.subscriptions;
+				vector<SubscriptionPtr>::iterator sit = std::find(subscriptions.begin(),
+					subscriptions.end(), subscription);
+				if (sit != subscriptions.end()) {
+					subscriptions.erase(sit);
+					if (subscriptions.empty()) {
+						inotify_rm_watch(fd, it->first);
+						watches.erase(it);
+					}
+					return;
+				}
+			}
+		#endif
+	}
+
+	/** The number of directories being watched. */
+	unsigned int size() {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return watches.size();
+	}
+};
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
+
+#endif /* _PASSENGER_APPLICATION_POOL2_RESTART_FILE_WATCHER_H_ */
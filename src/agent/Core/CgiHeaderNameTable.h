@@ -0,0 +1,330 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_CGI_HEADER_NAME_TABLE_H_
+#define _PASSENGER_CGI_HEADER_NAME_TABLE_H_
+
+#include <boost/cstdint.hpp>
+#include <cstring>
+#include <cassert>
+#include <oxt/macros.hpp>
+#include <MemoryKit/palloc.h>
+#include <DataStructures/LString.h>
+#include <DataStructures/HashedStaticString.h>
+#include <ServerKit/HeaderTable.h>
+#include <StaticString.h>
+
+namespace Passenger {
+namespace Core {
+
+using namespace std;
+
+
+/**
+ * A buffer for constructing a session protocol header in a single pass. It
+ * starts out in a caller-provided memory area (typically an mbuf), and
+ * moves to a larger buffer allocated from a palloc pool when it runs out
+ * of space.
+ */
+class SessionProtocolBuffer {
+private:
+	psg_pool_t *pool;
+	char *m_start;
+	char *m_pos;
+	char *m_end;
+	bool m_grown;
+
+	void grow(size_t needed) {
+		size_t used = m_pos - m_start;
+		size_t capacity = (m_end - m_start) * 2;
+		if (capacity < used + needed) {
+			capacity = used + needed;
+		}
+
+		char *newStart = (char *) psg_pnalloc(pool, capacity);
+		memcpy(newStart, m_start, used);
+		m_start = newStart;
+		m_pos = newStart + used;
+		m_end = newStart + capacity;
+		m_grown = true;
+	}
+
+public:
+	SessionProtocolBuffer(psg_pool_t *_pool, char *initialBuffer, size_t initialSize)
+		: pool(_pool),
+		  m_start(initialBuffer),
+		  m_pos(initialBuffer),
+		  m_end(initialBuffer + initialSize),
+		  m_grown(false)
+		{ }
+
+	OXT_FORCE_INLINE
+	void append(const char *data, size_t size) {
+		if (OXT_UNLIKELY(size_t(m_end - m_pos) < size)) {
+			grow(size);
+		}
+		memcpy(m_pos, data, size);
+		m_pos += size;
+	}
+
+	void append(const StaticString &data) {
+		append(data.data(), data.size());
+	}
+
+	void append(const LString *str) {
+		const LString::Part *part = str->start;
+		while (part != NULL) {
+			append(part->data, part->size);
+			part = part->next;
+		}
+	}
+
+	/**
+	 * Returns a pointer to `size` bytes at the end of the buffer, which the
+	 * caller must fill. The pointer is invalidated by the next append.
+	 */
+	char *appendUninitialized(size_t size) {
+		if (size_t(m_end - m_pos) < size) {
+			grow(size);
+		}
+		char *result = m_pos;
+		m_pos += size;
+		return result;
+	}
+
+	char *start() const {
+		return m_start;
+	}
+
+	size_t size() const {
+		return m_pos - m_start;
+	}
+
+	/** Whether the data has moved out of the initial buffer. */
+	bool grown() const {
+		return m_grown;
+	}
+};
+
+
+inline bool
+isCgiHeaderNameChar(char ch) {
+	return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z')
+		|| (ch >= 'A' && ch <= 'Z') || ch == '-';
+}
+
+/**
+ * For CGI, alphanum headers with optional dashes are mapped to UPP3R_CAS3. This
+ * function can be used to reject non-alphanum/dash headers that would end up with
+ * the same mapping (e.g. upp3r_cas3 and upp3r-cas3 would end up the same, and
+ * potentially collide each other in the receiving application). This is
+ * used to fix CVE-2015-7519.
+ */
+inline bool
+containsNonAlphaNumDash(const LString &s) {
+	const LString::Part *part = s.start;
+	while (part != NULL) {
+		for (unsigned int i = 0; i < part->size; i++) {
+			if (!isCgiHeaderNameChar(part->data[i])) {
+				return true;
+			}
+		}
+		part = part->next;
+	}
+	return false;
+}
+
+/**
+ * Converts a lower case header name that passed `containsNonAlphaNumDash()`
+ * to CGI form, without the "HTTP_" prefix: upper case, with dashes replaced
+ * by underscores.
+ */
+inline void
+httpHeaderToScgiUpperCase(char *data, unsigned int size) {
+	for (unsigned int i = 0; i < size; i++) {
+		char ch = data[i];
+		if (ch >= 'a' && ch <= 'z') {
+			data[i] = ch - ('a' - 'A');
+		} else if (ch == '-') {
+			data[i] = '_';
+		}
+	}
+}
+
+
+/**
+ * Maps the names of common request headers to their CGI form
+ * ("HTTP_ACCEPT_ENCODING"), which is computed once, when the table is
+ * created, instead of for every request. Lookups use the hash that
+ * HttpHeaderParser already computed for each header.
+ *
+ * The table also knows which headers are never passed as HTTP_* variables
+ * because the session protocol passes them in another way.
+ */
+class CgiHeaderNameTable {
+public:
+	struct Entry {
+		StaticString name;
+		boost::uint32_t hash;
+		/** "HTTP_NAME" including the terminating NUL. Empty if the header
+		 * must not be passed as an HTTP_* variable. */
+		StaticString cgiName;
+	};
+
+private:
+	static const unsigned int INDEX_SIZE = 256;
+	static const unsigned int MAX_ENTRIES = 128;
+
+	Entry entries[MAX_ENTRIES];
+	/** Open addressing hash table of entry numbers plus one, indexed by
+	 * the low bits of the header hash. 0 means empty. */
+	boost::uint8_t index[INDEX_SIZE];
+	unsigned int nentries;
+	psg_pool_t *pool;
+
+	void add(const char *name, bool skip) {
+		assert(nentries < MAX_ENTRIES);
+		unsigned int size = strlen(name);
+		Entry &entry = entries[nentries];
+		entry.name = StaticString(name, size);
+		entry.hash = HashedStaticString(name, size).hash();
+
+		if (!skip) {
+			char *cgiName = (char *) psg_pnalloc(pool, sizeof("HTTP_") - 1 + size + 1);
+			memcpy(cgiName, "HTTP_", sizeof("HTTP_") - 1);
+			memcpy(cgiName + sizeof("HTTP_") - 1, name, size);
+			httpHeaderToScgiUpperCase(cgiName + sizeof("HTTP_") - 1, size);
+			cgiName[sizeof("HTTP_") - 1 + size] = '\0';
+			entry.cgiName = StaticString(cgiName, sizeof("HTTP_") - 1 + size + 1);
+		}
+
+		unsigned int i = entry.hash & (INDEX_SIZE - 1);
+		while (index[i] != 0) {
+			i = (i + 1) & (INDEX_SIZE - 1);
+		}
+		nentries++;
+		index[i] = nentries;
+	}
+
+public:
+	CgiHeaderNameTable()
+		: nentries(0),
+		  pool(psg_create_pool(1024 * 4))
+	{
+		static const char * const commonHeaders[] = {
+			"accept", "accept-charset", "accept-encoding", "accept-language",
+			"access-control-request-headers", "access-control-request-method",
+			"authorization", "cache-control", "cookie", "date", "dnt", "expect",
+			"forwarded", "from", "host", "if-match", "if-modified-since",
+			"if-none-match", "if-range", "if-unmodified-since", "keep-alive",
+			"max-forwards", "origin", "pragma", "proxy-authorization", "range",
+			"referer", "save-data", "te", "transfer-encoding", "upgrade",
+			"upgrade-insecure-requests", "user-agent", "via", "warning",
+			"x-csrf-token", "x-forwarded-for", "x-forwarded-host",
+			"x-forwarded-port", "x-forwarded-proto", "x-forwarded-ssl",
+			"x-http-method-override", "x-real-ip", "x-request-id",
+			"x-request-start", "x-requested-with", "x-sendfile-type",
+			"x-accel-mapping"
+		};
+		// These are passed as CONTENT_LENGTH and CONTENT_TYPE, and
+		// HTTP_CONNECTION is set by the Core itself for upgraded requests.
+		static const char * const skippedHeaders[] = {
+			"content-length", "content-type", "connection"
+		};
+
+		memset(index, 0, sizeof(index));
+		for (unsigned int i = 0; i < sizeof(commonHeaders) / sizeof(const char *); i++) {
+			add(commonHeaders[i], false);
+		}
+		for (unsigned int i = 0; i < sizeof(skippedHeaders) / sizeof(const char *); i++) {
+			add(skippedHeaders[i], true);
+		}
+	}
+
+	~CgiHeaderNameTable() {
+		psg_destroy_pool(pool);
+	}
+
+	/** Returns NULL if the header is not in the table. */
+	const Entry *lookup(const ServerKit::Header *header) const {
+		unsigned int i = header->hash & (INDEX_SIZE - 1);
+		while (index[i] != 0) {
+			const Entry *entry = &entries[index[i] - 1];
+			if (entry->hash == header->hash
+			 && psg_lstr_cmp(&header->key, entry->name))
+			{
+				return entry;
+			}
+			i = (i + 1) & (INDEX_SIZE - 1);
+		}
+		return NULL;
+	}
+
+	/**
+	 * Appends the given headers to `buffer` in session protocol form:
+	 * "HTTP_NAME\0value\0" for each header. Headers that are not in the
+	 * table are converted at runtime; those with characters other than
+	 * alphanumerics and dashes are skipped.
+	 */
+	void serialize(const ServerKit::HeaderTable &headers, SessionProtocolBuffer &buffer) const {
+		ServerKit::HeaderTable::ConstIterator it(headers);
+		while (*it != NULL) {
+			const ServerKit::Header *header = it->header;
+			const Entry *entry = lookup(header);
+
+			if (entry != NULL) {
+				if (entry->cgiName.empty()) {
+					it.next();
+					continue;
+				}
+				buffer.append(entry->cgiName);
+			} else {
+				if (containsNonAlphaNumDash(header->key)) {
+					it.next();
+					continue;
+				}
+				buffer.append(P_STATIC_STRING("HTTP_"));
+				const LString::Part *part = header->key.start;
+				while (part != NULL) {
+					char *pos = buffer.appendUninitialized(part->size);
+					memcpy(pos, part->data, part->size);
+					httpHeaderToScgiUpperCase(pos, part->size);
+					part = part->next;
+				}
+				buffer.append("", 1);
+			}
+
+			buffer.append(&header->val);
+			buffer.append("", 1);
+			it.next();
+		}
+	}
+};
+
+
+} // namespace Core
+} // namespace Passenger
+
+#endif /* _PASSENGER_CGI_HEADER_NAME_TABLE_H_ */
@@ -78,10 +78,12 @@
 #include <Utils/HttpConstants.h>
 #include <Utils/VariantMap.h>
 #include <Utils/Timer.h>
+#include <Utils/Hasher.h>
 #include <Core/ApplicationPool/ErrorRenderer.h>
 #include <Core/Controller/Client.h>
 #include <Core/Controller/AppResponse.h>
 #include <Core/Controller/TurboCaching.h>
+#include <Core/CgiHeaderNameTable.h>
 #include <Core/UnionStation/Context.h>
 
 namespace Passenger {
@@ -125,15 +127,26 @@ private:
 
 	unsigned int statThrottleRate;
 	unsigned int responseBufferHighWatermark;
+	/**
+	 * The number of times that `maybeThrottleAppSource()` throttled an
+	 * application socket, by reason.
+	 */
+	unsigned int highWatermarkThrottles;
+	unsigned int diskBufferThrottles;
+	unsigned int fairShareThrottles;
+	unsigned int pipelineThrottles;
 	BenchmarkMode benchmarkMode: 3;
 	bool singleAppMode: 1;
 	bool showVersionInHeader: 1;
 	bool stickySessions: 1;
 	bool gracefulExit: 1;
+	bool spliceTunneling: 1;
+	/** The number of upgraded connections that were handed over to a SpliceTunnel. */
+	unsigned int spliceTunnels;
 
 	const VariantMap *agentsOptions;
 	psg_pool_t *stringPool;
-	StringKeyTable< boost::shared_ptr<Options> > poolOptionsCache;
+	StringKeyTable<ConstOptionsPtr> poolOptionsCache;
 
 	StaticString defaultRuby;
 	StaticString ustRouterAddress;
@@ -149,8 +162,12 @@ private:
 	HashedStaticString PASSENGER_APP_GROUP_NAME;
 	HashedStaticString PASSENGER_ENV_VARS;
 	HashedStaticString PASSENGER_MAX_REQUESTS;
+	HashedStaticString PASSENGER_MAX_REQUEST_QUEUE_TIME;
+	HashedStaticString PASSENGER_REQUEST_PRIORITY;
 	HashedStaticString PASSENGER_STICKY_SESSIONS;
 	HashedStaticString PASSENGER_STICKY_SESSIONS_COOKIE_NAME;
+	HashedStaticString PASSENGER_AFFINITY_HEADER;
+	HashedStaticString PASSENGER_AFFINITY_PATH_SEGMENTS;
 	HashedStaticString PASSENGER_REQUEST_OOB_WORK;
 	HashedStaticString UNION_STATION_SUPPORT;
 	HashedStaticString REMOTE_ADDR;
@@ -174,6 +191,7 @@ private:
 	friend class ResponseCache<Request>;
 	struct ev_check checkWatcher;
 	TurboCaching<Request> turboCaching;
+	CgiHeaderNameTable cgiHeaderNameTable;
 
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		struct ev_prepare prepareWatcher;
@@ -208,6 +226,7 @@ private:
 	void initializeUnionStation(Client *client, Request *req, RequestAnalysis &analysis);
 	void setStickySessionId(Client *client, Request *req);
 	const LString *getStickySessionCookieName(Request *req);
+	void setAffinityKey(Client *client, Request *req);
 
 
 	/****** Stage: buffering body ******/
@@ -231,8 +250,11 @@ private:
 	static void checkoutSessionLater(Request *req);
 	void reportSessionCheckoutError(Client *client, Request *req,
 		const ExceptionPtr &e);
+	int getRequestQueueOverflowStatusCode(Request *req);
 	void writeRequestQueueFullExceptionErrorResponse(Client *client,
 		Request *req, const boost::shared_ptr<RequestQueueFullException> &e);
+	void writeRequestQueueTimeoutExceptionErrorResponse(Client *client,
+		Request *req, const boost::shared_ptr<RequestQueueTimeoutException> &e);
 	void writeSpawnExceptionErrorResponse(Client *client, Request *req,
 		const boost::shared_ptr<SpawnException> &e);
 	void writeOtherExceptionErrorResponse(Client *client, Request *req,
@@ -250,10 +272,10 @@ private:
 	void sendHeaderToApp(Client *client, Request *req);
 	void sendHeaderToAppWithSessionProtocol(Client *client, Request *req);
 	static void sendBodyToAppWhenAppSinkIdle(Channel *_channel, unsigned int size);
-	unsigned int determineHeaderSizeForSessionProtocol(Request *req,
-		SessionProtocolWorkingState &state, string delta_monotonic);
-	bool constructHeaderForSessionProtocol(Request *req, char * restrict buffer,
-		unsigned int &size, const SessionProtocolWorkingState &state, string delta_monotonic);
+	void prepareSessionProtocolWorkingState(Request *req,
+		SessionProtocolWorkingState &state);
+	void constructHeaderForSessionProtocol(Request *req, SessionProtocolBuffer &buffer,
+		const SessionProtocolWorkingState &state, string delta_monotonic);
 	void sendHeaderToAppWithHttpProtocol(Client *client, Request *req);
 	bool constructHeaderBuffersForHttpProtocol(Request *req, struct iovec *buffers,
 		unsigned int maxbuffers, unsigned int & restrict_ref nbuffers,
@@ -316,6 +338,14 @@ private:
 	OXT_FORCE_INLINE void keepAliveAppConnection(Client *client, Request *req);
 	void storeAppResponseInTurboCache(Client *client, Request *req);
 	void finalizeUnionStationWithSuccess(Client *client, Request *req);
+	void maybeStartSpliceTunnel(Client *client, Request *req);
+	static void onSpliceTunnelEvent(ServerKit::SpliceTunnel *tunnel,
+		ServerKit::SpliceTunnel::Direction direction,
+		ServerKit::SpliceTunnel::Event event, int errcode);
+	void onSpliceTunnelRequestEnd(Client *client, Request *req,
+		ServerKit::SpliceTunnel::Event event, int errcode);
+	void onSpliceTunnelResponseEnd(Client *client, Request *req,
+		ServerKit::SpliceTunnel::Event event, int errcode);
 
 
 	/***** Hooks ******/
@@ -379,6 +409,7 @@ protected:
 	virtual Channel::Result onRequestBody(Client *client, Request *req,
 		const MemoryKit::mbuf &buffer, int errcode);
 	virtual void onNextRequestEarlyReadError(Client *client, Request *req, int errcode);
+	virtual void onRequestOutputUnblocked(Client *client, Request *req);
 	virtual bool shouldDisconnectClientOnShutdown(Client *client);
 	virtual bool supportsUpgrade(Client *client, Request *req);
 
@@ -393,6 +424,11 @@ public:
 	ResourceLocator *resourceLocator;
 	PoolPtr appPool;
 	UnionStation::ContextPtr unionStationContext;
+	/**
+	 * Accounts the response data buffered by all clients, possibly
+	 * shared with other Controllers. May be NULL.
+	 */
+	ServerKit::FileBufferedChannelAccount *responseBufferAccount;
 
 
 	/****** Initialization and shutdown ******/
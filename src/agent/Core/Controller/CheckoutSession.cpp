@@ -49,10 +49,10 @@ using namespace boost;
 void
 Controller::checkoutSession(Client *client, Request *req) {
 	GetCallback callback;
-	Options &options = req->options;
+	RequestOptions &options = req->options;
 
 	CC_BENCHMARK_POINT(client, req, BM_BEFORE_CHECKOUT);
-	SKC_TRACE(client, 2, "Checking out session: appRoot=" << options.appRoot);
+	SKC_TRACE(client, 2, "Checking out session: appRoot=" << options.getGroupOptions().appRoot);
 	req->state = Request::CHECKING_OUT_SESSION;
 
 	if (req->requestBodyBuffering) {
@@ -66,6 +66,19 @@ Controller::checkoutSession(Client *client, Request *req) {
 
 	options.currentTime = SystemTime::getUsec();
 
+	// The web server may limit how long this request may wait in the request
+	// queue (in milliseconds). After that the client has most likely given up,
+	// so the pool sheds the request instead of assigning it a session.
+	const LString *maxQueueTime = req->secureHeaders.lookup(PASSENGER_MAX_REQUEST_QUEUE_TIME);
+	if (maxQueueTime != NULL && maxQueueTime->size > 0) {
+		maxQueueTime = psg_lstr_make_contiguous(maxQueueTime, req->pool);
+		unsigned long long msec = stringToULL(StaticString(maxQueueTime->start->data,
+			maxQueueTime->size));
+		if (msec > 0) {
+			options.deadline = options.currentTime + msec * 1000;
+		}
+	}
+
 	refRequest(req, __FILE__, __LINE__);
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		req->timeBeforeAccessingApplicationPool = ev_now(getLoop());
@@ -166,7 +179,7 @@ Controller::maybeSend100Continue(Client *client, Request *req) {
 			char *buf = (char *) psg_pnalloc(req->pool, BUFSIZE);
 			int size = snprintf(buf, BUFSIZE, "HTTP/%d.%d 100 Continue\r\n",
 				(int) req->httpMajor, (int) req->httpMinor);
-			writeResponse(client, buf, size);
+			writeResponse(client, req, buf, size);
 			if (!req->ended()) {
 				// Allow sending more response headers.
 				req->responseBegun = false;
@@ -241,6 +254,14 @@ Controller::reportSessionCheckoutError(Client *client, Request *req,
 			return;
 		}
 	}
+	{
+		boost::shared_ptr<RequestQueueTimeoutException> e2 =
+			dynamic_pointer_cast<RequestQueueTimeoutException>(e);
+		if (e2 != NULL) {
+			writeRequestQueueTimeoutExceptionErrorResponse(client, req, e2);
+			return;
+		}
+	}
 	{
 		boost::shared_ptr<SpawnException> e2 = dynamic_pointer_cast<SpawnException>(e);
 		if (e2 != NULL) {
@@ -251,19 +272,24 @@ Controller::reportSessionCheckoutError(Client *client, Request *req,
 	writeOtherExceptionErrorResponse(client, req, e);
 }
 
-void
-Controller::writeRequestQueueFullExceptionErrorResponse(Client *client, Request *req,
-	const boost::shared_ptr<RequestQueueFullException> &e)
-{
-	TRACE_POINT();
+int
+Controller::getRequestQueueOverflowStatusCode(Request *req) {
 	const LString *value = req->secureHeaders.lookup(
 		"!~PASSENGER_REQUEST_QUEUE_OVERFLOW_STATUS_CODE");
-	int requestQueueOverflowStatusCode = 503;
 	if (value != NULL && value->size > 0) {
 		value = psg_lstr_make_contiguous(value, req->pool);
-		requestQueueOverflowStatusCode = stringToInt(
-			StaticString(value->start->data, value->size));
+		return stringToInt(StaticString(value->start->data, value->size));
+	} else {
+		return 503;
 	}
+}
+
+void
+Controller::writeRequestQueueFullExceptionErrorResponse(Client *client, Request *req,
+	const boost::shared_ptr<RequestQueueFullException> &e)
+{
+	TRACE_POINT();
+	int requestQueueOverflowStatusCode = getRequestQueueOverflowStatusCode(req);
 
 	SKC_WARN(client, "Returning HTTP " << requestQueueOverflowStatusCode <<
 		" due to: " << e->what());
@@ -275,6 +301,23 @@ Controller::writeRequestQueueFullExceptionErrorResponse(Client *client, Request
 		requestQueueOverflowStatusCode);
 }
 
+void
+Controller::writeRequestQueueTimeoutExceptionErrorResponse(Client *client, Request *req,
+	const boost::shared_ptr<RequestQueueTimeoutException> &e)
+{
+	TRACE_POINT();
+	int requestQueueOverflowStatusCode = getRequestQueueOverflowStatusCode(req);
+
+	SKC_WARN(client, "Returning HTTP " << requestQueueOverflowStatusCode <<
+		" due to: " << e->what());
+
+	endRequestWithSimpleResponse(&client, &req,
+		"<h2>This website is under heavy load (request timed out in queue)</h2>"
+		"<p>We're sorry, too many people are accessing this website at the same "
+		"time. We're working on this problem. Please try again later.</p>",
+		requestQueueOverflowStatusCode);
+}
+
 void
 Controller::writeSpawnExceptionErrorResponse(Client *client, Request *req,
 	const boost::shared_ptr<SpawnException> &e)
@@ -354,7 +397,7 @@ Controller::endRequestWithErrorResponse(Client **c, Request **r, const StaticStr
 
 	if (friendlyErrorPagesEnabled(req)) {
 		try {
-			data = renderer.renderWithDetails(message, req->options, e);
+			data = renderer.renderWithDetails(message, req->options.getGroupOptions(), e);
 		} catch (const SystemException &e2) {
 			SKC_ERROR(client, "Cannot render an error page: " << e2.what() <<
 				"\n" << e2.backtrace());
@@ -378,7 +421,7 @@ Controller::friendlyErrorPagesEnabled(Request *req) {
 	bool defaultValue;
 	string defaultStr = agentsOptions->get("friendly_error_pages");
 	if (defaultStr == "auto") {
-		defaultValue = (req->options.environment == "development");
+		defaultValue = (req->options.getGroupOptions().environment == "development");
 	} else {
 		defaultValue = defaultStr == "true";
 	}
@@ -111,6 +111,9 @@ Controller::onAppSourceData(Client *client, Request *req, const MemoryKit::mbuf
 				SKC_TRACE(client, 2, "Application upgraded connection");
 				req->wantKeepAlive = false;
 				onAppResponseBegin(client, req);
+				if (ret == buffer.size()) {
+					maybeStartSpliceTunnel(client, req);
+				}
 				return Channel::Result(ret, false);
 			case AppResponse::ONEHUNDRED_CONTINUE:
 				SKC_TRACE(client, 2, "Application sent 100-Continue status");
@@ -241,7 +244,7 @@ Controller::onAppSourceData(Client *client, Request *req, const MemoryKit::mbuf
 				case ServerKit::HttpChunkedEvent::NONE:
 				case ServerKit::HttpChunkedEvent::DATA:
 					assert(!event.end);
-					writeResponse(client, MemoryKit::mbuf(buffer, 0, event.consumed));
+					writeResponse(client, req, MemoryKit::mbuf(buffer, 0, event.consumed));
 					markResponsePartForTurboCaching(client, req, event.data);
 					maybeThrottleAppSource(client, req);
 					return Channel::Result(event.consumed, false);
@@ -250,7 +253,7 @@ Controller::onAppSourceData(Client *client, Request *req, const MemoryKit::mbuf
 					SKC_TRACE(client, 2, "End of application response body reached");
 					resp->aux.bodyInfo.endReached = true;
 					handleAppResponseBodyEnd(client, req);
-					writeResponse(client, MemoryKit::mbuf(buffer, 0, event.consumed));
+					writeResponse(client, req, MemoryKit::mbuf(buffer, 0, event.consumed));
 					if (!req->ended()) {
 						endRequest(&client, &req);
 					}
@@ -290,6 +293,9 @@ Controller::onAppSourceData(Client *client, Request *req, const MemoryKit::mbuf
 			resp->bodyAlreadyRead += buffer.size();
 			writeResponseAndMarkForTurboCaching(client, req, buffer);
 			maybeThrottleAppSource(client, req);
+			if (resp->httpState == AppResponse::UPGRADED) {
+				maybeStartSpliceTunnel(client, req);
+			}
 			return Channel::Result(buffer.size(), false);
 		} else if (errcode == 0 || errcode == ECONNRESET) {
 			// EOF
@@ -438,7 +444,7 @@ Controller::onAppResponse100Continue(Client *client, Request *req) {
 		char *buf = (char *) psg_pnalloc(req->pool, BUFSIZE);
 		int size = snprintf(buf, BUFSIZE, "HTTP/%d.%d 100 Continue\r\n",
 			(int) req->httpMajor, (int) req->httpMinor);
-		writeResponse(client, buf, size);
+		writeResponse(client, req, buf, size);
 	}
 	if (!req->ended()) {
 		UPDATE_TRACE_POINT();
@@ -712,7 +718,7 @@ Controller::constructHeaderBuffersForResponse(Request *req, struct iovec *buffer
 	}
 
 	if (req->stickySession) {
-		StaticString baseURI = req->options.baseURI;
+		StaticString baseURI = req->options.getGroupOptions().baseURI;
 		if (baseURI.empty()) {
 			baseURI = P_STATIC_STRING("/");
 		}
@@ -813,6 +819,13 @@ Controller::sendResponseHeaderWithWritev(Client *client, Request *req,
 		return true;
 	}
 
+	if (OXT_UNLIKELY(getOutputRequest(client) != req || !client->output.isFlushed())) {
+		// Writing directly to the socket would overtake the response data
+		// of earlier pipelined requests.
+		bytesWritten = 0;
+		return false;
+	}
+
 	unsigned int maxbuffers = std::min<unsigned int>(
 		8 + req->appResponse.headers.size() * 4 + 11, IOV_MAX);
 	struct iovec *buffers = (struct iovec *) psg_palloc(req->pool,
@@ -873,13 +886,13 @@ Controller::sendResponseHeaderWithBuffering(Client *client, Request *req,
 		MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&mbuf_pool));
 		gatherBuffers(buffer.start, MBUF_MAX_SIZE, buffers, nbuffers);
 		buffer = MemoryKit::mbuf(buffer, offset, dataSize - offset);
-		writeResponse(client, buffer);
+		writeResponse(client, req, buffer);
 	} else {
 		UPDATE_TRACE_POINT();
 		SKC_TRACE(client, 2, "Sending response headers using a psg_pool buffer");
 		char *buffer = (char *) psg_pnalloc(req->pool, dataSize);
 		gatherBuffers(buffer, dataSize, buffers, nbuffers);
-		writeResponse(client, buffer + offset, dataSize - offset);
+		writeResponse(client, req, buffer + offset, dataSize - offset);
 	}
 }
 
@@ -984,7 +997,7 @@ Controller::writeResponseAndMarkForTurboCaching(Client *client, Request *req,
 	const MemoryKit::mbuf &buffer)
 {
 	if (OXT_LIKELY(benchmarkMode != BM_RESPONSE_BEGIN)) {
-		writeResponse(client, buffer);
+		writeResponse(client, req, buffer);
 	}
 	markResponsePartForTurboCaching(client, req, buffer);
 }
@@ -1012,7 +1025,22 @@ Controller::markResponsePartForTurboCaching(Client *client, Request *req,
 
 void
 Controller::maybeThrottleAppSource(Client *client, Request *req) {
-	if (!req->ended()) {
+	if (OXT_UNLIKELY(getOutputRequest(client) != req)) {
+		// The response data is held back in memory until the responses to
+		// earlier pipelined requests have been written, so bound it to what
+		// the output channel would buffer in memory.
+		if (!req->ended()
+		 && !req->appSourceHeldBack
+		 && req->heldBackOutputSize >= getContext()->defaultFileBufferedChannelConfig.threshold)
+		{
+			SKC_TRACE(client, 2, "Responses to earlier pipelined requests are still being "
+				"written, and this request's held back response data has reached " <<
+				req->heldBackOutputSize << " bytes. Throttling application socket");
+			req->appSourceHeldBack = true;
+			req->appSource.stop();
+			pipelineThrottles++;
+		}
+	} else if (!req->ended()) {
 		assert(client->output.getBuffersFlushedCallback() == NULL);
 		assert(client->output.getDataFlushedCallback() == getClientOutputDataFlushedCallback());
 		if (responseBufferHighWatermark > 0
@@ -1022,12 +1050,26 @@ Controller::maybeThrottleAppSource(Client *client, Request *req) {
 				"can keep up with. Throttling application socket");
 			client->output.setDataFlushedCallback(_outputDataFlushed);
 			req->appSource.stop();
+			highWatermarkThrottles++;
+		} else if (responseBufferAccount != NULL
+		 && responseBufferAccount->isUnderPressure()
+		 && client->output.getTotalBytesBuffered() >= responseBufferAccount->getFairShare())
+		{
+			// The heaviest clients are the first to exceed their fair share,
+			// so they are throttled first while lighter clients keep flowing.
+			SKC_TRACE(client, 2, "The global response buffer limit has been reached, and this "
+				"client buffers more than its fair share (currently buffered " <<
+				client->output.getTotalBytesBuffered() << " bytes). Throttling application socket");
+			client->output.setDataFlushedCallback(_outputDataFlushed);
+			req->appSource.stop();
+			fairShareThrottles++;
 		} else if (client->output.passedThreshold()) {
 			SKC_TRACE(client, 2, "Application is sending response data quicker than the on-disk "
 				"buffer can keep up with (currently buffered " << client->output.getBytesBuffered() <<
 				" bytes). Throttling application socket");
 			client->output.setBuffersFlushedCallback(_outputBuffersFlushed);
 			req->appSource.stop();
+			diskBufferThrottles++;
 		}
 	}
 }
@@ -1037,8 +1079,8 @@ Controller::_outputBuffersFlushed(FileBufferedChannel *_channel) {
 	FileBufferedFdSinkChannel *channel = reinterpret_cast<FileBufferedFdSinkChannel *>(_channel);
 	Client *client = static_cast<Client *>(static_cast<
 		ServerKit::BaseClient *>(channel->getHooks()->userData));
-	Request *req = static_cast<Request *>(client->currentRequest);
 	Controller *self = static_cast<Controller *>(getServerFromClient(client));
+	Request *req = self->getOutputRequest(client);
 	if (client->connected() && req != NULL) {
 		self->outputBuffersFlushed(client, req);
 	}
@@ -1059,8 +1101,8 @@ Controller::_outputDataFlushed(FileBufferedChannel *_channel) {
 	FileBufferedFdSinkChannel *channel = reinterpret_cast<FileBufferedFdSinkChannel *>(_channel);
 	Client *client = static_cast<Client *>(static_cast<
 		ServerKit::BaseClient *>(channel->getHooks()->userData));
-	Request *req = static_cast<Request *>(client->currentRequest);
 	Controller *self = static_cast<Controller *>(getServerFromClient(client));
+	Request *req = self->getOutputRequest(client);
 
 	getClientOutputDataFlushedCallback()(_channel);
 	if (client->connected() && req != NULL) {
@@ -1151,6 +1193,144 @@ Controller::finalizeUnionStationWithSuccess(Client *client, Request *req) {
 	req->endStopwatchLog(&req->stopwatchLogs.requestProcessing, true);
 }
 
+/**
+ * Hands an upgraded connection over to a SpliceTunnel, so that from now on
+ * its data is relayed by the kernel instead of through the channels. This is
+ * only possible once no data is buffered in either direction, so this is
+ * retried every time the application sends data. Must be called from the
+ * appSource data callback, after the entire buffer has been consumed.
+ */
+void
+Controller::maybeStartSpliceTunnel(Client *client, Request *req) {
+	if (!spliceTunneling
+	 || !ServerKit::SpliceTunnel::isSupported()
+	 || req->spliceTunnel != NULL
+	 || req->ended()
+	 || !req->upgraded()
+	 || req->state != Request::FORWARDING_BODY_TO_APP
+	 || req->requestBodyBuffering
+	 || !req->cacheKey.empty())
+	{
+		return;
+	}
+
+	// Make sure that neither channel path holds data that hasn't been
+	// written yet, and that the app socket isn't being throttled.
+	if (req->appSource.hasPendingBuffers()
+	 || !req->appSource.isStarted()
+	 || client->input.getState() != Channel::IDLE
+	 || client->input.hasPendingBuffers()
+	 || !req->bodyChannel.acceptingInput()
+	 || !req->appSink.acceptingInput()
+	 || client->output.getState() != Channel::IDLE
+	 || !client->output.isFlushed()
+	 || client->output.getBuffersFlushedCallback() != NULL
+	 || client->output.getDataFlushedCallback() != getClientOutputDataFlushedCallback())
+	{
+		return;
+	}
+
+	TRACE_POINT();
+	ServerKit::SpliceTunnel *tunnel = new ServerKit::SpliceTunnel(getContext(),
+		&req->hooks, onSpliceTunnelEvent);
+	if (!tunnel->initialize(client->getFd(), req->session->fd())) {
+		int e = errno;
+		delete tunnel;
+		SKC_DEBUG(client, "Cannot create splice tunnel, relaying upgraded "
+			"connection through channels: " << ServerKit::getErrorDesc(e) <<
+			" (errno=" << e << ")");
+		return;
+	}
+
+	SKC_TRACE(client, 2, "Relaying upgraded connection with splice()");
+	client->input.stop();
+	req->appSource.stop();
+	req->spliceTunnel = tunnel;
+	spliceTunnels++;
+	tunnel->start();
+}
+
+void
+Controller::onSpliceTunnelEvent(ServerKit::SpliceTunnel *tunnel,
+	ServerKit::SpliceTunnel::Direction direction,
+	ServerKit::SpliceTunnel::Event event, int errcode)
+{
+	Request *req = static_cast<Request *>(static_cast<
+		ServerKit::BaseHttpRequest *>(tunnel->getHooks()->userData));
+	Client *client = static_cast<Client *>(req->client);
+	Controller *self = static_cast<Controller *>(getServerFromClient(client));
+	SKC_LOG_EVENT_FROM_STATIC(self, Controller, client, "onSpliceTunnelEvent");
+
+	if (direction == ServerKit::SpliceTunnel::CLIENT_TO_PEER) {
+		self->onSpliceTunnelRequestEnd(client, req, event, errcode);
+	} else {
+		self->onSpliceTunnelResponseEnd(client, req, event, errcode);
+	}
+}
+
+void
+Controller::onSpliceTunnelRequestEnd(Client *client, Request *req,
+	ServerKit::SpliceTunnel::Event event, int errcode)
+{
+	TRACE_POINT();
+	req->bodyAlreadyRead += req->spliceTunnel->getBytesTransferred(
+		ServerKit::SpliceTunnel::CLIENT_TO_PEER);
+
+	switch (event) {
+	case ServerKit::SpliceTunnel::END_OF_STREAM:
+		SKC_TRACE(client, 2, "End of request body encountered");
+		req->state = Request::WAITING_FOR_APP_OUTPUT;
+		maybeHalfCloseAppSinkBecauseRequestBodyEndReached(client, req);
+		break;
+	case ServerKit::SpliceTunnel::READ_ERROR: {
+		const unsigned int BUFSIZE = 1024;
+		char *message = (char *) psg_pnalloc(req->pool, BUFSIZE);
+		int size = snprintf(message, BUFSIZE,
+			"error reading request body: %s (errno=%d)",
+			ServerKit::getErrorDesc(errcode), errcode);
+		disconnectWithError(&client, StaticString(message, size));
+		break;
+	}
+	case ServerKit::SpliceTunnel::WRITE_ERROR:
+		// Like whenSendingRequest_onRequestBody(), we keep forwarding
+		// the response until the application closes the connection.
+		logAppSocketWriteError(client, errcode);
+		req->state = Request::WAITING_FOR_APP_OUTPUT;
+		break;
+	}
+}
+
+void
+Controller::onSpliceTunnelResponseEnd(Client *client, Request *req,
+	ServerKit::SpliceTunnel::Event event, int errcode)
+{
+	TRACE_POINT();
+	AppResponse *resp = &req->appResponse;
+	resp->bodyAlreadyRead += req->spliceTunnel->getBytesTransferred(
+		ServerKit::SpliceTunnel::PEER_TO_CLIENT);
+
+	switch (event) {
+	case ServerKit::SpliceTunnel::END_OF_STREAM:
+		SKC_TRACE(client, 2, "Application sent EOF");
+		SKC_TRACE(client, 2, "Not keep-aliving application session connection");
+		req->session->close(true, false);
+		endRequest(&client, &req);
+		break;
+	case ServerKit::SpliceTunnel::READ_ERROR:
+		if (errcode == ECONNRESET) {
+			SKC_TRACE(client, 2, "Application sent EOF");
+			req->session->close(true, false);
+			endRequest(&client, &req);
+		} else {
+			endRequestWithAppSocketReadError(&client, &req, errcode);
+		}
+		break;
+	case ServerKit::SpliceTunnel::WRITE_ERROR:
+		disconnectWithClientSocketWriteError(&client, errcode);
+		break;
+	}
+}
+
 
 } // namespace Core
 } // namespace Passenger
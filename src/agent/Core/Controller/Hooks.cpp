@@ -91,6 +91,7 @@ void
 Controller::onClientAccepted(Client *client) {
 	ParentClass::onClientAccepted(client);
 	client->connectedAt = ev_now(getLoop());
+	client->output.setAccount(responseBufferAccount);
 }
 
 void
@@ -134,8 +135,10 @@ Controller::reinitializeRequest(Client *client, Request *req) {
 	req->appResponseInitialized = false;
 	req->strip100ContinueHeader = false;
 	req->hasPragmaHeader = false;
+	req->appSourceHeldBack = false;
 	req->host = NULL;
 	req->bodyBytesBuffered = 0;
+	req->spliceTunnel = NULL;
 	req->cacheKey = HashedStaticString();
 	req->cacheControl = NULL;
 	req->varyCookie = NULL;
@@ -153,6 +156,11 @@ Controller::reinitializeRequest(Client *client, Request *req) {
 
 void
 Controller::deinitializeRequest(Client *client, Request *req) {
+	// The tunnel watches the application socket, so it must go first.
+	if (req->spliceTunnel != NULL) {
+		delete req->spliceTunnel;
+		req->spliceTunnel = NULL;
+	}
 	req->session.reset();
 
 	req->endStopwatchLog(&req->stopwatchLogs.getFromPool, false);
@@ -160,7 +168,7 @@ Controller::deinitializeRequest(Client *client, Request *req) {
 	req->endStopwatchLog(&req->stopwatchLogs.requestProxying, false);
 	req->endStopwatchLog(&req->stopwatchLogs.requestProcessing, false);
 
-	req->options.transaction.reset();
+	req->options = RequestOptions();
 
 	req->appSink.setConsumedCallback(NULL);
 	req->appSink.deinitialize();
@@ -174,6 +182,16 @@ Controller::deinitializeRequest(Client *client, Request *req) {
 		deinitializeAppResponse(client, req);
 	}
 
+	// If the next request is pipelined, then the client output channel is
+	// reused while this request's response is still being flushed. Make sure
+	// that no throttling callbacks refer to this request anymore. Requests
+	// whose response is held back never installed any, and must leave the
+	// callbacks of the request that is writing to the output alone.
+	if (getOutputRequest(client) == req) {
+		client->output.setBuffersFlushedCallback(NULL);
+		client->output.setDataFlushedCallback(getClientOutputDataFlushedCallback());
+	}
+
 	ParentClass::deinitializeRequest(client, req);
 }
 
@@ -271,6 +289,18 @@ Controller::onNextRequestEarlyReadError(Client *client, Request *req, int errcod
 	}
 }
 
+void
+Controller::onRequestOutputUnblocked(Client *client, Request *req) {
+	ParentClass::onRequestOutputUnblocked(client, req);
+	if (req->appSourceHeldBack) {
+		SKC_TRACE(client, 2, "Responses to earlier pipelined requests have been "
+			"written. Resuming application socket");
+		req->appSourceHeldBack = false;
+		req->appSource.start();
+		maybeThrottleAppSource(client, req);
+	}
+}
+
 bool
 Controller::shouldDisconnectClientOnShutdown(Client *client) {
 	return ParentClass::shouldDisconnectClientOnShutdown(client) || !gracefulExit;
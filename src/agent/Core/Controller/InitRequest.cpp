@@ -134,12 +134,12 @@ Controller::respondFromTurboCache(Client *client, Request *req) {
 
 void
 Controller::initializePoolOptions(Client *client, Request *req, RequestAnalysis &analysis) {
-	boost::shared_ptr<Options> *options;
+	ConstOptionsPtr *options;
 
 	if (singleAppMode) {
 		P_ASSERT_EQ(poolOptionsCache.size(), 1);
 		poolOptionsCache.lookupRandom(NULL, &options);
-		req->options = **options;
+		req->options = RequestOptions(*options);
 	} else {
 		ServerKit::HeaderTable::Cell *appGroupNameCell = analysis.appGroupNameCell;
 		if (appGroupNameCell != NULL && appGroupNameCell->header->val.size > 0) {
@@ -152,7 +152,7 @@ Controller::initializePoolOptions(Client *client, Request *req, RequestAnalysis
 			poolOptionsCache.lookup(hAppGroupName, &options);
 
 			if (options != NULL) {
-				req->options = **options;
+				req->options = RequestOptions(*options);
 			} else {
 				createNewPoolOptions(client, req, hAppGroupName);
 			}
@@ -173,6 +173,7 @@ Controller::initializePoolOptions(Client *client, Request *req, RequestAnalysis
 		}
 
 		fillPoolOption(req, req->options.maxRequests, PASSENGER_MAX_REQUESTS);
+		fillPoolOption(req, req->options.priority, PASSENGER_REQUEST_PRIORITY);
 	}
 }
 
@@ -208,10 +209,13 @@ Controller::fillPoolOptionsFromAgentsOptions(Options &options) {
 	options.minProcesses = agentsOptions->getInt("min_instances");
 	options.maxPreloaderIdleTime = agentsOptions->getInt("max_preloader_idle_time");
 	options.maxRequestQueueSize = agentsOptions->getInt("max_request_queue_size");
+	options.privateMemoryLimit = agentsOptions->getUint("private_memory_limit", false, 0);
+	options.privateMemoryGrowthLimit = agentsOptions->getUint("private_memory_growth_limit", false, 0);
 	options.abortWebsocketsOnProcessShutdown = agentsOptions->getBool("abort_websockets_on_process_shutdown");
 	options.forceMaxConcurrentRequestsPerProcess = agentsOptions->getInt("force_max_concurrent_requests_per_process");
 	options.spawnMethod = agentsOptions->get("spawn_method");
 	options.loadShellEnvvars = agentsOptions->getBool("load_shell_envvars");
+	options.preloaderWarmup = agentsOptions->getBool("preloader_warmup", false, false);
 	options.statThrottleRate = statThrottleRate;
 
 	/******************************/
@@ -298,12 +302,10 @@ Controller::createNewPoolOptions(Client *client, Request *req,
 	const HashedStaticString &appGroupName)
 {
 	ServerKit::HeaderTable &secureHeaders = req->secureHeaders;
-	Options &options = req->options;
+	Options options;
 
 	SKC_TRACE(client, 2, "Creating new pool options: app group name=" << appGroupName);
 
-	options = Options();
-
 	const LString *scriptName = secureHeaders.lookup("!~SCRIPT_NAME");
 	const LString *appRoot = secureHeaders.lookup("!~PASSENGER_APP_ROOT");
 	if (scriptName == NULL || scriptName->size == 0) {
@@ -376,11 +378,14 @@ Controller::createNewPoolOptions(Client *client, Request *req,
 	fillPoolOptionSecToMsec(req, options.startTimeout, "!~PASSENGER_START_TIMEOUT");
 	fillPoolOption(req, options.maxPreloaderIdleTime, "!~PASSENGER_MAX_PRELOADER_IDLE_TIME");
 	fillPoolOption(req, options.maxRequestQueueSize, "!~PASSENGER_MAX_REQUEST_QUEUE_SIZE");
+	fillPoolOption(req, options.privateMemoryLimit, "!~PASSENGER_PRIVATE_MEMORY_LIMIT");
+	fillPoolOption(req, options.privateMemoryGrowthLimit, "!~PASSENGER_PRIVATE_MEMORY_GROWTH_LIMIT");
 	fillPoolOption(req, options.abortWebsocketsOnProcessShutdown, "!~PASSENGER_ABORT_WEBSOCKETS_ON_PROCESS_SHUTDOWN");
 	fillPoolOption(req, options.forceMaxConcurrentRequestsPerProcess, "!~PASSENGER_FORCE_MAX_CONCURRENT_REQUESTS_PER_PROCESS");
 	fillPoolOption(req, options.restartDir, "!~PASSENGER_RESTART_DIR");
 	fillPoolOption(req, options.startupFile, "!~PASSENGER_STARTUP_FILE");
 	fillPoolOption(req, options.loadShellEnvvars, "!~PASSENGER_LOAD_SHELL_ENVVARS");
+	fillPoolOption(req, options.preloaderWarmup, "!~PASSENGER_PRELOADER_WARMUP");
 	fillPoolOption(req, options.fileDescriptorUlimit, "!~PASSENGER_APP_FILE_DESCRIPTOR_ULIMIT");
 	fillPoolOption(req, options.raiseInternalError, "!~PASSENGER_RAISE_INTERNAL_ERROR");
 	fillPoolOption(req, options.lveMinUid, "!~PASSENGER_LVE_MIN_UID");
@@ -391,12 +396,13 @@ Controller::createNewPoolOptions(Client *client, Request *req,
 	optionsCopy->clearPerRequestFields();
 	optionsCopy->detachFromUnionStationTransaction();
 	poolOptionsCache.insert(options.getAppGroupName(), optionsCopy);
+	req->options = RequestOptions(optionsCopy);
 }
 
 void
 Controller::initializeUnionStation(Client *client, Request *req, RequestAnalysis &analysis) {
 	if (analysis.unionStationSupport) {
-		Options &options = req->options;
+		RequestOptions &options = req->options;
 		ServerKit::HeaderTable &headers = req->secureHeaders;
 
 		const LString *key = headers.lookup("!~UNION_STATION_KEY");
@@ -463,6 +469,54 @@ Controller::getStickySessionCookieName(Request *req) {
 	}
 }
 
+/**
+ * Sets the affinity key, which routes all requests with the same key to
+ * the same process (see AffinityRing.h). The key is the value of the
+ * request header named by !~PASSENGER_AFFINITY_HEADER, or if the request
+ * doesn't have that header, the first !~PASSENGER_AFFINITY_PATH_SEGMENTS
+ * segments of the path (e.g. "/tenants/acme" for 2 segments).
+ */
+void
+Controller::setAffinityKey(Client *client, Request *req) {
+	if (req->options.stickySessionId != 0) {
+		return;
+	}
+
+	const LString *headerName = req->secureHeaders.lookup(PASSENGER_AFFINITY_HEADER);
+	if (headerName != NULL && headerName->size > 0) {
+		// The names of the headers in req->headers are in lower case.
+		headerName = psg_lstr_make_contiguous(headerName, req->pool);
+		char *lowerCaseName = (char *) psg_pnalloc(req->pool, headerName->size);
+		convertLowerCase((const unsigned char *) headerName->start->data,
+			(unsigned char *) lowerCaseName, headerName->size);
+
+		const LString *value = req->headers.lookup(HashedStaticString(
+			lowerCaseName, headerName->size));
+		if (value != NULL && value->size > 0) {
+			value = psg_lstr_make_contiguous(value, req->pool);
+			req->options.affinityKey = std::max<boost::uint32_t>(1,
+				Hasher::hash(value->start->data, value->size));
+			return;
+		}
+	}
+
+	unsigned int segments = 0;
+	fillPoolOption(req, segments, PASSENGER_AFFINITY_PATH_SEGMENTS);
+	if (segments > 0) {
+		StaticString path = req->getPathWithoutQueryString();
+		const char *pos = path.data();
+		const char *end = path.data() + path.size();
+
+		while (segments > 0 && pos < end) {
+			const char *next = (const char *) memchr(pos + 1, '/', end - pos - 1);
+			pos = (next == NULL) ? end : next;
+			segments--;
+		}
+		req->options.affinityKey = std::max<boost::uint32_t>(1,
+			Hasher::hash(path.data(), pos - path.data()));
+	}
+}
+
 
 /****************************
  *
@@ -511,6 +565,7 @@ Controller::onRequestBegin(Client *client, Request *req) {
 			return;
 		}
 		setStickySessionId(client, req);
+		setAffinityKey(client, req);
 	}
 
 	if (!req->hasBody() || !req->requestBodyBuffering) {
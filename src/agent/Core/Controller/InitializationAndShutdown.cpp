@@ -51,11 +51,17 @@ Controller::Controller(ServerKit::Context *context, const VariantMap *_agentsOpt
 
 	  statThrottleRate(_agentsOptions->getInt("stat_throttle_rate")),
 	  responseBufferHighWatermark(_agentsOptions->getInt("response_buffer_high_watermark")),
+	  highWatermarkThrottles(0),
+	  diskBufferThrottles(0),
+	  fairShareThrottles(0),
+	  pipelineThrottles(0),
 	  benchmarkMode(parseBenchmarkMode(_agentsOptions->get("benchmark_mode", false))),
 	  singleAppMode(false),
 	  showVersionInHeader(_agentsOptions->getBool("show_version_in_header")),
 	  stickySessions(_agentsOptions->getBool("sticky_sessions")),
 	  gracefulExit(_agentsOptions->getBool("core_graceful_exit")),
+	  spliceTunneling(_agentsOptions->getBool("core_splice_tunneling", false, true)),
+	  spliceTunnels(0),
 
 	  agentsOptions(_agentsOptions),
 	  stringPool(psg_create_pool(1024 * 4)),
@@ -64,8 +70,12 @@ Controller::Controller(ServerKit::Context *context, const VariantMap *_agentsOpt
 	  PASSENGER_APP_GROUP_NAME("!~PASSENGER_APP_GROUP_NAME"),
 	  PASSENGER_ENV_VARS("!~PASSENGER_ENV_VARS"),
 	  PASSENGER_MAX_REQUESTS("!~PASSENGER_MAX_REQUESTS"),
+	  PASSENGER_MAX_REQUEST_QUEUE_TIME("!~PASSENGER_MAX_REQUEST_QUEUE_TIME"),
+	  PASSENGER_REQUEST_PRIORITY("!~PASSENGER_REQUEST_PRIORITY"),
 	  PASSENGER_STICKY_SESSIONS("!~PASSENGER_STICKY_SESSIONS"),
 	  PASSENGER_STICKY_SESSIONS_COOKIE_NAME("!~PASSENGER_STICKY_SESSIONS_COOKIE_NAME"),
+	  PASSENGER_AFFINITY_HEADER("!~PASSENGER_AFFINITY_HEADER"),
+	  PASSENGER_AFFINITY_PATH_SEGMENTS("!~PASSENGER_AFFINITY_PATH_SEGMENTS"),
 	  PASSENGER_REQUEST_OOB_WORK("!~Request-OOB-Work"),
 	  UNION_STATION_SUPPORT("!~UNION_STATION_SUPPORT"),
 	  REMOTE_ADDR("!~REMOTE_ADDR"),
@@ -83,7 +93,8 @@ Controller::Controller(ServerKit::Context *context, const VariantMap *_agentsOpt
 	  HTTP_TRANSFER_ENCODING("transfer-encoding"),
 
 	  threadNumber(_threadNumber),
-	  turboCaching(getTurboCachingInitialState(_agentsOptions))
+	  turboCaching(getTurboCachingInitialState(_agentsOptions)),
+	  responseBufferAccount(NULL)
 {
 	defaultRuby = psg_pstrdup(stringPool,
 		agentsOptions->get("default_ruby"));
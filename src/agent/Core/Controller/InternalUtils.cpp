@@ -141,7 +141,7 @@ Controller::endRequestWithSimpleResponse(Client **c, Request **r,
 	ServerKit::HeaderTable headers;
 
 	headers.insert(req->pool, "cache-control", "no-cache, no-store, must-revalidate");
-	writeSimpleResponse(client, code, &headers, body);
+	writeSimpleResponse(client, req, code, &headers, body);
 	endRequest(c, r);
 }
 
@@ -152,7 +152,7 @@ Controller::endRequestAsBadGateway(Client **client, Request **req) {
 	} else {
 		ServerKit::HeaderTable headers;
 		headers.insert((*req)->pool, "cache-control", "no-cache, no-store, must-revalidate");
-		writeSimpleResponse(*client, 502, &headers, "<h1>Bad Gateway</h1>");
+		writeSimpleResponse(*client, *req, 502, &headers, "<h1>Bad Gateway</h1>");
 		endRequest(client, req);
 	}
 }
@@ -160,7 +160,7 @@ Controller::endRequestAsBadGateway(Client **client, Request **req) {
 void
 Controller::writeBenchmarkResponse(Client **client, Request **req, bool end) {
 	if (canKeepAlive(*req)) {
-		writeResponse(*client, P_STATIC_STRING(
+		writeResponse(*client, *req, P_STATIC_STRING(
 			"HTTP/1.1 200 OK\r\n"
 			"Status: 200 OK\r\n"
 			"Date: Wed, 15 Nov 1995 06:25:24 GMT\r\n"
@@ -170,7 +170,7 @@ Controller::writeBenchmarkResponse(Client **client, Request **req, bool end) {
 			"\r\n"
 			"ok\n"));
 	} else {
-		writeResponse(*client, P_STATIC_STRING(
+		writeResponse(*client, *req, P_STATIC_STRING(
 			"HTTP/1.1 200 OK\r\n"
 			"Status: 200 OK\r\n"
 			"Date: Wed, 15 Nov 1995 06:25:24 GMT\r\n"
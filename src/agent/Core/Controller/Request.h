@@ -33,6 +33,7 @@
 #include <ServerKit/HttpRequest.h>
 #include <ServerKit/FdSinkChannel.h>
 #include <ServerKit/FdSourceChannel.h>
+#include <ServerKit/SpliceTunnel.h>
 #include <Logging.h>
 #include <Core/ApplicationPool/Pool.h>
 #include <Core/UnionStation/Context.h>
@@ -80,8 +81,13 @@ public:
 	bool appResponseInitialized: 1;
 	bool strip100ContinueHeader: 1;
 	bool hasPragmaHeader: 1;
+	/** Whether appSource was stopped because the response data is held back
+	 * until the responses to earlier pipelined requests have been written. */
+	bool appSourceHeldBack: 1;
 
-	Options options;
+	// Refers to the cached per-group options in `Controller::poolOptionsCache`,
+	// so that setting up a request doesn't copy the whole Options struct.
+	RequestOptions options;
 	AbstractSessionPtr session;
 	const LString *host;
 
@@ -92,6 +98,10 @@ public:
 	ServerKit::FileBufferedChannel bodyBuffer;
 	boost::uint64_t bodyBytesBuffered; // After dechunking
 
+	// Relays the data of an upgraded connection once both directions have
+	// been flushed. NULL while the data goes through the channels.
+	ServerKit::SpliceTunnel *spliceTunnel;
+
 	struct {
 		UnionStation::StopwatchLog *requestProcessing;
 		UnionStation::StopwatchLog *bufferingRequestBody;
@@ -167,36 +167,25 @@ Controller::sendHeaderToAppWithSessionProtocol(Client *client, Request *req) {
 		deltaMonotonic = boost::to_string(-diff);
 	}
 
-	unsigned int bufferSize = determineHeaderSizeForSessionProtocol(req,
-		state, deltaMonotonic);
+	prepareSessionProtocolWorkingState(req, state);
+
+	// The header usually fits in a single mbuf. If it doesn't,
+	// SessionProtocolBuffer moves it to a larger buffer in the request pool.
 	MemoryKit::mbuf_pool &mbuf_pool = getContext()->mbuf_pool;
-	const unsigned int MBUF_MAX_SIZE = mbuf_pool_data_size(&mbuf_pool);
-	bool ok;
+	MemoryKit::mbuf mbuffer(MemoryKit::mbuf_get(&mbuf_pool));
+	SessionProtocolBuffer buffer(req->pool, mbuffer.start,
+		mbuf_pool_data_size(&mbuf_pool));
 
-	if (bufferSize <= MBUF_MAX_SIZE) {
-		MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&mbuf_pool));
-		bufferSize = MBUF_MAX_SIZE;
+	constructHeaderForSessionProtocol(req, buffer, state, deltaMonotonic);
+	SKC_TRACE(client, 3, "Header data: \"" << cEscapeString(
+		StaticString(buffer.start(), buffer.size())) << "\"");
 
-		ok = constructHeaderForSessionProtocol(req, buffer.start,
-			bufferSize, state, deltaMonotonic);
-		assert(ok);
-		buffer = MemoryKit::mbuf(buffer, 0, bufferSize);
-		SKC_TRACE(client, 3, "Header data: \"" << cEscapeString(
-			StaticString(buffer.start, bufferSize)) << "\"");
-		req->appSink.feedWithoutRefGuard(boost::move(buffer));
+	if (!buffer.grown()) {
+		req->appSink.feedWithoutRefGuard(MemoryKit::mbuf(mbuffer, 0, buffer.size()));
 	} else {
-		char *buffer = (char *) psg_pnalloc(req->pool, bufferSize);
-
-		ok = constructHeaderForSessionProtocol(req, buffer,
-			bufferSize, state, deltaMonotonic);
-		assert(ok);
-		SKC_TRACE(client, 3, "Header data: \"" << cEscapeString(
-			StaticString(buffer, bufferSize)) << "\"");
 		req->appSink.feedWithoutRefGuard(MemoryKit::mbuf(
-			buffer, bufferSize));
+			buffer.start(), buffer.size()));
 	}
-
-	(void) ok; // Shut up compiler warning
 }
 
 void
@@ -229,104 +218,17 @@ Controller::sendBodyToAppWhenAppSinkIdle(Channel *_channel, unsigned int size) {
 	}
 }
 
-static bool
-isAlphaNum(char ch) {
-	return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
-}
-
-/**
- * For CGI, alphanum headers with optional dashes are mapped to UPP3R_CAS3. This
- * function can be used to reject non-alphanum/dash headers that would end up with
- * the same mapping (e.g. upp3r_cas3 and upp3r-cas3 would end up the same, and
- * potentially collide each other in the receiving application). This is
- * used to fix CVE-2015-7519.
- */
-static bool
-containsNonAlphaNumDash(const LString &s) {
-	const LString::Part *part = s.start;
-	while (part != NULL) {
-		for (unsigned int i = 0; i < part->size; i++) {
-			const char start = part->data[i];
-			if (start != '-' && !isAlphaNum(start)) {
-				return true;
-			}
-		}
-		part = part->next;
-	}
-	return false;
-}
-
-static void
-httpHeaderToScgiUpperCase(unsigned char *data, unsigned int size) {
-	static const boost::uint8_t toUpperMap[256] = {
-		'\0', 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, '\t',
-		'\n', 0x0b, 0x0c, '\r', 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13,
-		0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
-		0x1e, 0x1f,  ' ',  '!',  '"',  '#',  '$',  '%',  '&', '\'',
-		 '(',  ')',  '*',  '+',  ',',  '_',  '.',  '/',  '0',  '1',
-		 '2',  '3',  '4',  '5',  '6',  '7',  '8',  '9',  ':',  ';',
-		 '<',  '=',  '>',  '?',  '@',  'A',  'B',  'C',  'D',  'E',
-		 'F',  'G',  'H',  'I',  'J',  'K',  'L',  'M',  'N',  'O',
-		 'P',  'Q',  'R',  'S',  'T',  'U',  'V',  'W',  'X',  'Y',
-		 'Z',  '[', '\\',  ']',  '^',  '_',  '`',  'A',  'B',  'C',
-		 'D',  'E',  'F',  'G',  'H',  'I',  'J',  'K',  'L',  'M',
-		 'N',  'O',  'P',  'Q',  'R',  'S',  'T',  'U',  'V',  'W',
-		 'X',  'Y',  'Z',  '{',  '|',  '}',  '~', 0x7f, 0x80, 0x81,
-		0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b,
-		0x8c, 0x8d, 0x8e, 0x8f, 0x90, 0x91, 0x92, 0x93, 0x94, 0x95,
-		0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
-		0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9,
-		0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf, 0xb0, 0xb1, 0xb2, 0xb3,
-		0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd,
-		0xbe, 0xbf, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
-		0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf, 0xd0, 0xd1,
-		0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xdb,
-		0xdc, 0xdd, 0xde, 0xdf, 0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5,
-		0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
-		0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9,
-		0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
-	};
-
-	const unsigned char *buf = data;
-	const size_t imax = size / 8;
-	const size_t leftover = size % 8;
-	size_t i;
-
-	for (i = 0; i < imax; i++, data += 8) {
-		data[0] = (unsigned char) toUpperMap[data[0]];
-		data[1] = (unsigned char) toUpperMap[data[1]];
-		data[2] = (unsigned char) toUpperMap[data[2]];
-		data[3] = (unsigned char) toUpperMap[data[3]];
-		data[4] = (unsigned char) toUpperMap[data[4]];
-		data[5] = (unsigned char) toUpperMap[data[5]];
-		data[6] = (unsigned char) toUpperMap[data[6]];
-		data[7] = (unsigned char) toUpperMap[data[7]];
-	}
-
-	i = imax * 8;
-	switch (leftover) {
-	case 7: *data++ = (unsigned char) toUpperMap[buf[i++]];
-	case 6: *data++ = (unsigned char) toUpperMap[buf[i++]];
-	case 5: *data++ = (unsigned char) toUpperMap[buf[i++]];
-	case 4: *data++ = (unsigned char) toUpperMap[buf[i++]];
-	case 3: *data++ = (unsigned char) toUpperMap[buf[i++]];
-	case 2: *data++ = (unsigned char) toUpperMap[buf[i++]];
-	case 1: *data++ = (unsigned char) toUpperMap[buf[i]];
-	case 0: break;
-	}
-}
-
-unsigned int
-Controller::determineHeaderSizeForSessionProtocol(Request *req,
-	SessionProtocolWorkingState &state, string delta_monotonic)
+void
+Controller::prepareSessionProtocolWorkingState(Request *req,
+	SessionProtocolWorkingState &state)
 {
-	unsigned int dataSize = sizeof(boost::uint32_t);
+	const StaticString &baseURI = req->options.getGroupOptions().baseURI;
 
 	state.path        = req->getPathWithoutQueryString();
-	state.hasBaseURI  = req->options.baseURI != P_STATIC_STRING("/")
-		&& startsWith(state.path, req->options.baseURI);
+	state.hasBaseURI  = baseURI != P_STATIC_STRING("/")
+		&& startsWith(state.path, baseURI);
 	if (state.hasBaseURI) {
-		state.path = state.path.substr(req->options.baseURI.size());
+		state.path = state.path.substr(baseURI.size());
 		if (state.path.empty()) {
 			state.path = P_STATIC_STRING("/");
 		}
@@ -358,25 +260,6 @@ Controller::determineHeaderSizeForSessionProtocol(Request *req,
 		state.environmentVariablesSize = len;
 	}
 
-	dataSize += sizeof("REQUEST_URI");
-	dataSize += req->path.size + 1;
-
-	dataSize += sizeof("PATH_INFO");
-	dataSize += state.path.size() + 1;
-
-	dataSize += sizeof("SCRIPT_NAME");
-	if (state.hasBaseURI) {
-		dataSize += req->options.baseURI.size();
-	} else {
-		dataSize += sizeof("");
-	}
-
-	dataSize += sizeof("QUERY_STRING");
-	dataSize += state.queryString.size() + 1;
-
-	dataSize += sizeof("REQUEST_METHOD");
-	dataSize += state.methodStr.size() + 1;
-
 	if (req->host != NULL && req->host->size > 0) {
 		const LString *host = psg_lstr_make_contiguous(req->host, req->pool);
 		const char *sep = (const char *) memchr(host->start->data, ':', host->size);
@@ -396,236 +279,119 @@ Controller::determineHeaderSizeForSessionProtocol(Request *req,
 		state.serverName = defaultServerName;
 		state.serverPort = defaultServerPort;
 	}
-
-	dataSize += sizeof("SERVER_NAME");
-	dataSize += state.serverName.size() + 1;
-
-	dataSize += sizeof("SERVER_PORT");
-	dataSize += state.serverPort.size() + 1;
-
-	dataSize += sizeof("SERVER_SOFTWARE");
-	dataSize += serverSoftware.size() + 1;
-
-	dataSize += sizeof("SERVER_PROTOCOL");
-	dataSize += sizeof("HTTP/1.1");
-
-	dataSize += sizeof("REMOTE_ADDR");
-	if (state.remoteAddr != NULL) {
-		dataSize += state.remoteAddr->size + 1;
-	} else {
-		dataSize += sizeof("127.0.0.1");
-	}
-
-	dataSize += sizeof("REMOTE_PORT");
-	if (state.remotePort != NULL) {
-		dataSize += state.remotePort->size + 1;
-	} else {
-		dataSize += sizeof("0");
-	}
-
-	if (state.remoteUser != NULL) {
-		dataSize += sizeof("REMOTE_USER");
-		dataSize += state.remoteUser->size + 1;
-	}
-
-	if (state.contentType != NULL) {
-		dataSize += sizeof("CONTENT_TYPE");
-		dataSize += state.contentType->size + 1;
-	}
-
-	if (state.contentLength != NULL) {
-		dataSize += sizeof("CONTENT_LENGTH");
-		dataSize += state.contentLength->size + 1;
-	}
-
-	dataSize += sizeof("PASSENGER_CONNECT_PASSWORD");
-	dataSize += ApplicationPool2::ApiKey::SIZE + 1;
-
-	if (req->https) {
-		dataSize += sizeof("HTTPS");
-		dataSize += sizeof("on");
-	}
-
-	if (req->options.analytics) {
-		dataSize += sizeof("PASSENGER_TXN_ID");
-		dataSize += req->options.transaction->getTxnId().size() + 1;
-
-		dataSize += sizeof("PASSENGER_DELTA_MONOTONIC");
-		dataSize += delta_monotonic.size() + 1;
-	}
-
-	if (req->upgraded()) {
-		dataSize += sizeof("HTTP_CONNECTION");
-		dataSize += sizeof("upgrade");
-	}
-
-	ServerKit::HeaderTable::Iterator it(req->headers);
-	while (*it != NULL) {
-		dataSize += sizeof("HTTP_") - 1 + it->header->key.size + 1;
-		dataSize += it->header->val.size + 1;
-		it.next();
-	}
-
-	if (state.environmentVariablesData != NULL) {
-		dataSize += state.environmentVariablesSize;
-	}
-
-	return dataSize + 1;
 }
 
-bool
-Controller::constructHeaderForSessionProtocol(Request *req, char * restrict buffer,
-	unsigned int &size, const SessionProtocolWorkingState &state, string delta_monotonic)
+void
+Controller::constructHeaderForSessionProtocol(Request *req, SessionProtocolBuffer &buffer,
+	const SessionProtocolWorkingState &state, string delta_monotonic)
 {
-	char *pos = buffer;
-	const char *end = buffer + size;
-
-	pos += sizeof(boost::uint32_t);
+	// Reserve space for the size prefix.
+	buffer.appendUninitialized(sizeof(boost::uint32_t));
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("REQUEST_URI"));
-	pos = appendData(pos, end, req->path.start->data, req->path.size);
-	pos = appendData(pos, end, "", 1);
+	buffer.append(P_STATIC_STRING_WITH_NULL("REQUEST_URI"));
+	buffer.append(&req->path);
+	buffer.append("", 1);
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("PATH_INFO"));
-	pos = appendData(pos, end, state.path.data(), state.path.size());
-	pos = appendData(pos, end, "", 1);
+	buffer.append(P_STATIC_STRING_WITH_NULL("PATH_INFO"));
+	buffer.append(state.path.data(), state.path.size());
+	buffer.append("", 1);
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("SCRIPT_NAME"));
+	buffer.append(P_STATIC_STRING_WITH_NULL("SCRIPT_NAME"));
 	if (state.hasBaseURI) {
-		pos = appendData(pos, end, req->options.baseURI);
-		pos = appendData(pos, end, "", 1);
+		buffer.append(req->options.getGroupOptions().baseURI);
+		buffer.append("", 1);
 	} else {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL(""));
+		buffer.append(P_STATIC_STRING_WITH_NULL(""));
 	}
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("QUERY_STRING"));
-	pos = appendData(pos, end, state.queryString.data(), state.queryString.size());
-	pos = appendData(pos, end, "", 1);
+	buffer.append(P_STATIC_STRING_WITH_NULL("QUERY_STRING"));
+	buffer.append(state.queryString.data(), state.queryString.size());
+	buffer.append("", 1);
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("REQUEST_METHOD"));
-	pos = appendData(pos, end, state.methodStr);
-	pos = appendData(pos, end, "", 1);
+	buffer.append(P_STATIC_STRING_WITH_NULL("REQUEST_METHOD"));
+	buffer.append(state.methodStr);
+	buffer.append("", 1);
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("SERVER_NAME"));
-	pos = appendData(pos, end, state.serverName);
-	pos = appendData(pos, end, "", 1);
+	buffer.append(P_STATIC_STRING_WITH_NULL("SERVER_NAME"));
+	buffer.append(state.serverName);
+	buffer.append("", 1);
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("SERVER_PORT"));
-	pos = appendData(pos, end, state.serverPort);
-	pos = appendData(pos, end, "", 1);
+	buffer.append(P_STATIC_STRING_WITH_NULL("SERVER_PORT"));
+	buffer.append(state.serverPort);
+	buffer.append("", 1);
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("SERVER_SOFTWARE"));
-	pos = appendData(pos, end, serverSoftware);
-	pos = appendData(pos, end, "", 1);
+	buffer.append(P_STATIC_STRING_WITH_NULL("SERVER_SOFTWARE"));
+	buffer.append(serverSoftware);
+	buffer.append("", 1);
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("SERVER_PROTOCOL"));
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("HTTP/1.1"));
+	buffer.append(P_STATIC_STRING_WITH_NULL("SERVER_PROTOCOL"));
+	buffer.append(P_STATIC_STRING_WITH_NULL("HTTP/1.1"));
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("REMOTE_ADDR"));
+	buffer.append(P_STATIC_STRING_WITH_NULL("REMOTE_ADDR"));
 	if (state.remoteAddr != NULL) {
-		pos = appendData(pos, end, state.remoteAddr);
-		pos = appendData(pos, end, "", 1);
+		buffer.append(state.remoteAddr);
+		buffer.append("", 1);
 	} else {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("127.0.0.1"));
+		buffer.append(P_STATIC_STRING_WITH_NULL("127.0.0.1"));
 	}
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("REMOTE_PORT"));
+	buffer.append(P_STATIC_STRING_WITH_NULL("REMOTE_PORT"));
 	if (state.remotePort != NULL) {
-		pos = appendData(pos, end, state.remotePort);
-		pos = appendData(pos, end, "", 1);
+		buffer.append(state.remotePort);
+		buffer.append("", 1);
 	} else {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("0"));
+		buffer.append(P_STATIC_STRING_WITH_NULL("0"));
 	}
 
 	if (state.remoteUser != NULL) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("REMOTE_USER"));
-		pos = appendData(pos, end, state.remoteUser);
-		pos = appendData(pos, end, "", 1);
+		buffer.append(P_STATIC_STRING_WITH_NULL("REMOTE_USER"));
+		buffer.append(state.remoteUser);
+		buffer.append("", 1);
 	}
 
 	if (state.contentType != NULL) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("CONTENT_TYPE"));
-		pos = appendData(pos, end, state.contentType);
-		pos = appendData(pos, end, "", 1);
+		buffer.append(P_STATIC_STRING_WITH_NULL("CONTENT_TYPE"));
+		buffer.append(state.contentType);
+		buffer.append("", 1);
 	}
 
 	if (state.contentLength != NULL) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("CONTENT_LENGTH"));
-		pos = appendData(pos, end, state.contentLength);
-		pos = appendData(pos, end, "", 1);
+		buffer.append(P_STATIC_STRING_WITH_NULL("CONTENT_LENGTH"));
+		buffer.append(state.contentLength);
+		buffer.append("", 1);
 	}
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("PASSENGER_CONNECT_PASSWORD"));
-	pos = appendData(pos, end, req->session->getApiKey().toStaticString());
-	pos = appendData(pos, end, "", 1);
+	buffer.append(P_STATIC_STRING_WITH_NULL("PASSENGER_CONNECT_PASSWORD"));
+	buffer.append(req->session->getApiKey().toStaticString());
+	buffer.append("", 1);
 
 	if (req->https) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("HTTPS"));
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("on"));
+		buffer.append(P_STATIC_STRING_WITH_NULL("HTTPS"));
+		buffer.append(P_STATIC_STRING_WITH_NULL("on"));
 	}
 
 	if (req->options.analytics) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("PASSENGER_TXN_ID"));
-		pos = appendData(pos, end, req->options.transaction->getTxnId());
-		pos = appendData(pos, end, "", 1);
+		buffer.append(P_STATIC_STRING_WITH_NULL("PASSENGER_TXN_ID"));
+		buffer.append(req->options.transaction->getTxnId());
+		buffer.append("", 1);
 
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("PASSENGER_DELTA_MONOTONIC"));
-		pos = appendData(pos, end, delta_monotonic);
-		pos = appendData(pos, end, "", 1);
+		buffer.append(P_STATIC_STRING_WITH_NULL("PASSENGER_DELTA_MONOTONIC"));
+		buffer.append(delta_monotonic);
+		buffer.append("", 1);
 	}
 
 	if (req->upgraded()) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("HTTP_CONNECTION"));
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("upgrade"));
+		buffer.append(P_STATIC_STRING_WITH_NULL("HTTP_CONNECTION"));
+		buffer.append(P_STATIC_STRING_WITH_NULL("upgrade"));
 	}
 
-	ServerKit::HeaderTable::Iterator it(req->headers);
-	while (*it != NULL) {
-		// This header-skipping is not accounted for in determineHeaderSizeForSessionProtocol(), but
-		// since we are only reducing the size it just wastes some mem bytes.
-		if ((
-				(it->header->hash == HTTP_CONTENT_LENGTH.hash()
-						|| it->header->hash == HTTP_CONTENT_TYPE.hash()
-						|| it->header->hash == HTTP_CONNECTION.hash()
-				) && (psg_lstr_cmp(&it->header->key, P_STATIC_STRING("content-type"))
-						|| psg_lstr_cmp(&it->header->key, P_STATIC_STRING("content-length"))
-						|| psg_lstr_cmp(&it->header->key, P_STATIC_STRING("connection"))
-				)
-			) || containsNonAlphaNumDash(it->header->key)
-		   )
-		{
-			it.next();
-			continue;
-		}
-
-		pos = appendData(pos, end, P_STATIC_STRING("HTTP_"));
-		const LString::Part *part = it->header->key.start;
-		while (part != NULL) {
-			char *start = pos;
-			pos = appendData(pos, end, part->data, part->size);
-			httpHeaderToScgiUpperCase((unsigned char *) start, pos - start);
-			part = part->next;
-		}
-		pos = appendData(pos, end, "", 1);
-
-		part = it->header->val.start;
-		while (part != NULL) {
-			pos = appendData(pos, end, part->data, part->size);
-			part = part->next;
-		}
-		pos = appendData(pos, end, "", 1);
-
-		it.next();
-	}
+	cgiHeaderNameTable.serialize(req->headers, buffer);
 
 	if (state.environmentVariablesData != NULL) {
-		pos = appendData(pos, end, state.environmentVariablesData, state.environmentVariablesSize);
+		buffer.append(state.environmentVariablesData, state.environmentVariablesSize);
 	}
 
-	Uint32Message::generate(buffer, pos - buffer - sizeof(boost::uint32_t));
-
-	size = pos - buffer;
-	return pos < end;
+	Uint32Message::generate(buffer.start(), buffer.size() - sizeof(boost::uint32_t));
 }
 
 void
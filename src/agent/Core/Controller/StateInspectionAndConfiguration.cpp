@@ -52,6 +52,7 @@ Controller::getConfigAsJson() const {
 	doc["single_app_mode"] = singleAppMode;
 	doc["stat_throttle_rate"] = statThrottleRate;
 	doc["show_version_in_header"] = showVersionInHeader;
+	doc["splice_tunneling"] = spliceTunneling;
 	doc["data_buffer_dir"] = getContext()->defaultFileBufferedChannelConfig.bufferDir;
 	return doc;
 }
@@ -62,6 +63,9 @@ Controller::configure(const Json::Value &doc) {
 	if (doc.isMember("show_version_in_header")) {
 		showVersionInHeader = doc["show_version_in_header"].asBool();
 	}
+	if (doc.isMember("splice_tunneling")) {
+		spliceTunneling = doc["splice_tunneling"].asBool();
+	}
 	if (doc.isMember("data_buffer_dir")) {
 		getContext()->defaultFileBufferedChannelConfig.bufferDir =
 			doc["data_buffer_dir"].asString();
@@ -81,6 +85,17 @@ Controller::inspectStateAsJson() const {
 		subdoc["store_success_ratio"] = turboCaching.responseCache.getStoreSuccessRatio();
 		doc["turbocaching"] = subdoc;
 	}
+
+	Json::Value responseBufferDoc;
+	responseBufferDoc["high_watermark_throttles"] = highWatermarkThrottles;
+	responseBufferDoc["disk_buffer_throttles"] = diskBufferThrottles;
+	responseBufferDoc["fair_share_throttles"] = fairShareThrottles;
+	responseBufferDoc["pipeline_throttles"] = pipelineThrottles;
+	if (responseBufferAccount != NULL) {
+		responseBufferDoc["global"] = responseBufferAccount->inspectStateAsJson();
+	}
+	doc["response_buffer"] = responseBufferDoc;
+	doc["splice_tunnels"] = spliceTunnels;
 	return doc;
 }
 
@@ -105,6 +120,9 @@ Controller::inspectRequestStateAsJson(const Request *req) const {
 		doc["sticky_session_id"] = req->options.stickySessionId;
 	}
 	doc["sticky_session"] = req->stickySession;
+	if (req->options.affinityKey != 0) {
+		doc["affinity_key"] = req->options.affinityKey;
+	}
 	doc["session_checkout_try"] = req->sessionCheckoutTry;
 
 	flags["dechunk_response"] = req->dechunkResponse;
@@ -153,6 +171,9 @@ Controller::inspectRequestStateAsJson(const Request *req) const {
 
 	doc["app_source_state"] = req->appSource.inspectAsJson();
 	doc["app_sink_state"] = req->appSink.inspectAsJson();
+	if (req->spliceTunnel != NULL) {
+		doc["splice_tunnel"] = req->spliceTunnel->inspectAsJson();
+	}
 
 	return doc;
 }
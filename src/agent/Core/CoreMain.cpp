@@ -83,6 +83,7 @@
 #include <Utils/Timer.h>
 #include <Utils/IOUtils.h>
 #include <Utils/MessageIO.h>
+#include <Utils/NumaTopology.h>
 #include <Utils/VariantMap.h>
 #include <Core/OptionParser.h>
 #include <Core/Controller.h>
@@ -137,8 +138,10 @@ namespace Core {
 		SpawningKit::FactoryPtr spawningKitFactory;
 		PoolPtr appPool;
 
-		ServerKit::AcceptLoadBalancer<Controller> loadBalancer;
+		vector<ServerKit::AcceptLoadBalancer<Controller> *> loadBalancers;
 		vector<ThreadWorkingObjects> threadWorkingObjects;
+		/** Empty unless NUMA-aware thread placement is enabled. */
+		vector<NumaThreadPlacement> numaPlacement;
 		struct ev_signal sigintWatcher;
 		struct ev_signal sigtermWatcher;
 		struct ev_signal sigquitWatcher;
@@ -150,12 +153,16 @@ namespace Core {
 		unsigned int terminationCount;
 		boost::atomic<unsigned int> shutdownCounter;
 		oxt::thread *prestarterThread;
+		ServerKit::FileBufferedChannelMemoryTier *fileBufferedChannelMemoryTier;
+		ServerKit::FileBufferedChannelAccount *responseBufferAccount;
 
 		WorkingObjects()
 			: exitEvent(__FILE__, __LINE__, "WorkingObjects: exitEvent"),
 			  allClientsDisconnectedEvent(__FILE__, __LINE__, "WorkingObjects: allClientsDisconnectedEvent"),
 			  terminationCount(0),
-			  shutdownCounter(0)
+			  shutdownCounter(0),
+			  fileBufferedChannelMemoryTier(NULL),
+			  responseBufferAccount(NULL)
 		{
 			for (unsigned int i = 0; i < SERVER_KIT_MAX_SERVER_ENDPOINTS; i++) {
 				serverFds[i] = -1;
@@ -166,6 +173,10 @@ namespace Core {
 		~WorkingObjects() {
 			delete prestarterThread;
 
+			for (unsigned int i = 0; i < loadBalancers.size(); i++) {
+				delete loadBalancers[i];
+			}
+
 			vector<ThreadWorkingObjects>::iterator it, end = threadWorkingObjects.end();
 			for (it = threadWorkingObjects.begin(); it != end; it++) {
 				delete it->controller;
@@ -176,6 +187,9 @@ namespace Core {
 			delete apiWorkingObjects.apiServer;
 			delete apiWorkingObjects.serverKitContext;
 			delete apiWorkingObjects.bgloop;
+
+			delete fileBufferedChannelMemoryTier;
+			delete responseBufferAccount;
 		}
 	};
 } // namespace Core
@@ -542,6 +556,67 @@ spawningKitErrorHandler(const SpawningKit::ConfigPtr &config, SpawnException &e,
 	ApplicationPool2::processAndLogNewSpawnException(e, options, config);
 }
 
+static void
+initializeNumaPlacement(unsigned int nthreads) {
+	TRACE_POINT();
+	WorkingObjects *wo = workingObjects;
+	vector<NumaNode> nodes = discoverNumaTopology();
+
+	if (nodes.empty()) {
+		P_WARN("NUMA-aware thread placement requested, but the NUMA topology"
+			" of this machine cannot be determined. Disabling NUMA-aware thread placement");
+		return;
+	}
+
+	wo->numaPlacement = computeNumaThreadPlacement(nthreads, nodes,
+		agentsOptions->getBool("core_cpu_affine"));
+	P_NOTICE("Distributing " << nthreads << " core thread(s) over "
+		<< nodes.size() << " NUMA node(s)");
+	for (unsigned int i = 0; i < nthreads; i++) {
+		P_DEBUG("Placing core thread " << (i + 1) << " on NUMA node "
+			<< wo->numaPlacement[i].node << ", CPUs "
+			<< formatCpuList(wo->numaPlacement[i].cpus));
+	}
+}
+
+static void
+bindThreadToNumaPlacement(const string &threadName, const NumaThreadPlacement *placement) {
+	int e = bindCurrentThreadToNumaPlacement(*placement);
+	if (e != 0) {
+		P_WARN("Cannot bind " << threadName << " to NUMA node " << placement->node
+			<< ": " << strerror(e) << " (errno=" << e << ")");
+	}
+}
+
+/**
+ * Creates one load balancer per NUMA node, each of which only feeds the
+ * controllers on its own node. This way a client socket is accepted,
+ * and its buffers are allocated, on the same node as the thread that
+ * serves it.
+ */
+static void
+createNumaLoadBalancers() {
+	WorkingObjects *wo = workingObjects;
+	vector<NumaNode> nodes = discoverNumaTopology();
+
+	for (unsigned int n = 0; n < nodes.size(); n++) {
+		ServerKit::AcceptLoadBalancer<Controller> *loadBalancer = NULL;
+
+		for (unsigned int i = 0; i < wo->threadWorkingObjects.size(); i++) {
+			if (wo->numaPlacement[i].node != nodes[n].id) {
+				continue;
+			}
+			if (loadBalancer == NULL) {
+				loadBalancer = new ServerKit::AcceptLoadBalancer<Controller>();
+				loadBalancer->placement.node = nodes[n].id;
+				loadBalancer->placement.cpus = nodes[n].cpus;
+				wo->loadBalancers.push_back(loadBalancer);
+			}
+			loadBalancer->servers.push_back(wo->threadWorkingObjects[i].controller);
+		}
+	}
+}
+
 static void
 initializeNonPrivilegedWorkingObjects() {
 	TRACE_POINT();
@@ -598,17 +673,49 @@ initializeNonPrivilegedWorkingObjects() {
 	wo->appPool->initialize();
 	wo->appPool->setMax(options.getInt("max_pool_size"));
 	wo->appPool->setMaxIdleTime(options.getInt("pool_idle_time") * 1000000ULL);
+	wo->appPool->setRequestQueueShedding(
+		options.getUint("request_queue_shed_target") * 1000ULL,
+		options.getUint("request_queue_shed_interval") * 1000ULL);
+	if (options.getBool("autoscale")) {
+		AutoscalerConfig autoscalerConfig;
+		autoscalerConfig.targetQueueTime = options.getUint("autoscale_queue_target") * 1000ULL;
+		autoscalerConfig.maxHostCpuUsage = options.getUint("autoscale_max_host_cpu");
+		autoscalerConfig.minHostMemoryFree = options.getUint("autoscale_min_host_memory");
+		wo->appPool->setAutoscaling(true, autoscalerConfig);
+	}
+	wo->appPool->setMemoryPressureThreshold(options.getUint("memory_pressure_threshold"));
+	wo->appPool->setRollingRestarts(options.getBool("rolling_restarts"));
+	wo->appPool->setOobwBudget(options.getUint("oobw_budget"));
 	wo->appPool->enableSelfChecking(options.getBool("selfchecks"));
 	wo->appPool->abortLongRunningConnectionsCallback = abortLongRunningConnections;
 
+	UPDATE_TRACE_POINT();
+	if (options.getUint("data_buffer_memory_limit") > 0) {
+		wo->fileBufferedChannelMemoryTier = new ServerKit::FileBufferedChannelMemoryTier(
+			(boost::uint64_t) options.getUint("data_buffer_memory_limit") * 1024 * 1024);
+	}
+	wo->responseBufferAccount = new ServerKit::FileBufferedChannelAccount(
+		(boost::uint64_t) options.getUint("response_buffer_global_limit") * 1024 * 1024);
+
 	UPDATE_TRACE_POINT();
 	unsigned int nthreads = options.getInt("core_threads");
 	BackgroundEventLoop *firstLoop = NULL; // Avoid compiler warning
+	vector<unsigned int> mainThreadCpus;
+	if (options.getBool("core_numa_affine")) {
+		initializeNumaPlacement(nthreads);
+		mainThreadCpus = getCurrentThreadCpuAffinity();
+	}
 	wo->threadWorkingObjects.reserve(nthreads);
 	for (unsigned int i = 0; i < nthreads; i++) {
 		UPDATE_TRACE_POINT();
 		ThreadWorkingObjects two;
 
+		if (!wo->numaPlacement.empty()) {
+			// Temporarily move to the core thread's node while creating its
+			// objects, so that their memory is allocated on that node.
+			bindThreadToNumaPlacement("the main thread", &wo->numaPlacement[i]);
+		}
+
 		if (i == 0) {
 			two.bgloop = firstLoop = new BackgroundEventLoop(true, true);
 		} else {
@@ -623,14 +730,25 @@ initializeNonPrivilegedWorkingObjects() {
 			options.get("data_buffer_dir");
 		two.serverKitContext->defaultFileBufferedChannelConfig.threshold =
 			options.getUint("file_buffer_threshold");
+		two.serverKitContext->defaultFileBufferedChannelConfig.useIoUring =
+			options.getBool("core_io_uring");
+		two.serverKitContext->defaultFileBufferedChannelConfig.memoryTier =
+			wo->fileBufferedChannelMemoryTier;
+		if (!wo->numaPlacement.empty()) {
+			two.serverKitContext->numaNode = wo->numaPlacement[i].node;
+			two.serverKitContext->cpuAffinity = formatCpuList(wo->numaPlacement[i].cpus);
+		}
 
 		UPDATE_TRACE_POINT();
 		two.controller = new Core::Controller(two.serverKitContext, agentsOptions, i + 1);
 		two.controller->minSpareClients = 128;
 		two.controller->clientFreelistLimit = 1024;
+		two.controller->pipelineDepth = options.getUint("http_pipeline_depth");
+		two.controller->setClientParkingDelay(options.getUint("client_parking_delay"));
 		two.controller->resourceLocator = &wo->resourceLocator;
 		two.controller->appPool = wo->appPool;
 		two.controller->unionStationContext = wo->unionStationContext;
+		two.controller->responseBufferAccount = wo->responseBufferAccount;
 		two.controller->shutdownFinishCallback = controllerShutdownFinished;
 		two.controller->initialize();
 		wo->shutdownCounter.fetch_add(1, boost::memory_order_relaxed);
@@ -659,6 +777,10 @@ initializeNonPrivilegedWorkingObjects() {
 			options.get("data_buffer_dir");
 		awo->serverKitContext->defaultFileBufferedChannelConfig.threshold =
 			options.getUint("file_buffer_threshold");
+		awo->serverKitContext->defaultFileBufferedChannelConfig.useIoUring =
+			options.getBool("core_io_uring");
+		awo->serverKitContext->defaultFileBufferedChannelConfig.memoryTier =
+			wo->fileBufferedChannelMemoryTier;
 
 		UPDATE_TRACE_POINT();
 		awo->apiServer = new Core::ApiServer::ApiServer(awo->serverKitContext);
@@ -685,24 +807,40 @@ initializeNonPrivilegedWorkingObjects() {
 	 * while the old server would delete the file yet again shortly after.
 	 * This is especially noticeable on systems that heavily swap.
 	 */
+	if (nthreads > 1) {
+		if (wo->numaPlacement.empty()) {
+			ServerKit::AcceptLoadBalancer<Controller> *loadBalancer =
+				new ServerKit::AcceptLoadBalancer<Controller>();
+			wo->loadBalancers.push_back(loadBalancer);
+			loadBalancer->servers.reserve(nthreads);
+			for (unsigned int i = 0; i < nthreads; i++) {
+				ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
+				loadBalancer->servers.push_back(two->controller);
+			}
+		} else {
+			createNumaLoadBalancers();
+		}
+	}
 	for (unsigned int i = 0; i < addresses.size(); i++) {
 		if (nthreads == 1) {
 			ThreadWorkingObjects *two = &wo->threadWorkingObjects[0];
 			two->controller->listen(wo->serverFds[i]);
 		} else {
-			wo->loadBalancer.listen(wo->serverFds[i]);
+			for (unsigned int j = 0; j < wo->loadBalancers.size(); j++) {
+				wo->loadBalancers[j]->listen(wo->serverFds[i]);
+			}
 		}
 	}
 	for (unsigned int i = 0; i < nthreads; i++) {
 		ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
+		if (!wo->numaPlacement.empty()) {
+			bindThreadToNumaPlacement("the main thread", &wo->numaPlacement[i]);
+		}
 		two->controller->createSpareClients();
 	}
-	if (nthreads > 1) {
-		wo->loadBalancer.servers.reserve(nthreads);
-		for (unsigned int i = 0; i < nthreads; i++) {
-			ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
-			wo->loadBalancer.servers.push_back(two->controller);
-		}
+	if (!wo->numaPlacement.empty()) {
+		setCurrentThreadCpuAffinity(mainThreadCpus);
+		setCurrentThreadPreferredNumaNode(-1);
 	}
 	for (unsigned int i = 0; i < apiAddresses.size(); i++) {
 		wo->apiWorkingObjects.apiServer->listen(wo->apiServerFds[i]);
@@ -776,6 +914,17 @@ mainLoop() {
 	installDiagnosticsDumper(dumpDiagnosticsOnCrash, NULL);
 	for (unsigned int i = 0; i < wo->threadWorkingObjects.size(); i++) {
 		ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
+		if (!wo->numaPlacement.empty()) {
+			two->bgloop->start("Main event loop: thread " + toString(i + 1), 0);
+			two->bgloop->safe->runSync(boost::bind(bindThreadToNumaPlacement,
+				"core thread " + toString(i + 1), &wo->numaPlacement[i]));
+			continue;
+		}
+		#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
+			if (cpuAffine) {
+				two->serverKitContext->cpuAffinity = toString(i % maxCpus);
+			}
+		#endif
 		two->bgloop->start("Main event loop: thread " + toString(i + 1), 0);
 		#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
 			if (cpuAffine) {
@@ -798,8 +947,8 @@ mainLoop() {
 	if (wo->apiWorkingObjects.apiServer != NULL) {
 		wo->apiWorkingObjects.bgloop->start("API event loop", 0);
 	}
-	if (wo->threadWorkingObjects.size() > 1) {
-		wo->loadBalancer.start();
+	for (unsigned int i = 0; i < wo->loadBalancers.size(); i++) {
+		wo->loadBalancers[i]->start();
 	}
 	waitForExitEvent();
 }
@@ -905,8 +1054,8 @@ waitForExitEvent() {
 			ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
 			two->bgloop->safe->runLater(boost::bind(shutdownController, two));
 		}
-		if (wo->threadWorkingObjects.size() > 1) {
-			wo->loadBalancer.shutdown();
+		for (unsigned int i = 0; i < wo->loadBalancers.size(); i++) {
+			wo->loadBalancers[i]->shutdown();
 		}
 		if (wo->apiWorkingObjects.apiServer != NULL) {
 			wo->apiWorkingObjects.bgloop->safe->runLater(shutdownApiServer);
@@ -1079,6 +1228,7 @@ setAgentsOptionsDefaults() {
 	options.setDefault("environment", DEFAULT_APP_ENV);
 	options.setDefault("spawn_method", DEFAULT_SPAWN_METHOD);
 	options.setDefaultBool("load_shell_envvars", false);
+	options.setDefaultBool("preloader_warmup", false);
 	options.setDefaultBool("abort_websockets_on_process_shutdown", true);
 	options.setDefaultInt("force_max_concurrent_requests_per_process", -1);
 	options.setDefault("concurrency_model", DEFAULT_CONCURRENCY_MODEL);
@@ -1088,6 +1238,16 @@ setAgentsOptionsDefaults() {
 	options.setDefaultInt("min_instances", 1);
 	options.setDefaultInt("max_preloader_idle_time", DEFAULT_MAX_PRELOADER_IDLE_TIME);
 	options.setDefaultUint("max_request_queue_size", DEFAULT_MAX_REQUEST_QUEUE_SIZE);
+	options.setDefaultUint("request_queue_shed_target", 0);
+	options.setDefaultUint("request_queue_shed_interval", 100);
+	options.setDefaultUint("private_memory_limit", 0);
+	options.setDefaultUint("private_memory_growth_limit", 0);
+	options.setDefaultUint("memory_pressure_threshold", 10);
+	options.setDefaultUint("oobw_budget", 10);
+	options.setDefaultBool("autoscale", false);
+	options.setDefaultUint("autoscale_queue_target", 100);
+	options.setDefaultUint("autoscale_max_host_cpu", 90);
+	options.setDefaultUint("autoscale_min_host_memory", 10);
 	options.setDefaultUint("stat_throttle_rate", DEFAULT_STAT_THROTTLE_RATE);
 	options.setDefault("server_software", SERVER_TOKEN_NAME "/" PASSENGER_VERSION);
 	options.setDefaultBool("show_version_in_header", true);
@@ -1096,11 +1256,18 @@ setAgentsOptionsDefaults() {
 	options.setDefaultBool("turbocaching", true);
 	options.setDefault("data_buffer_dir", getSystemTempDir());
 	options.setDefaultUint("file_buffer_threshold", DEFAULT_FILE_BUFFERED_CHANNEL_THRESHOLD);
+	options.setDefaultBool("core_io_uring", true);
+	options.setDefaultBool("core_splice_tunneling", true);
+	options.setDefaultUint("data_buffer_memory_limit", 0);
 	options.setDefaultInt("response_buffer_high_watermark", DEFAULT_RESPONSE_BUFFER_HIGH_WATERMARK);
+	options.setDefaultUint("response_buffer_global_limit", 0);
+	options.setDefaultUint("http_pipeline_depth", 0);
+	options.setDefaultUint("client_parking_delay", 10);
 	options.setDefaultBool("selfchecks", false);
 	options.setDefaultBool("core_graceful_exit", true);
 	options.setDefaultInt("core_threads", boost::thread::hardware_concurrency());
 	options.setDefaultBool("core_cpu_affine", false);
+	options.setDefaultBool("core_numa_affine", false);
 	options.setDefault("friendly_error_pages", "auto");
 	options.setDefaultBool("rolling_restarts", false);
 	options.setDefaultBool("resist_deployment_errors", false);
@@ -98,6 +98,8 @@ coreUsage() {
 	printf("      --spawn-method NAME   Spawn method to use. Can either be 'smart' or\n");
 	printf("                            'direct'. Default: %s\n", DEFAULT_SPAWN_METHOD);
 	printf("      --load-shell-envvars  Load shell startup files before loading application\n");
+	printf("      --preloader-warmup    Let preloaders warm up and compact their memory\n");
+	printf("                            before forking, for better copy-on-write sharing\n");
 	printf("      --concurrency-model   The concurrency model to use for the app, either\n");
 	printf("                            'process' or 'thread' (Enterprise only).\n");
 	printf("                            Default: " DEFAULT_CONCURRENCY_MODEL "\n");
@@ -122,7 +124,8 @@ coreUsage() {
 	printf("                            Set custom file descriptor ulimit for the app\n");
 	printf("      --debugger            Enable Ruby debugger support (Enterprise only)\n");
 	printf("\n");
-	printf("      --rolling-restarts    Enable rolling restarts (Enterprise only)\n");
+	printf("      --rolling-restarts    Restart applications by replacing their processes\n");
+	printf("                            in batches, instead of all at once\n");
 	printf("      --resist-deployment-errors\n");
 	printf("                            Enable deployment error resistance (Enterprise only)\n");
 	printf("\n");
@@ -143,6 +146,21 @@ coreUsage() {
 	printf("      --min-instances N     Minimum number of application processes. Default: 1\n");
 	printf("      --memory-limit MB     Restart application processes that go over the\n");
     printf("                            given memory limit (Enterprise only)\n");
+	printf("      --private-memory-limit MB\n");
+	printf("                            Replace application processes whose private\n");
+	printf("                            memory exceeds this limit. Default: 0 (unlimited)\n");
+	printf("      --private-memory-growth-limit MB\n");
+	printf("                            Replace application processes whose private\n");
+	printf("                            memory grows by more than this many MB per hour.\n");
+	printf("                            Default: 0 (unlimited)\n");
+	printf("      --memory-pressure-threshold PERCENT\n");
+	printf("                            When less than this much host memory is free,\n");
+	printf("                            prefer shutting down the processes that use the\n");
+	printf("                            most memory when freeing capacity. Default: 10\n");
+	printf("      --oobw-budget PERCENT\n");
+	printf("                            Let at most this percentage of an application's\n");
+	printf("                            processes perform out-of-band work at the same\n");
+	printf("                            time (at least 1). 0 means no limit. Default: 10\n");
 	printf("\n");
 	printf("Request handling options (optional):\n");
 	printf("      --max-request-time    Abort requests that take too much time (Enterprise\n");
@@ -150,6 +168,25 @@ coreUsage() {
 	printf("      --max-request-queue-size NUMBER\n");
 	printf("                            Specify request queue size. Default: %d\n",
 		DEFAULT_MAX_REQUEST_QUEUE_SIZE);
+	printf("      --request-queue-shed-target MSEC\n");
+	printf("                            Enable adaptive request queue shedding: under\n");
+	printf("                            sustained overload, shed queued requests after\n");
+	printf("                            this many milliseconds. Default: 0 (disabled)\n");
+	printf("      --request-queue-shed-interval MSEC\n");
+	printf("                            How long the request queue must stay non-empty\n");
+	printf("                            before it counts as overloaded. Default: 100\n");
+	printf("      --autoscale           Automatically raise and lower the process limit\n");
+	printf("                            of each application, within its configured\n");
+	printf("                            limits, based on queue time and utilization\n");
+	printf("      --autoscale-queue-target MSEC\n");
+	printf("                            Queue time above which an application is\n");
+	printf("                            considered overloaded. Default: 100\n");
+	printf("      --autoscale-max-host-cpu PERCENT\n");
+	printf("                            Do not grow applications while host CPU usage\n");
+	printf("                            is at least this high. Default: 90\n");
+	printf("      --autoscale-min-host-memory PERCENT\n");
+	printf("                            Shrink applications while less than this much\n");
+	printf("                            host memory is free. Default: 10\n");
 	printf("      --sticky-sessions     Enable sticky sessions\n");
 	printf("      --sticky-sessions-cookie-name NAME\n");
 	printf("                            Cookie name to use for sticky sessions.\n");
@@ -175,6 +212,30 @@ coreUsage() {
 	printf("      --data-buffer-dir PATH\n");
 	printf("                            Directory to store data buffers in. Default:\n");
 	printf("                            %s\n", getSystemTempDir());
+	printf("      --data-buffer-memory-limit MB\n");
+	printf("                            Before spilling large request and response bodies\n");
+	printf("                            to the data buffer dir, buffer them in memory up to\n");
+	printf("                            this many MB in total. Default: 0 (disabled)\n");
+	printf("      --response-buffer-global-limit MB\n");
+	printf("                            When the response data buffered for all clients\n");
+	printf("                            together exceeds this many MB, stop reading from\n");
+	printf("                            the applications of the clients that buffer more\n");
+	printf("                            than their fair share. Default: 0 (unlimited)\n");
+	printf("      --http-pipeline-depth N\n");
+	printf("                            Handle the pipelined requests of a keep-alive\n");
+	printf("                            client concurrently, while up to N earlier\n");
+	printf("                            requests are still in progress. Responses are\n");
+	printf("                            sent in request order. Default: 0\n");
+	printf("      --client-parking-delay SECONDS\n");
+	printf("                            Release the memory of keep-alive clients that\n");
+	printf("                            have been idle for this many seconds, keeping\n");
+	printf("                            only their connections until they send the next\n");
+	printf("                            request. Default: 10 (0 disables parking)\n");
+	printf("      --disable-io-uring    Do not use io_uring for data buffer file I/O,\n");
+	printf("                            even if the kernel supports it\n");
+	printf("      --disable-splice      Relay the data of upgraded connections (e.g.\n");
+	printf("                            WebSockets) through user space buffers instead\n");
+	printf("                            of with splice()\n");
 	printf("      --no-graceful-exit    When exiting, exit immediately instead of waiting\n");
 	printf("                            for all connections to terminate\n");
 	printf("      --benchmark MODE      Enable benchmark mode. Available modes:\n");
@@ -187,6 +248,9 @@ coreUsage() {
 	printf("                            Default: number of CPU cores (%d)\n",
 		boost::thread::hardware_concurrency());
 	printf("      --cpu-affine          Enable per-thread CPU affinity (Linux only)\n");
+	printf("      --numa-affine         Bind threads and their memory to NUMA nodes\n");
+	printf("                            (Linux only). Combine with --cpu-affine to also\n");
+	printf("                            pin each thread to a single CPU in its node\n");
 	printf("      --core-file-descriptor-ulimit NUMBER\n");
 	printf("                            Set custom file descriptor ulimit for the core\n");
 	printf("  -h, --help                Show this help\n");
@@ -286,6 +350,18 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--memory-limit")) {
 		options.setInt("memory_limit", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--private-memory-limit")) {
+		options.setUint("private_memory_limit", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--private-memory-growth-limit")) {
+		options.setUint("private_memory_growth_limit", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--memory-pressure-threshold")) {
+		options.setUint("memory_pressure_threshold", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--oobw-budget")) {
+		options.setUint("oobw_budget", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], 'e', "--environment")) {
 		options.set("environment", argv[i + 1]);
 		i += 2;
@@ -301,6 +377,9 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isFlag(argv[i], '\0', "--load-shell-envvars")) {
 		options.setBool("load_shell_envvars", true);
 		i++;
+	} else if (p.isFlag(argv[i], '\0', "--preloader-warmup")) {
+		options.setBool("preloader_warmup", true);
+		i++;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--concurrency-model")) {
 		options.set("concurrency_model", argv[i + 1]);
 		i += 2;
@@ -322,6 +401,24 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--max-request-queue-size")) {
 		options.setInt("max_request_queue_size", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--request-queue-shed-target")) {
+		options.setUint("request_queue_shed_target", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--request-queue-shed-interval")) {
+		options.setUint("request_queue_shed_interval", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--autoscale")) {
+		options.setBool("autoscale", true);
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--autoscale-queue-target")) {
+		options.setUint("autoscale_queue_target", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--autoscale-max-host-cpu")) {
+		options.setUint("autoscale_max_host_cpu", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--autoscale-min-host-memory")) {
+		options.setUint("autoscale_min_host_memory", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--sticky-sessions")) {
 		options.setBool("sticky_sessions", true);
 		i++;
@@ -385,6 +482,24 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--data-buffer-dir")) {
 		options.setInt("data_buffer_dir", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--data-buffer-memory-limit")) {
+		options.setUint("data_buffer_memory_limit", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--response-buffer-global-limit")) {
+		options.setUint("response_buffer_global_limit", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--http-pipeline-depth")) {
+		options.setUint("http_pipeline_depth", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--client-parking-delay")) {
+		options.setUint("client_parking_delay", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--disable-io-uring")) {
+		options.setBool("core_io_uring", false);
+		i++;
+	} else if (p.isFlag(argv[i], '\0', "--disable-splice")) {
+		options.setBool("core_splice_tunneling", false);
+		i++;
 	} else if (p.isFlag(argv[i], '\0', "--no-graceful-exit")) {
 		options.setBool("core_graceful_exit", false);
 		i++;
@@ -400,6 +515,9 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isFlag(argv[i], '\0', "--cpu-affine")) {
 		options.setBool("core_cpu_affine", true);
 		i++;
+	} else if (p.isFlag(argv[i], '\0', "--numa-affine")) {
+		options.setBool("core_numa_affine", true);
+		i++;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--core-file-descriptor-ulimit")) {
 		options.setUint("core_file_descriptor_ulimit", atoi(argv[i + 1]));
 		i += 2;
@@ -36,6 +36,7 @@
 #include <Exceptions.h>
 #include <Utils/VariantMap.h>
 #include <Core/UnionStation/Context.h>
+#include <Core/SpawningKit/NegotiationLoop.h>
 
 namespace Passenger {
 namespace ApplicationPool2 {
@@ -68,6 +69,7 @@ struct Config {
 	// Used by SmartSpawner and DirectSpawner.
 	RandomGeneratorPtr randomGenerator;
 	string instanceDir;
+	NegotiationLoopPtr negotiationLoop;
 
 	// Used by DummySpawner and SpawnerFactory.
 	unsigned int concurrency;
@@ -98,6 +100,9 @@ struct Config {
 		if (randomGenerator == NULL) {
 			randomGenerator = boost::make_shared<RandomGenerator>();
 		}
+		if (negotiationLoop == NULL) {
+			negotiationLoop = boost::make_shared<NegotiationLoop>();
+		}
 	}
 };
 
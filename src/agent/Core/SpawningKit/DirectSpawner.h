@@ -107,10 +107,21 @@ private:
 		return NULL;
 	}
 
-	void detachProcess(pid_t pid) {
+	static void detachProcess(pid_t pid) {
 		startBackgroundThread(detachProcessMain, (void *) (long) pid);
 	}
 
+	/**
+	 * Used as the abort handler of negotiations, which runs on the
+	 * negotiation loop, so the process is reaped in the background
+	 * instead of waiting for it to exit.
+	 */
+	static void killAndDetachProcess(pid_t pid) {
+		this_thread::disable_syscall_interruption dsi;
+		syscalls::kill(pid, SIGKILL);
+		detachProcess(pid);
+	}
+
 	vector<string> createCommand(const Options &options, const SpawnPreparationInfo &preparation,
 		shared_array<const char *> &args) const
 	{
@@ -153,13 +164,14 @@ public:
 		: Spawner(_config)
 		{ }
 
-	virtual Result spawn(const Options &options) {
+	virtual void asyncSpawn(const Options &options, const SpawnCallback &callback) {
 		TRACE_POINT();
 		this_thread::disable_interruption di;
 		this_thread::disable_syscall_interruption dsi;
 		P_DEBUG("Spawning new process: appRoot=" << options.appRoot);
 		possiblyRaiseInternalError(options);
 
+		unsigned long long spawnStartTime = SystemTime::getUsec();
 		shared_array<const char *> args;
 		SpawnPreparationInfo preparation = prepareSpawn(options);
 		vector<string> command = createCommand(options, preparation, args);
@@ -232,34 +244,23 @@ public:
 
 			NegotiationDetails details;
 			details.preparation = &preparation;
-			details.stderrCapturer =
-				boost::make_shared<BackgroundIOCapturer>(
-					errorPipe.first,
-					pid,
-					// The cast works around a compilation problem in Clang.
-					(const char *) "stderr");
-			details.stderrCapturer->start();
 			details.pid = pid;
 			details.adminSocket = adminSocket.second;
 			details.io = BufferedIO(adminSocket.second);
 			details.errorPipe = errorPipe.first;
 			details.options = &options;
 			details.debugDir = debugDir;
+			details.spawnStartTime = spawnStartTime;
+			details.forkTime = SystemTime::getUsec();
 
+			// From here on the negotiation loop owns the process: it kills
+			// the process if negotiation fails, and reaps it in the
+			// background if negotiation succeeds.
 			UPDATE_TRACE_POINT();
-			Result result;
-			{
-				this_thread::restore_interruption ri(di);
-				this_thread::restore_syscall_interruption rsi(dsi);
-				result = negotiateSpawn(details);
-			}
-
-			UPDATE_TRACE_POINT();
-			detachProcess(result["pid"].asInt());
 			guard.clear();
-			P_DEBUG("Process spawning done: appRoot=" << options.appRoot <<
-				", pid=" << result["pid"].asInt());
-			return result;
+			startNegotiation(details, callback,
+				boost::bind(killAndDetachProcess, pid),
+				detachProcess);
 		}
 	}
 };
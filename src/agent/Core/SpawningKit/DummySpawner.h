@@ -71,6 +71,9 @@ public:
 		result["gupid"] = "gupid-" + toString(number);
 		result["spawner_creation_time"] = (Json::UInt64) SystemTime::getUsec();
 		result["spawn_start_time"] = (Json::UInt64) SystemTime::getUsec();
+		result["spawn_fork_duration"] = 0;
+		result["spawn_app_load_duration"] = (Json::UInt64) config->spawnTime;
+		result["spawn_socket_ready_duration"] = 0;
 		result["sockets"].append(socket);
 		result.adminSocket = adminSocket.second;
 
@@ -0,0 +1,88 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SPAWNING_KIT_NEGOTIATION_LOOP_H_
+#define _PASSENGER_SPAWNING_KIT_NEGOTIATION_LOOP_H_
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <oxt/backtrace.hpp>
+
+#include <BackgroundEventLoop.h>
+#include <SafeLibev.h>
+
+namespace Passenger {
+namespace SpawningKit {
+
+using namespace std;
+
+
+/**
+ * The event loop on which DirectSpawner and SmartSpawner negotiate with the
+ * processes that they have spawned. All spawners that share a Config share
+ * this loop, so a spawn that is waiting for its process to finish loading
+ * does not occupy a thread. The loop thread is started the first time it
+ * is needed.
+ */
+class NegotiationLoop: public boost::noncopyable {
+private:
+	mutable boost::mutex syncher;
+	boost::scoped_ptr<BackgroundEventLoop> bgloop;
+
+public:
+	~NegotiationLoop() {
+		if (bgloop != NULL) {
+			bgloop->stop();
+		}
+	}
+
+	/**
+	 * Returns the loop, starting it if it isn't running yet.
+	 */
+	BackgroundEventLoop *get() {
+		TRACE_POINT();
+		boost::lock_guard<boost::mutex> l(syncher);
+		if (bgloop == NULL) {
+			bgloop.reset(new BackgroundEventLoop(false, false));
+			bgloop->start("Spawn negotiation loop");
+		}
+		return bgloop.get();
+	}
+
+	bool isStarted() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return bgloop != NULL;
+	}
+};
+
+typedef boost::shared_ptr<NegotiationLoop> NegotiationLoopPtr;
+
+
+} // namespace SpawningKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SPAWNING_KIT_NEGOTIATION_LOOP_H_ */
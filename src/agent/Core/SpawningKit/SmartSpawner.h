@@ -69,7 +69,7 @@ private:
 	map<string, string> preloaderAnnotations;
 	Options options;
 
-	// Protects m_lastUsed and pid.
+	// Protects m_lastUsed, pid and preloaderAnnotations.
 	mutable boost::mutex simpleFieldSyncher;
 	// Protects everything else.
 	mutable boost::mutex syncher;
@@ -314,7 +314,10 @@ private:
 			watcher->initialize();
 			watcher->start();
 
-			preloaderAnnotations = debugDir->readAll();
+			{
+				boost::lock_guard<boost::mutex> l(simpleFieldSyncher);
+				preloaderAnnotations = debugDir->readAll();
+			}
 			P_INFO("Preloader for " << options.appRoot <<
 				" started on PID " << pid <<
 				", listening on " << socketAddress);
@@ -633,6 +636,7 @@ private:
 
 		details.preparation = &preparation;
 		details.options = &options;
+		details.spawnStartTime = SystemTime::getUsec();
 
 		try {
 			sendSpawnCommand(details);
@@ -720,12 +724,16 @@ private:
 			details.pid = spawnedPid;
 			details.adminSocket = fd;
 			details.io = io;
+			details.forkTime = SystemTime::getUsec();
 
 		} else if (result == "Error\n") {
+			// The negotiation that asyncSpawn() starts reads the error
+			// report that follows, just like it would for a process that
+			// reports an error during startup.
 			UPDATE_TRACE_POINT();
+			details.adminSocket = fd;
 			details.io = io;
-			details.timeout = timeout;
-			handleSpawnErrorResponse(details);
+			details.io.unread("!> Error\n");
 
 		} else {
 			UPDATE_TRACE_POINT();
@@ -748,6 +756,7 @@ private:
 protected:
 	virtual void annotateAppSpawnException(SpawnException &e, NegotiationDetails &details) {
 		Spawner::annotateAppSpawnException(e, details);
+		boost::lock_guard<boost::mutex> l(simpleFieldSyncher);
 		e.addAnnotations(preloaderAnnotations);
 	}
 
@@ -768,11 +777,12 @@ public:
 	}
 
 	virtual ~SmartSpawner() {
+		cancelAsyncSpawns();
 		boost::lock_guard<boost::mutex> l(syncher);
 		stopPreloader();
 	}
 
-	virtual Result spawn(const Options &options) {
+	virtual void asyncSpawn(const Options &options, const SpawnCallback &callback) {
 		TRACE_POINT();
 		assert(options.appType == this->options.appType);
 		assert(options.appRoot == this->options.appRoot);
@@ -784,6 +794,12 @@ public:
 			boost::lock_guard<boost::mutex> l(simpleFieldSyncher);
 			m_lastUsed = SystemTime::getUsec();
 		}
+		// Talking to the preloader must be serialized, but once it has forked
+		// the process, the negotiation with that process happens on the
+		// negotiation loop, so that a process that takes a while to finish
+		// loading does not hold up other spawns and cleanups. The negotiation
+		// copies the preparation info because restarting the preloader
+		// resets it.
 		UPDATE_TRACE_POINT();
 		boost::lock_guard<boost::mutex> l(syncher);
 		if (!preloaderStarted()) {
@@ -793,10 +809,7 @@ public:
 
 		UPDATE_TRACE_POINT();
 		NegotiationDetails details = sendSpawnCommandAndGetNegotiationDetails(options);
-		Result result = negotiateSpawn(details);
-		P_DEBUG("Process spawning done: appRoot=" << options.appRoot <<
-			", pid=" << result["pid"].asInt());
-		return result;
+		startNegotiation(details, callback);
 	}
 
 	virtual bool cleanable() const {
@@ -56,14 +56,17 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include <utility>
 #include <algorithm>
 #include <boost/make_shared.hpp>
 #include <boost/shared_array.hpp>
 #include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/foreach.hpp>
 #include <boost/move/move.hpp>
+#include <boost/thread.hpp>
 #include <oxt/system_calls.hpp>
 #include <oxt/backtrace.hpp>
 #include <sys/types.h>
@@ -78,9 +81,12 @@
 #include <pwd.h>
 #include <grp.h>
 #include <dirent.h>
+#include <ev.h>
 #include <adhoc_lve.h>
 #include <modp_b64.h>
 #include <FileDescriptor.h>
+#include <BackgroundEventLoop.h>
+#include <SafeLibev.h>
 #include <Exceptions.h>
 #include <StaticString.h>
 #include <Utils.h>
@@ -109,6 +115,12 @@ using namespace boost;
 using namespace oxt;
 
 
+/**
+ * Called when an asynchronous spawn has finished. Upon failure, `e` describes
+ * the error; it is only valid during the call. Upon success, `e` is NULL.
+ */
+typedef boost::function<void (const Result &result, const SpawnException *e)> SpawnCallback;
+
 class Spawner {
 protected:
 	friend struct tut::ApplicationPool2_DirectSpawnerTest;
@@ -225,35 +237,150 @@ protected:
 		 * by security validators to check whether the information sent back by the
 		 * process make any sense. */
 		SpawnPreparationInfo *preparation;
-		/** This object captures the process's stderr while negotiation is in progress.
-		 * (Recall that negotiation is performed over the process's stdout while stderr
-		 * is used purely for outputting messages.)
-		 * If the negotiation protocol fails, then any output captured by this object
-		 * will be stored into the resulting SpawnException's error page. */
-		BackgroundIOCapturerPtr stderrCapturer;
 		/** The PID of the process we're negotiating with. */
 		pid_t pid;
 		FileDescriptor adminSocket;
+		/** If set, the process's stderr is captured while negotiation is in progress.
+		 * (Recall that negotiation is performed over the process's stdout while stderr
+		 * is used purely for outputting messages.) */
 		FileDescriptor errorPipe;
 		const Options *options;
 		DebugDirPtr debugDir;
 
 		/****** Working state ******/
+		/** Negotiation starts with any data that is already buffered in here. */
 		BufferedIO io;
 		string gupid;
+		/** Captured stderr output, plus anything the process has written to
+		 * stdout that isn't part of the protocol. If the negotiation protocol
+		 * fails, then this is stored into the resulting SpawnException's
+		 * error page. */
+		string stderrOutput;
+		/** Times at which spawning began, at which the process was forked,
+		 * and at which the process reported that it has finished loading the
+		 * application. Used for timing the spawn phases. Spawners that know
+		 * when spawning began or when the process was forked may set the first
+		 * two before negotiating; otherwise `negotiateSpawn()` sets them.
+		 * Microseconds resolution. */
 		unsigned long long spawnStartTime;
-		unsigned long long timeout;
+		unsigned long long forkTime;
+		unsigned long long readyTime;
 
 		NegotiationDetails() {
 			preparation = NULL;
 			pid = 0;
 			options = NULL;
 			spawnStartTime = 0;
-			timeout = 0;
+			forkTime = 0;
+			readyTime = 0;
 		}
 	};
 
+	/**
+	 * Working state of a negotiation that runs on the negotiation loop
+	 * (see NegotiationLoop.h). It doesn't block a thread until the process
+	 * has finished loading. Instead, libev watchers read the process's
+	 * responses, write the spawn request and capture the process's stderr.
+	 * Only accessed on the negotiation loop thread, except for being
+	 * registered in `Spawner::negotiations` when it is scheduled.
+	 */
+	struct AsyncNegotiation {
+		enum State {
+			READING_HANDSHAKE,
+			READING_RESPONSE_TYPE,
+			READING_STARTUP_RESPONSE,
+			READING_ERROR_RESPONSE,
+			READING_ERROR_MESSAGE,
+			DRAINING_STDERR,
+			DONE
+		};
+
+		/****** Arguments ******/
+		Spawner *spawner;
+		Options options;
+		SpawnPreparationInfo preparation;
+		NegotiationDetails details;
+		SpawnCallback callback;
+		/** Called if negotiation fails or is cancelled. */
+		boost::function<void ()> abortHandler;
+		/** Called with the PID of the process if negotiation succeeds. */
+		boost::function<void (pid_t pid)> successHandler;
+
+		/****** Working state ******/
+		State state;
+		/** Whether beginNegotiation() has been called. */
+		bool begun;
+		/**
+		 * Set if the negotiation was cancelled before it had begun. The
+		 * negotiation is then deleted when its turn comes on the loop.
+		 */
+		bool cancelled;
+		struct ev_loop *loop;
+		ev_io adminSocketReader;
+		ev_io adminSocketWriter;
+		ev_io errorPipeReader;
+		ev_timer timer;
+		/** Data read from the admin socket that hasn't been processed yet. */
+		string input;
+		/** Data that hasn't been written to the admin socket yet. */
+		string output;
+		bool adminSocketEof;
+		Json::Value sockets;
+		map<string, string> errorAttributes;
+		string errorMessage;
+		string failureMessage;
+		SpawnException::ErrorKind failureKind;
+
+		/****** Outcome ******/
+		Result result;
+		boost::shared_ptr<SpawnException> exception;
+
+		AsyncNegotiation(Spawner *_spawner, const NegotiationDetails &_details,
+			const SpawnCallback &_callback)
+			: spawner(_spawner),
+			  options(_details.options->copyAndPersist()),
+			  preparation(*_details.preparation),
+			  details(_details),
+			  callback(_callback),
+			  state(READING_HANDSHAKE),
+			  begun(false),
+			  cancelled(false),
+			  loop(NULL),
+			  adminSocketEof(false),
+			  failureKind(SpawnException::UNDEFINED_ERROR)
+		{
+			details.options = &options;
+			details.preparation = &preparation;
+		}
+	};
+
+	/**
+	 * Lets a thread wait for the outcome of an asynchronous spawn.
+	 */
+	struct SpawnTicket {
+		boost::mutex syncher;
+		boost::condition_variable cond;
+		bool done;
+		Result result;
+		boost::shared_ptr<SpawnException> exception;
+
+		SpawnTicket()
+			: done(false)
+			{ }
+	};
+
+	typedef boost::shared_ptr<SpawnTicket> SpawnTicketPtr;
+	typedef void (Spawner::*NegotiationStep)(AsyncNegotiation *negotiation);
+
 private:
+	/**
+	 * Negotiations that have been scheduled and haven't finished yet,
+	 * including those that are still waiting for their turn on the
+	 * negotiation loop. Protected by `negotiationsSyncher`.
+	 */
+	set<AsyncNegotiation *> negotiations;
+	boost::mutex negotiationsSyncher;
+
 	/**
 	 * Appends key + "\0" + value + "\0" to 'output'.
 	 */
@@ -266,163 +393,678 @@ private:
 		output.append(1, '\0');
 	}
 
-	void sendSpawnRequest(NegotiationDetails &details) {
+	string createSpawnRequest(const NegotiationDetails &details) const {
 		TRACE_POINT();
-		try {
-			const size_t UNIX_PATH_MAX = sizeof(((struct sockaddr_un *) 0)->sun_path);
-			string data = "You have control 1.0\n"
-				"passenger_root: " + config->resourceLocator->getInstallSpec() + "\n"
-				"passenger_version: " PASSENGER_VERSION "\n"
-				"ruby_libdir: " + config->resourceLocator->getRubyLibDir() + "\n"
-				"gupid: " + details.gupid + "\n"
-				"UNIX_PATH_MAX: " + toString(UNIX_PATH_MAX) + "\n";
-			if (!details.options->apiKey.empty()) {
-				data.append("connect_password: " + details.options->apiKey + "\n");
-			}
-			if (!config->instanceDir.empty()) {
-				data.append("instance_dir: " + config->instanceDir + "\n");
-				data.append("socket_dir: " + config->instanceDir + "/apps.s\n");
+		const size_t UNIX_PATH_MAX = sizeof(((struct sockaddr_un *) 0)->sun_path);
+		string data = "You have control 1.0\n"
+			"passenger_root: " + config->resourceLocator->getInstallSpec() + "\n"
+			"passenger_version: " PASSENGER_VERSION "\n"
+			"ruby_libdir: " + config->resourceLocator->getRubyLibDir() + "\n"
+			"gupid: " + details.gupid + "\n"
+			"UNIX_PATH_MAX: " + toString(UNIX_PATH_MAX) + "\n";
+		if (!details.options->apiKey.empty()) {
+			data.append("connect_password: " + details.options->apiKey + "\n");
+		}
+		if (!config->instanceDir.empty()) {
+			data.append("instance_dir: " + config->instanceDir + "\n");
+			data.append("socket_dir: " + config->instanceDir + "/apps.s\n");
+		}
+
+		vector<string> args;
+		vector<string>::const_iterator it, end;
+		details.options->toVector(args, *config->resourceLocator, Options::SPAWN_OPTIONS);
+		for (it = args.begin(); it != args.end(); it++) {
+			const string &key = *it;
+			it++;
+			const string &value = *it;
+			data.append(key + ": " + value + "\n");
+		}
+
+		vector<StaticString> lines;
+		split(data, '\n', lines);
+		foreach (const StaticString line, lines) {
+			P_DEBUG("[App " << details.pid << " stdin >>] " << line);
+		}
+		data.append("\n");
+		return data;
+	}
+
+	void sendSpawnRequest(AsyncNegotiation *negotiation) {
+		TRACE_POINT();
+		bool writing = !negotiation->output.empty();
+		negotiation->output.append(createSpawnRequest(negotiation->details));
+		if (!writing) {
+			writeAdminSocket(negotiation);
+		}
+	}
+
+	void handleStartupResponseLine(AsyncNegotiation *negotiation, const string &line) {
+		TRACE_POINT();
+		NegotiationDetails &details = negotiation->details;
+
+		if (line.empty()) {
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application. It unexpected closed the connection while "
+				"sending its startup response.",
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			return;
+		} else if (line[line.size() - 1] != '\n') {
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application. It sent a line without a newline character "
+				"in its startup response.",
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			return;
+		} else if (line == "\n") {
+			if (!hasSessionSockets(negotiation->sockets)) {
+				failNegotiation(negotiation, "An error occured while starting the web "
+					"application. It did not advertise any session sockets.",
+					SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			} else {
+				negotiation->result = createSpawnResult(details, negotiation->sockets);
+				negotiation->state = AsyncNegotiation::DONE;
 			}
+			return;
+		}
 
+		string::size_type pos = line.find(": ");
+		if (pos == string::npos) {
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application. It sent a startup response line without "
+				"separator.",
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			return;
+		}
+
+		string key = line.substr(0, pos);
+		string value = line.substr(pos + 2, line.size() - pos - 3);
+		if (key == "socket") {
+			// socket: <name>;<address>;<protocol>;<concurrency>
+			// TODO: in case of TCP sockets, check whether it points to localhost
+			// TODO: in case of unix sockets, check whether filename is absolute
+			// and whether owner is correct
 			vector<string> args;
-			vector<string>::const_iterator it, end;
-			details.options->toVector(args, *config->resourceLocator, Options::SPAWN_OPTIONS);
-			for (it = args.begin(); it != args.end(); it++) {
-				const string &key = *it;
-				it++;
-				const string &value = *it;
-				data.append(key + ": " + value + "\n");
+			split(value, ';', args);
+			if (args.size() == 4) {
+				string error = validateSocketAddress(details, args[1]);
+				if (!error.empty()) {
+					failNegotiation(negotiation,
+						"An error occurred while starting the web application. " + error,
+						SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+					return;
+				}
+
+				Json::Value socket;
+				socket["name"] = args[0];
+				socket["address"] = fixupSocketAddress(*details.options, args[1]);
+				socket["protocol"] = args[2];
+				socket["concurrency"] = atoi(args[3]);
+				negotiation->sockets.append(socket);
+			} else {
+				failNegotiation(negotiation, "An error occurred while starting the "
+					"web application. It reported a wrongly formatted 'socket'"
+					"response value: '" + value + "'",
+					SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			}
+		} else if (key == "pid") {
+			// pid: <PID>
+			pid_t pid = atoi(value);
+			ProcessMetricsCollector collector;
+			vector<pid_t> pids;
+
+			pids.push_back(pid);
+			ProcessMetricMap metrics = collector.collect(pids);
+			if (metrics[pid].uid != details.preparation->userSwitching.uid) {
+				failNegotiation(negotiation, "An error occurred while starting the "
+					"web application. The PID that the loader has returned does "
+					"not have the same UID as the loader itself.",
+					SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+				return;
 			}
+			details.pid = pid;
+		} else {
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application. It sent an unknown startup response line "
+				"called '" + key + "'.",
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+		}
+	}
 
-			vector<StaticString> lines;
-			split(data, '\n', lines);
-			foreach (const StaticString line, lines) {
-				P_DEBUG("[App " << details.pid << " stdin >>] " << line);
+	void handleErrorResponseLine(AsyncNegotiation *negotiation, const string &line) {
+		TRACE_POINT();
+		if (line.empty()) {
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application. It unexpected closed the connection while "
+				"sending its startup response.",
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			return;
+		} else if (line[line.size() - 1] != '\n') {
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application. It sent a line without a newline character "
+				"in its startup response.",
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			return;
+		} else if (line == "\n") {
+			negotiation->state = AsyncNegotiation::READING_ERROR_MESSAGE;
+			return;
+		}
+
+		string::size_type pos = line.find(": ");
+		if (pos == string::npos) {
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application. It sent a startup response line without "
+				"separator.",
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			return;
+		}
+
+		string key = line.substr(0, pos);
+		string value = line.substr(pos + 2, line.size() - pos - 3);
+		negotiation->errorAttributes[key] = value;
+	}
+
+	/**
+	 * Handles a protocol line, with the "!> " prefix removed. An empty
+	 * line means that the process has closed the admin socket.
+	 */
+	void handleNegotiationLine(AsyncNegotiation *negotiation, const string &line) {
+		TRACE_POINT();
+		switch (negotiation->state) {
+		case AsyncNegotiation::READING_HANDSHAKE:
+			if (line == "I have control 1.0\n") {
+				negotiation->state = AsyncNegotiation::READING_RESPONSE_TYPE;
+				sendSpawnRequest(negotiation);
+			} else if (line == "Error\n") {
+				negotiation->state = AsyncNegotiation::READING_ERROR_RESPONSE;
+			} else {
+				failWithInvalidSpawnResponseType(negotiation, line);
 			}
-			writeExact(details.adminSocket, data, &details.timeout);
-			writeExact(details.adminSocket, "\n", &details.timeout);
-		} catch (const SystemException &e) {
-			if (e.code() == EPIPE) {
-				/* Ignore this. Process might have written an
-				 * error response before reading the arguments,
-				 * in which case we'll want to show that instead.
-				 */
+			break;
+		case AsyncNegotiation::READING_RESPONSE_TYPE:
+			if (line == "Ready\n") {
+				negotiation->details.readyTime = SystemTime::getUsec();
+				negotiation->state = AsyncNegotiation::READING_STARTUP_RESPONSE;
+			} else if (line == "Error\n") {
+				negotiation->state = AsyncNegotiation::READING_ERROR_RESPONSE;
+			} else if (line == "I have control 1.0\n") {
+				sendSpawnRequest(negotiation);
 			} else {
-				throw;
+				failWithInvalidSpawnResponseType(negotiation, line);
 			}
+			break;
+		case AsyncNegotiation::READING_STARTUP_RESPONSE:
+			handleStartupResponseLine(negotiation, line);
+			break;
+		case AsyncNegotiation::READING_ERROR_RESPONSE:
+			handleErrorResponseLine(negotiation, line);
+			break;
+		default:
+			P_BUG("Unexpected negotiation state " << (int) negotiation->state);
 		}
 	}
 
-	Result handleSpawnResponse(NegotiationDetails &details) {
+	void failWithInvalidSpawnResponseType(AsyncNegotiation *negotiation, const string &line) {
+		string message;
+		SpawnException::ErrorKind errorKind =
+			describeInvalidSpawnResponseType(line, message);
+		failNegotiation(negotiation, message, errorKind);
+	}
+
+	/**
+	 * Processes the data that has been read from the admin socket, the same
+	 * way readMessageLine() does: protocol lines are handled, and any other
+	 * output is logged and captured.
+	 */
+	void processNegotiationInput(AsyncNegotiation *negotiation) {
 		TRACE_POINT();
-		Json::Value sockets;
-		Result result;
+		NegotiationDetails &details = negotiation->details;
+
+		while (negotiation->state < AsyncNegotiation::DRAINING_STDERR) {
+			if (negotiation->state == AsyncNegotiation::READING_ERROR_MESSAGE) {
+				negotiation->errorMessage.append(negotiation->input);
+				negotiation->input.clear();
+				if (negotiation->adminSocketEof) {
+					finishWithErrorResponse(negotiation);
+				}
+				return;
+			}
 
-		while (true) {
+			string::size_type pos = negotiation->input.find('\n');
 			string line;
+			if ((pos == string::npos ? negotiation->input.size() : pos) >= 1024 * 4) {
+				failNegotiation(negotiation, "An error occurred while starting the "
+					"web application. It sent a line that is too long.",
+					SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+				return;
+			} else if (pos == string::npos) {
+				if (!negotiation->adminSocketEof) {
+					return;
+				}
+				line.swap(negotiation->input);
+			} else {
+				line = negotiation->input.substr(0, pos + 1);
+				negotiation->input.erase(0, pos + 1);
+			}
 
-			try {
-				line = readMessageLine(details);
-			} catch (const SystemException &e) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. There was an I/O error while reading its "
-					"startup response: " + e.sys(),
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			} catch (const TimeoutException &) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application: it did not write a startup response in time.",
-					SpawnException::APP_STARTUP_TIMEOUT,
-					details);
+			string lineWithoutNewline = line;
+			if (!line.empty() && line[line.size() - 1] == '\n') {
+				lineWithoutNewline.erase(line.size() - 1, 1);
 			}
 
 			if (line.empty()) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. It unexpected closed the connection while "
-					"sending its startup response.",
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			} else if (line[line.size() - 1] != '\n') {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. It sent a line without a newline character "
-					"in its startup response.",
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			} else if (line == "\n") {
-				break;
+				handleNegotiationLine(negotiation, line);
+				return;
+			} else if (startsWith(line, "!> ")) {
+				P_DEBUG("[App " << details.pid << " stdout] " << lineWithoutNewline);
+				line.erase(0, sizeof("!> ") - 1);
+				handleNegotiationLine(negotiation, line);
+			} else {
+				details.stderrOutput.append(line);
+				printAppOutput(details.pid, "stdout", lineWithoutNewline.data(),
+					lineWithoutNewline.size());
 			}
+		}
+	}
 
-			string::size_type pos = line.find(": ");
-			if (pos == string::npos) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. It sent a startup response line without "
-					"separator.",
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
+	void beginNegotiation(AsyncNegotiation *negotiation) {
+		TRACE_POINT();
+		NegotiationDetails &details = negotiation->details;
+		unsigned long long now = SystemTime::getUsec();
+
+		negotiation->begun = true;
+		ev_io_init(&negotiation->adminSocketReader, onAdminSocketReadable,
+			details.adminSocket, EV_READ);
+		ev_io_init(&negotiation->adminSocketWriter, onAdminSocketWritable,
+			details.adminSocket, EV_WRITE);
+		ev_io_init(&negotiation->errorPipeReader, onErrorPipeReadable,
+			details.errorPipe, EV_READ);
+		ev_timer_init(&negotiation->timer, onNegotiationTimeout,
+			details.options->startTimeout / 1000.0, 0);
+		negotiation->adminSocketReader.data = negotiation;
+		negotiation->adminSocketWriter.data = negotiation;
+		negotiation->errorPipeReader.data = negotiation;
+		negotiation->timer.data = negotiation;
+
+		if (details.spawnStartTime == 0) {
+			details.spawnStartTime = now;
+		}
+		if (details.forkTime == 0) {
+			details.forkTime = now;
+		}
+		details.gupid = integerToHex(SystemTime::get() / 60) + "-" +
+			config->randomGenerator->generateAsciiString(10);
+		negotiation->input = details.io.getBuffer();
+
+		setNonBlocking(details.adminSocket);
+		ev_io_start(negotiation->loop, &negotiation->adminSocketReader);
+		if (details.errorPipe != -1) {
+			setNonBlocking(details.errorPipe);
+			ev_io_start(negotiation->loop, &negotiation->errorPipeReader);
+		}
+		ev_timer_start(negotiation->loop, &negotiation->timer);
+		processNegotiationInput(negotiation);
+	}
+
+	void readAdminSocket(AsyncNegotiation *negotiation) {
+		TRACE_POINT();
+		char buf[1024 * 8];
+		ssize_t ret;
+
+		do {
+			ret = read(negotiation->details.adminSocket, buf, sizeof(buf));
+		} while (ret == -1 && errno == EINTR);
+		if (ret == -1) {
+			int e = errno;
+			if (e != EAGAIN && e != EWOULDBLOCK) {
+				SystemException ex("Cannot read from the admin socket", e);
+				failWithIOError(negotiation, ex);
 			}
+			return;
+		} else if (ret == 0) {
+			ev_io_stop(negotiation->loop, &negotiation->adminSocketReader);
+			negotiation->adminSocketEof = true;
+		} else {
+			negotiation->input.append(buf, ret);
+		}
+		processNegotiationInput(negotiation);
+	}
 
-			string key = line.substr(0, pos);
-			string value = line.substr(pos + 2, line.size() - pos - 3);
-			if (key == "socket") {
-				// socket: <name>;<address>;<protocol>;<concurrency>
-				// TODO: in case of TCP sockets, check whether it points to localhost
-				// TODO: in case of unix sockets, check whether filename is absolute
-				// and whether owner is correct
-				vector<string> args;
-				split(value, ';', args);
-				if (args.size() == 4) {
-					string error = validateSocketAddress(details, args[1]);
-					if (!error.empty()) {
-						throwAppSpawnException(
-							"An error occurred while starting the web application. " + error,
-							SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-							details);
-					}
+	void writeAdminSocket(AsyncNegotiation *negotiation) {
+		TRACE_POINT();
+		ssize_t ret;
 
-					Json::Value socket;
-					socket["name"] = args[0];
-					socket["address"] = fixupSocketAddress(*details.options, args[1]);
-					socket["protocol"] = args[2];
-					socket["concurrency"] = atoi(args[3]);
-					sockets.append(socket);
-				} else {
-					throwAppSpawnException("An error occurred while starting the "
-						"web application. It reported a wrongly formatted 'socket'"
-						"response value: '" + value + "'",
-						SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-						details);
+		do {
+			ret = write(negotiation->details.adminSocket,
+				negotiation->output.data(), negotiation->output.size());
+		} while (ret == -1 && errno == EINTR);
+		if (ret == -1) {
+			int e = errno;
+			if (e == EAGAIN || e == EWOULDBLOCK) {
+				ev_io_start(negotiation->loop, &negotiation->adminSocketWriter);
+			} else if (e == EPIPE) {
+				/* Ignore this. Process might have written an
+				 * error response before reading the arguments,
+				 * in which case we'll want to show that instead.
+				 */
+				negotiation->output.clear();
+				ev_io_stop(negotiation->loop, &negotiation->adminSocketWriter);
+			} else {
+				failNegotiation(negotiation, "An error occurred while starting the "
+					"web application. There was an I/O error while sending the "
+					"spawn request to it: " + SystemException("write() failed", e).sys(),
+					SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			}
+			return;
+		}
+
+		negotiation->output.erase(0, ret);
+		if (negotiation->output.empty()) {
+			ev_io_stop(negotiation->loop, &negotiation->adminSocketWriter);
+		} else {
+			ev_io_start(negotiation->loop, &negotiation->adminSocketWriter);
+		}
+	}
+
+	void readErrorPipe(AsyncNegotiation *negotiation) {
+		TRACE_POINT();
+		char buf[1024 * 8];
+		ssize_t ret;
+
+		do {
+			ret = read(negotiation->details.errorPipe, buf, sizeof(buf));
+		} while (ret == -1 && errno == EINTR);
+		if (ret == -1) {
+			int e = errno;
+			if (e == EAGAIN || e == EWOULDBLOCK) {
+				return;
+			}
+			P_WARN("Stderr I/O capture error: " << strerror(e) << " (errno=" << e << ")");
+		} else if (ret > 0) {
+			negotiation->details.stderrOutput.append(buf, ret);
+			if (ret == 1 && buf[0] == '\n') {
+				printAppOutput(negotiation->details.pid, "stderr", "", 0);
+			} else {
+				vector<StaticString> lines;
+				if (buf[ret - 1] == '\n') {
+					ret--;
 				}
-			} else if (key == "pid") {
-				// pid: <PID>
-				pid_t pid = atoi(value);
-				ProcessMetricsCollector collector;
-				vector<pid_t> pids;
-
-				pids.push_back(pid);
-				ProcessMetricMap metrics = collector.collect(pids);
-				if (metrics[pid].uid != details.preparation->userSwitching.uid) {
-					throwAppSpawnException("An error occurred while starting the "
-						"web application. The PID that the loader has returned does "
-						"not have the same UID as the loader itself.",
-						SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-						details);
+				split(StaticString(buf, ret), '\n', lines);
+				foreach (const StaticString line, lines) {
+					printAppOutput(negotiation->details.pid, "stderr",
+						line.data(), line.size());
 				}
-				details.pid = pid;
+			}
+			return;
+		}
+
+		ev_io_stop(negotiation->loop, &negotiation->errorPipeReader);
+		if (negotiation->state == AsyncNegotiation::DRAINING_STDERR) {
+			finishWithFailure(negotiation);
+		}
+	}
+
+	void handleNegotiationTimeout(AsyncNegotiation *negotiation) {
+		TRACE_POINT();
+		switch (negotiation->state) {
+		case AsyncNegotiation::READING_HANDSHAKE:
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application: it did not write a handshake message in time.",
+				SpawnException::APP_STARTUP_TIMEOUT);
+			break;
+		case AsyncNegotiation::READING_RESPONSE_TYPE:
+		case AsyncNegotiation::READING_STARTUP_RESPONSE:
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application: it did not write a startup response in time.",
+				SpawnException::APP_STARTUP_TIMEOUT);
+			break;
+		case AsyncNegotiation::READING_ERROR_RESPONSE:
+		case AsyncNegotiation::READING_ERROR_MESSAGE:
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application. It tried to report an error message, but "
+				"it took too much time doing that.",
+				SpawnException::APP_STARTUP_TIMEOUT);
+			break;
+		case AsyncNegotiation::DRAINING_STDERR:
+			finishWithFailure(negotiation);
+			break;
+		default:
+			P_BUG("Unexpected negotiation state " << (int) negotiation->state);
+		}
+	}
+
+	void failWithIOError(AsyncNegotiation *negotiation, const SystemException &e) {
+		switch (negotiation->state) {
+		case AsyncNegotiation::READING_HANDSHAKE:
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application. There was an I/O error while reading its "
+				"handshake message: " + e.sys(),
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			break;
+		case AsyncNegotiation::READING_ERROR_RESPONSE:
+		case AsyncNegotiation::READING_ERROR_MESSAGE:
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application. It tried to report an error message, but "
+				"an I/O error occurred while reading this error message: " +
+				e.sys(),
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			break;
+		default:
+			failNegotiation(negotiation, "An error occurred while starting the "
+				"web application. There was an I/O error while reading its "
+				"startup response: " + e.sys(),
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			break;
+		}
+	}
+
+	/**
+	 * Fails the negotiation. Unless it failed because of a timeout, the
+	 * SpawnException is only created after the remaining stderr output has
+	 * been captured, for at most 2 seconds.
+	 */
+	void failNegotiation(AsyncNegotiation *negotiation, const string &msg,
+		SpawnException::ErrorKind errorKind)
+	{
+		TRACE_POINT();
+		if (negotiation->state == AsyncNegotiation::DONE) {
+			return;
+		} else if (negotiation->state == AsyncNegotiation::DRAINING_STDERR) {
+			finishWithFailure(negotiation);
+			return;
+		}
+
+		negotiation->failureMessage = msg;
+		negotiation->failureKind = errorKind;
+		negotiation->state = AsyncNegotiation::DRAINING_STDERR;
+		ev_io_stop(negotiation->loop, &negotiation->adminSocketReader);
+		ev_io_stop(negotiation->loop, &negotiation->adminSocketWriter);
+		ev_timer_stop(negotiation->loop, &negotiation->timer);
+
+		if (errorKind == SpawnException::APP_STARTUP_TIMEOUT
+		 || !ev_is_active(&negotiation->errorPipeReader))
+		{
+			finishWithFailure(negotiation);
+		} else {
+			ev_timer_set(&negotiation->timer, 2, 0);
+			ev_timer_start(negotiation->loop, &negotiation->timer);
+		}
+	}
+
+	void finishWithFailure(AsyncNegotiation *negotiation) {
+		TRACE_POINT();
+		negotiation->state = AsyncNegotiation::DONE;
+		negotiation->exception = boost::make_shared<SpawnException>(
+			createAppSpawnException(negotiation->failureMessage,
+				negotiation->failureKind, negotiation->details));
+		callErrorHandler(*negotiation->exception, negotiation->options);
+	}
+
+	void finishWithErrorResponse(AsyncNegotiation *negotiation) {
+		TRACE_POINT();
+		negotiation->state = AsyncNegotiation::DONE;
+		negotiation->exception = boost::make_shared<SpawnException>(
+			"An error occured while starting the web application.",
+			negotiation->errorMessage,
+			negotiation->errorAttributes["html"] == "true",
+			SpawnException::APP_STARTUP_EXPLAINABLE_ERROR);
+		annotateAppSpawnException(*negotiation->exception, negotiation->details);
+		callErrorHandler(*negotiation->exception, negotiation->options);
+	}
+
+	/**
+	 * Runs a negotiation step on the negotiation loop thread. Completes the
+	 * negotiation if the step has finished it.
+	 */
+	static void runNegotiationStep(AsyncNegotiation *negotiation, NegotiationStep step) {
+		Spawner *self = negotiation->spawner;
+		try {
+			(self->*step)(negotiation);
+		} catch (const tracable_exception &e) {
+			self->failNegotiation(negotiation, "An error occurred while starting "
+				"the web application: " + string(e.what()),
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+		}
+		if (negotiation->state == AsyncNegotiation::DONE) {
+			completeNegotiation(negotiation);
+		}
+	}
+
+	/**
+	 * Cleans up a finished negotiation and calls its callback. The spawner
+	 * isn't touched after calling the callback, because the callback may
+	 * cause the spawner to be destroyed.
+	 */
+	static void completeNegotiation(AsyncNegotiation *negotiation) {
+		TRACE_POINT();
+		NegotiationDetails &details = negotiation->details;
+
+		negotiation->spawner->unregisterNegotiation(negotiation);
+		stopNegotiationWatchers(negotiation);
+		if (negotiation->exception == NULL) {
+			setBlocking(details.adminSocket);
+			if (details.errorPipe != -1) {
+				setBlocking(details.errorPipe);
+			}
+			if (negotiation->successHandler) {
+				negotiation->successHandler(details.pid);
+			}
+			P_DEBUG("Process spawning done: appRoot=" << details.options->appRoot <<
+				", pid=" << details.pid);
+		} else if (negotiation->abortHandler) {
+			negotiation->abortHandler();
+		}
+
+		negotiation->callback(negotiation->result, negotiation->exception.get());
+		delete negotiation;
+	}
+
+	static void stopNegotiationWatchers(AsyncNegotiation *negotiation) {
+		ev_io_stop(negotiation->loop, &negotiation->adminSocketReader);
+		ev_io_stop(negotiation->loop, &negotiation->adminSocketWriter);
+		ev_io_stop(negotiation->loop, &negotiation->errorPipeReader);
+		ev_timer_stop(negotiation->loop, &negotiation->timer);
+	}
+
+	static void onAdminSocketReadable(EV_P_ ev_io *io, int revents) {
+		runNegotiationStep(static_cast<AsyncNegotiation *>(io->data),
+			&Spawner::readAdminSocket);
+	}
+
+	static void onAdminSocketWritable(EV_P_ ev_io *io, int revents) {
+		runNegotiationStep(static_cast<AsyncNegotiation *>(io->data),
+			&Spawner::writeAdminSocket);
+	}
+
+	static void onErrorPipeReadable(EV_P_ ev_io *io, int revents) {
+		runNegotiationStep(static_cast<AsyncNegotiation *>(io->data),
+			&Spawner::readErrorPipe);
+	}
+
+	static void onNegotiationTimeout(EV_P_ ev_timer *timer, int revents) {
+		runNegotiationStep(static_cast<AsyncNegotiation *>(timer->data),
+			&Spawner::handleNegotiationTimeout);
+	}
+
+	void unregisterNegotiation(AsyncNegotiation *negotiation) {
+		boost::lock_guard<boost::mutex> l(negotiationsSyncher);
+		negotiations.erase(negotiation);
+	}
+
+	/**
+	 * Must be called on the negotiation loop thread. Negotiations that
+	 * haven't begun yet are only marked as cancelled, because the loop
+	 * still refers to them; beginQueuedNegotiation() deletes them without
+	 * touching this Spawner, which may be gone by then.
+	 */
+	void cancelNegotiations() {
+		TRACE_POINT();
+		set<AsyncNegotiation *> negotiations;
+		{
+			boost::lock_guard<boost::mutex> l(negotiationsSyncher);
+			negotiations.swap(this->negotiations);
+		}
+		foreach (AsyncNegotiation *negotiation, negotiations) {
+			P_DEBUG("Cancelling spawn negotiation with process " << negotiation->details.pid);
+			if (negotiation->abortHandler) {
+				negotiation->abortHandler();
+			}
+			if (negotiation->begun) {
+				stopNegotiationWatchers(negotiation);
+				delete negotiation;
 			} else {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. It sent an unknown startup response line "
-					"called '" + key + "'.",
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
+				negotiation->cancelled = true;
 			}
 		}
+	}
+
+	static void beginQueuedNegotiation(AsyncNegotiation *negotiation) {
+		if (negotiation->cancelled) {
+			delete negotiation;
+		} else {
+			runNegotiationStep(negotiation, &Spawner::beginNegotiation);
+		}
+	}
+
+	/**
+	 * Registers the negotiation right away, so that cancelAsyncSpawns() also
+	 * cancels it if it hasn't had its turn on the negotiation loop yet.
+	 */
+	void scheduleNegotiation(AsyncNegotiation *negotiation) {
+		BackgroundEventLoop *bgloop = config->negotiationLoop->get();
+		negotiation->loop = bgloop->libev_loop;
+		{
+			boost::lock_guard<boost::mutex> l(negotiationsSyncher);
+			negotiations.insert(negotiation);
+		}
+		bgloop->safe->runLater(boost::bind(beginQueuedNegotiation, negotiation));
+	}
+
+	static void finishSpawnTicket(SpawnTicketPtr ticket, const Result &result,
+		const SpawnException *e)
+	{
+		boost::lock_guard<boost::mutex> l(ticket->syncher);
+		ticket->result = result;
+		if (e != NULL) {
+			ticket->exception = boost::make_shared<SpawnException>(*e);
+		}
+		ticket->done = true;
+		ticket->cond.notify_one();
+	}
 
-		if (!hasSessionSockets(sockets)) {
-			throwAppSpawnException("An error occured while starting the web "
-				"application. It did not advertise any session sockets.",
-				SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-				details);
+	static Result waitForSpawnTicket(const SpawnTicketPtr &ticket) {
+		TRACE_POINT();
+		this_thread::disable_interruption di;
+		boost::unique_lock<boost::mutex> l(ticket->syncher);
+		while (!ticket->done) {
+			ticket->cond.wait(l);
 		}
+		if (ticket->exception != NULL) {
+			throw *ticket->exception;
+		}
+		return ticket->result;
+	}
+
+	Result createSpawnResult(const NegotiationDetails &details, const Json::Value &sockets) const {
+		Result result;
 
 		result["type"] = "os_process";
 		result["pid"] = (int) details.pid;
@@ -431,6 +1073,12 @@ private:
 		result["code_revision"] = details.preparation->codeRevision;
 		result["spawner_creation_time"] = (Json::UInt64) creationTime;
 		result["spawn_start_time"] = (Json::UInt64) details.spawnStartTime;
+		result["spawn_fork_duration"] = (Json::UInt64)
+			(details.forkTime - details.spawnStartTime);
+		result["spawn_app_load_duration"] = (Json::UInt64)
+			(details.readyTime - details.forkTime);
+		result["spawn_socket_ready_duration"] = (Json::UInt64)
+			(SystemTime::getUsec() - details.readyTime);
 		result.adminSocket = details.adminSocket;
 		result.errorPipe = details.errorPipe;
 		return result;
@@ -591,62 +1239,39 @@ protected:
 		}
 	}
 
-	void throwAppSpawnException(const string &msg,
+	/**
+	 * Creates a SpawnException whose error page contains the stderr output
+	 * that has been captured during negotiation.
+	 */
+	SpawnException createAppSpawnException(const string &msg,
 		SpawnException::ErrorKind errorKind,
 		NegotiationDetails &details)
 	{
 		TRACE_POINT();
-		// Stop the stderr capturing thread and get the captured stderr
-		// output so far.
-		string stderrOutput;
-		if (details.stderrCapturer != NULL) {
-			stderrOutput = details.stderrCapturer->stop();
-		}
-
-		// If the exception wasn't due to a timeout, try to capture the
-		// remaining stderr output for at most 2 seconds.
-		if (errorKind != SpawnException::PRELOADER_STARTUP_TIMEOUT
-		 && errorKind != SpawnException::APP_STARTUP_TIMEOUT
-		 && details.stderrCapturer != NULL)
-		{
-			bool done = false;
-			unsigned long long timeout = 2000;
-			while (!done) {
-				char buf[1024 * 32];
-				unsigned int ret;
-
-				try {
-					ret = readExact(details.stderrCapturer->getFd(), buf,
-						sizeof(buf), &timeout);
-					if (ret == 0) {
-						done = true;
-					} else {
-						stderrOutput.append(buf, ret);
-					}
-				} catch (const SystemException &e) {
-					P_WARN("Stderr I/O capture error: " << e.what());
-					done = true;
-				} catch (const TimeoutException &) {
-					done = true;
-				}
-			}
-		}
-		details.stderrCapturer.reset();
-
-		// Now throw SpawnException with the captured stderr output
-		// as error response.
 		SpawnException e(msg,
-			createErrorPageFromStderrOutput(msg, errorKind, stderrOutput),
+			createErrorPageFromStderrOutput(msg, errorKind, details.stderrOutput),
 			true,
 			errorKind);
 		annotateAppSpawnException(e, details);
+		return e;
+	}
+
+	void throwAppSpawnException(const string &msg,
+		SpawnException::ErrorKind errorKind,
+		NegotiationDetails &details)
+	{
+		SpawnException e = createAppSpawnException(msg, errorKind, details);
 		throwSpawnException(e, *details.options);
 	}
 
-	void throwSpawnException(SpawnException &e, const Options &options) {
+	void callErrorHandler(SpawnException &e, const Options &options) {
 		if (config->errorHandler != NULL) {
 			config->errorHandler(config, e, options);
 		}
+	}
+
+	void throwSpawnException(SpawnException &e, const Options &options) {
+		callErrorHandler(e, options);
 		throw e;
 	}
 
@@ -1091,145 +1716,51 @@ protected:
 	}
 
 	/**
-	 * Execute the process spawning negotiation protocol.
+	 * Hands the negotiation with a forked process over to the negotiation
+	 * loop, which executes the process spawning negotiation protocol. The
+	 * callback is called on the negotiation loop thread. Upon success, the
+	 * result also contains the durations (in microseconds) of the spawn phases:
+	 * forking the process (`spawn_fork_duration`), loading the application
+	 * (`spawn_app_load_duration`), and reporting its sockets
+	 * (`spawn_socket_ready_duration`).
+	 *
+	 * `abortHandler` is called if negotiation fails or is cancelled;
+	 * `successHandler` is called with the process's PID if it succeeds.
 	 */
-	Result negotiateSpawn(NegotiationDetails &details) {
-		TRACE_POINT();
-		details.spawnStartTime = SystemTime::getUsec();
-		details.gupid = integerToHex(SystemTime::get() / 60) + "-" +
-			config->randomGenerator->generateAsciiString(10);
-		details.timeout = details.options->startTimeout * 1000;
-
-		string result;
-		try {
-			result = readMessageLine(details);
-		} catch (const SystemException &e) {
-			throwAppSpawnException("An error occurred while starting the "
-				"web application. There was an I/O error while reading its "
-				"handshake message: " + e.sys(),
-				SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-				details);
-		} catch (const TimeoutException &) {
-			throwAppSpawnException("An error occurred while starting the "
-				"web application: it did not write a handshake message in time.",
-				SpawnException::APP_STARTUP_TIMEOUT,
-				details);
-		}
-
-		protocol_begin:
-		if (result == "I have control 1.0\n") {
-			UPDATE_TRACE_POINT();
-			sendSpawnRequest(details);
-			try {
-				result = readMessageLine(details);
-			} catch (const SystemException &e) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. There was an I/O error while reading its "
-					"startup response: " + e.sys(),
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			} catch (const TimeoutException &) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application: it did not write a startup response in time.",
-					SpawnException::APP_STARTUP_TIMEOUT,
-					details);
-			}
-			if (result == "Ready\n") {
-				return handleSpawnResponse(details);
-			} else if (result == "Error\n") {
-				handleSpawnErrorResponse(details);
-			} else if (result == "I have control 1.0\n") {
-				goto protocol_begin;
-			} else {
-				handleInvalidSpawnResponseType(result, details);
-			}
-		} else {
-			UPDATE_TRACE_POINT();
-			if (result == "Error\n") {
-				handleSpawnErrorResponse(details);
-			} else {
-				handleInvalidSpawnResponseType(result, details);
-			}
-		}
-		return Result(); // Never reached.
-	}
-
-	void handleSpawnErrorResponse(NegotiationDetails &details) {
+	void startNegotiation(const NegotiationDetails &details, const SpawnCallback &callback,
+		const boost::function<void ()> &abortHandler = boost::function<void ()>(),
+		const boost::function<void (pid_t pid)> &successHandler = boost::function<void (pid_t pid)>())
+	{
 		TRACE_POINT();
-		map<string, string> attributes;
-
-		while (true) {
-			string line = readMessageLine(details);
-			if (line.empty()) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. It unexpected closed the connection while "
-					"sending its startup response.",
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			} else if (line[line.size() - 1] != '\n') {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. It sent a line without a newline character "
-					"in its startup response.",
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			} else if (line == "\n") {
-				break;
-			}
-
-			string::size_type pos = line.find(": ");
-			if (pos == string::npos) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. It sent a startup response line without "
-					"separator.",
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			}
-
-			string key = line.substr(0, pos);
-			string value = line.substr(pos + 2, line.size() - pos - 3);
-			attributes[key] = value;
-		}
-
-		try {
-			string message = details.io.readAll(&details.timeout);
-			SpawnException e("An error occured while starting the web application.",
-				message,
-				attributes["html"] == "true",
-				SpawnException::APP_STARTUP_EXPLAINABLE_ERROR);
-			annotateAppSpawnException(e, details);
-			throwSpawnException(e, *details.options);
-		} catch (const SystemException &e) {
-			throwAppSpawnException("An error occurred while starting the "
-				"web application. It tried to report an error message, but "
-				"an I/O error occurred while reading this error message: " +
-				e.sys(),
-				SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-				details);
-		} catch (const TimeoutException &) {
-			throwAppSpawnException("An error occurred while starting the "
-				"web application. It tried to report an error message, but "
-				"it took too much time doing that.",
-				SpawnException::APP_STARTUP_TIMEOUT,
-				details);
-		}
+		AsyncNegotiation *negotiation = new AsyncNegotiation(this, details, callback);
+		negotiation->abortHandler = abortHandler;
+		negotiation->successHandler = successHandler;
+		scheduleNegotiation(negotiation);
 	}
 
-	void handleInvalidSpawnResponseType(const string &line, NegotiationDetails &details) {
+	static SpawnException::ErrorKind describeInvalidSpawnResponseType(const string &line,
+		string &message)
+	{
 		if (line.empty()) {
-			throwAppSpawnException("An error occurred while starting "
+			message = "An error occurred while starting "
 				"the web application. It exited before signalling successful "
-				"startup back to " PROGRAM_NAME ".",
-				SpawnException::APP_STARTUP_ERROR,
-				details);
+				"startup back to " PROGRAM_NAME ".";
+			return SpawnException::APP_STARTUP_ERROR;
 		} else {
-			throwAppSpawnException("An error occurred while starting "
+			message = "An error occurred while starting "
 				"the web application. It sent an unknown response type \"" +
-				cEscapeString(line) + "\".",
-				SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-				details);
+				cEscapeString(line) + "\".";
+			return SpawnException::APP_STARTUP_PROTOCOL_ERROR;
 		}
 	}
 
+	void handleInvalidSpawnResponseType(const string &line, NegotiationDetails &details) {
+		string message;
+		SpawnException::ErrorKind errorKind =
+			describeInvalidSpawnResponseType(line, message);
+		throwAppSpawnException(message, errorKind, details);
+	}
+
 public:
 	/**
 	 * Timestamp at which this Spawner was created. Microseconds resolution.
@@ -1241,9 +1772,47 @@ public:
 		  creationTime(SystemTime::getUsec())
 		{ }
 
-	virtual ~Spawner() { }
+	virtual ~Spawner() {
+		cancelAsyncSpawns();
+	}
+
+	/**
+	 * Spawns a process and blocks until it is ready. Subclasses must
+	 * override this method, asyncSpawn(), or both.
+	 */
+	virtual Result spawn(const Options &options) {
+		TRACE_POINT();
+		SpawnTicketPtr ticket = boost::make_shared<SpawnTicket>();
+		asyncSpawn(options, boost::bind(finishSpawnTicket, ticket, _1, _2));
+		return waitForSpawnTicket(ticket);
+	}
+
+	/**
+	 * Spawns a process and calls the callback once it is ready, or once
+	 * spawning has failed. Errors that occur before the process has been
+	 * created are thrown instead. DirectSpawner and SmartSpawner negotiate
+	 * with the process on the negotiation loop, so that no thread is
+	 * occupied while the application is loading, and call the callback
+	 * on that loop's thread.
+	 */
+	virtual void asyncSpawn(const Options &options, const SpawnCallback &callback) {
+		Result result = spawn(options);
+		callback(result, NULL);
+	}
 
-	virtual Result spawn(const Options &options) = 0;
+	/**
+	 * Cancels all asynchronous spawns that are in progress, including those
+	 * that are still waiting for their turn on the negotiation loop. Their
+	 * callbacks are not called. Processes that the spawner has forked itself
+	 * are killed.
+	 */
+	void cancelAsyncSpawns() {
+		TRACE_POINT();
+		if (config->negotiationLoop != NULL && config->negotiationLoop->isStarted()) {
+			config->negotiationLoop->get()->safe->run(
+				boost::bind(&Spawner::cancelNegotiations, this));
+		}
+	}
 
 	virtual bool cleanable() const {
 		return false;
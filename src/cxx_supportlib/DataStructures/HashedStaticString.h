@@ -83,9 +83,7 @@ public:
 		{ }
 
 	void rehash() {
-		Hasher h;
-		h.update(data(), size());
-		m_hash = h.finalize();
+		m_hash = Hasher::hash(data(), size());
 	}
 
 	void setHash(boost::uint32_t value) {
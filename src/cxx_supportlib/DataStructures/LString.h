@@ -400,6 +400,9 @@ psg_lstr_hash(const LString *str) {
 	const LString::Part *part = str->start;
 	Hasher h;
 
+	if (part->next == NULL) {
+		return Hasher::hash(part->data, part->size);
+	}
 	while (part != NULL) {
 		h.update(part->data, part->size);
 		part = part->next;
@@ -416,6 +416,36 @@ public:
 	}
 };
 
+/**
+ * Indicates that a Pool::get() or Pool::asyncGet() request was shed from the
+ * getWaitlist queue, either because its deadline passed or because adaptive
+ * request queue shedding decided that it had been waiting for too long.
+ */
+class RequestQueueTimeoutException: public GetAbortedException {
+private:
+	string msg;
+
+public:
+	RequestQueueTimeoutException(unsigned long long waitTime, bool deadlinePassed)
+		: GetAbortedException(oxt::tracable_exception::no_backtrace())
+		{
+			stringstream str;
+			str << "Request shed from queue after waiting " << (waitTime / 1000) << " msec";
+			if (deadlinePassed) {
+				str << " (deadline passed)";
+			} else {
+				str << " (adaptive queue shedding)";
+			}
+			msg = str.str();
+		}
+
+	virtual ~RequestQueueTimeoutException() throw() {}
+
+	virtual const char *what() const throw() {
+		return msg.c_str();
+	}
+};
+
 /**
  * Indicates that a specified argument is incorrect or violates a requirement.
  *
@@ -45,6 +45,7 @@
 #include <Logging.h>
 #include <Utils.h>
 #include <Utils/IOUtils.h>
+#include <Utils/NumaTopology.h>
 
 namespace Passenger {
 namespace ServerKit {
@@ -217,7 +218,18 @@ private:
 		}
 	}
 
+	void bindToPlacement() {
+		int e = bindCurrentThreadToNumaPlacement(placement);
+		if (e != 0) {
+			P_WARN("Cannot bind the load balancer to NUMA node " << placement.node
+				<< ": " << strerror(e) << " (errno=" << e << ")");
+		}
+	}
+
 	void mainLoop() {
+		if (!placement.cpus.empty()) {
+			bindToPlacement();
+		}
 		while (!quit) {
 			pollAllEndpoints();
 			if (OXT_UNLIKELY(pollers[0].revents & POLLIN)) {
@@ -244,6 +256,13 @@ private:
 
 public:
 	vector<Server *> servers;
+	/**
+	 * If `placement.cpus` is not empty, then the load balancer thread binds
+	 * itself to these CPUs and to this NUMA node when it starts. Used for
+	 * running one load balancer per NUMA node, which feeds only the servers
+	 * on that node.
+	 */
+	NumaThreadPlacement placement;
 
 	AcceptLoadBalancer()
 		: nEndpoints(0),
@@ -27,12 +27,19 @@
 #define _PASSENGER_SERVER_KIT_CONTEXT_H_
 
 #include <boost/make_shared.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <oxt/macros.hpp>
+#include <algorithm>
 #include <string>
 #include <cstddef>
+#include <cassert>
 #include <jsoncpp/json.h>
 #include <MemoryKit/mbuf.h>
 #include <SafeLibev.h>
 #include <Constants.h>
+#include <ServerKit/IoUring.h>
+#include <ServerKit/HttpHeaderScanner.h>
 #include <Utils/StrIntUtils.h>
 #include <Utils/JsonUtils.h>
 
@@ -40,10 +47,165 @@ extern "C" {
 	struct uv_loop_s;
 }
 
+/** The maximum number of iovecs that FdSourceChannel passes to a single `readv()`. */
+#define FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS 8
+
 namespace Passenger {
 namespace ServerKit {
 
 
+/**
+ * A memory budget that sits between a FileBufferedChannel's regular in-memory
+ * buffers and its buffer file. Once a FileBufferedChannel has buffered more than
+ * its threshold, it keeps buffering in memory for as long as it can charge the
+ * excess to this budget. It only spills to disk when the budget is exhausted.
+ *
+ * A single FileBufferedChannelMemoryTier is meant to be shared by all
+ * FileBufferedChannels in the process, across multiple Contexts and threads,
+ * so it is thread-safe.
+ */
+class FileBufferedChannelMemoryTier {
+private:
+	const boost::uint64_t limit;
+	boost::atomic<boost::uint64_t> used;
+	boost::atomic<boost::uint64_t> peak;
+	boost::atomic<boost::uint64_t> exhausted;
+
+public:
+	FileBufferedChannelMemoryTier(boost::uint64_t _limit)
+		: limit(_limit),
+		  used(0),
+		  peak(0),
+		  exhausted(0)
+		{ }
+
+	/**
+	 * Charges `size` bytes to the budget. Returns false, without charging
+	 * anything, if that would exceed the limit.
+	 */
+	bool reserve(boost::uint64_t size) {
+		boost::uint64_t current = used.load(boost::memory_order_relaxed);
+		do {
+			if (current + size > limit) {
+				exhausted.fetch_add(1, boost::memory_order_relaxed);
+				return false;
+			}
+		} while (!used.compare_exchange_weak(current, current + size,
+			boost::memory_order_relaxed));
+
+		boost::uint64_t currentPeak = peak.load(boost::memory_order_relaxed);
+		while (current + size > currentPeak
+			&& !peak.compare_exchange_weak(currentPeak, current + size,
+				boost::memory_order_relaxed))
+		{
+			// Retry.
+		}
+		return true;
+	}
+
+	void release(boost::uint64_t size) {
+		boost::uint64_t previous = used.fetch_sub(size, boost::memory_order_relaxed);
+		assert(previous >= size);
+		(void) previous; // Avoid compiler warning when assertions are disabled.
+	}
+
+	boost::uint64_t getLimit() const {
+		return limit;
+	}
+
+	boost::uint64_t getUsed() const {
+		return used.load(boost::memory_order_relaxed);
+	}
+
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		doc["limit"] = byteSizeToJson(limit);
+		doc["used"] = byteSizeToJson(used.load(boost::memory_order_relaxed));
+		doc["peak"] = byteSizeToJson(peak.load(boost::memory_order_relaxed));
+		doc["exhausted"] = (Json::UInt64) exhausted.load(boost::memory_order_relaxed);
+		return doc;
+	}
+};
+
+/**
+ * Keeps track of the total number of bytes buffered (in memory and on disk)
+ * by a group of FileBufferedChannels, for example all client output channels
+ * in the process, and compares that against an optional limit. Channels are
+ * added to the group with `FileBufferedChannel::setAccount()`.
+ *
+ * This class is thread-safe so that it can be shared by multiple Contexts.
+ */
+class FileBufferedChannelAccount {
+private:
+	const boost::uint64_t limit;
+	boost::atomic<boost::uint64_t> bytesBuffered;
+	boost::atomic<unsigned int> bufferingChannels;
+
+public:
+	/**
+	 * @param limit The number of bytes above which the account is considered
+	 *              to be under pressure. 0 means unlimited.
+	 */
+	FileBufferedChannelAccount(boost::uint64_t _limit = 0)
+		: limit(_limit),
+		  bytesBuffered(0),
+		  bufferingChannels(0)
+		{ }
+
+	/**
+	 * Called by a FileBufferedChannel when its total number of buffered bytes
+	 * changes from `oldSize` to `newSize`.
+	 */
+	void update(boost::uint64_t oldSize, boost::uint64_t newSize) {
+		if (newSize > oldSize) {
+			bytesBuffered.fetch_add(newSize - oldSize, boost::memory_order_relaxed);
+		} else {
+			bytesBuffered.fetch_sub(oldSize - newSize, boost::memory_order_relaxed);
+		}
+		if (oldSize == 0 && newSize > 0) {
+			bufferingChannels.fetch_add(1, boost::memory_order_relaxed);
+		} else if (oldSize > 0 && newSize == 0) {
+			bufferingChannels.fetch_sub(1, boost::memory_order_relaxed);
+		}
+	}
+
+	boost::uint64_t getLimit() const {
+		return limit;
+	}
+
+	boost::uint64_t getBytesBuffered() const {
+		return bytesBuffered.load(boost::memory_order_relaxed);
+	}
+
+	/** The number of channels that currently buffer at least 1 byte. */
+	unsigned int getBufferingChannels() const {
+		return bufferingChannels.load(boost::memory_order_relaxed);
+	}
+
+	bool isUnderPressure() const {
+		return limit > 0 && getBytesBuffered() >= limit;
+	}
+
+	/**
+	 * The number of bytes that each buffering channel may buffer if the limit
+	 * were divided evenly among them.
+	 */
+	boost::uint64_t getFairShare() const {
+		return limit / std::max<unsigned int>(getBufferingChannels(), 1);
+	}
+
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		if (limit > 0) {
+			doc["limit"] = byteSizeToJson(limit);
+		}
+		doc["bytes_buffered"] = byteSizeToJson(getBytesBuffered());
+		doc["buffering_channels"] = getBufferingChannels();
+		doc["under_pressure"] = isUnderPressure();
+		return doc;
+	}
+};
+
 struct FileBufferedChannelConfig {
 	string bufferDir;
 	unsigned int threshold;
@@ -51,6 +213,18 @@ struct FileBufferedChannelConfig {
 	unsigned int maxDiskChunkReadSize;
 	bool autoTruncateFile;
 	bool autoStartMover;
+	/**
+	 * Whether to perform buffer file I/O through the Context's io_uring
+	 * instead of through the libuv thread pool. Has no effect if the
+	 * kernel doesn't support io_uring.
+	 */
+	bool useIoUring;
+	/**
+	 * The memory tier to buffer data in once `threshold` is passed, before
+	 * spilling to disk. Not owned by this config. NULL means that
+	 * FileBufferedChannels spill to disk as soon as `threshold` is passed.
+	 */
+	FileBufferedChannelMemoryTier *memoryTier;
 
 	FileBufferedChannelConfig()
 		: bufferDir("/tmp"),
@@ -58,15 +232,35 @@ struct FileBufferedChannelConfig {
 		  delayInFileModeSwitching(0),
 		  maxDiskChunkReadSize(0),
 		  autoTruncateFile(true),
-		  autoStartMover(true)
+		  autoStartMover(true),
+		  useIoUring(true),
+		  memoryTier(NULL)
+		{ }
+};
+
+struct FdSourceChannelConfig {
+	/**
+	 * Upper bound on the number of mbufs that FdSourceChannel fills with
+	 * a single `readv()` call. The actual number adapts to the observed
+	 * throughput. A value of 1 disables scatter reads.
+	 */
+	unsigned int maxScatterBuffers;
+
+	FdSourceChannelConfig()
+		: maxScatterBuffers(FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS)
 		{ }
 };
 
 class Context {
 private:
+	IoUring ioUring;
+	bool ioUringInitialized;
+
 	void initialize() {
+		httpHeaderScanner = HttpHeaderScanner::get();
 		mbuf_pool.mbuf_block_chunk_size = DEFAULT_MBUF_CHUNK_SIZE;
 		MemoryKit::mbuf_pool_init(&mbuf_pool);
+		ioUringInitialized = false;
 	}
 
 public:
@@ -75,24 +269,64 @@ public:
 	struct MemoryKit::mbuf_pool mbuf_pool;
 	string secureModePassword;
 	FileBufferedChannelConfig defaultFileBufferedChannelConfig;
+	FdSourceChannelConfig defaultFdSourceChannelConfig;
+	/**
+	 * The NUMA node that the event loop thread, and thus the memory that it
+	 * allocates for this Context, is bound to. -1 if not bound to a node.
+	 * Only used for state inspection.
+	 */
+	int numaNode;
+	/**
+	 * The CPUs that the event loop thread is bound to, in cpulist format
+	 * (e.g. "0-3,8-11"). Empty if not bound. Only used for state inspection.
+	 */
+	string cpuAffinity;
+	/**
+	 * The character scanners that HttpHeaderParser's fast path uses. Defaults
+	 * to the fastest ones that the CPU supports. NULL disables the fast path,
+	 * so that all HTTP headers are parsed by http_parser.
+	 */
+	const HttpHeaderScanner *httpHeaderScanner;
 
 	Context(const SafeLibevPtr &_libev, struct uv_loop_s *_libuv)
 		: libev(_libev),
-		  libuv(_libuv)
+		  libuv(_libuv),
+		  numaNode(-1)
 	{
 		initialize();
 	}
 
 	Context(struct ev_loop *loop)
-		: libev(boost::make_shared<SafeLibev>(loop))
+		: libev(boost::make_shared<SafeLibev>(loop)),
+		  numaNode(-1)
 	{
 		initialize();
 	}
 
 	~Context() {
+		// In-flight io_uring operations may refer to mbuf blocks and to
+		// the event loop, so wait for them before those are freed.
+		ioUring.shutdown();
 		MemoryKit::mbuf_pool_deinit(&mbuf_pool);
 	}
 
+	/**
+	 * Returns this Context's io_uring, or NULL if io_uring is not supported.
+	 * The ring is set up on first use, so this may only be called from the
+	 * event loop thread.
+	 */
+	IoUring *getIoUring() {
+		if (OXT_UNLIKELY(!ioUringInitialized)) {
+			ioUringInitialized = true;
+			ioUring.initialize(libev->getLoop());
+		}
+		if (ioUring.isAvailable()) {
+			return &ioUring;
+		} else {
+			return NULL;
+		}
+	}
+
 	Json::Value inspectStateAsJson() const {
 		Json::Value doc;
 		Json::Value mbufDoc;
@@ -127,6 +361,19 @@ public:
 		#endif
 
 		doc["mbuf_pool"] = mbufDoc;
+		if (numaNode >= 0) {
+			doc["numa_node"] = numaNode;
+		}
+		if (!cpuAffinity.empty()) {
+			doc["cpu_affinity"] = cpuAffinity;
+		}
+		if (ioUringInitialized) {
+			doc["io_uring"] = ioUring.inspectStateAsJson();
+		}
+		if (defaultFileBufferedChannelConfig.memoryTier != NULL) {
+			doc["file_buffer_memory_tier"] =
+				defaultFileBufferedChannelConfig.memoryTier->inspectStateAsJson();
+		}
 
 		return doc;
 	}
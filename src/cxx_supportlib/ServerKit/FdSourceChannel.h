@@ -28,13 +28,17 @@
 
 #include <oxt/macros.hpp>
 #include <boost/move/move.hpp>
+#include <boost/cstdint.hpp>
+#include <algorithm>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <ev.h>
 #include <jsoncpp/json.h>
 #include <MemoryKit/mbuf.h>
 #include <ServerKit/Context.h>
 #include <ServerKit/Channel.h>
+#include <Utils/JsonUtils.h>
 
 namespace Passenger {
 namespace ServerKit {
@@ -42,10 +46,35 @@ namespace ServerKit {
 using namespace oxt;
 
 
+/**
+ * A Channel that reads data from a file descriptor. Reads happen in bursts of up to
+ * `burstReadCount` system calls per readiness event.
+ *
+ * ## Scatter reads
+ *
+ * mbufs are small, so reading a large upload or app response one mbuf at a time
+ * results in many `read()` calls. If `Context::defaultFdSourceChannelConfig.maxScatterBuffers`
+ * is larger than 1, then FdSourceChannel fills several mbufs with a single `readv()` call
+ * and feeds them to the Channel one after another. The number of mbufs per `readv()`
+ * adapts to the observed throughput: it doubles every time a `readv()` fills all buffers
+ * and it is halved when at most half of the buffers were used. A connection that only
+ * transfers small messages therefore keeps doing single-buffer reads.
+ *
+ * If the data callback stops accepting input before the entire batch has been fed,
+ * then the remaining mbufs are kept in `pendingBuffers` and are fed before the next
+ * read from the file descriptor.
+ */
 class FdSourceChannel: protected Channel {
 private:
 	ev_io watcher;
 	MemoryKit::mbuf buffer;
+	MemoryKit::mbuf pendingBuffers[FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS];
+	FdSourceChannelConfig *config;
+	unsigned int pendingBufferIndex: 8;
+	unsigned int pendingBufferCount: 8;
+	unsigned int scatterBufferCount: 8;
+	unsigned int readCalls;
+	boost::uint64_t bytesRead;
 
 	static void _onReadable(EV_P_ ev_io *io, int revents) {
 		static_cast<FdSourceChannel *>(io->data)->onReadable(io, revents);
@@ -57,20 +86,36 @@ private:
 	}
 
 	void onReadableWithoutRefGuard() {
+		if (!acceptingInput()) {
+			stopReadingUntilConsumed();
+			return;
+		}
+
+		if (pendingBufferIndex < pendingBufferCount) {
+			if (!feedPendingBuffers()) {
+				// Callback deinitialized this object.
+				return;
+			}
+			if (!acceptingInput()) {
+				stopReadingUntilConsumed();
+				return;
+			}
+		}
+
+		if (config->maxScatterBuffers > 1) {
+			readWithScatter();
+		} else {
+			readWithoutScatter();
+		}
+	}
+
+	void readWithoutScatter() {
 		unsigned int generation = this->generation;
 		unsigned int i, origBufferSize;
 		bool done = false;
 		ssize_t ret;
 		int e;
 
-		if (!acceptingInput()) {
-			ev_io_stop(ctx->libev->getLoop(), &watcher);
-			if (mayAcceptInputLater()) {
-				consumedCallback = onChannelConsumed;
-			}
-			return;
-		}
-
 		for (i = 0; i < burstReadCount && !done; i++) {
 			if (buffer.empty()) {
 				buffer = MemoryKit::mbuf_get(&ctx->mbuf_pool);
@@ -80,8 +125,10 @@ private:
 			do {
 				ret = ::read(watcher.fd, buffer.start, buffer.size());
 			} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+			readCalls++;
 			if (ret > 0) {
 				MemoryKit::mbuf buffer2(buffer, 0, ret);
+				bytesRead += ret;
 				if (size_t(ret) == size_t(buffer.size())) {
 					// Unref mbuf_block
 					buffer = MemoryKit::mbuf();
@@ -96,10 +143,7 @@ private:
 
 				if (!acceptingInput()) {
 					done = true;
-					ev_io_stop(ctx->libev->getLoop(), &watcher);
-					if (mayAcceptInputLater()) {
-						consumedCallback = onChannelConsumed;
-					}
+					stopReadingUntilConsumed();
 				} else {
 					// If we were unable to fill the entire buffer, then it's likely that
 					// the client is slow and that the next read() will fail with
@@ -125,16 +169,166 @@ private:
 		}
 	}
 
+	void readWithScatter() {
+		MemoryKit::mbuf buffers[FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS];
+		struct iovec iov[FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS];
+		unsigned int i, j, count, used;
+		size_t capacity, remaining, size;
+		bool done = false;
+		ssize_t ret;
+		int e;
+
+		for (i = 0; i < burstReadCount && !done; i++) {
+			count = std::min<unsigned int>(scatterBufferCount, config->maxScatterBuffers);
+			count = std::min<unsigned int>(count, FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS);
+			capacity = 0;
+			for (j = 0; j < count; j++) {
+				if (j == 0 && !buffer.empty()) {
+					buffers[j] = buffer;
+				} else {
+					buffers[j] = MemoryKit::mbuf_get(&ctx->mbuf_pool);
+				}
+				iov[j].iov_base = buffers[j].start;
+				iov[j].iov_len  = buffers[j].size();
+				capacity += buffers[j].size();
+			}
+
+			do {
+				ret = ::readv(watcher.fd, iov, count);
+			} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+			readCalls++;
+			if (ret > 0) {
+				bytesRead += ret;
+				remaining = ret;
+				used = 0;
+				while (remaining > 0) {
+					size = std::min<size_t>(remaining, buffers[used].size());
+					pendingBuffers[used] = MemoryKit::mbuf(buffers[used], 0, size);
+					remaining -= size;
+					used++;
+				}
+				if (pendingBuffers[used - 1].size() < buffers[used - 1].size()) {
+					buffer = MemoryKit::mbuf(buffers[used - 1],
+						pendingBuffers[used - 1].size());
+				} else {
+					// Unref mbuf_block
+					buffer = MemoryKit::mbuf();
+				}
+				for (j = 0; j < count; j++) {
+					// Return unused mbuf_blocks to the pool.
+					buffers[j] = MemoryKit::mbuf();
+				}
+				pendingBufferIndex = 0;
+				pendingBufferCount = used;
+				adjustScatterBufferCount(count, used, (size_t) ret == capacity);
+
+				if (!feedPendingBuffers()) {
+					// Callback deinitialized this object.
+					return;
+				}
+
+				if (!acceptingInput()) {
+					done = true;
+					stopReadingUntilConsumed();
+				} else {
+					// See the comment in readWithoutScatter().
+					done = (size_t) ret < capacity;
+				}
+
+			} else {
+				for (j = 0; j < count; j++) {
+					buffers[j] = MemoryKit::mbuf();
+				}
+				done = true;
+				buffer = MemoryKit::mbuf();
+
+				if (ret == 0) {
+					ev_io_stop(ctx->libev->getLoop(), &watcher);
+					feedWithoutRefGuard(MemoryKit::mbuf());
+				} else {
+					e = errno;
+					if (e != EAGAIN && e != EWOULDBLOCK) {
+						ev_io_stop(ctx->libev->getLoop(), &watcher);
+						feedError(e);
+					}
+				}
+			}
+		}
+	}
+
+	void adjustScatterBufferCount(unsigned int count, unsigned int used, bool full) {
+		unsigned int max = std::min<unsigned int>(config->maxScatterBuffers,
+			FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS);
+		if (full) {
+			scatterBufferCount = std::min<unsigned int>(count * 2, max);
+		} else if (used <= count / 2) {
+			scatterBufferCount = std::max<unsigned int>(count / 2, 1);
+		}
+	}
+
+	/**
+	 * Feeds the mbufs that were filled by the last `readv()` but that haven't
+	 * been passed to the Channel yet, for as long as the Channel accepts input.
+	 * Returns false if the data callback deinitialized this object.
+	 */
+	bool feedPendingBuffers() {
+		unsigned int generation = this->generation;
+
+		while (pendingBufferIndex < pendingBufferCount && acceptingInput()) {
+			MemoryKit::mbuf buffer2(boost::move(pendingBuffers[pendingBufferIndex]));
+			pendingBuffers[pendingBufferIndex] = MemoryKit::mbuf();
+			pendingBufferIndex++;
+			feedWithoutRefGuard(boost::move(buffer2));
+			if (generation != this->generation) {
+				return false;
+			}
+		}
+
+		if (pendingBufferIndex == pendingBufferCount) {
+			pendingBufferIndex = 0;
+			pendingBufferCount = 0;
+		}
+		return true;
+	}
+
+	void clearPendingBuffers() {
+		while (pendingBufferIndex < pendingBufferCount) {
+			pendingBuffers[pendingBufferIndex] = MemoryKit::mbuf();
+			pendingBufferIndex++;
+		}
+		pendingBufferIndex = 0;
+		pendingBufferCount = 0;
+	}
+
+	void stopReadingUntilConsumed() {
+		ev_io_stop(ctx->libev->getLoop(), &watcher);
+		if (mayAcceptInputLater()) {
+			consumedCallback = onChannelConsumed;
+		}
+	}
+
 	static void onChannelConsumed(Channel *channel, unsigned int size) {
 		FdSourceChannel *self = static_cast<FdSourceChannel *>(channel);
 		self->consumedCallback = NULL;
 		if (self->acceptingInput()) {
 			ev_io_start(self->ctx->libev->getLoop(), &self->watcher);
+			if (self->pendingBufferIndex < self->pendingBufferCount) {
+				// The remainder of the last scatter read must be fed even if
+				// the fd doesn't become readable again, but not from inside
+				// the consumer's `consumed()` call.
+				ev_feed_event(self->ctx->libev->getLoop(), &self->watcher, EV_READ);
+			}
 		}
 	}
 
 	void initialize() {
 		burstReadCount = 1;
+		config = NULL;
+		pendingBufferIndex = 0;
+		pendingBufferCount = 0;
+		scatterBufferCount = 1;
+		readCalls = 0;
+		bytesRead = 0;
 		watcher.active = false;
 		watcher.fd = -1;
 		watcher.data = this;
@@ -151,6 +345,7 @@ public:
 		: Channel(context)
 	{
 		initialize();
+		config = &context->defaultFdSourceChannelConfig;
 	}
 
 	~FdSourceChannel() {
@@ -163,15 +358,22 @@ public:
 	OXT_FORCE_INLINE
 	void setContext(Context *context) {
 		Channel::setContext(context);
+		if (config == NULL) {
+			config = &context->defaultFdSourceChannelConfig;
+		}
 	}
 
 	void reinitialize(int fd) {
 		Channel::reinitialize();
 		ev_io_init(&watcher, _onReadable, fd, EV_READ);
+		scatterBufferCount = 1;
+		readCalls = 0;
+		bytesRead = 0;
 	}
 
 	void deinitialize() {
 		buffer = MemoryKit::mbuf();
+		clearPendingBuffers();
 		if (ev_is_active(&watcher)) {
 			ev_io_stop(ctx->libev->getLoop(), &watcher);
 		}
@@ -232,6 +434,36 @@ public:
 		return hooks;
 	}
 
+	OXT_FORCE_INLINE
+	FdSourceChannelConfig *getConfig() const {
+		return config;
+	}
+
+	OXT_FORCE_INLINE
+	void setConfig(FdSourceChannelConfig *config) {
+		this->config = config;
+	}
+
+	OXT_FORCE_INLINE
+	unsigned int getReadCalls() const {
+		return readCalls;
+	}
+
+	OXT_FORCE_INLINE
+	boost::uint64_t getBytesRead() const {
+		return bytesRead;
+	}
+
+	/**
+	 * Returns whether some mbufs from the last scatter read haven't been
+	 * fed yet. When called from the data callback, this tells whether more
+	 * data will follow the current buffer without reading from the fd again.
+	 */
+	OXT_FORCE_INLINE
+	bool hasPendingBuffers() const {
+		return pendingBufferIndex < pendingBufferCount;
+	}
+
 	OXT_FORCE_INLINE
 	void setHooks(Hooks *hooks) {
 		this->hooks = hooks;
@@ -241,6 +473,12 @@ public:
 		Json::Value doc = Channel::inspectAsJson();
 		doc["initialized"] = watcher.fd != -1;
 		doc["io_watcher_active"] = (bool) watcher.active;
+		doc["read_calls"] = readCalls;
+		doc["bytes_read"] = byteSizeToJson(bytesRead);
+		doc["scatter_buffers"] = scatterBufferCount;
+		if (pendingBufferIndex < pendingBufferCount) {
+			doc["pending_buffers"] = pendingBufferCount - pendingBufferIndex;
+		}
 		return doc;
 	}
 };
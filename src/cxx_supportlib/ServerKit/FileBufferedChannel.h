@@ -45,6 +45,7 @@
 #include <ServerKit/Context.h>
 #include <ServerKit/Errors.h>
 #include <ServerKit/Channel.h>
+#include <ServerKit/IoUring.h>
 #include <Utils/JsonUtils.h>
 
 namespace Passenger {
@@ -79,6 +80,11 @@ using namespace std;
  * FileBufferedChannel operates by default in the in-memory mode. All data is buffered
  * in memory. Beyond a threshold (determined by `passedThreshold()`), it switches
  * to in-file mode.
+ *
+ * If the config specifies a memory tier (see FileBufferedChannelMemoryTier), then
+ * data beyond the threshold stays in memory as long as the memory tier's budget,
+ * which is shared by all FileBufferedChannels, permits. Only when the budget is
+ * exhausted does it switch to in-file mode.
  */
 class FileBufferedChannel: protected Channel {
 public:
@@ -205,8 +211,8 @@ public:
 
 private:
 	/**
-	 * A structure containing the details of a libuv asynchronous
-	 * filesystem I/O request.
+	 * A structure containing the details of an asynchronous filesystem
+	 * I/O request, performed through either libuv or io_uring.
 	 *
 	 * The I/O callback is responsible for destroying its corresponding
 	 * FileIOContext object.
@@ -235,8 +241,17 @@ private:
 		 */
 		SafeLibevPtr libev;
 		uv_loop_t *libuv;
-		/* req.data always refers back to the FileIOContext object itself. */
+		/** NULL if io_uring is not used for this FileBufferedChannel. */
+		IoUring *ioUring;
+		/**
+		 * req.data always refers back to the FileIOContext object itself.
+		 * If the I/O operation is performed through io_uring, then
+		 * `req.result` is set before the callback is called, but the
+		 * rest of `req` is unused.
+		 */
 		uv_fs_t req;
+		/* ringOp.data always refers back to the FileIOContext object itself. */
+		IoUring::Operation ringOp;
 
 		/**
 		 * Also a pointer to the FileBufferedChannel, but this is used for
@@ -250,11 +265,13 @@ private:
 			: self(_self),
 			  libev(_self->ctx->libev),
 			  libuv(_self->ctx->libuv),
+			  ioUring(_self->getIoUring()),
 			  logbase(_self)
 		{
 			req.type = UV_UNKNOWN_REQ;
 			req.result = -1;
 			req.data = this;
+			ringOp.data = this;
 		}
 
 		virtual ~FileIOContext() { }
@@ -262,8 +279,9 @@ private:
 		void cancel() {
 			if (!isCanceled()) {
 				// uv_cancel() fails if the work is already in progress
-				// or completed, so we set self to NULL as an extra
-				// indicator that this I/O operation is canceled.
+				// or completed, or if the operation was submitted through
+				// io_uring, so we set self to NULL as an extra indicator
+				// that this I/O operation is canceled.
 				uv_cancel((uv_req_t *) &req);
 				self = NULL;
 			}
@@ -325,6 +343,12 @@ private:
 		 */
 		uv_loop_t *libuv;
 
+		/**
+		 * The io_uring associated with the FileBufferedChannel, or NULL
+		 * if it doesn't use io_uring.
+		 */
+		IoUring *ioUring;
+
 		/**
 		 * The file descriptor of the temp file. It's -1 if the file is being
 		 * created.
@@ -374,8 +398,9 @@ private:
 		 */
 		boost::int64_t written;
 
-		InFileMode(uv_loop_t *_libuv)
+		InFileMode(uv_loop_t *_libuv, IoUring *_ioUring)
 			: libuv(_libuv),
+			  ioUring(_ioUring),
 			  fd(-1),
 			  readRequest(NULL),
 			  writerState(WS_INACTIVE),
@@ -393,6 +418,10 @@ private:
 		}
 
 		void closeFdInBackground() {
+			if (ioUring != NULL && closeFdInBackgroundWithIoUring(ioUring, fd)) {
+				return;
+			}
+
 			uv_fs_t *req = (uv_fs_t *) malloc(sizeof(uv_fs_t));
 			if (req == NULL) {
 				P_CRITICAL("Cannot close file descriptor for FileBufferedChannel temp file: "
@@ -416,6 +445,28 @@ private:
 		}
 	};
 
+	struct CloseOperation: public IoUring::Operation {
+		int fd;
+	};
+
+	static bool closeFdInBackgroundWithIoUring(IoUring *ioUring, int fd) {
+		CloseOperation *op = new CloseOperation();
+		op->callback = fileClosedWithIoUring;
+		op->fd = fd;
+		if (ioUring->close(fd, op)) {
+			return true;
+		} else {
+			delete op;
+			return false;
+		}
+	}
+
+	static void fileClosedWithIoUring(IoUring::Operation *_op, int result) {
+		CloseOperation *op = static_cast<CloseOperation *>(_op);
+		P_LOG_FILE_DESCRIPTOR_CLOSE(op->fd);
+		delete op;
+	}
+
 	FileBufferedChannelConfig *config;
 	Mode mode: 2;
 	ReaderState readerState: 3;
@@ -444,6 +495,21 @@ private:
 	 * is responsible for popping buffers (and writing them to the file).
 	 */
 	boost::uint32_t bytesBuffered;
+	/**
+	 * Number of bytes beyond the threshold that are charged to
+	 * `config->memoryTier`.
+	 *
+	 * @invariant
+	 *     if bytesInMemoryTier > 0:
+	 *         config->memoryTier != NULL
+	 */
+	boost::uint32_t bytesInMemoryTier;
+	/**
+	 * The account that `getTotalBytesBuffered()` is reported to, if any.
+	 * `bytesAccounted` is the value that was last reported.
+	 */
+	FileBufferedChannelAccount *account;
+	boost::uint64_t bytesAccounted;
 	MemoryKit::mbuf firstBuffer;
 	deque<MemoryKit::mbuf> moreBuffers;
 
@@ -460,6 +526,10 @@ private:
 		unsigned int oldNbuffers = nbuffers;
 		nbuffers = 0;
 		bytesBuffered = 0;
+		if (OXT_UNLIKELY(bytesInMemoryTier > 0)) {
+			dischargeMemoryTier();
+		}
+		updateAccount();
 		firstBuffer = MemoryKit::mbuf();
 		if (!moreBuffers.empty()) {
 			// Some STL implementations, like OS X's, iterate through
@@ -482,6 +552,7 @@ private:
 		}
 		nbuffers++;
 		bytesBuffered += buffer.size();
+		updateAccount();
 		FBC_DEBUG("pushBuffer() completed: nbuffers = " << nbuffers << ", bytesBuffered = " << bytesBuffered);
 	}
 
@@ -489,6 +560,10 @@ private:
 		assert(bytesBuffered >= firstBuffer.size());
 		bytesBuffered -= firstBuffer.size();
 		nbuffers--;
+		if (OXT_UNLIKELY(bytesInMemoryTier > 0)) {
+			dischargeMemoryTier();
+		}
+		updateAccount();
 		FBC_DEBUG("popBuffer() completed: nbuffers = " << nbuffers << ", bytesBuffered = " << bytesBuffered);
 		if (moreBuffers.empty()) {
 			firstBuffer = MemoryKit::mbuf();
@@ -526,6 +601,59 @@ private:
 		}
 	}
 
+	/**
+	 * Charges the part of `bytesBuffered` beyond the threshold to the memory
+	 * tier, so that we can keep buffering in memory instead of spilling to disk.
+	 * Returns false if there is no memory tier or if its budget is exhausted.
+	 */
+	bool chargeMemoryTier() {
+		FileBufferedChannelMemoryTier *tier = config->memoryTier;
+		if (tier == NULL) {
+			return false;
+		}
+
+		boost::uint32_t excess = bytesBuffered - config->threshold;
+		if (excess <= bytesInMemoryTier) {
+			return true;
+		} else if (tier->reserve(excess - bytesInMemoryTier)) {
+			bytesInMemoryTier = excess;
+			FBC_DEBUG("Charged to memory tier: bytesInMemoryTier = " << bytesInMemoryTier);
+			return true;
+		} else {
+			FBC_DEBUG("Memory tier exhausted");
+			return false;
+		}
+	}
+
+	/**
+	 * Releases the memory tier charges that are no longer needed
+	 * because buffers have been popped.
+	 */
+	void dischargeMemoryTier() {
+		boost::uint32_t excess = (bytesBuffered > config->threshold)
+			? bytesBuffered - config->threshold
+			: 0;
+		if (excess < bytesInMemoryTier) {
+			config->memoryTier->release(bytesInMemoryTier - excess);
+			bytesInMemoryTier = excess;
+		}
+	}
+
+	/**
+	 * Reports changes in `getTotalBytesBuffered()` to the account.
+	 * Must be called after every change in `bytesBuffered`,
+	 * `inFileMode->written` or `mode`.
+	 */
+	void updateAccount() {
+		if (account != NULL) {
+			boost::uint64_t total = getTotalBytesBuffered();
+			if (total != bytesAccounted) {
+				account->update(bytesAccounted, total);
+				bytesAccounted = total;
+			}
+		}
+	}
+
 	void callBuffersFlushedCallback() {
 		if (buffersFlushedCallback != NULL) {
 			FBC_DEBUG("Calling buffersFlushedCallback");
@@ -736,15 +864,32 @@ private:
 		readerState = RS_READING_FROM_FILE;
 		inFileMode->readRequest = readContext;
 
-		uv_fs_read(ctx->libuv, &readContext->req, inFileMode->fd,
-			&readContext->uvBuffer, 1, inFileMode->readOffset,
-			_nextChunkDoneReading);
+		readContext->ringOp.callback = _nextChunkDoneReadingWithIoUring;
+		if (readContext->ioUring == NULL
+		 || !readContext->ioUring->read(inFileMode->fd, readContext->buffer.start,
+			size, inFileMode->readOffset, &readContext->ringOp))
+		{
+			uv_fs_read(ctx->libuv, &readContext->req, inFileMode->fd,
+				&readContext->uvBuffer, 1, inFileMode->readOffset,
+				_nextChunkDoneReading);
+		}
 		verifyInvariants();
 	}
 
 	static void _nextChunkDoneReading(uv_fs_t *req) {
 		ReadContext *readContext = (ReadContext *) req->data;
 		uv_fs_req_cleanup(req);
+		_nextChunkDoneReadingCommon(readContext);
+	}
+
+	static void _nextChunkDoneReadingWithIoUring(IoUring::Operation *op, int result) {
+		ReadContext *readContext = static_cast<ReadContext *>(
+			static_cast<FileIOContext *>(op->data));
+		readContext->req.result = result;
+		_nextChunkDoneReadingCommon(readContext);
+	}
+
+	static void _nextChunkDoneReadingCommon(ReadContext *readContext) {
 		if (readContext->isCanceled()) {
 			delete readContext;
 			return;
@@ -772,6 +917,7 @@ private:
 			buffer = MemoryKit::mbuf(buffer, 0, fd);
 			inFileMode->readOffset += buffer.size();
 			inFileMode->written -= buffer.size();
+			updateAccount();
 
 			FBC_DEBUG("Reader: feeding buffer, " << buffer.size() << " bytes");
 			readerState = RS_FEEDING;
@@ -836,7 +982,7 @@ private:
 
 		FBC_DEBUG("Switching to in-file mode");
 		mode = IN_FILE_MODE;
-		inFileMode = boost::make_shared<InFileMode>(ctx->libuv);
+		inFileMode = boost::make_shared<InFileMode>(ctx->libuv, getIoUring());
 		createBufferFile();
 	}
 
@@ -885,6 +1031,13 @@ private:
 
 		if (config->delayInFileModeSwitching == 0) {
 			FBC_DEBUG("Writer: creating file " << fcContext->path);
+			fcContext->ringOp.callback = _bufferFileCreatedWithIoUring;
+			if (fcContext->ioUring != NULL
+			 && fcContext->ioUring->open(fcContext->path.c_str(),
+				O_RDWR | O_CREAT | O_EXCL, 0600, &fcContext->ringOp))
+			{
+				return;
+			}
 			int result = uv_fs_open(ctx->libuv, &fcContext->req,
 				fcContext->path.c_str(), O_RDWR | O_CREAT | O_EXCL,
 				0600, _bufferFileCreated);
@@ -916,6 +1069,13 @@ private:
 	void bufferFileDoneDelaying(FileCreationContext *fcContext) {
 		FBC_DEBUG("Writer: done delaying in-file mode switching. "
 			"Creating file: " << fcContext->path);
+		fcContext->ringOp.callback = _bufferFileCreatedWithIoUring;
+		if (fcContext->ioUring != NULL
+		 && fcContext->ioUring->open(fcContext->path.c_str(),
+			O_RDWR | O_CREAT | O_EXCL, 0600, &fcContext->ringOp))
+		{
+			return;
+		}
 		int result = uv_fs_open(ctx->libuv, &fcContext->req,
 			fcContext->path.c_str(), O_RDWR | O_CREAT | O_EXCL,
 			0600, _bufferFileCreated);
@@ -928,8 +1088,19 @@ private:
 	static void _bufferFileCreated(uv_fs_t *req) {
 		FileCreationContext *fcContext = static_cast<FileCreationContext *>(req->data);
 		uv_fs_req_cleanup(req);
+		_bufferFileCreatedCommon(fcContext);
+	}
+
+	static void _bufferFileCreatedWithIoUring(IoUring::Operation *op, int result) {
+		FileCreationContext *fcContext = static_cast<FileCreationContext *>(
+			static_cast<FileIOContext *>(op->data));
+		fcContext->req.result = result;
+		_bufferFileCreatedCommon(fcContext);
+	}
+
+	static void _bufferFileCreatedCommon(FileCreationContext *fcContext) {
 		if (fcContext->isCanceled()) {
-			if (req->result >= 0) {
+			if (fcContext->req.result >= 0) {
 				FBC_DEBUG_FROM_CALLBACK(fcContext,
 					"Writer: creation of file " << fcContext->path <<
 					"canceled. Deleting file in the background");
@@ -978,6 +1149,12 @@ private:
 
 		assert(fcContext->req.result >= 0);
 
+		if (fcContext->ioUring != NULL
+		 && closeFdInBackgroundWithIoUring(fcContext->ioUring, fcContext->req.result))
+		{
+			return;
+		}
+
 		uv_fs_t *closeReq = (uv_fs_t *) malloc(sizeof(uv_fs_t));
 		if (closeReq == NULL) {
 			FBC_CRITICAL_FROM_CALLBACK(fcContext,
@@ -1002,6 +1179,13 @@ private:
 		// here as a warning that we should not use the backpointer.
 		fcContext->self = NULL;
 
+		fcContext->ringOp.callback = bufferFileUnlinkedWithIoUring;
+		if (fcContext->ioUring != NULL
+		 && fcContext->ioUring->unlink(fcContext->path.c_str(), &fcContext->ringOp))
+		{
+			return;
+		}
+
 		uv_fs_t *unlinkReq = (uv_fs_t *) malloc(sizeof(uv_fs_t));
 		if (unlinkReq == NULL) {
 			FBC_ERROR_FROM_CALLBACK(fcContext,
@@ -1047,6 +1231,22 @@ private:
 		delete fcContext;
 	}
 
+	static void bufferFileUnlinkedWithIoUring(IoUring::Operation *op, int result) {
+		FileCreationContext *fcContext = static_cast<FileCreationContext *>(
+			static_cast<FileIOContext *>(op->data));
+		assert(fcContext->self == NULL);
+
+		if (result >= 0) {
+			FBC_DEBUG_FROM_CALLBACK(fcContext,
+				"Writer: file " << fcContext->path << " deleted");
+		} else {
+			FBC_DEBUG_FROM_CALLBACK(fcContext,
+				"Writer: failed to delete " << fcContext->path <<
+				": " << getErrorDesc(-result) << " (errno=" << -result << ")");
+		}
+		delete fcContext;
+	}
+
 	static void bufferFileClosed(uv_fs_t *req) {
 		uv_fs_req_cleanup(req);
 		free(req);
@@ -1095,6 +1295,20 @@ private:
 
 		inFileMode->writerState = WS_MOVING;
 		inFileMode->writerRequest = moveContext;
+		writeMoveContextBuffer(moveContext);
+		verifyInvariants();
+	}
+
+	void writeMoveContextBuffer(MoveContext *moveContext) {
+		moveContext->ringOp.callback = _bufferWrittenToFileWithIoUring;
+		if (moveContext->ioUring != NULL
+		 && moveContext->ioUring->write(inFileMode->fd, moveContext->uvBuffer.base,
+			moveContext->uvBuffer.len, inFileMode->readOffset + inFileMode->written,
+			&moveContext->ringOp))
+		{
+			return;
+		}
+
 		int result = uv_fs_write(ctx->libuv, &moveContext->req, inFileMode->fd,
 			&moveContext->uvBuffer, 1,
 			inFileMode->readOffset + inFileMode->written,
@@ -1104,12 +1318,22 @@ private:
 			ctx->libev->runLater(boost::bind(_bufferWrittenToFile,
 				&moveContext->req));
 		}
-		verifyInvariants();
 	}
 
 	static void _bufferWrittenToFile(uv_fs_t *req) {
 		MoveContext *moveContext = static_cast<MoveContext *>(req->data);
 		uv_fs_req_cleanup(req);
+		_bufferWrittenToFileCommon(moveContext);
+	}
+
+	static void _bufferWrittenToFileWithIoUring(IoUring::Operation *op, int result) {
+		MoveContext *moveContext = static_cast<MoveContext *>(
+			static_cast<FileIOContext *>(op->data));
+		moveContext->req.result = result;
+		_bufferWrittenToFileCommon(moveContext);
+	}
+
+	static void _bufferWrittenToFileCommon(MoveContext *moveContext) {
 		if (moveContext->isCanceled()) {
 			delete moveContext;
 			return;
@@ -1154,15 +1378,7 @@ private:
 				moveContext->uvBuffer = uv_buf_init(
 					moveContext->buffer.start + moveContext->written,
 					moveContext->buffer.size() - moveContext->written);
-				int result = uv_fs_write(ctx->libuv, &moveContext->req,
-					inFileMode->fd, &moveContext->uvBuffer, 1,
-					inFileMode->readOffset + inFileMode->written,
-					_bufferWrittenToFile);
-				if (result != 0) {
-					moveContext->req.result = result;
-					ctx->libev->runLater(boost::bind(_bufferWrittenToFile,
-						&moveContext->req));
-				}
+				writeMoveContextBuffer(moveContext);
 				verifyInvariants();
 			}
 		} else {
@@ -1178,6 +1394,14 @@ private:
 
 	/***** Misc *****/
 
+	IoUring *getIoUring() const {
+		if (config->useIoUring) {
+			return ctx->getIoUring();
+		} else {
+			return NULL;
+		}
+	}
+
 	void setError(int errcode, const char *file, unsigned int line) {
 		if (mode >= ERROR) {
 			return;
@@ -1192,6 +1416,7 @@ private:
 		readerState = RS_TERMINATED;
 		this->errcode = errcode;
 		inFileMode.reset();
+		updateAccount();
 		if (acceptingInput()) {
 			FBC_DEBUG("Feeding error");
 			mode = ERROR;
@@ -1355,6 +1580,9 @@ public:
 		  nbuffers(0),
 		  errcode(0),
 		  bytesBuffered(0),
+		  bytesInMemoryTier(0),
+		  account(NULL),
+		  bytesAccounted(0),
 		  inFileMode(),
 		  buffersFlushedCallback(NULL),
 		  dataFlushedCallback(NULL)
@@ -1370,6 +1598,9 @@ public:
 		  nbuffers(0),
 		  errcode(0),
 		  bytesBuffered(0),
+		  bytesInMemoryTier(0),
+		  account(NULL),
+		  bytesAccounted(0),
 		  inFileMode(),
 		  buffersFlushedCallback(NULL),
 		  dataFlushedCallback(NULL)
@@ -1382,6 +1613,12 @@ public:
 		if (mode == IN_FILE_MODE) {
 			cancelWriter();
 		}
+		if (bytesInMemoryTier > 0) {
+			config->memoryTier->release(bytesInMemoryTier);
+		}
+		if (bytesAccounted > 0) {
+			account->update(bytesAccounted, 0);
+		}
 	}
 
 	// May only be called right after construction.
@@ -1413,7 +1650,7 @@ public:
 			return;
 		}
 		pushBuffer(buffer);
-		if (mode == IN_MEMORY_MODE && passedThreshold()) {
+		if (mode == IN_MEMORY_MODE && passedThreshold() && !chargeMemoryTier()) {
 			switchToInFileMode();
 		} else if (mode == IN_FILE_MODE
 		        && inFileMode->writerState == WS_INACTIVE
@@ -1462,6 +1699,7 @@ public:
 		if (OXT_UNLIKELY(inFileMode != NULL)) {
 			inFileMode.reset();
 		}
+		updateAccount();
 		Channel::deinitialize();
 	}
 
@@ -1504,6 +1742,14 @@ public:
 		return bytesBuffered;
 	}
 
+	/**
+	 * Returns the number of bytes buffered in memory beyond the threshold,
+	 * which are charged to the memory tier.
+	 */
+	unsigned int getBytesBufferedInMemoryTier() const {
+		return bytesInMemoryTier;
+	}
+
 	/**
 	 * Returns the number of bytes that are buffered on disk
 	 * and have not yet been read.
@@ -1523,6 +1769,23 @@ public:
 		return bytesBuffered + getBytesBufferedOnDisk();
 	}
 
+	FileBufferedChannelAccount *getAccount() const {
+		return account;
+	}
+
+	/**
+	 * Makes this channel report the total number of bytes it buffers
+	 * to the given account (which may be NULL).
+	 */
+	void setAccount(FileBufferedChannelAccount *newAccount) {
+		if (bytesAccounted > 0) {
+			account->update(bytesAccounted, 0);
+			bytesAccounted = 0;
+		}
+		account = newAccount;
+		updateAccount();
+	}
+
 	bool ended() const {
 		return (hasBuffers() && peekLastBuffer().empty())
 			|| mode >= ERROR || Channel::ended();
@@ -1536,6 +1799,14 @@ public:
 		return bytesBuffered >= config->threshold;
 	}
 
+	/**
+	 * Returns whether all data that has been fed so far has been
+	 * consumed by the data callback.
+	 */
+	bool isFlushed() const {
+		return readerState == RS_INACTIVE;
+	}
+
 	OXT_FORCE_INLINE
 	void setDataCallback(DataCallback callback) {
 		Channel::dataCallback = callback;
@@ -1597,6 +1868,9 @@ public:
 		doc["reader_state"] = getReaderStateString();
 		doc["nbuffers"] = nbuffers;
 		doc["bytes_buffered"] = byteSizeToJson(getBytesBuffered());
+		if (config->memoryTier != NULL) {
+			doc["bytes_buffered_in_memory_tier"] = byteSizeToJson(bytesInMemoryTier);
+		}
 
 		return doc;
 	}
@@ -214,6 +214,16 @@ public:
 		return FileBufferedChannel::getTotalBytesBuffered();
 	}
 
+	OXT_FORCE_INLINE
+	FileBufferedChannelAccount *getAccount() const {
+		return FileBufferedChannel::getAccount();
+	}
+
+	OXT_FORCE_INLINE
+	void setAccount(FileBufferedChannelAccount *account) {
+		FileBufferedChannel::setAccount(account);
+	}
+
 	OXT_FORCE_INLINE
 	bool ended() const {
 		return FileBufferedChannel::ended();
@@ -224,6 +234,11 @@ public:
 		return FileBufferedChannel::endAcked();
 	}
 
+	OXT_FORCE_INLINE
+	bool isFlushed() const {
+		return FileBufferedChannel::isFlushed();
+	}
+
 	OXT_FORCE_INLINE
 	Hooks *getHooks() const {
 		return FileBufferedChannel::getHooks();
@@ -39,6 +39,7 @@ class BaseHttpClient: public BaseClient {
 public:
 	typedef Request RequestType;
 	LIST_HEAD(RequestList, Request);
+	STAILQ_HEAD(PipelinedRequestList, Request);
 
 	/**
 	 * @invariant
@@ -48,12 +49,32 @@ public:
 	 */
 	Request *currentRequest;
 	unsigned int requestsBegun;
+	/**
+	 * The number of lingering requests whose response is still being
+	 * flushed while later, pipelined requests are being handled.
+	 *
+	 * @invariant pipelinedResponseCount <= lingeringRequestCount
+	 */
+	unsigned int pipelinedResponseCount;
+	/**
+	 * Requests that have been fully received, and that are still being
+	 * handled while `currentRequest` already receives the next request on
+	 * the connection. In request order. Only the first one writes its
+	 * response to the output channel; the others hold back their response
+	 * data until the requests before them have ended.
+	 */
+	PipelinedRequestList pipelinedRequests;
+	unsigned int pipelinedRequestCount;
 
 	BaseHttpClient(void *server)
 		: BaseClient(server),
 		  currentRequest(NULL),
-		  requestsBegun(0)
-		{ }
+		  requestsBegun(0),
+		  pipelinedResponseCount(0),
+		  pipelinedRequestCount(0)
+	{
+		STAILQ_INIT(&pipelinedRequests);
+	}
 };
 
 
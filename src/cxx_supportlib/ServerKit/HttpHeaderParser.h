@@ -28,6 +28,8 @@
 
 #include <boost/cstdint.hpp>
 #include <oxt/backtrace.hpp>
+#include <algorithm>
+#include <limits>
 #include <cstddef>
 #include <cassert>
 #include <cstring>
@@ -35,6 +37,7 @@
 #include <ServerKit/Context.h>
 #include <ServerKit/HttpRequest.h>
 #include <ServerKit/HttpHeaderParserState.h>
+#include <ServerKit/HttpHeaderScanner.h>
 #include <DataStructures/LString.h>
 #include <DataStructures/HashedStaticString.h>
 #include <Logging.h>
@@ -207,11 +210,9 @@ private:
 			self->state->hasher.update(data, len);
 		} else {
 			char *downcasedData = (char *) psg_pnalloc(self->pool, len);
-			convertLowerCase((const unsigned char *) data,
-				(unsigned char *) downcasedData, len);
+			self->state->hasher.updateLowerCase(data, downcasedData, len);
 			psg_lstr_append(&self->state->currentHeader->key, self->pool,
 				downcasedData, len);
-			self->state->hasher.update(downcasedData, len);
 		}
 
 		return 0;
@@ -305,6 +306,301 @@ private:
 			|| message->httpState == Message::ONEHUNDRED_CONTINUE;
 	}
 
+	/***** Fast path *****/
+
+	/** The maximum number of headers that the fast path handles. */
+	static const unsigned int MAX_FAST_PATH_HEADERS = 128;
+
+	static bool equalsLowerCase(const char *data, size_t size, const char *str, size_t strSize) {
+		if (size != strSize) {
+			return false;
+		}
+		for (size_t i = 0; i < size; i++) {
+			char ch = data[i];
+			if (ch >= 'A' && ch <= 'Z') {
+				ch += 'a' - 'A';
+			}
+			if (ch != str[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static bool parseMethodFast(const char *&pos, const char *end, http_method &method) {
+		#define PSG_MATCH_METHOD(str, value) \
+			if (size_t(end - pos) >= sizeof(str) - 1 \
+			 && memcmp(pos, str, sizeof(str) - 1) == 0) \
+			{ \
+				pos += sizeof(str) - 1; \
+				method = value; \
+				return true; \
+			}
+
+		PSG_MATCH_METHOD("GET ", HTTP_GET);
+		PSG_MATCH_METHOD("POST ", HTTP_POST);
+		PSG_MATCH_METHOD("HEAD ", HTTP_HEAD);
+		PSG_MATCH_METHOD("PUT ", HTTP_PUT);
+		PSG_MATCH_METHOD("DELETE ", HTTP_DELETE);
+		PSG_MATCH_METHOD("OPTIONS ", HTTP_OPTIONS);
+		PSG_MATCH_METHOD("PATCH ", HTTP_PATCH);
+		return false;
+
+		#undef PSG_MATCH_METHOD
+	}
+
+	Header *createHeaderFast(const MemoryKit::mbuf &buffer, const char *name,
+		size_t nameSize, const char *value, size_t valueSize)
+	{
+		Header *header = (Header *) psg_palloc(pool, sizeof(Header));
+		Hasher hasher;
+
+		psg_lstr_init(&header->key);
+		psg_lstr_init(&header->origKey);
+		psg_lstr_init(&header->val);
+		psg_lstr_append(&header->origKey, pool, buffer, name, nameSize);
+		if (name[0] == '!') {
+			psg_lstr_append(&header->key, pool, buffer, name, nameSize);
+			hasher.update(name, nameSize);
+		} else {
+			char *downcasedName = (char *) psg_pnalloc(pool, nameSize);
+			hasher.updateLowerCase(name, downcasedName, nameSize);
+			psg_lstr_append(&header->key, pool, downcasedName, nameSize);
+		}
+		header->hash = hasher.finalize();
+		psg_lstr_append(&header->val, pool, buffer, value, valueSize);
+		return header;
+	}
+
+	static bool interpretConnectionHeaderFast(const char *value, size_t valueSize,
+		bool trailingWhitespace, unsigned int &flags)
+	{
+		if (trailingWhitespace) {
+			return false;
+		}
+		if (equalsLowerCase(value, valueSize, "keep-alive", sizeof("keep-alive") - 1)) {
+			flags |= F_CONNECTION_KEEP_ALIVE;
+		} else if (equalsLowerCase(value, valueSize, "close", sizeof("close") - 1)) {
+			flags |= F_CONNECTION_CLOSE;
+		}
+		return true;
+	}
+
+	/**
+	 * Interprets the headers that http_parser interprets, setting the same
+	 * parser fields. Returns false for values that http_parser would treat
+	 * specially, and that the fast path therefore leaves to it.
+	 */
+	static bool interpretHeaderFast(const Header *header, const char *value,
+		size_t valueSize, unsigned int &flags, boost::uint64_t &contentLength)
+	{
+		const char *key = header->key.start->data;
+		size_t keySize = header->key.size;
+		bool trailingWhitespace = valueSize > 0
+			&& (value[valueSize - 1] == ' ' || value[valueSize - 1] == '\t');
+
+		switch (keySize) {
+		case sizeof("content-length") - 1:
+			// http_parser ignores empty values.
+			if (valueSize > 0 && memcmp(key, "content-length", keySize) == 0) {
+				// Up to 18 digits can't overflow.
+				if (valueSize > 18) {
+					return false;
+				}
+				contentLength = 0;
+				for (size_t i = 0; i < valueSize; i++) {
+					if (value[i] < '0' || value[i] > '9') {
+						return false;
+					}
+					contentLength = contentLength * 10 + (value[i] - '0');
+				}
+			}
+			return true;
+		case sizeof("transfer-encoding") - 1:
+			if (memcmp(key, "transfer-encoding", keySize) == 0) {
+				if (trailingWhitespace) {
+					return false;
+				}
+				if (equalsLowerCase(value, valueSize, "chunked", sizeof("chunked") - 1)) {
+					flags |= F_CHUNKED;
+				}
+			}
+			return true;
+		case sizeof("connection") - 1:
+			if (memcmp(key, "connection", keySize) == 0) {
+				return interpretConnectionHeaderFast(value, valueSize,
+					trailingWhitespace, flags);
+			}
+			return true;
+		case sizeof("proxy-connection") - 1:
+			if (memcmp(key, "proxy-connection", keySize) == 0) {
+				return interpretConnectionHeaderFast(value, valueSize,
+					trailingWhitespace, flags);
+			}
+			return true;
+		case sizeof("upgrade") - 1:
+			return memcmp(key, "upgrade", keySize) != 0;
+		default:
+			return true;
+		}
+	}
+
+	/**
+	 * Releases the buffer references held by headers that parseFast()
+	 * created but won't commit. Always returns false.
+	 */
+	static bool discardHeadersFast(Header **headers, unsigned int nheaders) {
+		for (unsigned int i = 0; i < nheaders; i++) {
+			psg_lstr_deinit(&headers[i]->key);
+			psg_lstr_deinit(&headers[i]->origKey);
+			psg_lstr_deinit(&headers[i]->val);
+		}
+		return false;
+	}
+
+	/**
+	 * Parses request headers that are fully contained in `buffer` and that
+	 * only use the common, strictly formed subset of HTTP/1.0 and 1.1 (one of
+	 * the usual methods, an origin-form request target, CRLF line endings,
+	 * no obsolete line folding, no upgrade). The
+	 * request line and header boundaries are found with the SIMD scanners,
+	 * and header names are lower cased and hashed in a single pass. Produces
+	 * the same result as http_parser.
+	 *
+	 * Returns false, without modifying the message, if the request does not
+	 * qualify; http_parser then parses it. So this never has to deal with
+	 * errors, or with headers that arrive in multiple pieces.
+	 */
+	bool parseFast(const HttpParseRequest &tag, const MemoryKit::mbuf &buffer, size_t &ret) {
+		const HttpHeaderScanner *scanner = ctx->httpHeaderScanner;
+		if (scanner == NULL
+		 || state->state != HttpHeaderParserState::PARSING_NOT_STARTED
+		 || state->parser.nread != 0)
+		{
+			return false;
+		}
+
+		const char *begin = buffer.start;
+		const char *end = buffer.start + std::min<size_t>(buffer.size(), HTTP_MAX_HEADER_SIZE);
+		const char *pos = begin;
+		const char *url, *urlEnd;
+		http_method method;
+		unsigned short httpMinor;
+		unsigned int flags = 0;
+		boost::uint64_t contentLength = std::numeric_limits<boost::uint64_t>::max();
+		Header *headers[MAX_FAST_PATH_HEADERS];
+		bool secure[MAX_FAST_PATH_HEADERS];
+		unsigned int nheaders = 0, i;
+
+		// Request line
+		if (!parseMethodFast(pos, end, method) || pos == end || *pos != '/') {
+			return false;
+		}
+		url = pos;
+		pos = urlEnd = scanner->scanUrl(pos, end);
+		if (end - pos < (long) sizeof(" HTTP/1.x\r\n") - 1
+		 || memcmp(pos, " HTTP/1.", sizeof(" HTTP/1.") - 1) != 0
+		 || (pos[8] != '0' && pos[8] != '1')
+		 || pos[9] != '\r' || pos[10] != '\n')
+		{
+			return false;
+		}
+		httpMinor = pos[8] - '0';
+		pos += sizeof(" HTTP/1.x\r\n") - 1;
+
+		// Header lines
+		while (true) {
+			if (pos == end) {
+				return false;
+			} else if (*pos == '\r') {
+				if (end - pos < 2 || pos[1] != '\n') {
+					return false;
+				}
+				pos += 2;
+				break;
+			} else if (nheaders == MAX_FAST_PATH_HEADERS) {
+				return false;
+			}
+
+			const char *name = pos;
+			pos = scanner->scanToken(pos, end);
+			if (pos == name || pos == end || *pos != ':') {
+				return false;
+			}
+			const char *nameEnd = pos;
+
+			pos++;
+			while (pos < end && (*pos == ' ' || *pos == '\t')) {
+				pos++;
+			}
+			const char *value = pos;
+			pos = scanner->scanValue(pos, end);
+			// Also look at the first byte of the next line, to rule out
+			// obsolete line folding.
+			if (end - pos < 3
+			 || pos[0] != '\r' || pos[1] != '\n'
+			 || pos[2] == ' ' || pos[2] == '\t')
+			{
+				return false;
+			}
+			const char *valueEnd = pos;
+			pos += 2;
+
+			Header *header = createHeaderFast(buffer, name, nameEnd - name,
+				value, valueEnd - value);
+			headers[nheaders] = header;
+			nheaders++;
+			if (!interpretHeaderFast(header, value, valueEnd - value, flags,
+				contentLength))
+			{
+				return discardHeadersFast(headers, nheaders);
+			}
+		}
+
+		for (i = 0; i < nheaders; i++) {
+			if (!validateHeader(tag, headers[i])) {
+				// Let http_parser report the error.
+				state->state = HttpHeaderParserState::PARSING_NOT_STARTED;
+				state->secureMode = false;
+				return discardHeadersFast(headers, nheaders);
+			}
+			secure[i] = state->secureMode;
+		}
+
+		// The request qualifies. Commit the results.
+		psg_lstr_append(&message->path, pool, buffer, url, urlEnd - url);
+		for (i = 0; i < nheaders; i++) {
+			if (!secure[i]) {
+				message->headers.insert(&headers[i], pool);
+			} else {
+				message->secureHeaders.insert(&headers[i], pool);
+			}
+		}
+		state->parser.method = method;
+		state->parser.http_major = 1;
+		state->parser.http_minor = httpMinor;
+		state->parser.flags = flags;
+		state->parser.content_length = contentLength;
+		state->parser.upgrade = 0;
+		state->state = HttpHeaderParserState::PARSING_HEADER_VALUE;
+		state->currentHeader = NULL;
+		message->httpState = Message::PARSED_HEADERS;
+		indexQueryString(tag);
+		ret = pos - begin;
+		return true;
+	}
+
+	bool parseFast(const HttpParseResponse &tag, const MemoryKit::mbuf &buffer, size_t &ret) {
+		return false;
+	}
+
+	void finishParsing() {
+		message->httpMajor = state->parser.http_major;
+		message->httpMinor = state->parser.http_minor;
+		message->wantKeepAlive = http_should_keep_alive(&state->parser);
+		processParseResult(MessageType());
+	}
+
 	void processParseResult(const HttpParseRequest &tag) {
 		TRACE_POINT();
 		bool isChunked = state->parser.flags & F_CHUNKED;
@@ -451,6 +747,12 @@ public:
 		size_t ret;
 		bool paused;
 
+		if (parseFast(MessageType(), buffer, ret)) {
+			UPDATE_TRACE_POINT();
+			finishParsing();
+			return ret;
+		}
+
 		settings.on_message_begin = NULL;
 		settings.on_url = _onURL;
 		settings.on_status = onStatus;
@@ -497,10 +799,7 @@ public:
 		} else if (messageHttpStateIndicatesCompletion(MessageType())) {
 			UPDATE_TRACE_POINT();
 			ret++;
-			message->httpMajor = state->parser.http_major;
-			message->httpMinor = state->parser.http_minor;
-			message->wantKeepAlive = http_should_keep_alive(&state->parser);
-			processParseResult(MessageType());
+			finishParsing();
 		}
 
 		return ret;
@@ -0,0 +1,315 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+// Implementation is in its own file so that we can enable compiler optimizations
+// for these functions only, and so that only these functions are compiled for
+// instruction sets that are selected at runtime.
+
+#include <ServerKit/HttpHeaderScanner.h>
+#include <boost/cstdint.hpp>
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+	&& ((defined(__clang__) && (__clang_major__ > 3 || (__clang_major__ == 3 && __clang_minor__ >= 8))) \
+		|| (!defined(__clang__) && defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+	#define PSG_HTTP_HEADER_SCANNER_X86
+	#include <immintrin.h>
+#endif
+
+namespace Passenger {
+namespace ServerKit {
+
+
+enum {
+	CC_TOKEN = 1,
+	CC_URL   = 2,
+	CC_VALUE = 4
+};
+
+#define T CC_TOKEN
+#define U CC_URL
+#define V CC_VALUE
+
+static const boost::uint8_t charClasses[256] = {
+	/*   0 nul    1 soh    2 stx    3 etx    4 eot    5 enq    6 ack    7 bel  */
+	     0,       0,       0,       0,       0,       0,       0,       0,
+	/*   8 bs     9 ht    10 nl    11 vt    12 np    13 cr    14 so    15 si   */
+	     0,       V,       0,       0,       0,       0,       0,       0,
+	/*  16 dle   17 dc1   18 dc2   19 dc3   20 dc4   21 nak   22 syn   23 etb  */
+	     0,       0,       0,       0,       0,       0,       0,       0,
+	/*  24 can   25 em    26 sub   27 esc   28 fs    29 gs    30 rs    31 us   */
+	     0,       0,       0,       0,       0,       0,       0,       0,
+	/*  32 sp    33  !    34  "    35  #    36  $    37  %    38  &    39  '   */
+	     V,     T|U|V,    U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,
+	/*  40  (    41  )    42  *    43  +    44  ,    45  -    46  .    47  /   */
+	    U|V,     U|V,   T|U|V,   T|U|V,    U|V,   T|U|V,   T|U|V,    U|V,
+	/*  48  0    49  1    50  2    51  3    52  4    53  5    54  6    55  7   */
+	  T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,
+	/*  56  8    57  9    58  :    59  ;    60  <    61  =    62  >    63  ?   */
+	  T|U|V,   T|U|V,    U|V,     U|V,     U|V,     U|V,     U|V,     U|V,
+	/*  64  @    65  A    66  B    67  C    68  D    69  E    70  F    71  G   */
+	    U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,
+	/*  72  H    73  I    74  J    75  K    76  L    77  M    78  N    79  O   */
+	  T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,
+	/*  80  P    81  Q    82  R    83  S    84  T    85  U    86  V    87  W   */
+	  T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,
+	/*  88  X    89  Y    90  Z    91  [    92  \    93  ]    94  ^    95  _   */
+	  T|U|V,   T|U|V,   T|U|V,    U|V,     U|V,     U|V,   T|U|V,   T|U|V,
+	/*  96  `    97  a    98  b    99  c   100  d   101  e   102  f   103  g   */
+	  T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,
+	/* 104  h   105  i   106  j   107  k   108  l   109  m   110  n   111  o   */
+	  T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,
+	/* 112  p   113  q   114  r   115  s   116  t   117  u   118  v   119  w   */
+	  T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,   T|U|V,
+	/* 120  x   121  y   122  z   123  {   124  |   125  }   126  ~   127 del  */
+	  T|U|V,   T|U|V,   T|U|V,    U|V,   T|U|V,    U|V,   T|U|V,     0,
+	/* 128-255: only allowed in header values. */
+	V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+	V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+	V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+	V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+	V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+	V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+	V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+	V, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V
+};
+
+#undef T
+#undef U
+#undef V
+
+template<boost::uint8_t charClass>
+static inline const char *
+scanScalar(const char *begin, const char *end) {
+	while (begin < end && (charClasses[(unsigned char) *begin] & charClass)) {
+		begin++;
+	}
+	return begin;
+}
+
+static const char *
+scanTokenScalar(const char *begin, const char *end) {
+	return scanScalar<CC_TOKEN>(begin, end);
+}
+
+static const char *
+scanUrlScalar(const char *begin, const char *end) {
+	return scanScalar<CC_URL>(begin, end);
+}
+
+static const char *
+scanValueScalar(const char *begin, const char *end) {
+	return scanScalar<CC_VALUE>(begin, end);
+}
+
+
+#ifdef PSG_HTTP_HEADER_SCANNER_X86
+
+/*
+ * Finds the first byte in [begin, end) that falls in one of the given byte
+ * ranges, 16 bytes at a time. The ranges may be a superset of the bytes that
+ * are not in `charClass`: bytes that do belong to the class are skipped.
+ */
+template<boost::uint8_t charClass>
+__attribute__((target("sse4.2")))
+static inline const char *
+scanSse42(const char *begin, const char *end, const char *ranges, int rangesSize) {
+	__m128i rangesVector = _mm_loadu_si128((const __m128i *) ranges);
+
+	while (end - begin >= 16) {
+		__m128i data = _mm_loadu_si128((const __m128i *) begin);
+		int index = _mm_cmpestri(rangesVector, rangesSize, data, 16,
+			_SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+		if (index == 16) {
+			begin += 16;
+		} else {
+			begin += index;
+			if (!(charClasses[(unsigned char) *begin] & charClass)) {
+				return begin;
+			}
+			begin++;
+		}
+	}
+	return scanScalar<charClass>(begin, end);
+}
+
+// The token ranges include '|', '}', '~' and DEL; '|' and '~' are tokens.
+static const char TOKEN_STOP_RANGES[16] = {
+	'\x00', ' ', '"', '"', '(', ')', ',', ',', '/', '/', ':', '@', '[', ']', '{', '\xff'
+};
+static const char URL_STOP_RANGES[16] = {
+	'\x00', ' ', '\x7f', '\xff'
+};
+static const char VALUE_STOP_RANGES[16] = {
+	'\x00', '\x08', '\x0a', '\x1f', '\x7f', '\x7f'
+};
+
+__attribute__((target("sse4.2")))
+static const char *
+scanTokenSse42(const char *begin, const char *end) {
+	return scanSse42<CC_TOKEN>(begin, end, TOKEN_STOP_RANGES, 16);
+}
+
+__attribute__((target("sse4.2")))
+static const char *
+scanUrlSse42(const char *begin, const char *end) {
+	return scanSse42<CC_URL>(begin, end, URL_STOP_RANGES, 4);
+}
+
+__attribute__((target("sse4.2")))
+static const char *
+scanValueSse42(const char *begin, const char *end) {
+	return scanSse42<CC_VALUE>(begin, end, VALUE_STOP_RANGES, 6);
+}
+
+static inline const char *
+firstSetBit(const char *begin, unsigned int mask) {
+	return begin + __builtin_ctz(mask);
+}
+
+/* Request target characters are 0x21-0x7E. Bytes >= 0x80 are negative as
+ * signed bytes, so one signed comparison finds both them and 0x00-0x20. */
+__attribute__((target("avx2")))
+static const char *
+scanUrlAvx2(const char *begin, const char *end) {
+	const __m256i lowerBound = _mm256_set1_epi8(0x21);
+	const __m256i del = _mm256_set1_epi8(0x7f);
+
+	while (end - begin >= 32) {
+		__m256i data = _mm256_loadu_si256((const __m256i *) begin);
+		__m256i stop = _mm256_or_si256(
+			_mm256_cmpgt_epi8(lowerBound, data),
+			_mm256_cmpeq_epi8(data, del));
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(stop);
+		if (mask != 0) {
+			return firstSetBit(begin, mask);
+		}
+		begin += 32;
+	}
+	return scanUrlSse42(begin, end);
+}
+
+/* Header values stop at control characters other than horizontal tab:
+ * bytes that are below 0x20 as signed bytes but not negative, and DEL. */
+__attribute__((target("avx2")))
+static const char *
+scanValueAvx2(const char *begin, const char *end) {
+	const __m256i space = _mm256_set1_epi8(0x20);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i tab = _mm256_set1_epi8(0x09);
+	const __m256i del = _mm256_set1_epi8(0x7f);
+
+	while (end - begin >= 32) {
+		__m256i data = _mm256_loadu_si256((const __m256i *) begin);
+		__m256i control = _mm256_andnot_si256(
+			_mm256_cmpgt_epi8(zero, data),
+			_mm256_cmpgt_epi8(space, data));
+		__m256i stop = _mm256_or_si256(
+			_mm256_andnot_si256(_mm256_cmpeq_epi8(data, tab), control),
+			_mm256_cmpeq_epi8(data, del));
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(stop);
+		if (mask != 0) {
+			return firstSetBit(begin, mask);
+		}
+		begin += 32;
+	}
+	return scanValueSse42(begin, end);
+}
+
+#endif /* PSG_HTTP_HEADER_SCANNER_X86 */
+
+
+static const HttpHeaderScanner scalarScanner = {
+	"scalar",
+	scanTokenScalar,
+	scanUrlScalar,
+	scanValueScalar
+};
+
+#ifdef PSG_HTTP_HEADER_SCANNER_X86
+	static const HttpHeaderScanner sse42Scanner = {
+		"sse4.2",
+		scanTokenSse42,
+		scanUrlSse42,
+		scanValueSse42
+	};
+
+	// Header names are short, so they're scanned with SSE 4.2.
+	static const HttpHeaderScanner avx2Scanner = {
+		"avx2",
+		scanTokenSse42,
+		scanUrlAvx2,
+		scanValueAvx2
+	};
+#endif
+
+
+const HttpHeaderScanner *
+HttpHeaderScanner::scalar() {
+	return &scalarScanner;
+}
+
+const HttpHeaderScanner *
+HttpHeaderScanner::sse42() {
+	#ifdef PSG_HTTP_HEADER_SCANNER_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse4.2")) {
+			return &sse42Scanner;
+		}
+	#endif
+	return NULL;
+}
+
+const HttpHeaderScanner *
+HttpHeaderScanner::avx2() {
+	#ifdef PSG_HTTP_HEADER_SCANNER_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2")) {
+			return &avx2Scanner;
+		}
+	#endif
+	return NULL;
+}
+
+static const HttpHeaderScanner *
+detectBestScanner() {
+	const HttpHeaderScanner *result = HttpHeaderScanner::avx2();
+	if (result == NULL) {
+		result = HttpHeaderScanner::sse42();
+	}
+	if (result == NULL) {
+		result = HttpHeaderScanner::scalar();
+	}
+	return result;
+}
+
+const HttpHeaderScanner *
+HttpHeaderScanner::get() {
+	static const HttpHeaderScanner *best = detectBestScanner();
+	return best;
+}
+
+} // namespace ServerKit
+} // namespace Passenger
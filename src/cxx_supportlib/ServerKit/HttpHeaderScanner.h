@@ -0,0 +1,71 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_HTTP_HEADER_SCANNER_H_
+#define _PASSENGER_SERVER_KIT_HTTP_HEADER_SCANNER_H_
+
+namespace Passenger {
+namespace ServerKit {
+
+
+/**
+ * Character scanning primitives for HttpHeaderParser's fast path, which
+ * finds the boundaries of the request line and header fields by scanning
+ * many bytes at once instead of running a byte-at-a-time state machine
+ * (like picohttpparser does).
+ *
+ * Each function returns a pointer to the first byte in [begin, end) that
+ * does not belong to the given character class, or `end` if all of them do.
+ * There are implementations that use SSE 4.2 and AVX2, and a scalar one
+ * that works everywhere. `get()` returns the best one that the CPU supports,
+ * as determined at runtime with CPUID.
+ */
+struct HttpHeaderScanner {
+	typedef const char *(*ScanFunction)(const char *begin, const char *end);
+
+	const char *name;
+	/** Scans over HTTP token characters (RFC 7230), as used in header names. */
+	ScanFunction scanToken;
+	/** Scans over the characters that http_parser (in strict mode) accepts
+	 * in a request target: 0x21-0x7E. */
+	ScanFunction scanUrl;
+	/** Scans over header value characters: anything except control
+	 * characters, but including horizontal tab. */
+	ScanFunction scanValue;
+
+	static const HttpHeaderScanner *get();
+
+	static const HttpHeaderScanner *scalar();
+	/** Returns NULL if the compiler or the CPU doesn't support SSE 4.2. */
+	static const HttpHeaderScanner *sse42();
+	/** Returns NULL if the compiler or the CPU doesn't support AVX2. */
+	static const HttpHeaderScanner *avx2();
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_HTTP_HEADER_SCANNER_H_ */
@@ -26,6 +26,7 @@
 #ifndef _PASSENGER_SERVER_KIT_HTTP_REQUEST_H_
 #define _PASSENGER_SERVER_KIT_HTTP_REQUEST_H_
 
+#include <deque>
 #include <psg_sysqueue.h>
 #include <boost/cstdint.hpp>
 #include <boost/atomic.hpp>
@@ -37,6 +38,7 @@
 #include <ServerKit/HttpHeaderParserState.h>
 #include <ServerKit/HttpChunkedBodyParserState.h>
 #include <MemoryKit/palloc.h>
+#include <MemoryKit/mbuf.h>
 #include <DataStructures/LString.h>
 
 namespace Passenger {
@@ -68,8 +70,9 @@ public:
 		/**
 		 * The request has been ended. We've deinitialized the request object, and we're now
 		 * waiting for output to be flushed before transitioning to WAITING_FOR_REFERENCES.
-		 * In this state, the client object's `currentRequest` field still points to this
-		 * request.
+		 * If responses to earlier pipelined requests are still being written, then it
+		 * first waits for its turn. In this state, the client object's `currentRequest`
+		 * field still points to this request.
 		 */
 		FLUSHING_OUTPUT,
 		/**
@@ -103,6 +106,18 @@ public:
 	bool wantKeepAlive: 1;
 	bool responseBegun: 1;
 	bool detectingNextRequestEarlyReadError: 1;
+	/** Whether this request has ended, but is kept around until its response
+	 * is flushed because a pipelined request is being handled in the meantime. */
+	bool pipelinedResponsePending: 1;
+	/** Whether this request was already waiting for its first byte during the
+	 * previous idle client parking round. See HttpServer::parkIdleClients(). */
+	bool parkingCandidate: 1;
+	/** Whether onRequestBegin() has been postponed until the responses to the
+	 * pipelined requests before this one have been written. */
+	bool beginDeferred: 1;
+	/** Whether the next request's data arrived while `pipelineDepth` didn't
+	 * allow handling it yet. Client input is stopped until it does. */
+	bool parseAheadBlocked: 1;
 
 	boost::atomic<int> refcount;
 
@@ -168,6 +183,14 @@ public:
 	 */
 	int nextRequestEarlyReadError;
 
+	/**
+	 * Response data written while the responses to earlier pipelined requests
+	 * are still being written. It is written to the client output channel once
+	 * this request's turn has come. See HttpServer::writeResponse().
+	 */
+	std::deque<MemoryKit::mbuf> heldBackOutput;
+	unsigned int heldBackOutputSize;
+
 
 	BaseHttpRequest()
 		: refcount(1),
@@ -175,7 +198,8 @@ public:
 		  pool(NULL),
 		  headers(16),
 		  secureHeaders(32),
-		  bodyAlreadyRead(0)
+		  bodyAlreadyRead(0),
+		  heldBackOutputSize(0)
 	{
 		psg_lstr_init(&path);
 		aux.bodyInfo.contentLength = 0; // Sets the entire union to 0.
@@ -281,7 +305,8 @@ public:
 	union { \
 		STAILQ_ENTRY(RequestType) freeRequest; \
 		LIST_ENTRY(RequestType) lingeringRequest; \
-	} nextRequest
+	} nextRequest; \
+	STAILQ_ENTRY(RequestType) nextPipelinedRequest
 
 
 class HttpRequest: public BaseHttpRequest {
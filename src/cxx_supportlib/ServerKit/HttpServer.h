@@ -42,6 +42,7 @@
 #include <ServerKit/HttpRequestRef.h>
 #include <ServerKit/HttpHeaderParser.h>
 #include <ServerKit/HttpChunkedBodyParser.h>
+#include <ServerKit/ParkedClientSet.h>
 #include <Algorithms/MovingAverage.h>
 #include <Integrations/LibevJsonUtils.h>
 #include <Utils/SystemTime.h>
@@ -69,7 +70,27 @@ public:
 
 	FreeRequestList freeRequests;
 	unsigned int freeRequestCount, requestFreelistLimit;
+	/**
+	 * The maximum number of earlier requests per client that may still be in
+	 * progress while the next pipelined request is already being handled.
+	 * Those earlier requests are either still being handled themselves, in
+	 * which case their responses are written in request order, or they have
+	 * ended and their responses are still being flushed. 0 means that the
+	 * next request is only handled after the previous response has been
+	 * fully flushed.
+	 */
+	unsigned int pipelineDepth;
+	/**
+	 * Keep-alive clients that have been waiting for their next request for
+	 * between `clientParkingDelay` and twice that many seconds are parked:
+	 * their client and request objects are released, and only their file
+	 * descriptors are kept in `parkedClients` until they send data again.
+	 * 0 disables parking. Change with setClientParkingDelay().
+	 */
+	ev_tstamp clientParkingDelay;
 	unsigned long totalRequestsBegun, lastTotalRequestsBegun;
+	unsigned long totalRequestsPipelined;
+	unsigned long totalClientsParked, totalClientsUnparked;
 	double requestBeginSpeed1m, requestBeginSpeed1h;
 
 private:
@@ -106,6 +127,8 @@ private:
 
 	RequestHooksImpl requestHooksImpl;
 	object_pool<HttpHeaderParserState> headerParserStatePool;
+	ParkedClientSet parkedClients;
+	ev::timer clientParkingWatcher;
 
 
 	/***** Request object creation and destruction *****/
@@ -201,8 +224,6 @@ private:
 	/***** Request deinitialization and preparation for next request *****/
 
 	void deinitializeRequestAndAddToFreelist(Client *client, Request *req) {
-		assert(client->currentRequest == req);
-
 		if (req->httpState != Request::WAITING_FOR_REFERENCES) {
 			req->httpState = Request::WAITING_FOR_REFERENCES;
 			deinitializeRequest(client, req);
@@ -213,6 +234,13 @@ private:
 		}
 	}
 
+	void resetRequestPool(Request *req) {
+		if (!psg_reset_pool(req->pool, PSG_DEFAULT_POOL_SIZE)) {
+			psg_destroy_pool(req->pool);
+			req->pool = NULL;
+		}
+	}
+
 	void doneWithCurrentRequest(Client **client) {
 		Client *c = *client;
 		assert(c->currentRequest != NULL);
@@ -223,11 +251,12 @@ private:
 		P_ASSERT_EQ(req->httpState, Request::WAITING_FOR_REFERENCES);
 		assert(req->pool != NULL);
 		c->currentRequest = NULL;
-		if (!psg_reset_pool(req->pool, PSG_DEFAULT_POOL_SIZE)) {
-			psg_destroy_pool(req->pool);
-			req->pool = NULL;
+		if (!req->pipelinedResponsePending) {
+			resetRequestPool(req);
+			unrefRequest(req, __FILE__, __LINE__);
 		}
-		unrefRequest(req, __FILE__, __LINE__);
+		// else: the request and its pool are kept alive until
+		// the output is flushed. See releasePipelinedRequests().
 		if (keepAlive) {
 			SKC_TRACE(c, 3, "Keeping alive connection, handling next request");
 			handleNextRequest(c);
@@ -249,8 +278,13 @@ private:
 		this->refClient(client, __FILE__, __LINE__);
 
 		client->input.start();
-		client->output.deinitialize();
-		client->output.reinitialize(client->getFd());
+		if (client->pipelinedResponseCount == 0 && client->pipelinedRequestCount == 0) {
+			client->output.deinitialize();
+			client->output.reinitialize(client->getFd());
+		}
+		// else: the previous requests are still in progress. The
+		// response for this request is appended to the same output
+		// channel so that responses are sent in request order.
 
 		client->currentRequest = req = checkoutRequestObject(client);
 		req->client = client;
@@ -258,6 +292,466 @@ private:
 	}
 
 
+	/***** Request pipelining *****/
+
+	bool hasRoomForPipelinedRequest(Client *client) const {
+		return client->pipelinedRequestCount + client->pipelinedResponseCount
+			< pipelineDepth;
+	}
+
+	bool canPipelineNextRequest(Client *client, Request *req) const {
+		return hasRoomForPipelinedRequest(client)
+			&& canKeepAlive(req)
+			&& req->nextRequestEarlyReadError == 0
+			&& !client->output.isFlushed();
+	}
+
+	/**
+	 * Ends the current request without waiting for its response to be
+	 * flushed, and starts handling the next request on the connection.
+	 * The response may refer to memory in the request's pool, so the
+	 * request object is kept around until the output is flushed.
+	 */
+	void pipelineNextRequest(Client **client, Request *req) {
+		Client *c = *client;
+		SKC_TRACE(c, 2, "Output not yet flushed; handling next pipelined request "
+			"in the meantime");
+		req->pipelinedResponsePending = true;
+		c->pipelinedResponseCount++;
+		totalRequestsPipelined++;
+		doneWithCurrentRequest(client);
+	}
+
+	/**
+	 * Releases the requests that were kept around by `pipelineNextRequest()`
+	 * and `retirePipelinedRequest()`.
+	 * Must only be called when their responses are no longer referenced
+	 * by the output channel.
+	 */
+	void releasePipelinedRequests(Client *client) {
+		Request *req = LIST_FIRST(&client->lingeringRequests);
+
+		while (req != NULL && client->pipelinedResponseCount > 0) {
+			Request *next = LIST_NEXT(req, nextRequest.lingeringRequest);
+			if (req->pipelinedResponsePending) {
+				req->pipelinedResponsePending = false;
+				client->pipelinedResponseCount--;
+				resetRequestPool(req);
+				unrefRequest(req, __FILE__, __LINE__);
+			}
+			req = next;
+		}
+		assert(client->pipelinedResponseCount == 0);
+	}
+
+	/**
+	 * Called when a pipelined request's response has been written to the
+	 * output channel in full. If the output has already been flushed then the
+	 * request is released right away, otherwise it is released by
+	 * releasePipelinedRequests().
+	 */
+	void retirePipelinedRequest(Client *client, Request *req) {
+		if (client->output.isFlushed()) {
+			resetRequestPool(req);
+			unrefRequest(req, __FILE__, __LINE__);
+		} else {
+			req->pipelinedResponsePending = true;
+			client->pipelinedResponseCount++;
+		}
+	}
+
+	static bool isSafeMethod(http_method method) {
+		return method == HTTP_GET || method == HTTP_HEAD || method == HTTP_OPTIONS;
+	}
+
+	/**
+	 * Whether the next request on the connection may be received and handled
+	 * while `req` is still in progress. Only requests with safe methods are
+	 * handled concurrently with the requests after them: clients should not
+	 * pipeline requests with other methods (RFC 7230 section 6.3.2), and
+	 * their side effects may depend on the order in which they are handled.
+	 */
+	bool canParseAhead(Client *client, Request *req) const {
+		return hasRoomForPipelinedRequest(client)
+			&& !req->ended()
+			&& !req->beginDeferred
+			&& isSafeMethod(req->method)
+			&& canKeepAlive(req)
+			&& req->nextRequestEarlyReadError == 0;
+	}
+
+	void queuePipelinedRequest(Client *client, Request *req) {
+		STAILQ_INSERT_TAIL(&client->pipelinedRequests, req, nextPipelinedRequest);
+		client->pipelinedRequestCount++;
+		client->currentRequest = NULL;
+		totalRequestsPipelined++;
+	}
+
+	Request *dequeuePipelinedRequest(Client *client) {
+		Request *req = STAILQ_FIRST(&client->pipelinedRequests);
+		assert(client->pipelinedRequestCount > 0);
+		STAILQ_REMOVE_HEAD(&client->pipelinedRequests, nextPipelinedRequest);
+		client->pipelinedRequestCount--;
+		return req;
+	}
+
+	/**
+	 * Keeps handling the current request in the background, and starts
+	 * receiving the next request on the connection.
+	 */
+	void parseAhead(Client *client, Request *req) {
+		SKC_TRACE(client, 2, "Handling next pipelined request while the current "
+			"one is still in progress");
+		queuePipelinedRequest(client, req);
+		handleNextRequest(client);
+	}
+
+	/**
+	 * Starts receiving the next request if the current request stopped the
+	 * client input because there was no room in the pipeline yet.
+	 */
+	void resumeParseAhead(Client *client) {
+		Request *req = client->currentRequest;
+		if (req != NULL && req->parseAheadBlocked && canParseAhead(client, req)) {
+			req->parseAheadBlocked = false;
+			parseAhead(client, req);
+		}
+	}
+
+	/**
+	 * Calls onRequestBegin(), unless responses to earlier pipelined requests
+	 * are still outstanding and `req` must not be handled concurrently with
+	 * them. In that case the request is begun by advancePipeline() once its
+	 * turn has come, and no further data is received until then.
+	 */
+	void beginRequest(Client *client, Request *req) {
+		if (OXT_UNLIKELY(client->pipelinedRequestCount > 0)
+		 && (!isSafeMethod(req->method) || req->upgraded()))
+		{
+			SKC_TRACE(client, 2, "Deferring request until the pipelined requests "
+				"before it have ended");
+			req->beginDeferred = true;
+			client->input.stop();
+		} else {
+			onRequestBegin(client, req);
+		}
+	}
+
+	/**
+	 * Called when an EOF or a read error is encountered while the client has
+	 * not yet sent (all of) its next request, but responses to earlier
+	 * pipelined requests are still outstanding. The client is disconnected
+	 * once those responses have been written; see
+	 * processDeferredEarlyReadError().
+	 */
+	Channel::Result deferEarlyReadError(Client *client, Request *req, int errcode) {
+		Request *last = NULL, *it;
+
+		SKC_TRACE(client, 3, "Early read EOF or error detected while pipelined "
+			"requests are still in progress");
+		client->input.stop();
+		req->nextRequestEarlyReadError = (errcode == 0) ? EARLY_EOF_DETECTED : errcode;
+		STAILQ_FOREACH(it, &client->pipelinedRequests, nextPipelinedRequest) {
+			last = it;
+		}
+		if (last != NULL && !last->ended() && last->nextRequestEarlyReadError == 0) {
+			last->nextRequestEarlyReadError = req->nextRequestEarlyReadError;
+			onNextRequestEarlyReadError(client, last, last->nextRequestEarlyReadError);
+		}
+		return Channel::Result(0, false);
+	}
+
+	void processDeferredEarlyReadError(Client *client) {
+		Request *req = client->currentRequest;
+		if (req != NULL
+		 && req->httpState == Request::PARSING_HEADERS
+		 && req->nextRequestEarlyReadError != 0
+		 && client->pipelinedRequestCount == 0
+		 && client->pipelinedResponseCount == 0)
+		{
+			onClientDataReceived(client, MemoryKit::mbuf(), req->nextRequestEarlyReadError);
+		}
+	}
+
+	void holdBackResponseData(Request *req, const MemoryKit::mbuf &buffer) {
+		req->heldBackOutput.push_back(buffer);
+		req->heldBackOutputSize += buffer.size();
+	}
+
+	/**
+	 * Writes the response data that `req` held back while it wasn't its turn.
+	 * Returns whether the client is still connected afterwards.
+	 */
+	bool writeHeldBackOutput(Client *client, Request *req) {
+		std::deque<MemoryKit::mbuf> buffers;
+		std::deque<MemoryKit::mbuf>::const_iterator it;
+
+		if (req->heldBackOutput.empty()) {
+			return client->connected();
+		}
+		SKC_TRACE(client, 3, "Writing " << req->heldBackOutputSize <<
+			" bytes of held back response data");
+		// Take ownership first, because writing may trigger a disconnection,
+		// which clears the buffers of all pipelined requests.
+		buffers.swap(req->heldBackOutput);
+		req->heldBackOutputSize = 0;
+		for (it = buffers.begin(); it != buffers.end() && client->connected(); it++) {
+			client->output.feedWithoutRefGuard(*it);
+		}
+		return client->connected();
+	}
+
+	/**
+	 * Called when a request that isn't the output request (see
+	 * getOutputRequest()) ends. Its response data stays held back.
+	 */
+	void holdBackEndedRequest(Client *client, Request *req) {
+		req->wantKeepAlive = canKeepAlive(req);
+		if (req != client->currentRequest) {
+			// Already queued; advancePipeline() continues from here.
+			return;
+		}
+		if (req->wantKeepAlive
+		 && req->nextRequestEarlyReadError == 0
+		 && hasRoomForPipelinedRequest(client))
+		{
+			SKC_TRACE(client, 2, "Responses to earlier requests are still being "
+				"written; handling next pipelined request in the meantime");
+			queuePipelinedRequest(client, req);
+			handleNextRequest(client);
+		} else {
+			// Finished by advancePipeline() once it's this request's turn.
+			SKC_TRACE(client, 2, "Waiting until responses to earlier requests "
+				"have been written");
+			req->httpState = Request::FLUSHING_OUTPUT;
+		}
+	}
+
+	/**
+	 * Called when the first pipelined request has ended. Its response has
+	 * already been written to the output channel in full.
+	 */
+	void endFirstPipelinedRequest(Client **client, Request *req) {
+		Client *c = *client;
+
+		assert(STAILQ_FIRST(&c->pipelinedRequests) == req);
+		dequeuePipelinedRequest(c);
+		if (canKeepAlive(req)) {
+			retirePipelinedRequest(c, req);
+			advancePipeline(client);
+			if (c->connected()) {
+				resumeParseAhead(c);
+			}
+		} else {
+			closeAfterRequest(client, req);
+		}
+	}
+
+	/**
+	 * Passes the output channel on to the next request after the first
+	 * pipelined request has been removed from the queue: writes the response
+	 * data that was held back, and resumes that request if necessary.
+	 */
+	void advancePipeline(Client **client) {
+		Client *c = *client;
+		Request *req;
+
+		while ((req = STAILQ_FIRST(&c->pipelinedRequests)) != NULL) {
+			if (!writeHeldBackOutput(c, req)) {
+				return;
+			}
+			if (!req->ended()) {
+				onRequestOutputUnblocked(c, req);
+				return;
+			}
+
+			// This request ended while waiting for its turn.
+			dequeuePipelinedRequest(c);
+			if (canKeepAlive(req)) {
+				retirePipelinedRequest(c, req);
+			} else {
+				closeAfterRequest(client, req);
+				return;
+			}
+		}
+
+		req = c->currentRequest;
+		assert(req != NULL);
+		if (!writeHeldBackOutput(c, req)) {
+			return;
+		}
+		if (req->httpState == Request::FLUSHING_OUTPUT) {
+			finishRequestOutput(client, req);
+		} else if (req->beginDeferred) {
+			RequestRef ref(req, __FILE__, __LINE__);
+			SKC_TRACE(c, 2, "Beginning deferred request");
+			req->beginDeferred = false;
+			onRequestBegin(c, req);
+			if (c->connected() && !req->ended()) {
+				c->input.start();
+			}
+		} else if (req->httpState == Request::PARSING_HEADERS) {
+			processDeferredEarlyReadError(c);
+		} else {
+			onRequestOutputUnblocked(c, req);
+		}
+	}
+
+	/**
+	 * Called when a pipelined request that doesn't allow keep-alive has
+	 * ended, and all responses before it have been written. Discards the
+	 * requests after it, and disconnects the client once its response has
+	 * been flushed.
+	 */
+	void closeAfterRequest(Client **client, Request *req) {
+		Client *c = *client;
+		Request *next;
+
+		SKC_TRACE(c, 2, "Not keeping alive connection; discarding " <<
+			c->pipelinedRequestCount << " later pipelined request(s)");
+		c->input.stop();
+		while (!STAILQ_EMPTY(&c->pipelinedRequests)) {
+			discardRequest(c, dequeuePipelinedRequest(c));
+		}
+		next = c->currentRequest;
+		c->currentRequest = NULL;
+		if (next != NULL) {
+			discardRequest(c, next);
+		}
+
+		c->currentRequest = req;
+		req->wantKeepAlive = false;
+		finishRequestOutput(client, req);
+	}
+
+	/**
+	 * Releases a request that is no longer the client's current request,
+	 * whether it has ended or not.
+	 */
+	void discardRequest(Client *client, Request *req) {
+		deinitializeRequestAndAddToFreelist(client, req);
+		req->heldBackOutput.clear();
+		req->heldBackOutputSize = 0;
+		if (req->pool != NULL) {
+			resetRequestPool(req);
+		}
+		unrefRequest(req, __FILE__, __LINE__);
+	}
+
+
+	/***** Idle client parking *****/
+
+	bool acceptingParkedClients() const {
+		return this->serverState == HttpServer::ACTIVE
+			|| this->serverState == HttpServer::TOO_MANY_FDS;
+	}
+
+	/**
+	 * Whether the client is waiting for the first byte of its next request,
+	 * and nothing else refers to it or its request.
+	 */
+	bool isIdle(Client *client) const {
+		Request *req = client->currentRequest;
+		return req != NULL
+			&& req->httpState == Request::PARSING_HEADERS
+			&& req->lastDataReceiveTime == 0
+			&& req->refcount.load(boost::memory_order_relaxed) == 1
+			&& client->refcount.load(boost::memory_order_relaxed) == 2
+			&& client->lingeringRequestCount == 0
+			&& client->pipelinedResponseCount == 0
+			&& client->pipelinedRequestCount == 0
+			&& client->output.isFlushed()
+			&& !client->input.hasPendingBuffers();
+	}
+
+	void onClientParkingTimeout(ev::timer &timer, int revents) {
+		TRACE_POINT();
+		parkIdleClients();
+	}
+
+	/**
+	 * Parks the clients that were already idle during the previous round, and
+	 * marks the clients that are idle now so that they're parked during the
+	 * next round, unless they send data in the meantime.
+	 */
+	void parkIdleClients() {
+		Client *client, *next;
+		unsigned int count = 0;
+
+		if (!acceptingParkedClients() || !parkedClients.initialized()) {
+			return;
+		}
+
+		client = TAILQ_FIRST(&this->activeClients);
+		while (client != NULL) {
+			next = TAILQ_NEXT(client, nextClient.activeOrDisconnectedClient);
+			if (isIdle(client)) {
+				if (client->currentRequest->parkingCandidate) {
+					if (parkClient(&client)) {
+						count++;
+					}
+				} else {
+					client->currentRequest->parkingCandidate = true;
+				}
+			}
+			client = next;
+		}
+
+		if (count > 0) {
+			SKS_DEBUG(count << " idle client(s) parked; there are now " <<
+				parkedClients.size() << " parked client(s)");
+		}
+	}
+
+	bool parkClient(Client **client) {
+		Client *c = *client;
+		int fd = c->getFd();
+
+		// Register the file descriptor before releasing the client object,
+		// so that a client that can't be parked is left alone.
+		if (!parkedClients.add(fd, c->number)) {
+			int e = errno;
+			SKC_DEBUG(c, "Cannot park idle client: " << getErrorDesc(e) <<
+				" (errno=" << e << ")");
+			return false;
+		}
+
+		SKC_TRACE(c, 2, "Parking idle client");
+		this->detach(client);
+		totalClientsParked++;
+		return true;
+	}
+
+	static void onParkedClientReadable(ParkedClientSet *set, int fd,
+		unsigned int number, bool hangup)
+	{
+		static_cast<HttpServer *>(set->userData)->unparkClient(fd, number, hangup);
+	}
+
+	void unparkClient(int fd, unsigned int number, bool hangup) {
+		TRACE_POINT();
+		totalClientsUnparked++;
+		if (hangup) {
+			SKS_TRACE(2, "Parked client " << number << " hung up; closing file descriptor " << fd);
+			safelyClose(fd, true);
+			P_LOG_FILE_DESCRIPTOR_CLOSE(fd);
+		} else {
+			SKS_TRACE(2, "Parked client " << number << " sent data; unparking");
+			this->reattach(fd, number);
+		}
+	}
+
+	void updateClientParkingWatcher() {
+		clientParkingWatcher.stop();
+		if (clientParkingDelay > 0 && acceptingParkedClients()
+		 && (parkedClients.initialized() || parkedClients.initialize()))
+		{
+			clientParkingWatcher.set(clientParkingDelay, clientParkingDelay);
+			clientParkingWatcher.start();
+		}
+	}
+
+
 	/***** Client data handling *****/
 
 	Channel::Result processClientDataWhenParsingHeaders(Client *client, Request *req,
@@ -292,22 +786,22 @@ private:
 			switch (req->httpState) {
 			case Request::COMPLETE:
 				req->detectingNextRequestEarlyReadError = true;
-				onRequestBegin(client, req);
+				beginRequest(client, req);
 				return Channel::Result(ret, false);
 			case Request::PARSING_BODY:
 				SKC_TRACE(client, 2, "Expecting a request body");
-				onRequestBegin(client, req);
+				beginRequest(client, req);
 				return Channel::Result(ret, false);
 			case Request::PARSING_CHUNKED_BODY:
 				SKC_TRACE(client, 2, "Expecting a chunked request body");
 				prepareChunkedBodyParsing(client, req);
-				onRequestBegin(client, req);
+				beginRequest(client, req);
 				return Channel::Result(ret, false);
 			case Request::UPGRADED:
 				assert(!req->wantKeepAlive);
 				if (supportsUpgrade(client, req)) {
 					SKC_TRACE(client, 2, "Expecting connection upgrade");
-					onRequestBegin(client, req);
+					beginRequest(client, req);
 					return Channel::Result(ret, false);
 				} else {
 					endWithErrorResponse(&client, &req, 422,
@@ -554,14 +1048,14 @@ private:
 	}
 
 	void writeDefault500Response(Client *client, Request *req) {
-		writeSimpleResponse(client, 500, NULL, DEFAULT_INTERNAL_SERVER_ERROR_RESPONSE);
+		writeSimpleResponse(client, req, 500, NULL, DEFAULT_INTERNAL_SERVER_ERROR_RESPONSE);
 	}
 
 	void endWithErrorResponse(Client **client, Request **req, int code, const StaticString &body) {
 		HeaderTable headers;
 		headers.insert((*req)->pool, "connection", "close");
 		headers.insert((*req)->pool, "cache-control", "no-cache, no-store, must-revalidate");
-		writeSimpleResponse(*client, code, &headers, body);
+		writeSimpleResponse(*client, *req, code, &headers, body);
 		endRequest(client, req);
 	}
 
@@ -633,8 +1127,20 @@ private:
 			channel->getHooks()->userData));
 
 		HttpServer *self = static_cast<HttpServer *>(HttpServer::getServerFromClient(client));
+		if (client->pipelinedResponseCount > 0) {
+			self->releasePipelinedRequests(client);
+			self->processDeferredEarlyReadError(client);
+			if (client->connected()) {
+				self->resumeParseAhead(client);
+			}
+		}
+		// The current request may also be in the FLUSHING_OUTPUT state while
+		// it waits for its turn, or while its held back response data is
+		// being written. It is only done once the output has been ended.
 		if (client->currentRequest != NULL
-		 && client->currentRequest->httpState == Request::FLUSHING_OUTPUT)
+		 && client->currentRequest->httpState == Request::FLUSHING_OUTPUT
+		 && client->output.ended()
+		 && STAILQ_EMPTY(&client->pipelinedRequests))
 		{
 			client->currentRequest->httpState = Request::WAITING_FOR_REFERENCES;
 			self->doneWithCurrentRequest(&client);
@@ -720,6 +1226,16 @@ protected:
 		RequestRef ref(req, __FILE__, __LINE__);
 		bool ended = req->ended();
 
+		if (req->detectingNextRequestEarlyReadError && !buffer.empty()) {
+			if (canParseAhead(client, req)) {
+				req->detectingNextRequestEarlyReadError = false;
+				parseAhead(client, req);
+				return onClientDataReceived(client, buffer, errcode);
+			} else if (!ended) {
+				// Continued by resumeParseAhead() when possible.
+				req->parseAheadBlocked = true;
+			}
+		}
 		if (!ended) {
 			req->lastDataReceiveTime = ev_now(this->getLoop());
 		}
@@ -730,6 +1246,11 @@ protected:
 		// Moved outside switch() so that the CPU branch predictor can do its work
 		if (req->httpState == Request::PARSING_HEADERS) {
 			assert(!ended);
+			if (OXT_UNLIKELY(buffer.empty())
+			 && (client->pipelinedRequestCount > 0 || client->pipelinedResponseCount > 0))
+			{
+				return deferEarlyReadError(client, req, errcode);
+			}
 			return processClientDataWhenParsingHeaders(client, req, buffer, errcode);
 		} else {
 			switch (req->bodyType) {
@@ -771,13 +1292,23 @@ protected:
 			Request *req = client->currentRequest;
 			deinitializeRequestAndAddToFreelist(client, req);
 			client->currentRequest = NULL;
+			req->heldBackOutput.clear();
+			req->heldBackOutputSize = 0;
 			unrefRequest(req, __FILE__, __LINE__);
 		}
+		while (!STAILQ_EMPTY(&client->pipelinedRequests)) {
+			discardRequest(client, dequeuePipelinedRequest(client));
+		}
+		if (client->pipelinedResponseCount > 0) {
+			releasePipelinedRequests(client);
+		}
 	}
 
 	virtual void deinitializeClient(Client *client) {
 		ParentClass::deinitializeClient(client);
 		client->currentRequest = NULL;
+		assert(client->pipelinedResponseCount == 0);
+		assert(client->pipelinedRequestCount == 0);
 	}
 
 	virtual bool shouldDisconnectClientOnShutdown(Client *client) {
@@ -808,6 +1339,17 @@ protected:
 		lastTotalRequestsBegun = totalRequestsBegun;
 	}
 
+	virtual void onShutdown(bool forceDisconnect) {
+		ParentClass::onShutdown(forceDisconnect);
+		// Parked clients are idle, so they can be disconnected without
+		// interrupting any requests.
+		clientParkingWatcher.stop();
+		if (parkedClients.size() > 0) {
+			SKS_DEBUG("Disconnecting " << parkedClients.size() << " parked client(s)");
+		}
+		parkedClients.closeAll();
+	}
+
 
 	/***** New hooks *****/
 
@@ -837,6 +1379,16 @@ protected:
 		// Do nothing.
 	}
 
+	/**
+	 * Called when `req` has become the request that writes directly to the
+	 * client output channel, after the responses to the pipelined requests
+	 * before it have been written. Any response data that it held back in
+	 * the meantime has just been written.
+	 */
+	virtual void onRequestOutputUnblocked(Client *client, Request *req) {
+		// Do nothing.
+	}
+
 	virtual bool supportsUpgrade(Client *client, Request *req) {
 		return false;
 	}
@@ -866,6 +1418,11 @@ protected:
 		req->wantKeepAlive = false;
 		req->responseBegun = false;
 		req->detectingNextRequestEarlyReadError = false;
+		req->pipelinedResponsePending = false;
+		req->parkingCandidate = false;
+		req->beginDeferred = false;
+		req->parseAheadBlocked = false;
+		assert(req->heldBackOutput.empty());
 		req->parserState.headerParser = headerParserStatePool.construct();
 		createRequestHeaderParser(this->getContext(), req).initialize();
 		if (OXT_UNLIKELY(req->pool == NULL)) {
@@ -939,13 +1496,24 @@ public:
 		: ParentClass(context),
 		  freeRequestCount(0),
 		  requestFreelistLimit(1024),
+		  pipelineDepth(0),
+		  clientParkingDelay(0),
 		  totalRequestsBegun(0),
 		  lastTotalRequestsBegun(0),
+		  totalRequestsPipelined(0),
+		  totalClientsParked(0),
+		  totalClientsUnparked(0),
 		  requestBeginSpeed1m(-1),
 		  requestBeginSpeed1h(-1),
-		  headerParserStatePool(16, 256)
+		  headerParserStatePool(16, 256),
+		  parkedClients(context, onParkedClientReadable)
 	{
 		STAILQ_INIT(&freeRequests);
+		parkedClients.userData = this;
+		clientParkingWatcher.set(context->libev->getLoop());
+		clientParkingWatcher.set<
+			HttpServer<DerivedServer, Client>,
+			&HttpServer<DerivedServer, Client>::onClientParkingTimeout>(this);
 	}
 
 
@@ -973,6 +1541,12 @@ public:
 	}
 
 
+	void setClientParkingDelay(ev_tstamp delay) {
+		clientParkingDelay = delay;
+		updateClientParkingWatcher();
+	}
+
+
 	/***** Request manipulation *****/
 
 		/** Increase request reference count. */
@@ -1009,23 +1583,71 @@ public:
 			&& HttpServer::serverState < HttpServer::SHUTTING_DOWN;
 	}
 
+	/**
+	 * Returns the request that writes directly to the client output channel:
+	 * the first pipelined request if there is one, otherwise the current
+	 * request. Other requests hold back their response data until it's
+	 * their turn.
+	 */
+	Request *getOutputRequest(Client *client) const {
+		if (OXT_UNLIKELY(!STAILQ_EMPTY(&client->pipelinedRequests))) {
+			return STAILQ_FIRST(&client->pipelinedRequests);
+		} else {
+			return client->currentRequest;
+		}
+	}
+
+	void writeResponse(Client *client, Request *req, const MemoryKit::mbuf &buffer) {
+		req->responseBegun = true;
+		req->lastDataSendTime = ev_now(this->getLoop());
+		if (OXT_LIKELY(getOutputRequest(client) == req)) {
+			client->output.feedWithoutRefGuard(buffer);
+		} else {
+			holdBackResponseData(req, buffer);
+		}
+	}
+
+	void writeResponse(Client *client, Request *req, const char *data, unsigned int size) {
+		writeResponse(client, req, MemoryKit::mbuf(data, size));
+	}
+
+	void writeResponse(Client *client, Request *req, const StaticString &data) {
+		writeResponse(client, req, data.data(), data.size());
+	}
+
+	/*
+	 * The following overloads write to `client->currentRequest`, which is only
+	 * the request being handled when pipelined requests are not handled
+	 * concurrently. Servers that set `pipelineDepth` must use the overloads
+	 * that take a Request.
+	 */
+
 	void writeResponse(Client *client, const MemoryKit::mbuf &buffer) {
-		client->currentRequest->responseBegun = true;
-		client->currentRequest->lastDataSendTime = ev_now(this->getLoop());
-		client->output.feedWithoutRefGuard(buffer);
+		assert(pipelineDepth == 0);
+		writeResponse(client, client->currentRequest, buffer);
 	}
 
 	void writeResponse(Client *client, const char *data, unsigned int size) {
-		writeResponse(client, MemoryKit::mbuf(data, size));
+		assert(pipelineDepth == 0);
+		writeResponse(client, client->currentRequest, MemoryKit::mbuf(data, size));
 	}
 
 	void writeResponse(Client *client, const StaticString &data) {
-		writeResponse(client, data.data(), data.size());
+		assert(pipelineDepth == 0);
+		writeResponse(client, client->currentRequest, data.data(), data.size());
 	}
 
 	void
 	writeSimpleResponse(Client *client, int code, const HeaderTable *headers,
 		const StaticString &body)
+	{
+		assert(pipelineDepth == 0);
+		writeSimpleResponse(client, client->currentRequest, code, headers, body);
+	}
+
+	void
+	writeSimpleResponse(Client *client, Request *req, int code, const HeaderTable *headers,
+		const StaticString &body)
 	{
 		unsigned int headerBufSize = 300;
 
@@ -1038,7 +1660,6 @@ public:
 			}
 		}
 
-		Request *req = client->currentRequest;
 		char *header = (char *) psg_pnalloc(req->pool, headerBufSize);
 		char statusBuffer[50];
 		char *pos = header;
@@ -1124,9 +1745,9 @@ public:
 
 		pos = appendData(pos, end, P_STATIC_STRING("\r\n"));
 
-		writeResponse(client, header, pos - header);
+		writeResponse(client, req, header, pos - header);
 		if (!req->ended() && req->method != HTTP_HEAD) {
-			writeResponse(client, body.data(), body.size());
+			writeResponse(client, req, body.data(), body.size());
 		}
 	}
 
@@ -1143,7 +1764,6 @@ public:
 		}
 
 		SKC_TRACE(c, 2, "Ending request");
-		assert(c->currentRequest == req);
 
 		if (OXT_UNLIKELY(!req->responseBegun)) {
 			writeDefault500Response(c, req);
@@ -1162,11 +1782,34 @@ public:
 		deinitializeRequestAndAddToFreelist(c, req);
 		req->pool = pool;
 
+		if (OXT_UNLIKELY(getOutputRequest(c) != req)) {
+			holdBackEndedRequest(c, req);
+		} else if (OXT_UNLIKELY(c->currentRequest != req)) {
+			endFirstPipelinedRequest(&c, req);
+		} else {
+			finishRequestOutput(&c, req);
+		}
+		return true;
+	}
+
+	/**
+	 * Ends the output for the current request, which has ended and whose
+	 * response has been written to the output channel in full.
+	 */
+	void finishRequestOutput(Client **client, Request *req) {
+		Client *c = *client;
+
+		assert(c->currentRequest == req);
+		req->httpState = Request::WAITING_FOR_REFERENCES;
 		if (!c->output.ended()) {
+			if (canPipelineNextRequest(c, req)) {
+				pipelineNextRequest(client, req);
+				return;
+			}
 			c->output.feedWithoutRefGuard(MemoryKit::mbuf());
 		}
 		if (c->output.endAcked()) {
-			doneWithCurrentRequest(&c);
+			doneWithCurrentRequest(client);
 		} else {
 			// Call doneWithCurrentRequest() when data flushed
 			SKC_TRACE(c, 2, "Waiting until output is flushed");
@@ -1176,8 +1819,6 @@ public:
 			// request body data that we receive from now on.
 			req->wantKeepAlive = canKeepAlive(req);
 		}
-
-		return true;
 	}
 
 	void endAsBadRequest(Client **client, Request **req, const StaticString &body) {
@@ -1192,11 +1833,19 @@ public:
 		if (doc.isMember("request_freelist_limit")) {
 			requestFreelistLimit = doc["request_freelist_limit"].asUInt();
 		}
+		if (doc.isMember("pipeline_depth")) {
+			pipelineDepth = doc["pipeline_depth"].asUInt();
+		}
+		if (doc.isMember("client_parking_delay")) {
+			setClientParkingDelay(doc["client_parking_delay"].asDouble());
+		}
 	}
 
 	virtual Json::Value getConfigAsJson() const {
 		Json::Value doc = ParentClass::getConfigAsJson();
 		doc["request_freelist_limit"] = requestFreelistLimit;
+		doc["pipeline_depth"] = pipelineDepth;
+		doc["client_parking_delay"] = clientParkingDelay;
 		return doc;
 	}
 
@@ -1204,6 +1853,11 @@ public:
 		Json::Value doc = ParentClass::inspectStateAsJson();
 		doc["free_request_count"] = freeRequestCount;
 		doc["total_requests_begun"] = (Json::UInt64) totalRequestsBegun;
+		doc["total_requests_pipelined"] = (Json::UInt64) totalRequestsPipelined;
+		doc["parked_client_count"] = parkedClients.size();
+		doc["total_clients_parked"] = (Json::UInt64) totalClientsParked;
+		doc["total_clients_unparked"] = (Json::UInt64) totalClientsUnparked;
+		doc["idle_client_memory"] = inspectIdleClientMemoryAsJson();
 		doc["request_begin_speed"]["1m"] = averageSpeedToJson(
 			capFloatPrecision(requestBeginSpeed1m * 60),
 			"minute", "1 minute", -1);
@@ -1220,6 +1874,29 @@ public:
 		}
 		doc["requests_begun"] = client->requestsBegun;
 		doc["lingering_request_count"] = client->lingeringRequestCount;
+		doc["pipelined_response_count"] = client->pipelinedResponseCount;
+		doc["pipelined_request_count"] = client->pipelinedRequestCount;
+		return doc;
+	}
+
+	/**
+	 * Reports how much memory an idle keep-alive client takes before it is
+	 * parked (its client object, its current request object with its header
+	 * parser state, and the request's memory pool) and after it is parked.
+	 * Kernel memory, such as socket buffers and epoll registrations, is not
+	 * included.
+	 */
+	Json::Value inspectIdleClientMemoryAsJson() const {
+		Json::Value doc;
+		size_t unparked = sizeof(Client) + sizeof(Request)
+			+ sizeof(HttpHeaderParserState) + PSG_DEFAULT_POOL_SIZE;
+		size_t parked = sizeof(ParkedClientSet::Entry);
+
+		doc["per_unparked_client"] = byteSizeToJson(unparked);
+		doc["per_parked_client"] = byteSizeToJson(parked);
+		doc["parked_clients"] = byteSizeToJson(parkedClients.getMemoryUsage());
+		doc["saved_by_parking"] = byteSizeToJson(
+			parkedClients.size() * (unparked - parked));
 		return doc;
 	}
 
@@ -0,0 +1,612 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_IO_URING_H_
+#define _PASSENGER_SERVER_KIT_IO_URING_H_
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <sys/types.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <ev.h>
+#include <jsoncpp/json.h>
+#include <Logging.h>
+
+#if defined(__linux__) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#include <linux/io_uring.h>
+		#include <sys/syscall.h>
+		// IORING_FEAT_RSRC_TAGS was introduced in the same kernel headers
+		// release (5.13) as the last opcode that we need (unlinkat).
+		#if defined(IORING_FEAT_RSRC_TAGS) && defined(__NR_io_uring_setup)
+			#define PSG_HAVE_IO_URING
+		#endif
+	#endif
+#endif
+
+#ifdef PSG_HAVE_IO_URING
+	#include <sys/mman.h>
+	#include <sys/eventfd.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <cstdlib>
+#endif
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+/**
+ * A minimal io_uring driver that runs on a libev event loop. It is used by
+ * FileBufferedChannel to perform buffer file I/O without going through the libuv
+ * thread pool.
+ *
+ * Operations are queued in the submission ring and are submitted in batch, with
+ * a single `io_uring_enter()` call per event loop iteration (from an `ev_prepare`
+ * watcher). Completions are signaled through an eventfd that is watched by libev,
+ * and the operation's callback is called from the event loop with the operation's
+ * result (a negative errno value on failure, like libuv).
+ *
+ * `initialize()` returns false if the kernel (or the seccomp policy we run under)
+ * lacks the necessary io_uring support. Submission methods return false if the
+ * operation cannot be queued right now, e.g. because too many operations are in
+ * flight. In both cases the caller is expected to fall back to libuv.
+ *
+ * This class is not thread-safe. It may only be used from the event loop thread.
+ */
+class IoUring: public boost::noncopyable {
+public:
+	struct Operation;
+	typedef void (*Callback)(Operation *op, int result);
+
+	/**
+	 * Describes a queued operation. The caller owns this structure and must
+	 * keep it, and any buffers or paths passed along with it, alive until
+	 * the callback has been called.
+	 */
+	struct Operation {
+		Callback callback;
+		void *data;
+
+		Operation()
+			: callback(NULL),
+			  data(NULL)
+			{ }
+	};
+
+private:
+	struct ev_loop *loop;
+	unsigned int inFlight;
+	unsigned int unsubmitted;
+	boost::uint64_t submitCalls;
+	boost::uint64_t completions;
+
+	#ifdef PSG_HAVE_IO_URING
+		int ringFd;
+		int eventFd;
+		ev_io eventWatcher;
+		ev_prepare prepareWatcher;
+
+		void *ringPtr;
+		size_t ringSize;
+		struct io_uring_sqe *sqes;
+		size_t sqesSize;
+
+		unsigned int *sqHead;
+		unsigned int *sqTail;
+		unsigned int sqMask;
+		unsigned int sqEntries;
+		unsigned int *sqArray;
+		unsigned int sqLocalTail;
+
+		unsigned int *cqHead;
+		unsigned int *cqTail;
+		unsigned int cqMask;
+		unsigned int cqEntries;
+		struct io_uring_cqe *cqes;
+
+		static int sysSetup(unsigned int entries, struct io_uring_params *params) {
+			return (int) syscall(__NR_io_uring_setup, entries, params);
+		}
+
+		static int sysEnter(int fd, unsigned int toSubmit, unsigned int minComplete = 0,
+			unsigned int flags = 0)
+		{
+			return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+				flags, NULL, 0);
+		}
+
+		static int sysRegister(int fd, unsigned int opcode, void *arg, unsigned int nargs) {
+			return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+		}
+
+		bool opcodesSupported() {
+			static const unsigned int NOPS = 256;
+			static const unsigned int opcodes[] = {
+				IORING_OP_READ,
+				IORING_OP_WRITE,
+				IORING_OP_OPENAT,
+				IORING_OP_CLOSE,
+				IORING_OP_UNLINKAT
+			};
+			size_t size = sizeof(struct io_uring_probe)
+				+ NOPS * sizeof(struct io_uring_probe_op);
+			struct io_uring_probe *probe = (struct io_uring_probe *) malloc(size);
+			bool result = true;
+
+			if (probe == NULL) {
+				return false;
+			}
+			memset(probe, 0, size);
+			if (sysRegister(ringFd, IORING_REGISTER_PROBE, probe, NOPS) == -1) {
+				free(probe);
+				return false;
+			}
+			for (unsigned int i = 0; i < sizeof(opcodes) / sizeof(unsigned int); i++) {
+				if (opcodes[i] > probe->last_op
+				 || !(probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED))
+				{
+					result = false;
+				}
+			}
+			free(probe);
+			return result;
+		}
+
+		void destroyRing() {
+			if (ev_is_active(&eventWatcher)) {
+				ev_io_stop(loop, &eventWatcher);
+			}
+			if (ev_is_active(&prepareWatcher)) {
+				ev_prepare_stop(loop, &prepareWatcher);
+			}
+			if (sqes != NULL) {
+				munmap(sqes, sqesSize);
+				sqes = NULL;
+			}
+			if (ringPtr != NULL) {
+				munmap(ringPtr, ringSize);
+				ringPtr = NULL;
+			}
+			if (eventFd != -1) {
+				::close(eventFd);
+				eventFd = -1;
+			}
+			if (ringFd != -1) {
+				::close(ringFd);
+				ringFd = -1;
+			}
+		}
+
+		struct io_uring_sqe *getSqe(Operation *op) {
+			unsigned int head;
+
+			// Never have more operations outstanding than the completion
+			// ring can hold, so that completions are never held back
+			// by the kernel.
+			if (ringFd == -1 || inFlight + unsubmitted >= cqEntries) {
+				return NULL;
+			}
+
+			head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+			if (sqLocalTail - head >= sqEntries) {
+				return NULL;
+			}
+
+			unsigned int index = sqLocalTail & sqMask;
+			struct io_uring_sqe *sqe = &sqes[index];
+			memset(sqe, 0, sizeof(struct io_uring_sqe));
+			sqe->user_data = (boost::uint64_t) (uintptr_t) op;
+			sqArray[index] = index;
+			return sqe;
+		}
+
+		void commitSqe() {
+			sqLocalTail++;
+			__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+			unsubmitted++;
+			if (!ev_is_active(&prepareWatcher)) {
+				ev_prepare_start(loop, &prepareWatcher);
+			}
+		}
+
+		void submit() {
+			int ret;
+
+			while (unsubmitted > 0) {
+				do {
+					ret = sysEnter(ringFd, unsubmitted);
+				} while (ret == -1 && errno == EINTR);
+				submitCalls++;
+
+				if (ret > 0) {
+					unsubmitted -= ret;
+					inFlight += ret;
+				} else if (ret == -1 && (errno == EAGAIN || errno == EBUSY)) {
+					// The kernel is temporarily out of resources. Reap
+					// completions and retry in the next loop iteration.
+					return;
+				} else {
+					int e = errno;
+					P_ERROR("io_uring_enter() failed: " << strerror(e) <<
+						" (errno=" << e << ")");
+					failUnsubmitted(-e);
+					return;
+				}
+			}
+			if (ev_is_active(&prepareWatcher)) {
+				ev_prepare_stop(loop, &prepareWatcher);
+			}
+		}
+
+		/**
+		 * Takes the operations that the kernel hasn't consumed yet back out of
+		 * the submission ring, and completes them with the given error.
+		 */
+		void failUnsubmitted(int result) {
+			vector<Operation *> ops;
+			unsigned int i, count = unsubmitted;
+
+			for (i = 0; i < count; i++) {
+				unsigned int index = (sqLocalTail - count + i) & sqMask;
+				ops.push_back((Operation *) (uintptr_t) sqes[index].user_data);
+			}
+			sqLocalTail -= count;
+			__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+			unsubmitted = 0;
+			if (ev_is_active(&prepareWatcher)) {
+				ev_prepare_stop(loop, &prepareWatcher);
+			}
+			for (i = 0; i < count; i++) {
+				ops[i]->callback(ops[i], result);
+			}
+		}
+
+		void reapCompletions() {
+			unsigned int head = *cqHead;
+			unsigned int tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+			while (head != tail) {
+				struct io_uring_cqe *cqe = &cqes[head & cqMask];
+				Operation *op = (Operation *) (uintptr_t) cqe->user_data;
+				int result = cqe->res;
+
+				head++;
+				// Release the slot before calling the callback, which may
+				// queue new operations.
+				__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+				inFlight--;
+				completions++;
+				op->callback(op, result);
+
+				tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+			}
+		}
+
+		void waitForCompletions() {
+			int ret, e;
+
+			do {
+				ret = sysEnter(ringFd, 0, 1, IORING_ENTER_GETEVENTS);
+			} while (ret == -1 && errno == EINTR);
+			if (ret == -1) {
+				// We must not return while the kernel may still write
+				// into the operations' buffers.
+				e = errno;
+				P_CRITICAL("Cannot wait for in-flight io_uring operations: " <<
+					strerror(e) << " (errno=" << e << ")");
+				abort();
+			}
+		}
+
+		static void onEventFdReadable(EV_P_ ev_io *io, int revents) {
+			IoUring *self = static_cast<IoUring *>(io->data);
+			boost::uint64_t value;
+			ssize_t ret;
+
+			do {
+				ret = ::read(self->eventFd, &value, sizeof(value));
+			} while (ret == -1 && errno == EINTR);
+			self->reapCompletions();
+		}
+
+		static void onPrepare(EV_P_ ev_prepare *prepare, int revents) {
+			IoUring *self = static_cast<IoUring *>(prepare->data);
+			self->submit();
+		}
+	#endif
+
+public:
+	IoUring()
+		: loop(NULL),
+		  inFlight(0),
+		  unsubmitted(0),
+		  submitCalls(0),
+		  completions(0)
+	{
+		#ifdef PSG_HAVE_IO_URING
+			ringFd = -1;
+			eventFd = -1;
+			ringPtr = NULL;
+			ringSize = 0;
+			sqes = NULL;
+			sqesSize = 0;
+			sqLocalTail = 0;
+			ev_io_init(&eventWatcher, onEventFdReadable, -1, EV_READ);
+			eventWatcher.data = this;
+			ev_prepare_init(&prepareWatcher, onPrepare);
+			prepareWatcher.data = this;
+		#endif
+	}
+
+	~IoUring() {
+		shutdown();
+	}
+
+	/**
+	 * Sets up the ring and starts watching for completions on the given loop.
+	 * Returns false if io_uring is not supported, in which case this object
+	 * stays unusable.
+	 */
+	bool initialize(struct ev_loop *_loop, unsigned int entries = 128) {
+		#ifdef PSG_HAVE_IO_URING
+			struct io_uring_params params;
+			int e;
+
+			assert(ringFd == -1);
+			loop = _loop;
+			memset(&params, 0, sizeof(params));
+			ringFd = sysSetup(entries, &params);
+			if (ringFd == -1) {
+				e = errno;
+				P_DEBUG("io_uring not available: " << strerror(e) <<
+					" (errno=" << e << ")");
+				return false;
+			}
+			if (!(params.features & IORING_FEAT_SINGLE_MMAP)
+			 || !(params.features & IORING_FEAT_NODROP)
+			 || !opcodesSupported())
+			{
+				P_DEBUG("io_uring not available: kernel lacks required features");
+				destroyRing();
+				return false;
+			}
+
+			ringSize = std::max<size_t>(
+				params.sq_off.array + params.sq_entries * sizeof(unsigned int),
+				params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+			ringPtr = mmap(NULL, ringSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+			if (ringPtr == MAP_FAILED) {
+				e = errno;
+				ringPtr = NULL;
+				P_DEBUG("io_uring not available: cannot map ring: " <<
+					strerror(e) << " (errno=" << e << ")");
+				destroyRing();
+				return false;
+			}
+			sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+			sqes = (struct io_uring_sqe *) mmap(NULL, sqesSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+			if (sqes == MAP_FAILED) {
+				e = errno;
+				sqes = NULL;
+				P_DEBUG("io_uring not available: cannot map submission queue: " <<
+					strerror(e) << " (errno=" << e << ")");
+				destroyRing();
+				return false;
+			}
+
+			char *base = (char *) ringPtr;
+			sqHead    = (unsigned int *) (base + params.sq_off.head);
+			sqTail    = (unsigned int *) (base + params.sq_off.tail);
+			sqMask    = *(unsigned int *) (base + params.sq_off.ring_mask);
+			sqEntries = *(unsigned int *) (base + params.sq_off.ring_entries);
+			sqArray   = (unsigned int *) (base + params.sq_off.array);
+			sqLocalTail = *sqTail;
+			cqHead    = (unsigned int *) (base + params.cq_off.head);
+			cqTail    = (unsigned int *) (base + params.cq_off.tail);
+			cqMask    = *(unsigned int *) (base + params.cq_off.ring_mask);
+			cqEntries = *(unsigned int *) (base + params.cq_off.ring_entries);
+			cqes      = (struct io_uring_cqe *) (base + params.cq_off.cqes);
+
+			eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (eventFd == -1) {
+				e = errno;
+				P_DEBUG("io_uring not available: cannot create eventfd: " <<
+					strerror(e) << " (errno=" << e << ")");
+				destroyRing();
+				return false;
+			}
+			if (sysRegister(ringFd, IORING_REGISTER_EVENTFD, &eventFd, 1) == -1) {
+				e = errno;
+				P_DEBUG("io_uring not available: cannot register eventfd: " <<
+					strerror(e) << " (errno=" << e << ")");
+				destroyRing();
+				return false;
+			}
+
+			ev_io_set(&eventWatcher, eventFd, EV_READ);
+			ev_io_start(loop, &eventWatcher);
+			return true;
+		#else
+			return false;
+		#endif
+	}
+
+	/**
+	 * Waits until all queued and in-flight operations have completed, calling
+	 * their callbacks, and then destroys the ring. Operations queued by those
+	 * callbacks are waited for too. The kernel may still be writing into
+	 * the operations' buffers until they complete, so this must be called
+	 * before freeing any memory that operations may refer to. Afterwards,
+	 * `isAvailable()` returns false.
+	 *
+	 * Must be called from the event loop thread while the loop still exists.
+	 */
+	void shutdown() {
+		#ifdef PSG_HAVE_IO_URING
+			if (ringFd == -1) {
+				return;
+			}
+
+			while (unsubmitted > 0 || inFlight > 0) {
+				if (unsubmitted > 0) {
+					submit();
+					if (unsubmitted > 0 && inFlight == 0) {
+						// The kernel is out of resources and there is
+						// nothing to wait for that would free them.
+						failUnsubmitted(-EAGAIN);
+					}
+				}
+				if (inFlight > 0) {
+					waitForCompletions();
+				}
+				reapCompletions();
+			}
+
+			destroyRing();
+		#endif
+	}
+
+	bool isAvailable() const {
+		#ifdef PSG_HAVE_IO_URING
+			return ringFd != -1;
+		#else
+			return false;
+		#endif
+	}
+
+	bool read(int fd, void *buf, unsigned int size, off_t offset, Operation *op) {
+		#ifdef PSG_HAVE_IO_URING
+			struct io_uring_sqe *sqe = getSqe(op);
+			if (sqe == NULL) {
+				return false;
+			}
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = fd;
+			sqe->addr = (boost::uint64_t) (uintptr_t) buf;
+			sqe->len = size;
+			sqe->off = offset;
+			commitSqe();
+			return true;
+		#else
+			return false;
+		#endif
+	}
+
+	bool write(int fd, const void *buf, unsigned int size, off_t offset, Operation *op) {
+		#ifdef PSG_HAVE_IO_URING
+			struct io_uring_sqe *sqe = getSqe(op);
+			if (sqe == NULL) {
+				return false;
+			}
+			sqe->opcode = IORING_OP_WRITE;
+			sqe->fd = fd;
+			sqe->addr = (boost::uint64_t) (uintptr_t) buf;
+			sqe->len = size;
+			sqe->off = offset;
+			commitSqe();
+			return true;
+		#else
+			return false;
+		#endif
+	}
+
+	bool open(const char *path, int flags, mode_t mode, Operation *op) {
+		#ifdef PSG_HAVE_IO_URING
+			struct io_uring_sqe *sqe = getSqe(op);
+			if (sqe == NULL) {
+				return false;
+			}
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (boost::uint64_t) (uintptr_t) path;
+			sqe->len = mode;
+			sqe->open_flags = flags | O_CLOEXEC;
+			commitSqe();
+			return true;
+		#else
+			return false;
+		#endif
+	}
+
+	bool close(int fd, Operation *op) {
+		#ifdef PSG_HAVE_IO_URING
+			struct io_uring_sqe *sqe = getSqe(op);
+			if (sqe == NULL) {
+				return false;
+			}
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->fd = fd;
+			commitSqe();
+			return true;
+		#else
+			return false;
+		#endif
+	}
+
+	bool unlink(const char *path, Operation *op) {
+		#ifdef PSG_HAVE_IO_URING
+			struct io_uring_sqe *sqe = getSqe(op);
+			if (sqe == NULL) {
+				return false;
+			}
+			sqe->opcode = IORING_OP_UNLINKAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (boost::uint64_t) (uintptr_t) path;
+			commitSqe();
+			return true;
+		#else
+			return false;
+		#endif
+	}
+
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		doc["available"] = isAvailable();
+		if (isAvailable()) {
+			doc["in_flight"] = inFlight;
+			doc["unsubmitted"] = unsubmitted;
+			doc["submit_calls"] = (Json::UInt64) submitCalls;
+			doc["completions"] = (Json::UInt64) completions;
+		}
+		return doc;
+	}
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_IO_URING_H_ */
@@ -0,0 +1,273 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_PARKED_CLIENT_SET_H_
+#define _PASSENGER_SERVER_KIT_PARKED_CLIENT_SET_H_
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <oxt/macros.hpp>
+#include <cerrno>
+#include <cstddef>
+#include <vector>
+#include <unistd.h>
+#include <ev.h>
+#include <ServerKit/Context.h>
+
+#if defined(__linux__)
+	#include <sys/epoll.h>
+	#if defined(EPOLLRDHUP) && defined(EPOLL_CLOEXEC)
+		#define PSG_HAVE_CLIENT_PARKING
+	#endif
+#endif
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+/**
+ * Holds the file descriptors of idle clients whose client objects have been
+ * released, so that an idle connection costs an `Entry` instead of a full
+ * client object (with its channels, watchers and current request). The file
+ * descriptors are watched with a single edge-triggered epoll instance, which
+ * is in turn watched by a single libev watcher.
+ *
+ * When a parked file descriptor becomes readable, it is removed from the set
+ * and the callback is called, so that the owner can create a client object
+ * for it again. When the peer has hung up, `hangup` is true and the owner is
+ * expected to close the file descriptor instead.
+ *
+ * Entries are stored in a compact array. The slot of a removed entry is reused
+ * by the next parked client, so that the slot numbers that are registered in
+ * the epoll instance remain valid.
+ *
+ * `initialize()` returns false if parking is not supported on this platform
+ * (only Linux is supported) or if the epoll instance cannot be created. In
+ * that case idle clients keep their client objects.
+ *
+ * This class is not thread-safe. It may only be used from the event loop thread.
+ */
+class ParkedClientSet: public boost::noncopyable {
+public:
+	struct Entry {
+		/** -1 if this slot is unused. */
+		int fd;
+		unsigned int number;
+	};
+
+	typedef void (*Callback)(ParkedClientSet *set, int fd, unsigned int number,
+		bool hangup);
+
+	/** Maximum number of epoll events to process in a single event loop iteration. */
+	static const unsigned int MAX_EVENTS = 64;
+
+	void *userData;
+
+private:
+	Context *ctx;
+	Callback callback;
+	int epollFd;
+	ev_io watcher;
+	std::vector<Entry> entries;
+	std::vector<unsigned int> freeSlots;
+	unsigned int count;
+
+	static void _onReadable(EV_P_ ev_io *io, int revents) {
+		static_cast<ParkedClientSet *>(io->data)->onReadable();
+	}
+
+	void onReadable() {
+		#ifdef PSG_HAVE_CLIENT_PARKING
+			struct epoll_event events[MAX_EVENTS];
+			int ret;
+
+			do {
+				ret = epoll_wait(epollFd, events, MAX_EVENTS, 0);
+			} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+
+			// Remove all entries before calling the callback, because the
+			// callback may park other clients, which reuses slots.
+			Entry ready[MAX_EVENTS];
+			bool hangup[MAX_EVENTS];
+			for (int i = 0; i < ret; i++) {
+				unsigned int slot = events[i].data.u32;
+				ready[i] = entries[slot];
+				hangup[i] = (events[i].events & (EPOLLHUP | EPOLLERR)) != 0;
+				remove(slot);
+			}
+			for (int i = 0; i < ret; i++) {
+				callback(this, ready[i].fd, ready[i].number, hangup[i]);
+			}
+		#endif
+	}
+
+	void remove(unsigned int slot) {
+		#ifdef PSG_HAVE_CLIENT_PARKING
+			// epoll_ctl() requires a non-NULL event argument on old kernels.
+			struct epoll_event event;
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, entries[slot].fd, &event);
+		#endif
+		entries[slot].fd = -1;
+		count--;
+		if (count == 0) {
+			entries.clear();
+			freeSlots.clear();
+		} else {
+			freeSlots.push_back(slot);
+		}
+	}
+
+public:
+	ParkedClientSet(Context *context, Callback _callback)
+		: userData(NULL),
+		  ctx(context),
+		  callback(_callback),
+		  epollFd(-1),
+		  count(0)
+	{
+		ev_io_init(&watcher, _onReadable, -1, EV_READ);
+		watcher.data = this;
+	}
+
+	~ParkedClientSet() {
+		closeAll();
+		if (epollFd != -1) {
+			::close(epollFd);
+		}
+	}
+
+	static bool isSupported() {
+		#ifdef PSG_HAVE_CLIENT_PARKING
+			return true;
+		#else
+			return false;
+		#endif
+	}
+
+	/**
+	 * Creates the epoll instance. Returns false, with errno set, if parking is
+	 * not supported or if the epoll instance cannot be created.
+	 */
+	bool initialize() {
+		#ifdef PSG_HAVE_CLIENT_PARKING
+			if (epollFd != -1) {
+				return true;
+			}
+			epollFd = epoll_create1(EPOLL_CLOEXEC);
+			if (epollFd == -1) {
+				return false;
+			}
+			ev_io_set(&watcher, epollFd, EV_READ);
+			return true;
+		#else
+			errno = ENOSYS;
+			return false;
+		#endif
+	}
+
+	bool initialized() const {
+		return epollFd != -1;
+	}
+
+	/**
+	 * Parks the given file descriptor. Returns false, with errno set, if it
+	 * cannot be watched; the caller then still owns the file descriptor.
+	 * If the file descriptor is already readable, the callback is called in
+	 * the next event loop iteration.
+	 */
+	bool add(int fd, unsigned int number) {
+		#ifdef PSG_HAVE_CLIENT_PARKING
+			struct epoll_event event;
+			unsigned int slot;
+
+			if (epollFd == -1) {
+				errno = EBADF;
+				return false;
+			}
+
+			if (freeSlots.empty()) {
+				slot = entries.size();
+			} else {
+				slot = freeSlots.back();
+			}
+
+			event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+			event.data.u64 = 0;
+			event.data.u32 = slot;
+			if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+				return false;
+			}
+
+			if (freeSlots.empty()) {
+				entries.push_back(Entry());
+			} else {
+				freeSlots.pop_back();
+			}
+			entries[slot].fd = fd;
+			entries[slot].number = number;
+			count++;
+			if (!ev_is_active(&watcher)) {
+				ev_io_start(ctx->libev->getLoop(), &watcher);
+			}
+			return true;
+		#else
+			errno = ENOSYS;
+			return false;
+		#endif
+	}
+
+	/** Closes all parked file descriptors and stops watching. */
+	void closeAll() {
+		for (unsigned int i = 0; i < entries.size(); i++) {
+			if (entries[i].fd != -1) {
+				::close(entries[i].fd);
+			}
+		}
+		entries.clear();
+		freeSlots.clear();
+		count = 0;
+		if (ev_is_active(&watcher)) {
+			ev_io_stop(ctx->libev->getLoop(), &watcher);
+		}
+	}
+
+	unsigned int size() const {
+		return count;
+	}
+
+	/** Memory used by the parked clients, excluding the kernel's epoll bookkeeping. */
+	size_t getMemoryUsage() const {
+		return entries.capacity() * sizeof(Entry)
+			+ freeSlots.capacity() * sizeof(unsigned int);
+	}
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_PARKED_CLIENT_SET_H_ */
@@ -468,6 +468,47 @@ private:
 		}
 	}
 
+	/**
+	 * Implements disconnect() and detach(). Returns the client's file
+	 * descriptor number, or -1 if the client wasn't active.
+	 */
+	int releaseClient(Client **client, bool closeFd) {
+		Client *c = *client;
+		if (c->getConnState() != Client::ACTIVE) {
+			return -1;
+		}
+
+		int fdnum = c->getFd();
+		SKC_TRACE(c, 2, "Disconnecting; there are now " << (activeClientCount - 1) <<
+			" active clients");
+		onClientDisconnecting(c);
+
+		c->setConnState(ClientType::DISCONNECTED);
+		TAILQ_REMOVE(&activeClients, c, nextClient.activeOrDisconnectedClient);
+		activeClientCount--;
+		TAILQ_INSERT_HEAD(&disconnectedClients, c, nextClient.activeOrDisconnectedClient);
+		disconnectedClientCount++;
+
+		deinitializeClient(c);
+		if (closeFd) {
+			SKC_TRACE(c, 2, "Closing client file descriptor: " << fdnum);
+			try {
+				safelyClose(fdnum);
+				P_LOG_FILE_DESCRIPTOR_CLOSE(fdnum);
+			} catch (const SystemException &e) {
+				SKC_WARN(c, "An error occurred while closing the client file descriptor: " <<
+					e.what() << " (errno=" << e.code() << ")");
+			}
+		} else {
+			SKC_TRACE(c, 2, "Detached from client file descriptor: " << fdnum);
+		}
+
+		*client = NULL;
+		onClientDisconnected(c);
+		unrefClient(c, __FILE__, __LINE__);
+		return fdnum;
+	}
+
 	void logClientDataReceived(Client *client, const MemoryKit::mbuf &buffer, int errcode) {
 		if (buffer.size() > 0) {
 			SKC_TRACE(client, 3, "Processing " << buffer.size() << " bytes of client data");
@@ -951,36 +992,34 @@ public:
 	}
 
 	bool disconnect(Client **client) {
-		Client *c = *client;
-		if (c->getConnState() != Client::ACTIVE) {
-			return false;
-		}
-
-		int fdnum = c->getFd();
-		SKC_TRACE(c, 2, "Disconnecting; there are now " << (activeClientCount - 1) <<
-			" active clients");
-		onClientDisconnecting(c);
-
-		c->setConnState(ClientType::DISCONNECTED);
-		TAILQ_REMOVE(&activeClients, c, nextClient.activeOrDisconnectedClient);
-		activeClientCount--;
-		TAILQ_INSERT_HEAD(&disconnectedClients, c, nextClient.activeOrDisconnectedClient);
-		disconnectedClientCount++;
+		return releaseClient(client, true) != -1;
+	}
 
-		deinitializeClient(c);
-		SKC_TRACE(c, 2, "Closing client file descriptor: " << fdnum);
-		try {
-			safelyClose(fdnum);
-			P_LOG_FILE_DESCRIPTOR_CLOSE(fdnum);
-		} catch (const SystemException &e) {
-			SKC_WARN(c, "An error occurred while closing the client file descriptor: " <<
-				e.what() << " (errno=" << e.code() << ")");
-		}
+	/**
+	 * Like disconnect(), but doesn't close the client's file descriptor.
+	 * Instead, the file descriptor is returned and the caller becomes
+	 * responsible for it, e.g. to pass it to reattach() later. Returns -1
+	 * if the client wasn't active.
+	 */
+	int detach(Client **client) {
+		return releaseClient(client, false);
+	}
 
-		*client = NULL;
-		onClientDisconnected(c);
-		unrefClient(c, __FILE__, __LINE__);
-		return true;
+	/**
+	 * Creates a client object for a file descriptor that was obtained with
+	 * detach(). The client gets its old number back so that it keeps its
+	 * name in the logs, and it isn't counted as a newly accepted client.
+	 */
+	void reattach(int fd, unsigned int number) {
+		assert(serverState == ACTIVE || serverState == TOO_MANY_FDS);
+		Client *client = checkoutClientObject();
+		TAILQ_INSERT_HEAD(&activeClients, client, nextClient.activeOrDisconnectedClient);
+		activeClientCount++;
+		client->number = number;
+		reinitializeClient(client, fd);
+		SKC_TRACE(client, 2, "Reattached; there are now " << activeClientCount <<
+			" active clients");
+		onClientsAccepted(&client, 1);
 	}
 
 	void disconnectWithWarning(Client **client, const StaticString &message) {
@@ -0,0 +1,396 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_SPLICE_TUNNEL_H_
+#define _PASSENGER_SERVER_KIT_SPLICE_TUNNEL_H_
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <oxt/macros.hpp>
+#include <sys/types.h>
+#include <cerrno>
+#include <cstddef>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ev.h>
+#include <jsoncpp/json.h>
+#include <ServerKit/Context.h>
+#include <ServerKit/Hooks.h>
+#include <Utils/JsonUtils.h>
+
+#if defined(__linux__) && defined(SPLICE_F_NONBLOCK)
+	#define PSG_HAVE_SPLICE
+#endif
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+/**
+ * Relays data in both directions between two connected, non-blocking sockets
+ * (a client and a peer) with `splice()`, so that the data never leaves the
+ * kernel. Each direction moves data from its source socket into a pipe, and
+ * from that pipe into its sink socket. It is used for connections that have been
+ * upgraded (e.g. WebSockets), where the data is not inspected by us and
+ * doesn't need to be buffered.
+ *
+ * A direction only reads from its source while its pipe is empty. If the sink
+ * cannot take all data in the pipe, then the direction stops reading and waits
+ * until the sink becomes writable, so that a slow receiver throttles its
+ * sender like it does with channels.
+ *
+ * When a direction reaches the end of its source's stream (after all data has
+ * been written to the sink), or when it encounters an error, it stops and calls
+ * the callback. The callback decides what to do with the sockets, e.g. half-close
+ * the sink; the other direction keeps running. The callback may destroy the tunnel.
+ *
+ * `initialize()` returns false if splicing is not supported or if the pipes
+ * cannot be created. In that case the caller is expected to keep relaying data
+ * through channels.
+ *
+ * This class is not thread-safe. It may only be used from the event loop thread.
+ */
+class SpliceTunnel: public boost::noncopyable {
+public:
+	enum Direction {
+		CLIENT_TO_PEER,
+		PEER_TO_CLIENT
+	};
+
+	enum Event {
+		/** The source sent EOF, and all data has been written to the sink. */
+		END_OF_STREAM,
+		READ_ERROR,
+		WRITE_ERROR
+	};
+
+	typedef void (*Callback)(SpliceTunnel *tunnel, Direction direction,
+		Event event, int errcode);
+
+	/** Maximum number of bytes to move with a single `splice()` call. */
+	static const unsigned int MAX_SPLICE_SIZE = 64 * 1024;
+
+private:
+	struct Stream {
+		int pipeReader;
+		int pipeWriter;
+		int source;
+		int sink;
+		/** Number of bytes in the pipe that haven't been written to the sink yet. */
+		size_t bytesInPipe;
+		boost::uint64_t bytesTransferred;
+		bool sourceEof;
+		bool ended;
+	};
+
+	Context *ctx;
+	Hooks *hooks;
+	Callback callback;
+	Stream streams[2];
+	ev_io clientWatcher;
+	ev_io peerWatcher;
+	unsigned int spliceCalls;
+
+	static void _onClientEvent(EV_P_ ev_io *io, int revents) {
+		SpliceTunnel *self = static_cast<SpliceTunnel *>(io->data);
+		RefGuard guard(self->hooks, self, __FILE__, __LINE__);
+		self->onEvent(PEER_TO_CLIENT, CLIENT_TO_PEER, revents);
+	}
+
+	static void _onPeerEvent(EV_P_ ev_io *io, int revents) {
+		SpliceTunnel *self = static_cast<SpliceTunnel *>(io->data);
+		RefGuard guard(self->hooks, self, __FILE__, __LINE__);
+		self->onEvent(CLIENT_TO_PEER, PEER_TO_CLIENT, revents);
+	}
+
+	/**
+	 * The watched socket is the sink of `sinkDirection` and the source of
+	 * `sourceDirection`. Writes are handled first so that data that is already
+	 * in a pipe leaves before more data is read.
+	 */
+	void onEvent(Direction sinkDirection, Direction sourceDirection, int revents) {
+		if ((revents & EV_WRITE) && !flush(sinkDirection)) {
+			// Callback may have destroyed this object.
+			return;
+		}
+		if (revents & EV_READ) {
+			read(sourceDirection);
+		}
+	}
+
+	static ssize_t spliceSome(int from, int to, size_t size) {
+		#ifdef PSG_HAVE_SPLICE
+			ssize_t ret;
+			do {
+				ret = ::splice(from, NULL, to, NULL, size,
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+			return ret;
+		#else
+			errno = ENOSYS;
+			return -1;
+		#endif
+	}
+
+	/**
+	 * Moves data from the source socket into the pipe and from there into the
+	 * sink. Returns false if the callback was called.
+	 */
+	bool read(Direction direction) {
+		Stream &stream = streams[direction];
+		ssize_t ret;
+
+		if (stream.ended || stream.sourceEof || stream.bytesInPipe > 0) {
+			return true;
+		}
+
+		ret = spliceSome(stream.source, stream.pipeWriter, MAX_SPLICE_SIZE);
+		spliceCalls++;
+		if (ret > 0) {
+			stream.bytesInPipe = ret;
+			return flush(direction);
+		} else if (ret == 0) {
+			stream.sourceEof = true;
+			return flush(direction);
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return true;
+		} else {
+			end(direction, READ_ERROR, errno);
+			return false;
+		}
+	}
+
+	/**
+	 * Writes the data in the pipe to the sink. Returns false if the
+	 * callback was called.
+	 */
+	bool flush(Direction direction) {
+		Stream &stream = streams[direction];
+		ssize_t ret;
+
+		if (stream.ended) {
+			return true;
+		}
+
+		while (stream.bytesInPipe > 0) {
+			ret = spliceSome(stream.pipeReader, stream.sink, stream.bytesInPipe);
+			spliceCalls++;
+			if (ret > 0) {
+				stream.bytesInPipe -= ret;
+				stream.bytesTransferred += ret;
+			} else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				updateWatchers();
+				return true;
+			} else {
+				end(direction, WRITE_ERROR, (ret == 0) ? EPIPE : errno);
+				return false;
+			}
+		}
+
+		if (stream.sourceEof) {
+			end(direction, END_OF_STREAM, 0);
+			return false;
+		} else {
+			updateWatchers();
+			return true;
+		}
+	}
+
+	void end(Direction direction, Event event, int errcode) {
+		streams[direction].ended = true;
+		updateWatchers();
+		callback(this, direction, event, errcode);
+	}
+
+	int wantedEvents(Direction sourceDirection, Direction sinkDirection) const {
+		const Stream &source = streams[sourceDirection];
+		const Stream &sink = streams[sinkDirection];
+		int events = 0;
+
+		if (!source.ended && !source.sourceEof && source.bytesInPipe == 0) {
+			events |= EV_READ;
+		}
+		if (!sink.ended && sink.bytesInPipe > 0) {
+			events |= EV_WRITE;
+		}
+		return events;
+	}
+
+	void updateWatcher(ev_io *watcher, int events) {
+		struct ev_loop *loop = ctx->libev->getLoop();
+		if (ev_is_active(watcher) && watcher->events == events) {
+			return;
+		}
+		if (ev_is_active(watcher)) {
+			ev_io_stop(loop, watcher);
+		}
+		if (events != 0) {
+			ev_io_set(watcher, watcher->fd, events);
+			ev_io_start(loop, watcher);
+		}
+	}
+
+	void updateWatchers() {
+		updateWatcher(&clientWatcher, wantedEvents(CLIENT_TO_PEER, PEER_TO_CLIENT));
+		updateWatcher(&peerWatcher, wantedEvents(PEER_TO_CLIENT, CLIENT_TO_PEER));
+	}
+
+	void closePipes() {
+		for (unsigned int i = 0; i < 2; i++) {
+			if (streams[i].pipeReader != -1) {
+				::close(streams[i].pipeReader);
+				::close(streams[i].pipeWriter);
+				streams[i].pipeReader = -1;
+				streams[i].pipeWriter = -1;
+			}
+		}
+	}
+
+public:
+	SpliceTunnel(Context *context, Hooks *_hooks, Callback _callback)
+		: ctx(context),
+		  hooks(_hooks),
+		  callback(_callback),
+		  spliceCalls(0)
+	{
+		for (unsigned int i = 0; i < 2; i++) {
+			streams[i].pipeReader = -1;
+			streams[i].pipeWriter = -1;
+			streams[i].source = -1;
+			streams[i].sink = -1;
+			streams[i].bytesInPipe = 0;
+			streams[i].bytesTransferred = 0;
+			streams[i].sourceEof = false;
+			streams[i].ended = false;
+		}
+		ev_io_init(&clientWatcher, _onClientEvent, -1, EV_READ);
+		ev_io_init(&peerWatcher, _onPeerEvent, -1, EV_READ);
+		clientWatcher.data = this;
+		peerWatcher.data = this;
+	}
+
+	~SpliceTunnel() {
+		stop();
+		closePipes();
+	}
+
+	static bool isSupported() {
+		#ifdef PSG_HAVE_SPLICE
+			return true;
+		#else
+			return false;
+		#endif
+	}
+
+	/**
+	 * Creates the pipes. Returns false, with errno set, if splicing is not
+	 * supported or if the pipes cannot be created.
+	 */
+	bool initialize(int clientFd, int peerFd) {
+		#ifdef PSG_HAVE_SPLICE
+			int fds[2][2];
+
+			if (pipe2(fds[0], O_NONBLOCK | O_CLOEXEC) == -1) {
+				return false;
+			}
+			if (pipe2(fds[1], O_NONBLOCK | O_CLOEXEC) == -1) {
+				int e = errno;
+				::close(fds[0][0]);
+				::close(fds[0][1]);
+				errno = e;
+				return false;
+			}
+
+			for (unsigned int i = 0; i < 2; i++) {
+				streams[i].pipeReader = fds[i][0];
+				streams[i].pipeWriter = fds[i][1];
+			}
+			streams[CLIENT_TO_PEER].source = clientFd;
+			streams[CLIENT_TO_PEER].sink = peerFd;
+			streams[PEER_TO_CLIENT].source = peerFd;
+			streams[PEER_TO_CLIENT].sink = clientFd;
+			ev_io_set(&clientWatcher, clientFd, EV_READ);
+			ev_io_set(&peerWatcher, peerFd, EV_READ);
+			return true;
+		#else
+			errno = ENOSYS;
+			return false;
+		#endif
+	}
+
+	/**
+	 * Starts relaying. Both sockets must not have any data that was read
+	 * from them, but that hasn't been written to the other socket yet.
+	 */
+	void start() {
+		updateWatchers();
+	}
+
+	void stop() {
+		struct ev_loop *loop = ctx->libev->getLoop();
+		if (ev_is_active(&clientWatcher)) {
+			ev_io_stop(loop, &clientWatcher);
+		}
+		if (ev_is_active(&peerWatcher)) {
+			ev_io_stop(loop, &peerWatcher);
+		}
+	}
+
+	bool ended(Direction direction) const {
+		return streams[direction].ended;
+	}
+
+	boost::uint64_t getBytesTransferred(Direction direction) const {
+		return streams[direction].bytesTransferred;
+	}
+
+	unsigned int getSpliceCalls() const {
+		return spliceCalls;
+	}
+
+	Hooks *getHooks() const {
+		return hooks;
+	}
+
+	Json::Value inspectAsJson() const {
+		Json::Value doc;
+		doc["client_to_peer"]["bytes_transferred"] =
+			byteSizeToJson(streams[CLIENT_TO_PEER].bytesTransferred);
+		doc["client_to_peer"]["ended"] = streams[CLIENT_TO_PEER].ended;
+		doc["peer_to_client"]["bytes_transferred"] =
+			byteSizeToJson(streams[PEER_TO_CLIENT].bytesTransferred);
+		doc["peer_to_client"]["ended"] = streams[PEER_TO_CLIENT].ended;
+		doc["splice_calls"] = spliceCalls;
+		return doc;
+	}
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_SPLICE_TUNNEL_H_ */
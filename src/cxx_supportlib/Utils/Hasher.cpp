@@ -26,10 +26,149 @@
 
 // Implementation is in its own file so that we can enable compiler optimizations for these functions only.
 
+#include <cstring>
 #include <Utils/Hasher.h>
 
 namespace Passenger {
 
+
+/***** WyHash *****/
+
+static const boost::uint64_t WYHASH_SECRET1 = 0xe7037ed1a0b428dbull;
+
+static inline boost::uint64_t
+wyRead64(const unsigned char *data) {
+	boost::uint64_t result;
+	memcpy(&result, data, sizeof(result));
+	return result;
+}
+
+/**
+ * Multiplies two 64-bit numbers and folds the 128-bit result by XORing
+ * its high and low halves.
+ */
+static inline boost::uint64_t
+wyMix(boost::uint64_t a, boost::uint64_t b) {
+	#ifdef __SIZEOF_INT128__
+		unsigned __int128 result = (unsigned __int128) a * b;
+		return (boost::uint64_t) result ^ (boost::uint64_t) (result >> 64);
+	#else
+		boost::uint64_t ha = a >> 32, hb = b >> 32;
+		boost::uint64_t la = (boost::uint32_t) a, lb = (boost::uint32_t) b;
+		boost::uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+		boost::uint64_t t = rl + (rm0 << 32);
+		boost::uint64_t carry = t < rl;
+		boost::uint64_t lo = t + (rm1 << 32);
+		carry += lo < t;
+		boost::uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+		return lo ^ hi;
+	#endif
+}
+
+static inline boost::uint64_t
+wyRead32(const unsigned char *data) {
+	boost::uint32_t result;
+	memcpy(&result, data, sizeof(result));
+	return result;
+}
+
+static inline void
+wyConsumeBlock(boost::uint64_t &seed, const unsigned char *block) {
+	seed = wyMix(wyRead64(block) ^ WYHASH_SECRET1, wyRead64(block + 8) ^ seed);
+}
+
+/**
+ * Mixes the last 0-15 bytes and the total size into the state. Like wyhash,
+ * this reads the tail with a few possibly overlapping fixed size loads.
+ */
+static inline boost::uint32_t
+wyFinish(boost::uint64_t seed, boost::uint64_t totalSize, const unsigned char *tail,
+	unsigned int tailSize)
+{
+	boost::uint64_t a, b, result;
+
+	if (tailSize >= 4) {
+		unsigned int offset = (tailSize >> 3) << 2;
+		a = (wyRead32(tail) << 32) | wyRead32(tail + offset);
+		b = (wyRead32(tail + tailSize - 4) << 32) | wyRead32(tail + tailSize - 4 - offset);
+	} else if (tailSize > 0) {
+		a = ((boost::uint64_t) tail[0] << 16) | ((boost::uint64_t) tail[tailSize >> 1] << 8)
+			| tail[tailSize - 1];
+		b = 0;
+	} else {
+		a = b = 0;
+	}
+
+	result = wyMix(a ^ WYHASH_SECRET1, b ^ seed);
+	result = wyMix(totalSize ^ WYHASH_SECRET1, result);
+	return (boost::uint32_t) (result ^ (result >> 32));
+}
+
+void
+WyHash::update(const char *data, unsigned int size) {
+	const unsigned char *pos = (const unsigned char *) data;
+	const unsigned char *end = pos + size;
+
+	totalSize += size;
+
+	if (bufferSize > 0) {
+		while (bufferSize < INPUT_BLOCK_SIZE && pos < end) {
+			buffer[bufferSize] = *pos;
+			bufferSize++;
+			pos++;
+		}
+		if (bufferSize < INPUT_BLOCK_SIZE) {
+			return;
+		}
+		wyConsumeBlock(seed, buffer);
+		bufferSize = 0;
+	}
+
+	while (end - pos >= (long) INPUT_BLOCK_SIZE) {
+		wyConsumeBlock(seed, pos);
+		pos += INPUT_BLOCK_SIZE;
+	}
+
+	bufferSize = end - pos;
+	memcpy(buffer, pos, bufferSize);
+}
+
+void
+WyHash::updateLowerCase(const char *data, char *output, unsigned int size) {
+	while (size > 0) {
+		unsigned int n = (size < INPUT_BLOCK_SIZE) ? size : INPUT_BLOCK_SIZE;
+		for (unsigned int i = 0; i < n; i++) {
+			unsigned char ch = data[i];
+			output[i] = ch + ((unsigned char) (ch - 'A') < 26) * ('a' - 'A');
+		}
+		update(output, n);
+		data += n;
+		output += n;
+		size -= n;
+	}
+}
+
+boost::uint32_t
+WyHash::finalize() {
+	return wyFinish(seed, totalSize, buffer, bufferSize);
+}
+
+boost::uint32_t
+WyHash::hash(const char *data, unsigned int size) {
+	const unsigned char *pos = (const unsigned char *) data;
+	const unsigned char *end = pos + size;
+	boost::uint64_t seed = INITIAL_SEED;
+
+	while (end - pos >= (long) INPUT_BLOCK_SIZE) {
+		wyConsumeBlock(seed, pos);
+		pos += INPUT_BLOCK_SIZE;
+	}
+	return wyFinish(seed, size, pos, end - pos);
+}
+
+
+/***** JenkinsHash *****/
+
 void
 JenkinsHash::update(const char *data, unsigned int size) {
 	const char *end = data + size;
@@ -50,4 +189,5 @@ JenkinsHash::finalize() {
 	return hash;
 }
 
+
 } // namespace Passenger
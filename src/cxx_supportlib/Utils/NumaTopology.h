@@ -0,0 +1,352 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_NUMA_TOPOLOGY_H_
+#define _PASSENGER_NUMA_TOPOLOGY_H_
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cerrno>
+#include <sys/types.h>
+#include <dirent.h>
+#include <unistd.h>
+#ifdef __linux__
+	#include <sched.h>
+	#include <sys/syscall.h>
+#endif
+#include <Exceptions.h>
+#include <StaticString.h>
+#include <Utils/IOUtils.h>
+#include <Utils/StrIntUtils.h>
+
+/*
+ * Discovers the NUMA topology of the machine through sysfs, and binds threads
+ * (and the memory that they allocate) to NUMA nodes. We talk to the kernel
+ * directly instead of through libnuma so that we don't introduce a new
+ * library dependency.
+ */
+
+namespace Passenger {
+
+using namespace std;
+
+
+struct NumaNode {
+	unsigned int id;
+	/** The CPUs that belong to this node, sorted in ascending order. */
+	vector<unsigned int> cpus;
+
+	struct IdLess {
+		bool operator()(const NumaNode &a, const NumaNode &b) const {
+			return a.id < b.id;
+		}
+	};
+};
+
+/** Describes which NUMA node and which CPUs a thread should be bound to. */
+struct NumaThreadPlacement {
+	unsigned int node;
+	vector<unsigned int> cpus;
+
+	NumaThreadPlacement()
+		: node(0)
+		{ }
+};
+
+
+/**
+ * Parses a CPU list in the format used by sysfs and cpusets, for example
+ * "0-3,8-11". Returns the CPUs in ascending order, without duplicates.
+ *
+ * @throws ArgumentException The list is malformed.
+ */
+inline vector<unsigned int>
+parseCpuList(const StaticString &str) {
+	vector<unsigned int> result;
+	const char *pos = str.data();
+	const char *end = str.data() + str.size();
+
+	while (end > pos && (end[-1] == '\n' || end[-1] == ' ')) {
+		end--;
+	}
+	while (pos < end) {
+		char *numEnd;
+		unsigned long first, last;
+
+		first = strtoul(pos, &numEnd, 10);
+		if (numEnd == pos || numEnd > end) {
+			throw ArgumentException("Invalid CPU list: " + str.toString());
+		}
+		pos = numEnd;
+		last = first;
+		if (pos < end && *pos == '-') {
+			pos++;
+			last = strtoul(pos, &numEnd, 10);
+			if (numEnd == pos || numEnd > end || last < first) {
+				throw ArgumentException("Invalid CPU list: " + str.toString());
+			}
+			pos = numEnd;
+		}
+		for (unsigned long cpu = first; cpu <= last; cpu++) {
+			result.push_back((unsigned int) cpu);
+		}
+		if (pos < end) {
+			if (*pos != ',') {
+				throw ArgumentException("Invalid CPU list: " + str.toString());
+			}
+			pos++;
+		}
+	}
+
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+	return result;
+}
+
+/** The inverse of `parseCpuList()`. */
+inline string
+formatCpuList(const vector<unsigned int> &cpus) {
+	string result;
+	unsigned int i = 0;
+
+	while (i < cpus.size()) {
+		unsigned int j = i;
+		while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+			j++;
+		}
+		if (!result.empty()) {
+			result.append(1, ',');
+		}
+		result.append(toString(cpus[i]));
+		if (j > i) {
+			result.append(1, '-');
+			result.append(toString(cpus[j]));
+		}
+		i = j + 1;
+	}
+	return result;
+}
+
+/**
+ * Discovers the NUMA nodes of this machine by reading
+ * `<sysfsNodeDir>/node<N>/cpulist`. Nodes without CPUs (e.g. memory-only nodes)
+ * are skipped. Returns the nodes sorted by ID, or an empty vector if the
+ * topology cannot be determined (e.g. because this is not Linux).
+ */
+inline vector<NumaNode>
+discoverNumaTopology(const string &sysfsNodeDir = "/sys/devices/system/node") {
+	vector<NumaNode> result;
+	DIR *dir = opendir(sysfsNodeDir.c_str());
+	struct dirent *ent;
+
+	if (dir == NULL) {
+		return result;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		string name(ent->d_name);
+		if (!startsWith(name, "node") || name.size() == 4
+		 || name.find_first_not_of("0123456789", 4) != string::npos)
+		{
+			continue;
+		}
+
+		NumaNode node;
+		node.id = stringToUint(name.substr(4));
+		try {
+			node.cpus = parseCpuList(readAll(sysfsNodeDir + "/" + name + "/cpulist"));
+		} catch (const SystemException &) {
+			continue;
+		} catch (const ArgumentException &) {
+			continue;
+		}
+		if (!node.cpus.empty()) {
+			result.push_back(node);
+		}
+	}
+	closedir(dir);
+
+	std::sort(result.begin(), result.end(), NumaNode::IdLess());
+	return result;
+}
+
+/**
+ * Distributes `nthreads` threads over the given NUMA nodes, in proportion to
+ * the number of CPUs in each node. Consecutive threads are kept on the same
+ * node. If `pinToSingleCpu` is true, each thread is bound to a single CPU
+ * within its node (round-robin); otherwise it is bound to all CPUs of its node
+ * and the kernel scheduler may move it around within that node.
+ */
+inline vector<NumaThreadPlacement>
+computeNumaThreadPlacement(unsigned int nthreads, const vector<NumaNode> &nodes,
+	bool pinToSingleCpu)
+{
+	vector<NumaThreadPlacement> result;
+	vector<unsigned int> threadsOnNode(nodes.size(), 0);
+	unsigned long long totalCpus = 0;
+
+	if (nodes.empty()) {
+		return result;
+	}
+	for (unsigned int i = 0; i < nodes.size(); i++) {
+		totalCpus += nodes[i].cpus.size();
+	}
+
+	result.reserve(nthreads);
+	for (unsigned int i = 0; i < nthreads; i++) {
+		// Map the middle of this thread's share onto the CPUs, then
+		// find the node that owns that CPU.
+		unsigned long long pos = ((2ull * i + 1) * totalCpus) / (2ull * nthreads);
+		unsigned int n = 0;
+		while (n + 1 < nodes.size() && pos >= nodes[n].cpus.size()) {
+			pos -= nodes[n].cpus.size();
+			n++;
+		}
+
+		NumaThreadPlacement placement;
+		placement.node = nodes[n].id;
+		if (pinToSingleCpu) {
+			placement.cpus.push_back(
+				nodes[n].cpus[threadsOnNode[n] % nodes[n].cpus.size()]);
+		} else {
+			placement.cpus = nodes[n].cpus;
+		}
+		threadsOnNode[n]++;
+		result.push_back(placement);
+	}
+	return result;
+}
+
+/**
+ * Returns the CPUs that the calling thread may run on, or an empty list if
+ * that cannot be determined.
+ */
+inline vector<unsigned int>
+getCurrentThreadCpuAffinity() {
+	vector<unsigned int> result;
+	#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+			for (unsigned int i = 0; i < CPU_SETSIZE; i++) {
+				if (CPU_ISSET(i, &set)) {
+					result.push_back(i);
+				}
+			}
+		}
+	#endif
+	return result;
+}
+
+/**
+ * Restricts the calling thread to the given CPUs. An empty list allows all
+ * CPUs. Returns 0 on success or an errno code on failure.
+ */
+inline int
+setCurrentThreadCpuAffinity(const vector<unsigned int> &cpus) {
+	#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (cpus.empty()) {
+			long n = sysconf(_SC_NPROCESSORS_CONF);
+			for (long i = 0; i < n && i < CPU_SETSIZE; i++) {
+				CPU_SET(i, &set);
+			}
+		} else {
+			for (unsigned int i = 0; i < cpus.size(); i++) {
+				if (cpus[i] >= CPU_SETSIZE) {
+					return EINVAL;
+				}
+				CPU_SET(cpus[i], &set);
+			}
+		}
+		if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+			return errno;
+		} else {
+			return 0;
+		}
+	#else
+		return ENOSYS;
+	#endif
+}
+
+/**
+ * Makes the kernel prefer allocating memory for the calling thread from the
+ * given NUMA node. Pass -1 to restore the default policy, which allocates
+ * from the node that the thread runs on at the time of the page fault.
+ * Returns 0 on success or an errno code on failure.
+ */
+inline int
+setCurrentThreadPreferredNumaNode(int node) {
+	#if defined(__linux__) && defined(SYS_set_mempolicy)
+		// Values from <linux/mempolicy.h>.
+		static const int MEMPOLICY_DEFAULT = 0;
+		static const int MEMPOLICY_PREFERRED = 1;
+		static const unsigned int MASK_WORDS = 16;
+		static const unsigned int BITS_PER_WORD = sizeof(unsigned long) * 8;
+		unsigned long nodemask[MASK_WORDS];
+		long ret;
+
+		if (node < 0) {
+			ret = syscall(SYS_set_mempolicy, MEMPOLICY_DEFAULT, NULL, 0);
+		} else if ((unsigned int) node >= MASK_WORDS * BITS_PER_WORD) {
+			return EINVAL;
+		} else {
+			std::fill(nodemask, nodemask + MASK_WORDS, 0);
+			nodemask[node / BITS_PER_WORD] = 1ul << (node % BITS_PER_WORD);
+			ret = syscall(SYS_set_mempolicy, MEMPOLICY_PREFERRED, nodemask,
+				(unsigned long) (MASK_WORDS * BITS_PER_WORD));
+		}
+		if (ret == -1) {
+			return errno;
+		} else {
+			return 0;
+		}
+	#else
+		return ENOSYS;
+	#endif
+}
+
+/**
+ * Binds the calling thread to the CPUs of the given placement, and makes it
+ * allocate memory from the placement's NUMA node. Memory that the thread
+ * touches first, such as the blocks of its ServerKit::Context's mbuf pool and
+ * its palloc pools, then ends up being node-local.
+ * Returns 0 on success or an errno code on failure.
+ */
+inline int
+bindCurrentThreadToNumaPlacement(const NumaThreadPlacement &placement) {
+	int e = setCurrentThreadCpuAffinity(placement.cpus);
+	if (e != 0) {
+		return e;
+	}
+	return setCurrentThreadPreferredNumaNode(placement.node);
+}
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_NUMA_TOPOLOGY_H_ */
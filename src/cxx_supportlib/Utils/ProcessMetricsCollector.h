@@ -92,6 +92,12 @@ struct ProcessMetrics {
 	 * -1 if unknown, 0 if no swap used.
 	 */
 	ssize_t  swap;
+	/** Shared clean RSS, shared dirty RSS and private clean RSS, see
+	 * measureRealMemory(). Do not include swap. -1 if unknown.
+	 */
+	ssize_t  sharedClean;
+	ssize_t  sharedDirty;
+	ssize_t  privateClean;
 	/** OS X Snow Leopard does not report the VM size correctly, so don't use this. */
 	ssize_t  vmsize;
 	pid_t   processGroupId;
@@ -106,6 +112,9 @@ struct ProcessMetrics {
 		pss = -1;
 		privateDirty = -1;
 		swap = -1;
+		sharedClean = -1;
+		sharedDirty = -1;
+		privateClean = -1;
 		vmsize = -1;
 		processGroupId = (pid_t) -1;
 		uid = (uid_t) -1;
@@ -115,6 +124,31 @@ struct ProcessMetrics {
 		return pid != (pid_t) -1;
 	}
 
+	/**
+	 * Returns the amount of resident memory (in KB) that this process shares
+	 * with other processes, such as with the preloader that it was forked
+	 * from, or -1 if unknown.
+	 */
+	ssize_t sharedMemory() const {
+		if (sharedClean == -1 || sharedDirty == -1) {
+			return -1;
+		} else {
+			return sharedClean + sharedDirty;
+		}
+	}
+
+	/**
+	 * Returns the amount of resident memory (in KB) that is private to this
+	 * process, or -1 if unknown.
+	 */
+	ssize_t privateMemory() const {
+		if (privateClean == -1 || privateDirty == -1) {
+			return -1;
+		} else {
+			return privateClean + privateDirty;
+		}
+	}
+
 	/**
 	 * Returns an estimate of the "real" memory usage of a process in KB.
 	 * We don't use the PSS here because that would mean if another
@@ -322,8 +356,7 @@ public:
 			ProcessMetricMap::iterator it;
 			for (it = result.begin(); it != result.end(); it++) {
 				ProcessMetrics &metric = it->second;
-				measureRealMemory(metric.pid, metric.pss,
-					metric.privateDirty, metric.swap);
+				measureRealMemory(metric.pid, metric);
 			}
 		}
 		return result;
@@ -342,20 +375,32 @@ public:
 	 *   sharing it.
 	 * - The private dirty RSS.
 	 * - Amount of memory in swap.
+	 * - The shared and private clean and dirty RSS, which tell how much of a
+	 *   process's memory is shared with other processes, e.g. with the
+	 *   preloader that it was forked from.
 	 *
 	 * At this time only OS X and recent Linux versions (>= 2.6.25) support
 	 * measuring the proportional set size. Usually root privileges are required.
+	 * On Linux >= 4.14 the totals are read from /proc/<pid>/smaps_rollup, which
+	 * is much cheaper than summing up /proc/<pid>/smaps.
 	 *
-	 * pss, privateDirty and swap can each be individually set to -1 if that
-	 * part cannot be measured, e.g. because we do not have permission
-	 * to do so or because the OS does not support measuring it.
+	 * Each of these can be individually set to -1 if that part cannot be
+	 * measured, e.g. because we do not have permission to do so or because
+	 * the OS does not support measuring it.
 	 */
-	static void measureRealMemory(pid_t pid, ssize_t &pss, ssize_t &privateDirty, ssize_t &swap) {
+	static void measureRealMemory(pid_t pid, ProcessMetrics &metrics) {
+		ssize_t &pss = metrics.pss;
+		ssize_t &privateDirty = metrics.privateDirty;
+		ssize_t &swap = metrics.swap;
+
 		#ifdef __APPLE__
 			kern_return_t ret;
 			mach_port_t task;
 
 			swap = -1;
+			metrics.sharedClean = -1;
+			metrics.sharedDirty = -1;
+			metrics.privateClean = -1;
 
 			ret = task_for_pid(mach_task_self(), pid, &task);
 			if (ret != KERN_SUCCESS) {
@@ -408,26 +453,47 @@ public:
 		#else
 			string smapsFilename = "/proc/";
 			smapsFilename.append(toString(pid));
-			smapsFilename.append("/smaps");
+			smapsFilename.append("/smaps_rollup");
 
 			FILE *f = syscalls::fopen(smapsFilename.c_str(), "r");
+			if (f == NULL && errno == ENOENT) {
+				smapsFilename.resize(smapsFilename.size() - sizeof("_rollup") + 1);
+				f = syscalls::fopen(smapsFilename.c_str(), "r");
+			}
 			if (f == NULL) {
 				error:
 				pss = -1;
 				privateDirty = -1;
 				swap = -1;
+				metrics.sharedClean = -1;
+				metrics.sharedDirty = -1;
+				metrics.privateClean = -1;
 				return;
 			}
 
 			StdioGuard guard(f, NULL, 0);
-			bool hasPss = false;
-			bool hasPrivateDirty = false;
-			bool hasSwap = false;
+			struct {
+				const char *name;
+				ssize_t *value;
+				bool found;
+			} fields[] = {
+				/* Linux supports Proportional Set Size since kernel 2.6.25.
+				 * See kernel commit ec4dd3eb35759f9fbeb5c1abb01403b2fde64cc9.
+				 */
+				{ "Pss:", &pss, false },
+				{ "Private_Dirty:", &privateDirty, false },
+				{ "Private_Clean:", &metrics.privateClean, false },
+				{ "Shared_Clean:", &metrics.sharedClean, false },
+				{ "Shared_Dirty:", &metrics.sharedDirty, false },
+				{ "Swap:", &swap, false }
+			};
+			const unsigned int nfields = sizeof(fields) / sizeof(fields[0]);
+			unsigned int i;
 
 			// In KB.
-			pss = 0;
-			privateDirty = 0;
-			swap = 0;
+			for (i = 0; i < nfields; i++) {
+				*fields[i].value = 0;
+			}
 
 			while (!feof(f)) {
 				char line[1024 * 4];
@@ -441,48 +507,38 @@ public:
 						break;
 					}
 				}
-				try {
-					if (startsWith(line, "Pss:")) {
-						/* Linux supports Proportional Set Size since kernel 2.6.25.
-						 * See kernel commit ec4dd3eb35759f9fbeb5c1abb01403b2fde64cc9.
-						 */
-						hasPss = true;
-						readNextWord(&buf);
-						pss += readNextWordAsLongLong(&buf);
-						if (readNextWord(&buf) != "kB") {
-							goto error;
-						}
-					} else if (startsWith(line, "Private_Dirty:")) {
-						hasPrivateDirty = true;
-						readNextWord(&buf);
-						privateDirty += readNextWordAsLongLong(&buf);
-						if (readNextWord(&buf) != "kB") {
-							goto error;
-						}
-					} else if (startsWith(line, "Swap:")) {
-						hasSwap = true;
-						readNextWord(&buf);
-						swap += readNextWordAsLongLong(&buf);
-						if (readNextWord(&buf) != "kB") {
+				for (i = 0; i < nfields; i++) {
+					if (startsWith(line, fields[i].name)) {
+						try {
+							fields[i].found = true;
+							readNextWord(&buf);
+							*fields[i].value += readNextWordAsLongLong(&buf);
+							if (readNextWord(&buf) != "kB") {
+								goto error;
+							}
+						} catch (const ParseException &) {
 							goto error;
 						}
+						break;
 					}
-				} catch (const ParseException &) {
-					goto error;
 				}
 			}
 
-			if (!hasPss) {
-				pss = -1;
-			}
-			if (!hasPrivateDirty) {
-				privateDirty = -1;
-			}
-			if (!hasSwap) {
-				swap = -1;
+			for (i = 0; i < nfields; i++) {
+				if (!fields[i].found) {
+					*fields[i].value = -1;
+				}
 			}
 		#endif
 	}
+
+	static void measureRealMemory(pid_t pid, ssize_t &pss, ssize_t &privateDirty, ssize_t &swap) {
+		ProcessMetrics metrics;
+		measureRealMemory(pid, metrics);
+		pss = metrics.pss;
+		privateDirty = metrics.privateDirty;
+		swap = metrics.swap;
+	}
 };
 
 } // namespace Passenger
@@ -27,6 +27,7 @@
 
 #include <boost/thread/mutex.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
 #include <list>
 #include <vector>
 #include <string>
@@ -72,8 +73,26 @@ struct thread_local_context {
 	spin_lock syscall_interruption_lock;
 
 	#ifdef OXT_BACKTRACE_IS_ENABLED
-		std::vector<trace_point *> backtrace_list;
-		spin_lock backtrace_lock;
+		/** The maximum number of trace points that are recorded per thread.
+		 * Trace points that are nested deeper are counted in `backtrace_depth`,
+		 * but not recorded. */
+		static const unsigned int MAX_BACKTRACE_DEPTH = 128;
+
+		/**
+		 * The shadow stack of trace points that are active in this thread.
+		 * Only this thread writes to it, so pushing and popping trace points
+		 * only involves relaxed atomic stores and no locks or read-modify-write
+		 * operations. Other threads (e.g. `thread::all_backtraces()`) read it
+		 * seqlock-style: each slot has a generation number that is odd while
+		 * the slot holds an active trace point and that is incremented when
+		 * the trace point is pushed or popped. A reader formats a slot's trace
+		 * point and then checks that the slot's generation did not change in
+		 * the meantime, because a popped trace point may no longer be accessed.
+		 * See `format_thread_backtrace()`.
+		 */
+		boost::atomic<trace_point *> backtrace_list[MAX_BACKTRACE_DEPTH];
+		boost::atomic<unsigned int> backtrace_generations[MAX_BACKTRACE_DEPTH];
+		boost::atomic<unsigned int> backtrace_depth;
 	#endif
 
 	static thread_local_context_ptr make_shared_ptr();
@@ -42,6 +42,8 @@
 	#include <cstring>
 #endif
 #include <cstring>
+#include <algorithm>
+#include <vector>
 
 
 namespace oxt {
@@ -133,6 +135,44 @@ static global_context_t *global_context = NULL;
 
 #ifdef OXT_BACKTRACE_IS_ENABLED
 
+/*
+ * Trace points are pushed onto and popped from the current thread's shadow
+ * stack on every TRACE_POINT(), so these must be cheap: there is only one
+ * writer, so plain loads and relaxed (or release) stores suffice. On x86 none
+ * of these compile to anything more expensive than a regular mov.
+ */
+
+const unsigned int thread_local_context::MAX_BACKTRACE_DEPTH;
+
+static inline OXT_FORCE_INLINE void
+push_trace_point(thread_local_context *ctx, trace_point *p) {
+	unsigned int depth = ctx->backtrace_depth.load(boost::memory_order_relaxed);
+	if (OXT_LIKELY(depth < thread_local_context::MAX_BACKTRACE_DEPTH)) {
+		boost::atomic<unsigned int> &generation = ctx->backtrace_generations[depth];
+		ctx->backtrace_list[depth].store(p, boost::memory_order_relaxed);
+		// Publishes the trace point to readers that observe the new generation.
+		generation.store(generation.load(boost::memory_order_relaxed) + 1,
+			boost::memory_order_release);
+	}
+	ctx->backtrace_depth.store(depth + 1, boost::memory_order_relaxed);
+}
+
+static inline OXT_FORCE_INLINE void
+pop_trace_point(thread_local_context *ctx) {
+	unsigned int depth = ctx->backtrace_depth.load(boost::memory_order_relaxed);
+	assert(depth > 0);
+	depth--;
+	ctx->backtrace_depth.store(depth, boost::memory_order_relaxed);
+	if (OXT_LIKELY(depth < thread_local_context::MAX_BACKTRACE_DEPTH)) {
+		boost::atomic<unsigned int> &generation = ctx->backtrace_generations[depth];
+		generation.store(generation.load(boost::memory_order_relaxed) + 1,
+			boost::memory_order_relaxed);
+		// The trace point's memory is reused after it's popped. Readers that
+		// observe any of those writes must also observe the new generation.
+		boost::atomic_thread_fence(boost::memory_order_release);
+	}
+}
+
 trace_point::trace_point(const char *_function, const char *_source, unsigned short _line,
 	const char *_data)
 	: function(_function),
@@ -141,14 +181,13 @@ trace_point::trace_point(const char *_function, const char *_source, unsigned sh
 	  m_detached(false),
 	  m_hasDataFunc(false)
 {
+	u.data = _data;
 	thread_local_context *ctx = get_thread_local_context();
 	if (OXT_LIKELY(ctx != NULL)) {
-		spin_lock::scoped_lock l(ctx->backtrace_lock);
-		ctx->backtrace_list.push_back(this);
+		push_trace_point(ctx, this);
 	} else {
 		m_detached = true;
 	}
-	u.data = _data;
 }
 
 trace_point::trace_point(const char *_function, const char *_source, unsigned short _line,
@@ -159,17 +198,16 @@ trace_point::trace_point(const char *_function, const char *_source, unsigned sh
 	  m_detached(detached),
 	  m_hasDataFunc(true)
 {
+	u.dataFunc.func = _dataFunc;
+	u.dataFunc.userData = _userData;
 	if (!detached) {
 		thread_local_context *ctx = get_thread_local_context();
 		if (OXT_LIKELY(ctx != NULL)) {
-			spin_lock::scoped_lock l(ctx->backtrace_lock);
-			ctx->backtrace_list.push_back(this);
+			push_trace_point(ctx, this);
 		} else {
 			m_detached = true;
 		}
 	}
-	u.dataFunc.func = _dataFunc;
-	u.dataFunc.userData = _userData;
 }
 
 trace_point::trace_point(const char *_function, const char *_source, unsigned short _line,
@@ -187,9 +225,7 @@ trace_point::~trace_point() {
 	if (OXT_LIKELY(!m_detached)) {
 		thread_local_context *ctx = get_thread_local_context();
 		if (OXT_LIKELY(ctx != NULL)) {
-			spin_lock::scoped_lock l(ctx->backtrace_lock);
-			assert(!ctx->backtrace_list.empty());
-			ctx->backtrace_list.pop_back();
+			pop_trace_point(ctx);
 		}
 	}
 }
@@ -204,26 +240,30 @@ trace_point::update(const char *source, unsigned short line) {
 tracable_exception::tracable_exception() {
 	thread_local_context *ctx = get_thread_local_context();
 	if (OXT_LIKELY(ctx != NULL)) {
-		spin_lock::scoped_lock l(ctx->backtrace_lock);
-		vector<trace_point *>::const_iterator it, end = ctx->backtrace_list.end();
-
-		backtrace_copy.reserve(ctx->backtrace_list.size());
-		for (it = ctx->backtrace_list.begin(); it != end; it++) {
+		// Only the current thread modifies its own shadow stack,
+		// so it can be read without further synchronization.
+		unsigned int depth = std::min(
+			ctx->backtrace_depth.load(boost::memory_order_relaxed),
+			thread_local_context::MAX_BACKTRACE_DEPTH);
+
+		backtrace_copy.reserve(depth);
+		for (unsigned int i = 0; i < depth; i++) {
+			const trace_point *orig = ctx->backtrace_list[i].load(boost::memory_order_relaxed);
 			trace_point *p;
-			if ((*it)->m_hasDataFunc) {
+			if (orig->m_hasDataFunc) {
 				p = new trace_point(
-					(*it)->function,
-					(*it)->source,
-					(*it)->line,
-					(*it)->u.dataFunc.func,
-					(*it)->u.dataFunc.userData,
+					orig->function,
+					orig->source,
+					orig->line,
+					orig->u.dataFunc.func,
+					orig->u.dataFunc.userData,
 					true);
 			} else {
 				p = new trace_point(
-					(*it)->function,
-					(*it)->source,
-					(*it)->line,
-					(*it)->u.data,
+					orig->function,
+					orig->source,
+					orig->line,
+					orig->u.data,
 					trace_point::detached());
 			}
 			backtrace_copy.push_back(p);
@@ -271,43 +311,113 @@ tracable_exception::~tracable_exception() throw() {
 	}
 }
 
+static void
+format_trace_point(const trace_point *p, ostream &result) {
+	result << "     in '" << p->function << "'";
+	if (p->source != NULL) {
+		const char *source = strrchr(p->source, '/');
+		if (source != NULL) {
+			source++;
+		} else {
+			source = p->source;
+		}
+		result << " (" << source << ":" << p->line << ")";
+		if (p->m_hasDataFunc) {
+			if (p->u.dataFunc.func != NULL) {
+				char buf[64];
+
+				memset(buf, 0, sizeof(buf));
+				if (p->u.dataFunc.func(buf, sizeof(buf) - 1, p->u.dataFunc.userData)) {
+					buf[63] = '\0';
+					result << " -- " << buf;
+				}
+			}
+		} else if (p->u.data != NULL) {
+			result << " -- " << p->u.data;
+		}
+	}
+	result << endl;
+}
+
 template<typename Collection>
 static string
 format_backtrace(const Collection &backtrace_list) {
 	if (backtrace_list.empty()) {
 		return "     (empty)";
 	} else {
-		backtrace_list.rbegin();
 		stringstream result;
 		typename Collection::const_reverse_iterator it;
 
 		for (it = backtrace_list.rbegin(); it != backtrace_list.rend(); it++) {
-			const trace_point *p = *it;
-
-			result << "     in '" << p->function << "'";
-			if (p->source != NULL) {
-				const char *source = strrchr(p->source, '/');
-				if (source != NULL) {
-					source++;
-				} else {
-					source = p->source;
-				}
-				result << " (" << source << ":" << p->line << ")";
-				if (p->m_hasDataFunc) {
-					if (p->u.dataFunc.func != NULL) {
-						char buf[64];
-
-						memset(buf, 0, sizeof(buf));
-						if (p->u.dataFunc.func(buf, sizeof(buf) - 1, p->u.dataFunc.userData)) {
-							buf[63] = '\0';
-							result << " -- " << buf;
-						}
-					}
-				} else if (p->u.data != NULL) {
-					result << " -- " << p->u.data;
-				}
-			}
-			result << endl;
+			format_trace_point(*it, result);
+		}
+		return result.str();
+	}
+}
+
+/**
+ * Formats the backtrace of the given thread, which may be concurrently
+ * pushing and popping trace points. Slots are read from the outermost trace
+ * point inwards. A slot is only used if its generation is odd (i.e. it holds
+ * an active trace point) and did not change while it was being read; reading
+ * stops at the first slot that fails this check, so that the result is the
+ * backtrace as it was at some point during the call, possibly without the
+ * innermost trace points of a thread that was busy.
+ *
+ * A popped trace point's memory may be reused at any time, so its fields are
+ * first copied and validated before anything they point to is accessed. The
+ * trace point's data is formatted after that and validated once more, so
+ * trace point data must point to memory that stays mapped for a while after
+ * the trace point is popped, which all trace points in Passenger satisfy.
+ */
+static string
+format_thread_backtrace(const thread_local_context *ctx) {
+	unsigned int depth = ctx->backtrace_depth.load(boost::memory_order_relaxed);
+	unsigned int recorded = std::min(depth, thread_local_context::MAX_BACKTRACE_DEPTH);
+	vector<string> lines;
+	unsigned int i;
+
+	lines.reserve(recorded);
+	for (i = 0; i < recorded; i++) {
+		const boost::atomic<unsigned int> &generation = ctx->backtrace_generations[i];
+		unsigned int before = generation.load(boost::memory_order_acquire);
+		if (before % 2 == 0) {
+			break;
+		}
+
+		const volatile trace_point *orig = ctx->backtrace_list[i].load(boost::memory_order_relaxed);
+		trace_point copy(orig->function, orig->source, orig->line, (const char *) NULL,
+			trace_point::detached());
+		copy.m_hasDataFunc = orig->m_hasDataFunc;
+		// Copies either member of the union.
+		copy.u.dataFunc.func = orig->u.dataFunc.func;
+		copy.u.dataFunc.userData = orig->u.dataFunc.userData;
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+		if (generation.load(boost::memory_order_relaxed) != before) {
+			break;
+		}
+
+		stringstream line;
+		format_trace_point(&copy, line);
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+		if (generation.load(boost::memory_order_relaxed) != before) {
+			break;
+		}
+		lines.push_back(line.str());
+	}
+
+	if (lines.empty()) {
+		return "     (empty)";
+	} else {
+		stringstream result;
+		vector<string>::const_reverse_iterator it;
+
+		if (i == recorded && depth > recorded) {
+			result << "     (" << (depth - recorded) <<
+				" more deeply nested trace points not recorded)" << endl;
+		}
+		for (it = lines.rbegin(); it != lines.rend(); it++) {
+			result << *it;
 		}
 		return result.str();
 	}
@@ -371,7 +481,11 @@ thread_local_context::thread_local_context()
 	#endif
 	syscall_interruption_lock.lock();
 	#ifdef OXT_BACKTRACE_IS_ENABLED
-		backtrace_list.reserve(50);
+		for (unsigned int i = 0; i < MAX_BACKTRACE_DEPTH; i++) {
+			backtrace_list[i].store(NULL, boost::memory_order_relaxed);
+			backtrace_generations[i].store(0, boost::memory_order_relaxed);
+		}
+		backtrace_depth.store(0, boost::memory_order_relaxed);
 	#endif
 }
 
@@ -438,8 +552,7 @@ thread::name() const throw() {
 std::string
 thread::backtrace() const throw() {
 	#ifdef OXT_BACKTRACE_IS_ENABLED
-		spin_lock::scoped_lock l(context->backtrace_lock);
-		return format_backtrace(context->backtrace_list);
+		return format_thread_backtrace(context.get());
 	#else
 		return "    (backtrace support disabled during compile time)";
 	#endif
@@ -465,8 +578,7 @@ thread::all_backtraces() throw() {
 				#endif
 				result << "):" << endl;
 
-				spin_lock::scoped_lock l(ctx->backtrace_lock);
-				std::string bt = format_backtrace(ctx->backtrace_list);
+				std::string bt = format_thread_backtrace(ctx.get());
 				result << bt;
 				if (bt.empty() || bt[bt.size() - 1] != '\n') {
 					result << endl;
@@ -487,8 +599,7 @@ thread::current_backtrace() throw() {
 	#ifdef OXT_BACKTRACE_IS_ENABLED
 		thread_local_context *ctx = get_thread_local_context();
 		if (OXT_LIKELY(ctx != NULL)) {
-			spin_lock::scoped_lock l(ctx->backtrace_lock);
-			return format_backtrace(ctx->backtrace_list);
+			return format_thread_backtrace(ctx);
 		} else {
 			return "(OXT not initialized)";
 		}
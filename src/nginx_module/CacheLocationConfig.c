@@ -299,6 +299,30 @@ int generated_cache_location_part(ngx_conf_t *cf, passenger_loc_conf_t *conf) {
 	
 
 	
+		if (conf->max_request_queue_time != NGX_CONF_UNSET) {
+			end = ngx_snprintf(int_buf,
+				sizeof(int_buf) - 1,
+				"%d",
+				conf->max_request_queue_time);
+			len += sizeof("!~PASSENGER_MAX_REQUEST_QUEUE_TIME: ") - 1;
+			len += end - int_buf;
+			len += sizeof("\r\n") - 1;
+		}
+	
+
+	
+		if (conf->request_priority != NGX_CONF_UNSET) {
+			end = ngx_snprintf(int_buf,
+				sizeof(int_buf) - 1,
+				"%d",
+				conf->request_priority);
+			len += sizeof("!~PASSENGER_REQUEST_PRIORITY: ") - 1;
+			len += end - int_buf;
+			len += sizeof("\r\n") - 1;
+		}
+	
+
+	
 		if (conf->restart_dir.data != NULL) {
 			len += sizeof("!~PASSENGER_RESTART_DIR: ") - 1;
 			len += conf->restart_dir.len;
@@ -332,6 +356,26 @@ int generated_cache_location_part(ngx_conf_t *cf, passenger_loc_conf_t *conf) {
 	
 
 	
+		if (conf->affinity_header.data != NULL) {
+			len += sizeof("!~PASSENGER_AFFINITY_HEADER: ") - 1;
+			len += conf->affinity_header.len;
+			len += sizeof("\r\n") - 1;
+		}
+	
+
+	
+		if (conf->affinity_path_segments != NGX_CONF_UNSET) {
+			end = ngx_snprintf(int_buf,
+				sizeof(int_buf) - 1,
+				"%d",
+				conf->affinity_path_segments);
+			len += sizeof("!~PASSENGER_AFFINITY_PATH_SEGMENTS: ") - 1;
+			len += end - int_buf;
+			len += sizeof("\r\n") - 1;
+		}
+	
+
+	
 		if (conf->vary_turbocache_by_cookie.data != NULL) {
 			len += sizeof("!~PASSENGER_VARY_TURBOCACHE_BY_COOKIE: ") - 1;
 			len += conf->vary_turbocache_by_cookie.len;
@@ -705,6 +749,34 @@ if (buf == NULL) {
 	
 
 	
+		if (conf->max_request_queue_time != NGX_CONF_UNSET) {
+			pos = ngx_copy(pos,
+				"!~PASSENGER_MAX_REQUEST_QUEUE_TIME: ",
+				sizeof("!~PASSENGER_MAX_REQUEST_QUEUE_TIME: ") - 1);
+			end = ngx_snprintf(int_buf,
+				sizeof(int_buf) - 1,
+				"%d",
+				conf->max_request_queue_time);
+			pos = ngx_copy(pos, int_buf, end - int_buf);
+			pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+		}
+	
+
+	
+		if (conf->request_priority != NGX_CONF_UNSET) {
+			pos = ngx_copy(pos,
+				"!~PASSENGER_REQUEST_PRIORITY: ",
+				sizeof("!~PASSENGER_REQUEST_PRIORITY: ") - 1);
+			end = ngx_snprintf(int_buf,
+				sizeof(int_buf) - 1,
+				"%d",
+				conf->request_priority);
+			pos = ngx_copy(pos, int_buf, end - int_buf);
+			pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+		}
+	
+
+	
 		if (conf->restart_dir.data != NULL) {
 			pos = ngx_copy(pos,
 				"!~PASSENGER_RESTART_DIR: ",
@@ -754,6 +826,32 @@ if (buf == NULL) {
 	
 
 	
+		if (conf->affinity_header.data != NULL) {
+			pos = ngx_copy(pos,
+				"!~PASSENGER_AFFINITY_HEADER: ",
+				sizeof("!~PASSENGER_AFFINITY_HEADER: ") - 1);
+			pos = ngx_copy(pos,
+				conf->affinity_header.data,
+				conf->affinity_header.len);
+			pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+		}
+	
+
+	
+		if (conf->affinity_path_segments != NGX_CONF_UNSET) {
+			pos = ngx_copy(pos,
+				"!~PASSENGER_AFFINITY_PATH_SEGMENTS: ",
+				sizeof("!~PASSENGER_AFFINITY_PATH_SEGMENTS: ") - 1);
+			end = ngx_snprintf(int_buf,
+				sizeof(int_buf) - 1,
+				"%d",
+				conf->affinity_path_segments);
+			pos = ngx_copy(pos, int_buf, end - int_buf);
+			pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+		}
+	
+
+	
 		if (conf->vary_turbocache_by_cookie.data != NULL) {
 			pos = ngx_copy(pos,
 				"!~PASSENGER_VARY_TURBOCACHE_BY_COOKIE: ",
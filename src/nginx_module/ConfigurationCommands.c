@@ -460,6 +460,26 @@
 	NULL
 },
 
+{
+	
+	ngx_string("passenger_max_request_queue_time"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(passenger_loc_conf_t, max_request_queue_time),
+	NULL
+},
+
+{
+	
+	ngx_string("passenger_request_priority"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(passenger_loc_conf_t, request_priority),
+	NULL
+},
+
 {
 	
 	ngx_string("passenger_restart_dir"),
@@ -510,6 +530,26 @@
 	NULL
 },
 
+{
+	
+	ngx_string("passenger_affinity_header"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_str_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(passenger_loc_conf_t, affinity_header),
+	NULL
+},
+
+{
+	
+	ngx_string("passenger_affinity_path_segments"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(passenger_loc_conf_t, affinity_path_segments),
+	NULL
+},
+
 {
 	
 	ngx_string("passenger_vary_turbocache_by_cookie"),
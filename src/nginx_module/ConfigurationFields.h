@@ -53,6 +53,8 @@
 
 	ngx_int_t abort_websockets_on_process_shutdown;
 
+	ngx_int_t affinity_path_segments;
+
 	ngx_uint_t app_file_descriptor_ulimit;
 
 	ngx_array_t *base_uris;
@@ -83,10 +85,14 @@
 
 	ngx_int_t max_request_queue_size;
 
+	ngx_int_t max_request_queue_time;
+
 	ngx_int_t max_requests;
 
 	ngx_int_t min_instances;
 
+	ngx_int_t request_priority;
+
 	ngx_int_t request_queue_overflow_status_code;
 
 	ngx_int_t socket_backlog;
@@ -99,6 +105,8 @@
 
 	ngx_int_t union_station_support;
 
+	ngx_str_t affinity_header;
+
 	ngx_str_t app_group_name;
 
 	ngx_str_t app_rights;
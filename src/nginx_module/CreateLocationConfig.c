@@ -187,6 +187,14 @@ void generated_set_conf_part(passenger_loc_conf_t  *conf) {
 	
 
 	
+		conf->max_request_queue_time = NGX_CONF_UNSET;
+	
+
+	
+		conf->request_priority = NGX_CONF_UNSET;
+	
+
+	
 		conf->restart_dir.data = NULL;
 		conf->restart_dir.len  = 0;
 	
@@ -211,6 +219,15 @@ void generated_set_conf_part(passenger_loc_conf_t  *conf) {
 	
 
 	
+		conf->affinity_header.data = NULL;
+		conf->affinity_header.len  = 0;
+	
+
+	
+		conf->affinity_path_segments = NGX_CONF_UNSET;
+	
+
+	
 		conf->vary_turbocache_by_cookie.data = NULL;
 		conf->vary_turbocache_by_cookie.len  = 0;
 	
@@ -247,6 +247,18 @@ int generated_merge_part(passenger_loc_conf_t *conf, passenger_loc_conf_t *prev,
 	
 
 	
+		ngx_conf_merge_value(conf->max_request_queue_time,
+			prev->max_request_queue_time,
+			NGX_CONF_UNSET);
+	
+
+	
+		ngx_conf_merge_value(conf->request_priority,
+			prev->request_priority,
+			NGX_CONF_UNSET);
+	
+
+	
 		ngx_conf_merge_str_value(conf->restart_dir,
 			prev->restart_dir,
 			NULL);
@@ -277,6 +289,18 @@ int generated_merge_part(passenger_loc_conf_t *conf, passenger_loc_conf_t *prev,
 	
 
 	
+		ngx_conf_merge_str_value(conf->affinity_header,
+			prev->affinity_header,
+			NULL);
+	
+
+	
+		ngx_conf_merge_value(conf->affinity_path_segments,
+			prev->affinity_path_segments,
+			NGX_CONF_UNSET);
+	
+
+	
 		ngx_conf_merge_str_value(conf->vary_turbocache_by_cookie,
 			prev->vary_turbocache_by_cookie,
 			NULL);
@@ -52,12 +52,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <limits.h>
 #include <grp.h>
 #include <signal.h>
+#include <time.h>
 #include <pthread.h>
 #ifdef HAVE_ALLOCA_H
 	#include <alloca.h>
@@ -78,6 +80,9 @@
 #ifndef RSTRING_LEN
 	#define RSTRING_LEN(str) RSTRING(str)->len
 #endif
+#ifndef RB_GC_GUARD
+	#define RB_GC_GUARD(v) (*(volatile VALUE *) &(v))
+#endif
 #if !defined(RUBY_UBF_IO) && defined(RB_UBF_DFL)
 	/* MacRuby compatibility */
 	#define RUBY_UBF_IO RB_UBF_DFL
@@ -146,6 +151,215 @@ split_by_null_into_hash(VALUE self, VALUE data) {
 	return result;
 }
 
+/* Header names that the Passenger Core sends in the session protocol, plus
+ * the most common HTTP headers. read_session_request() uses a shared, frozen
+ * string for these keys instead of allocating a new one for every request.
+ */
+static const char *known_session_header_names[] = {
+	"REQUEST_METHOD",
+	"REQUEST_URI",
+	"PATH_INFO",
+	"QUERY_STRING",
+	"SCRIPT_NAME",
+	"SERVER_NAME",
+	"SERVER_PORT",
+	"SERVER_PROTOCOL",
+	"SERVER_SOFTWARE",
+	"REMOTE_ADDR",
+	"REMOTE_PORT",
+	"REMOTE_USER",
+	"CONTENT_LENGTH",
+	"CONTENT_TYPE",
+	"TRANSFER_ENCODING",
+	"HTTPS",
+	"PASSENGER_CONNECT_PASSWORD",
+	"PASSENGER_TXN_ID",
+	"PASSENGER_DELTA_MONOTONIC",
+	"HTTP_HOST",
+	"HTTP_CONNECTION",
+	"HTTP_ACCEPT",
+	"HTTP_ACCEPT_CHARSET",
+	"HTTP_ACCEPT_ENCODING",
+	"HTTP_ACCEPT_LANGUAGE",
+	"HTTP_CACHE_CONTROL",
+	"HTTP_COOKIE",
+	"HTTP_IF_MODIFIED_SINCE",
+	"HTTP_IF_NONE_MATCH",
+	"HTTP_ORIGIN",
+	"HTTP_PRAGMA",
+	"HTTP_REFERER",
+	"HTTP_TRANSFER_ENCODING",
+	"HTTP_UPGRADE",
+	"HTTP_USER_AGENT",
+	"HTTP_VERSION",
+	"HTTP_X_FORWARDED_FOR",
+	"HTTP_X_FORWARDED_PROTO",
+	"HTTP_X_REAL_IP",
+	"HTTP_X_REQUESTED_WITH"
+};
+#define KNOWN_SESSION_HEADER_COUNT \
+	(sizeof(known_session_header_names) / sizeof(const char *))
+static VALUE known_session_header_keys[KNOWN_SESSION_HEADER_COUNT];
+static long known_session_header_lengths[KNOWN_SESSION_HEADER_COUNT];
+static unsigned int content_length_key_index;
+static unsigned int transfer_encoding_key_index;
+
+static void
+init_known_session_header_keys(void) {
+	unsigned int i;
+
+	for (i = 0; i < KNOWN_SESSION_HEADER_COUNT; i++) {
+		known_session_header_lengths[i] = (long) strlen(known_session_header_names[i]);
+		known_session_header_keys[i] = rb_str_new(known_session_header_names[i],
+			known_session_header_lengths[i]);
+		OBJ_FREEZE(known_session_header_keys[i]);
+		rb_global_variable(&known_session_header_keys[i]);
+		if (strcmp(known_session_header_names[i], "CONTENT_LENGTH") == 0) {
+			content_length_key_index = i;
+		} else if (strcmp(known_session_header_names[i], "TRANSFER_ENCODING") == 0) {
+			transfer_encoding_key_index = i;
+		}
+	}
+}
+
+/* Returns the index of the given header name in known_session_header_names,
+ * or -1 if it's not a known header.
+ */
+static int
+lookup_known_session_header(const char *name, long len) {
+	unsigned int i;
+
+	for (i = 0; i < KNOWN_SESSION_HEADER_COUNT; i++) {
+		if (known_session_header_lengths[i] == len
+		 && memcmp(known_session_header_names[i], name, len) == 0)
+		{
+			return (int) i;
+		}
+	}
+	return -1;
+}
+
+/* Reads exactly +size+ bytes from the given socket, yielding to other Ruby
+ * threads while no data is available. Returns the number of bytes read,
+ * which is less than +size+ only on EOF.
+ */
+static size_t
+read_exactly_from_socket(int fd, VALUE buffer, size_t offset, size_t size) {
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < size) {
+		#ifdef MSG_DONTWAIT
+			ret = recv(fd, RSTRING_PTR(buffer) + offset + done, size - done, MSG_DONTWAIT);
+		#else
+			rb_thread_wait_fd(fd);
+			ret = read(fd, RSTRING_PTR(buffer) + offset + done, size - done);
+		#endif
+		if (ret > 0) {
+			done += ret;
+		} else if (ret == 0) {
+			break;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			rb_thread_wait_fd(fd);
+		} else if (errno != EINTR) {
+			rb_sys_fail("Cannot read session request");
+		}
+	}
+	return done;
+}
+
+/**
+ * call-seq: read_session_request(fd, max_size)
+ *
+ * Reads a session protocol request header from the socket +fd+: a 32-bit
+ * big-endian size, followed by a block of NUL-terminated names and values.
+ * The header is parsed into a Rack env hash directly, without allocating
+ * intermediate strings. Keys of well-known headers are shared, frozen
+ * strings; other keys are frozen too, so that Hash#[]= doesn't have to
+ * copy them.
+ *
+ * Returns <tt>[headers, body_length]</tt>, where +body_length+ describes
+ * the request body framing: the value of CONTENT_LENGTH as an Integer, -1
+ * if the body is chunked (a TRANSFER_ENCODING header is present), or nil
+ * if the request has no body. Returns nil on EOF. Raises SecurityError if
+ * the header is larger than +max_size+.
+ *
+ * The socket must not have been read from through buffered Ruby IO, because
+ * this function reads from the file descriptor directly.
+ */
+static VALUE
+read_session_request(VALUE self, VALUE fd, VALUE max_size) {
+	int fd_num = NUM2INT(fd);
+	unsigned char size_buf[4];
+	VALUE buffer, result, key, value, body_length = Qnil;
+	const char *data, *current, *end, *key_begin, *value_begin;
+	unsigned long size;
+	int index;
+
+	buffer = rb_str_new(NULL, sizeof(size_buf));
+	if (read_exactly_from_socket(fd_num, buffer, 0, sizeof(size_buf)) < sizeof(size_buf)) {
+		return Qnil;
+	}
+	memcpy(size_buf, RSTRING_PTR(buffer), sizeof(size_buf));
+	size = ((unsigned long) size_buf[0] << 24)
+		| ((unsigned long) size_buf[1] << 16)
+		| ((unsigned long) size_buf[2] << 8)
+		| (unsigned long) size_buf[3];
+	if (!NIL_P(max_size) && size > NUM2ULONG(max_size)) {
+		rb_raise(rb_eSecurityError, "Scalar message size (%lu) exceeds maximum "
+			"allowed size (%lu).", size, NUM2ULONG(max_size));
+	}
+
+	rb_str_resize(buffer, (long) size);
+	if (read_exactly_from_socket(fd_num, buffer, 0, size) < size) {
+		return Qnil;
+	}
+
+	result  = rb_hash_new();
+	data    = RSTRING_PTR(buffer);
+	current = data;
+	end     = data + size;
+	while (current < end) {
+		key_begin = current;
+		current = memchr(current, '\0', end - current);
+		if (current == NULL) {
+			break;
+		}
+		value_begin = current + 1;
+		current = memchr(value_begin, '\0', end - value_begin);
+		if (current == NULL) {
+			break;
+		}
+
+		index = lookup_known_session_header(key_begin, value_begin - 1 - key_begin);
+		if (index >= 0) {
+			key = known_session_header_keys[index];
+		} else {
+			key = rb_str_new(key_begin, value_begin - 1 - key_begin);
+			OBJ_FREEZE(key);
+		}
+		value = rb_str_new(value_begin, current - value_begin);
+		rb_hash_aset(result, key, value);
+
+		if (index == (int) transfer_encoding_key_index) {
+			body_length = INT2NUM(-1);
+		} else if (index == (int) content_length_key_index && body_length != INT2NUM(-1)) {
+			const char *pos = value_begin;
+			unsigned long long length = 0;
+			while (pos < current && *pos >= '0' && *pos <= '9') {
+				length = length * 10 + (*pos - '0');
+				pos++;
+			}
+			body_length = ULL2NUM(length);
+		}
+
+		current++;
+	}
+
+	RB_GC_GUARD(buffer);
+	return rb_ary_new3(2, result, body_length);
+}
+
 typedef struct {
 	/* The IO vectors in this group. */
 	struct iovec *io_vectors;
@@ -218,6 +432,67 @@ update_group_written_info(IOVectorGroup *group, ssize_t bytes_written) {
 	#endif
 #endif
 
+/* Writes all data in the given IO vector groups to +fd_num+, performing one
+ * or more writev() calls per group. Yields to other Ruby threads while the
+ * file descriptor isn't writable.
+ */
+static void
+write_io_vector_groups(int fd_num, IOVectorGroup *groups, unsigned int ngroups) {
+	unsigned int i;
+	ssize_t ret;
+	int done, e;
+	#ifndef TRAP_BEG
+		WritevWrapperData writev_wrapper_data;
+	#endif
+
+	for (i = 0; i < ngroups; i++) {
+		/* Wait until the file descriptor becomes writable before writing things. */
+		rb_thread_fd_writable(fd_num);
+
+		done = 0;
+		while (!done) {
+			#ifdef TRAP_BEG
+				TRAP_BEG;
+				ret = writev(fd_num, groups[i].io_vectors, groups[i].count);
+				TRAP_END;
+			#else
+				writev_wrapper_data.filedes = fd_num;
+				writev_wrapper_data.iov     = groups[i].io_vectors;
+				writev_wrapper_data.iovcnt  = groups[i].count;
+				#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+					ret = (ssize_t) rb_thread_call_without_gvl(writev_wrapper,
+						&writev_wrapper_data, RUBY_UBF_IO, NULL);
+				#elif defined(HAVE_RB_THREAD_IO_BLOCKING_REGION)
+					ret = (ssize_t) rb_thread_io_blocking_region(writev_wrapper,
+						&writev_wrapper_data, fd_num);
+				#else
+					ret = (ssize_t) rb_thread_blocking_region(writev_wrapper,
+						&writev_wrapper_data, RUBY_UBF_IO, 0);
+				#endif
+			#endif
+			if (ret == -1) {
+				/* If the error is something like EAGAIN, yield to another
+				 * thread until the file descriptor becomes writable again.
+				 * In case of other errors, raise an exception.
+				 */
+				if (!rb_io_wait_writable(fd_num)) {
+					rb_sys_fail("writev()");
+				}
+			} else if (ret < groups[i].total_size) {
+				/* Not everything in this group has been written. Retry without
+				 * writing the bytes that been successfully written.
+				 */
+				e = errno;
+				update_group_written_info(&groups[i], ret);
+				errno = e;
+				rb_io_wait_writable(fd_num);
+			} else {
+				done = 1;
+			}
+		}
+	}
+}
+
 static VALUE
 f_generic_writev(VALUE fd, VALUE *array_of_components, unsigned int count) {
 	VALUE components, str;
@@ -225,11 +500,6 @@ f_generic_writev(VALUE fd, VALUE *array_of_components, unsigned int count) {
 	IOVectorGroup *groups;
 	unsigned int i, j, group_offset, vector_offset;
 	unsigned long long ssize_max;
-	ssize_t ret;
-	int done, fd_num, e;
-	#ifndef TRAP_BEG
-		WritevWrapperData writev_wrapper_data;
-	#endif
 
 	/* First determine the number of components that we have. */
 	total_components   = 0;
@@ -317,53 +587,7 @@ f_generic_writev(VALUE fd, VALUE *array_of_components, unsigned int count) {
 	}
 
 	/* Write the data. */
-	fd_num = NUM2INT(fd);
-	for (i = 0; i < ngroups; i++) {
-		/* Wait until the file descriptor becomes writable before writing things. */
-		rb_thread_fd_writable(fd_num);
-
-		done = 0;
-		while (!done) {
-			#ifdef TRAP_BEG
-				TRAP_BEG;
-				ret = writev(fd_num, groups[i].io_vectors, groups[i].count);
-				TRAP_END;
-			#else
-				writev_wrapper_data.filedes = fd_num;
-				writev_wrapper_data.iov     = groups[i].io_vectors;
-				writev_wrapper_data.iovcnt  = groups[i].count;
-				#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
-					ret = (ssize_t) rb_thread_call_without_gvl(writev_wrapper,
-						&writev_wrapper_data, RUBY_UBF_IO, NULL);
-				#elif defined(HAVE_RB_THREAD_IO_BLOCKING_REGION)
-					ret = (ssize_t) rb_thread_io_blocking_region(writev_wrapper,
-						&writev_wrapper_data, fd_num);
-				#else
-					ret = (ssize_t) rb_thread_blocking_region(writev_wrapper,
-						&writev_wrapper_data, RUBY_UBF_IO, 0);
-				#endif
-			#endif
-			if (ret == -1) {
-				/* If the error is something like EAGAIN, yield to another
-				 * thread until the file descriptor becomes writable again.
-				 * In case of other errors, raise an exception.
-				 */
-				if (!rb_io_wait_writable(fd_num)) {
-					rb_sys_fail("writev()");
-				}
-			} else if (ret < groups[i].total_size) {
-				/* Not everything in this group has been written. Retry without
-				 * writing the bytes that been successfully written.
-				 */
-				e = errno;
-				update_group_written_info(&groups[i], ret);
-				errno = e;
-				rb_io_wait_writable(fd_num);
-			} else {
-				done = 1;
-			}
-		}
-	}
+	write_io_vector_groups(NUM2INT(fd), groups, ngroups);
 	return INT2NUM(total_size);
 }
 
@@ -410,6 +634,383 @@ f_writev3(VALUE self, VALUE fd, VALUE components1, VALUE components2, VALUE comp
 	return f_generic_writev(fd, array_of_components, 3);
 }
 
+/* Status lines for the most common status codes, used when responding
+ * directly to an HTTP client. Behind the Passenger Core the reason phrase
+ * doesn't matter, because the Core generates its own.
+ */
+static const struct {
+	int code;
+	const char *line;
+} common_status_lines[] = {
+	{ 200, "HTTP/1.1 200 OK\r\n" },
+	{ 201, "HTTP/1.1 201 Created\r\n" },
+	{ 204, "HTTP/1.1 204 No Content\r\n" },
+	{ 301, "HTTP/1.1 301 Moved Permanently\r\n" },
+	{ 302, "HTTP/1.1 302 Found\r\n" },
+	{ 303, "HTTP/1.1 303 See Other\r\n" },
+	{ 304, "HTTP/1.1 304 Not Modified\r\n" },
+	{ 400, "HTTP/1.1 400 Bad Request\r\n" },
+	{ 401, "HTTP/1.1 401 Unauthorized\r\n" },
+	{ 403, "HTTP/1.1 403 Forbidden\r\n" },
+	{ 404, "HTTP/1.1 404 Not Found\r\n" },
+	{ 422, "HTTP/1.1 422 Unprocessable Entity\r\n" },
+	{ 500, "HTTP/1.1 500 Internal Server Error\r\n" },
+	{ 502, "HTTP/1.1 502 Bad Gateway\r\n" },
+	{ 503, "HTTP/1.1 503 Service Unavailable\r\n" }
+};
+#define COMMON_STATUS_LINE_COUNT \
+	(sizeof(common_status_lines) / sizeof(common_status_lines[0]))
+
+#define STATIC_STR_CAT(buffer, str) rb_str_buf_cat(buffer, str, sizeof(str) - 1)
+#define STATIC_STR_EQUALS_IGNORE_CASE(str, len, literal) \
+	((len) == sizeof(literal) - 1 && strncasecmp(str, literal, sizeof(literal) - 1) == 0)
+
+/* Values returned by write_rack_response(). The lower bits describe how the
+ * response body is framed, the RESPONSE_KEEPALIVE bit whether the connection
+ * may be kept alive.
+ */
+#define RESPONSE_NO_BODY         0
+#define RESPONSE_CONTENT_LENGTH  1
+#define RESPONSE_CHUNKED_BY_APP  2
+#define RESPONSE_NEEDS_CHUNKING  3
+#define RESPONSE_FRAMING_MASK    3
+#define RESPONSE_KEEPALIVE       4
+
+/* The number of IO vectors that write_rack_response() can handle without
+ * allocating memory.
+ */
+#define RESPONSE_STACK_IOVECS    64
+
+typedef struct {
+	/* The serialized response header. */
+	VALUE buffer;
+	/* The value of the Content-Length header, or Qnil. */
+	VALUE content_length;
+	int has_transfer_encoding;
+	int has_sendfile;
+	int has_date;
+} RackResponseHeader;
+
+static char   cached_date_header[64];
+static size_t cached_date_header_len = 0;
+static time_t cached_date_header_time = (time_t) -1;
+
+/* Appends a Date header for the current time. The header is formatted at
+ * most once per second. This function is only called while holding the GVL,
+ * so the cache needs no locking.
+ */
+static void
+append_date_header(VALUE buffer) {
+	time_t now = time(NULL);
+	struct tm the_tm;
+
+	if (now != cached_date_header_time) {
+		gmtime_r(&now, &the_tm);
+		cached_date_header_len = strftime(cached_date_header, sizeof(cached_date_header),
+			"Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &the_tm);
+		cached_date_header_time = now;
+	}
+	rb_str_buf_cat(buffer, cached_date_header, (long) cached_date_header_len);
+}
+
+/* rb_hash_foreach() callback which appends one Rack response header to the
+ * serialized header. Like the Ruby implementation, multiple values are
+ * separated by newlines, and each value becomes a separate header line.
+ */
+static int
+serialize_rack_response_header(VALUE key, VALUE value, VALUE arg) {
+	RackResponseHeader *header = (RackResponseHeader *) arg;
+	const char *name, *pos, *end, *line_end;
+	long name_len;
+
+	key = rb_obj_as_string(key);
+	name = RSTRING_PTR(key);
+	name_len = RSTRING_LEN(key);
+	if (name_len == sizeof("rack.hijack") - 1
+	 && memcmp(name, "rack.hijack", sizeof("rack.hijack") - 1) == 0)
+	{
+		return ST_CONTINUE;
+	}
+	if (NIL_P(value)) {
+		return ST_CONTINUE;
+	}
+
+	value = rb_obj_as_string(value);
+	if (STATIC_STR_EQUALS_IGNORE_CASE(name, name_len, "Content-Length")) {
+		header->content_length = value;
+	} else if (STATIC_STR_EQUALS_IGNORE_CASE(name, name_len, "Transfer-Encoding")) {
+		header->has_transfer_encoding = 1;
+	} else if (STATIC_STR_EQUALS_IGNORE_CASE(name, name_len, "X-Sendfile")
+		|| STATIC_STR_EQUALS_IGNORE_CASE(name, name_len, "X-Accel-Redirect"))
+	{
+		header->has_sendfile = 1;
+	} else if (STATIC_STR_EQUALS_IGNORE_CASE(name, name_len, "Date")) {
+		header->has_date = 1;
+	}
+
+	/* String#split drops trailing empty values, so we do too. */
+	pos = RSTRING_PTR(value);
+	end = pos + RSTRING_LEN(value);
+	while (end > pos && end[-1] == '\n') {
+		end--;
+	}
+	while (pos < end) {
+		line_end = memchr(pos, '\n', end - pos);
+		if (line_end == NULL) {
+			line_end = end;
+		}
+		rb_str_buf_cat(header->buffer, name, name_len);
+		STATIC_STR_CAT(header->buffer, ": ");
+		rb_str_buf_cat(header->buffer, pos, line_end - pos);
+		STATIC_STR_CAT(header->buffer, "\r\n");
+		pos = line_end + 1;
+	}
+
+	RB_GC_GUARD(key);
+	RB_GC_GUARD(value);
+	return ST_CONTINUE;
+}
+
+static int
+status_code_allows_body(int status) {
+	return status < 100 || (status >= 200 && status != 204 && status != 304);
+}
+
+/**
+ * call-seq: write_rack_response(fd, status, headers, body, keepalive, output_body, full_http_response)
+ *
+ * Serializes the HTTP response header for the given Rack +status+ and
+ * +headers+ Hash, and writes it to +fd+, followed by the +body+ Array (if
+ * not nil and +output_body+ is true), in a single +writev()+ call.
+ * The header is serialized into one buffer, without allocating a string per
+ * header line. A Content-Length or Transfer-Encoding header is added if the
+ * app set neither. Pass nil as +body+ if the body is not an Array; the caller
+ * must then write the body itself, according to the returned framing.
+ *
+ * If +full_http_response+ is true, the response goes to an HTTP client
+ * directly instead of to the Passenger Core, so the status line gets a proper
+ * reason phrase and a (cached) Date header is added unless the app set one.
+ *
+ * +keepalive+ is whether the connection may be kept alive as far as the
+ * request is concerned. This function turns it off if it cannot verify that
+ * the body matches the header.
+ *
+ * Returns one of the RESPONSE_NO_BODY, RESPONSE_CONTENT_LENGTH,
+ * RESPONSE_CHUNKED_BY_APP and RESPONSE_NEEDS_CHUNKING constants, OR-ed with
+ * RESPONSE_KEEPALIVE if the connection may be kept alive. Raises a
+ * RuntimeError, without writing anything, if the headers conflict or if the
+ * body doesn't match the Content-Length header.
+ */
+static VALUE
+write_rack_response(VALUE self, VALUE fd, VALUE status, VALUE headers, VALUE body,
+	VALUE keepalive, VALUE output_body, VALUE full_http_response)
+{
+	RackResponseHeader header;
+	struct iovec stack_iovecs[RESPONSE_STACK_IOVECS];
+	struct iovec *iovecs;
+	IOVectorGroup *groups;
+	VALUE part, converted_parts = Qnil, iovecs_storage = Qnil;
+	int status_code, can_keepalive, should_output_body, framing;
+	long i, nparts, niovecs, body_size = 0;
+	unsigned long long total_size;
+	unsigned int ngroups, iov_max = (unsigned int) IOV_MAX;
+	char status_line[64];
+
+	Check_Type(headers, T_HASH);
+	if (!NIL_P(body)) {
+		Check_Type(body, T_ARRAY);
+	}
+	status_code = NUM2INT(status);
+	can_keepalive = RTEST(keepalive);
+	should_output_body = RTEST(output_body);
+	nparts = NIL_P(body) ? 0 : RARRAY_LEN(body);
+
+	/* Serialize the header. */
+	header.buffer = rb_str_buf_new(1024);
+	header.content_length = Qnil;
+	header.has_transfer_encoding = 0;
+	header.has_sendfile = 0;
+	header.has_date = 0;
+	i = 0;
+	if (RTEST(full_http_response)) {
+		while (i < (long) COMMON_STATUS_LINE_COUNT
+		 && common_status_lines[i].code != status_code)
+		{
+			i++;
+		}
+	} else {
+		i = COMMON_STATUS_LINE_COUNT;
+	}
+	if (i < (long) COMMON_STATUS_LINE_COUNT) {
+		rb_str_buf_cat2(header.buffer, common_status_lines[i].line);
+	} else {
+		snprintf(status_line, sizeof(status_line), "HTTP/1.1 %d Whatever\r\n", status_code);
+		rb_str_buf_cat2(header.buffer, status_line);
+	}
+	rb_hash_foreach(headers, serialize_rack_response_header, (VALUE) &header);
+	if (!header.has_date && RTEST(full_http_response)) {
+		append_date_header(header.buffer);
+	}
+
+	/* Rack requires body parts to be Strings, but be lenient like #writev. */
+	for (i = 0; i < nparts; i++) {
+		part = rb_ary_entry(body, i);
+		if (TYPE(part) != T_STRING) {
+			if (NIL_P(converted_parts)) {
+				converted_parts = rb_ary_dup(body);
+			}
+			part = rb_obj_as_string(part);
+			rb_ary_store(converted_parts, i, part);
+		}
+		body_size += RSTRING_LEN(part);
+	}
+	if (!NIL_P(converted_parts)) {
+		body = converted_parts;
+	}
+
+	/* Determine the message length, the same way as
+	 * Rack::ThreadHandlerExtension#write_response_in_ruby.
+	 */
+	if (!NIL_P(header.content_length)) {
+		framing = RESPONSE_CONTENT_LENGTH;
+		if (header.has_transfer_encoding) {
+			rb_raise(rb_eRuntimeError, "Response object may not contain both "
+				"Content-Length and Transfer-Encoding");
+		}
+		if (should_output_body) {
+			if (NIL_P(body) || header.has_sendfile) {
+				/* The Core ignores the body if X-Sendfile or
+				 * X-Accel-Redirect is set, so don't check its size.
+				 */
+				can_keepalive = 0;
+			} else {
+				VALUE content_length = rb_str_to_inum(header.content_length, 10, 0);
+				if (NUM2LL(content_length) != (long long) body_size) {
+					rb_raise(rb_eRuntimeError, "Response body size doesn't match "
+						"Content-Length header: %ld vs %lld", body_size,
+						NUM2LL(content_length));
+				}
+			}
+		}
+	} else if (header.has_transfer_encoding) {
+		/* We assume that the app has already chunked the body. We can't
+		 * verify that, so don't keep-alive the connection.
+		 */
+		framing = RESPONSE_CHUNKED_BY_APP;
+		if (should_output_body) {
+			can_keepalive = 0;
+		}
+	} else if (status_code_allows_body(status_code)) {
+		if (!NIL_P(body)) {
+			framing = RESPONSE_CONTENT_LENGTH;
+			snprintf(status_line, sizeof(status_line), "Content-Length: %ld\r\n", body_size);
+			rb_str_buf_cat2(header.buffer, status_line);
+		} else {
+			framing = RESPONSE_NEEDS_CHUNKING;
+			STATIC_STR_CAT(header.buffer, "Transfer-Encoding: chunked\r\n");
+		}
+	} else {
+		framing = RESPONSE_NO_BODY;
+	}
+	if (can_keepalive) {
+		STATIC_STR_CAT(header.buffer, "\r\n");
+	} else {
+		STATIC_STR_CAT(header.buffer, "Connection: close\r\n\r\n");
+	}
+
+	/* Gather the header and the body into IO vectors. */
+	if (!should_output_body) {
+		nparts = 0;
+	}
+	if (nparts + 1 <= RESPONSE_STACK_IOVECS) {
+		iovecs = stack_iovecs;
+	} else {
+		iovecs_storage = rb_str_new(NULL, (nparts + 1) * sizeof(struct iovec));
+		iovecs = (struct iovec *) RSTRING_PTR(iovecs_storage);
+	}
+	iovecs[0].iov_base = RSTRING_PTR(header.buffer);
+	iovecs[0].iov_len  = RSTRING_LEN(header.buffer);
+	total_size = RSTRING_LEN(header.buffer);
+	niovecs = 1;
+	for (i = 0; i < nparts; i++) {
+		part = rb_ary_entry(body, i);
+		if (RSTRING_LEN(part) > 0) {
+			iovecs[niovecs].iov_base = RSTRING_PTR(part);
+			iovecs[niovecs].iov_len  = RSTRING_LEN(part);
+			total_size += RSTRING_LEN(part);
+			niovecs++;
+		}
+	}
+	if (total_size > (unsigned long long) SSIZE_MAX) {
+		rb_raise(rb_eArgError, "The response may not be larger than SSIZE_MAX.");
+	}
+
+	/* Write everything, in IOV_MAX-sized groups. Normally that's a single
+	 * writev() call.
+	 */
+	ngroups = (unsigned int) ((niovecs + iov_max - 1) / iov_max);
+	groups = alloca(ngroups * sizeof(IOVectorGroup));
+	if (groups == NULL) {
+		rb_raise(rb_eNoMemError, "Insufficient stack space.");
+	}
+	for (i = 0; i < (long) ngroups; i++) {
+		unsigned int j;
+
+		groups[i].io_vectors = iovecs + i * iov_max;
+		groups[i].count = (unsigned int) MIN((unsigned long) iov_max,
+			(unsigned long) (niovecs - i * iov_max));
+		groups[i].total_size = 0;
+		for (j = 0; j < groups[i].count; j++) {
+			groups[i].total_size += groups[i].io_vectors[j].iov_len;
+		}
+	}
+	write_io_vector_groups(NUM2INT(fd), groups, ngroups);
+
+	RB_GC_GUARD(header.buffer);
+	RB_GC_GUARD(header.content_length);
+	RB_GC_GUARD(body);
+	RB_GC_GUARD(converted_parts);
+	RB_GC_GUARD(iovecs_storage);
+	if (can_keepalive) {
+		framing |= RESPONSE_KEEPALIVE;
+	}
+	return INT2NUM(framing);
+}
+
+/**
+ * call-seq: write_chunk(fd, data)
+ *
+ * Writes +data+ to +fd+ as a single chunk of a chunked transfer encoded
+ * body, in a single +writev()+ call. Does nothing if +data+ is empty,
+ * because an empty chunk terminates the body.
+ */
+static VALUE
+write_chunk(VALUE self, VALUE fd, VALUE data) {
+	char size_line[sizeof(long) * 2 + 3];
+	struct iovec iovecs[3];
+	IOVectorGroup group;
+	int size_line_len;
+
+	StringValue(data);
+	if (RSTRING_LEN(data) == 0) {
+		return INT2NUM(0);
+	}
+	size_line_len = snprintf(size_line, sizeof(size_line), "%lx\r\n",
+		(unsigned long) RSTRING_LEN(data));
+	iovecs[0].iov_base = size_line;
+	iovecs[0].iov_len  = size_line_len;
+	iovecs[1].iov_base = RSTRING_PTR(data);
+	iovecs[1].iov_len  = RSTRING_LEN(data);
+	iovecs[2].iov_base = (char *) "\r\n";
+	iovecs[2].iov_len  = 2;
+	group.io_vectors = iovecs;
+	group.count      = 3;
+	group.total_size = size_line_len + RSTRING_LEN(data) + 2;
+	write_io_vector_groups(NUM2INT(fd), &group, 1);
+	RB_GC_GUARD(data);
+	return INT2NUM(group.total_size);
+}
+
 static VALUE
 process_times(VALUE self) {
 	struct rusage usage;
@@ -974,12 +1575,16 @@ Init_passenger_native_support() {
 	mNativeSupport = rb_define_module_under(mPassenger, "NativeSupport");
 
 	S_ProcessTimes = rb_struct_define("ProcessTimes", "utime", "stime", NULL);
+	init_known_session_header_keys();
 
 	rb_define_singleton_method(mNativeSupport, "disable_stdio_buffering", disable_stdio_buffering, 0);
 	rb_define_singleton_method(mNativeSupport, "split_by_null_into_hash", split_by_null_into_hash, 1);
+	rb_define_singleton_method(mNativeSupport, "read_session_request", read_session_request, 2);
 	rb_define_singleton_method(mNativeSupport, "writev", f_writev, 2);
 	rb_define_singleton_method(mNativeSupport, "writev2", f_writev2, 3);
 	rb_define_singleton_method(mNativeSupport, "writev3", f_writev3, 4);
+	rb_define_singleton_method(mNativeSupport, "write_rack_response", write_rack_response, 7);
+	rb_define_singleton_method(mNativeSupport, "write_chunk", write_chunk, 2);
 	rb_define_singleton_method(mNativeSupport, "process_times", process_times, 0);
 	rb_define_singleton_method(mNativeSupport, "detach_process", detach_process, 1);
 	rb_define_singleton_method(mNativeSupport, "freeze_process", freeze_process, 0);
@@ -999,4 +1604,11 @@ Init_passenger_native_support() {
 	rb_define_const(mNativeSupport, "UNIX_PATH_MAX", INT2NUM(sizeof(addr.sun_path)));
 	/* The maximum size of the data that may be passed to #writev. */
 	rb_define_const(mNativeSupport, "SSIZE_MAX", LL2NUM(SSIZE_MAX));
+	/* Return values of #write_rack_response. */
+	rb_define_const(mNativeSupport, "RESPONSE_NO_BODY", INT2NUM(RESPONSE_NO_BODY));
+	rb_define_const(mNativeSupport, "RESPONSE_CONTENT_LENGTH", INT2NUM(RESPONSE_CONTENT_LENGTH));
+	rb_define_const(mNativeSupport, "RESPONSE_CHUNKED_BY_APP", INT2NUM(RESPONSE_CHUNKED_BY_APP));
+	rb_define_const(mNativeSupport, "RESPONSE_NEEDS_CHUNKING", INT2NUM(RESPONSE_NEEDS_CHUNKING));
+	rb_define_const(mNativeSupport, "RESPONSE_FRAMING_MASK", INT2NUM(RESPONSE_FRAMING_MASK));
+	rb_define_const(mNativeSupport, "RESPONSE_KEEPALIVE", INT2NUM(RESPONSE_KEEPALIVE));
 }
@@ -315,6 +315,10 @@ def locate_source_file(path)
     :source   => 'ServerKit/Implementation.cpp',
     :category => :other,
     :optimize => true
+  define_component 'ServerKit/HttpHeaderScanner.o',
+    :source   => 'ServerKit/HttpHeaderScanner.cpp',
+    :category => :other,
+    :optimize => :very_heavy
   define_component 'DataStructures/LString.o',
     :source   => 'DataStructures/LString.cpp',
     :category => :other
@@ -84,13 +84,9 @@ def self.create_option_parser(options)
             options[:app_group_name] = value
           end
           opts.on("--rolling-restart", "Perform a rolling restart instead of a#{nl}" +
-            "regular restart (Enterprise only). The#{nl}" +
-            "default is a blocking restart") do |value|
-            if Config::Utils.is_enterprise?
-              options[:rolling_restart] = true
-            else
-              abort "--rolling-restart is only available in #{PROGRAM_NAME} Enterprise: #{ENTERPRISE_URL}"
-            end
+            "regular restart. The default is a#{nl}" +
+            "blocking restart") do |value|
+            options[:rolling_restart] = true
           end
           opts.on("--ignore-app-not-running", "Exit successfully if the specified#{nl}" +
             "application is not currently running. The#{nl}" +
@@ -297,6 +297,14 @@
     :name  => 'passenger_request_queue_overflow_status_code',
     :type  => :integer
   },
+  {
+    :name  => 'passenger_max_request_queue_time',
+    :type  => :integer
+  },
+  {
+    :name  => 'passenger_request_priority',
+    :type  => :integer
+  },
   {
     :name  => 'passenger_restart_dir',
     :type  => :string
@@ -318,6 +326,14 @@
     :name   => 'passenger_sticky_sessions_cookie_name',
     :type   => :string
   },
+  {
+    :name   => 'passenger_affinity_header',
+    :type   => :string
+  },
+  {
+    :name   => 'passenger_affinity_path_segments',
+    :type   => :integer
+  },
   {
     :name   => 'passenger_vary_turbocache_by_cookie',
     :type   => :string
@@ -60,12 +60,18 @@ def accept_and_process_next_client(server_socket)
       if command !~ /\n\Z/
         STDERR.puts "Command must end with a newline"
       elsif command == "spawn\n"
-        while client.readline != "\n"
-          # Do nothing.
+        spawn_options = {}
+        while (line = client.readline) != "\n"
+          key, value = line.chomp.split(': ', 2)
+          spawn_options[key] = value
         end
 
-        # Improve copy-on-write friendliness.
-        GC.start
+        if spawn_options['preloader_warmup'] == 'true' && !@warmed_up
+          warmup
+        else
+          # Improve copy-on-write friendliness.
+          GC.start
+        end
 
         pid = fork
         if pid.nil?
@@ -95,6 +101,49 @@ def accept_and_process_next_client(server_socket)
       end
     end
 
+    # Prepares the preloader's memory for being shared with the processes
+    # that it's about to fork: gives the application a chance to load lazily
+    # initialized data through the `preloader_warmup` event, then collects
+    # garbage and compacts the heap so that live objects are packed into as
+    # few pages as possible. Objects that are moved or marked after forking
+    # cause copy-on-write faults, so this is done only once, before the
+    # first fork.
+    def warmup
+      @warmed_up = true
+      start_time = Time.now
+      private_before = private_memory_kb
+      PhusionPassenger.call_event(:preloader_warmup)
+      GC.start
+      GC.compact if GC.respond_to?(:compact)
+      private_after = private_memory_kb
+      if private_before && private_after
+        STDERR.puts "Preloader warmed up in #{((Time.now - start_time) * 1000).to_i} ms; " +
+          "private memory: #{private_before / 1024} MB before, #{private_after / 1024} MB after"
+      else
+        STDERR.puts "Preloader warmed up in #{((Time.now - start_time) * 1000).to_i} ms"
+      end
+      STDERR.flush
+    end
+
+    def private_memory_kb
+      ['/proc/self/smaps_rollup', '/proc/self/smaps'].each do |filename|
+        begin
+          result = 0
+          File.open(filename, 'rb') do |f|
+            f.each_line do |line|
+              if line =~ /\APrivate_(Clean|Dirty):\s+(\d+)/
+                result += $2.to_i
+              end
+            end
+          end
+          return result
+        rescue SystemCallError
+          # Try the next file.
+        end
+      end
+      return nil
+    end
+
     def run_main_loop(options)
       $0 = "Passenger AppPreloader: #{options['app_root']}"
       client = nil
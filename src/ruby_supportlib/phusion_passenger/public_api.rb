@@ -30,6 +30,7 @@ class << self
     @@event_credentials = []
     @@event_after_installing_signal_handlers = []
     @@event_oob_work = []
+    @@event_preloader_warmup = []
     @@advertised_concurrency_level = nil
     @@union_station_key = nil
 
@@ -86,6 +87,8 @@ def callback_list_for_event(name)
         @@event_after_installing_signal_handlers
       when :oob_work
         @@event_oob_work
+      when :preloader_warmup
+        @@event_preloader_warmup
       else
         raise ArgumentError, "Unknown event name '#{name}'"
       end
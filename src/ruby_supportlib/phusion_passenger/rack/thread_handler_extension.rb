@@ -23,6 +23,7 @@
 #  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 #  THE SOFTWARE.
 
+PhusionPassenger.require_passenger_lib 'native_support'
 PhusionPassenger.require_passenger_lib 'utils/tee_input'
 
 module PhusionPassenger
@@ -65,6 +66,8 @@ module ThreadHandlerExtension
       STATUS         = "Status: "         # :nodoc:
       NAME_VALUE_SEPARATOR = ": "         # :nodoc:
       TERMINATION_CHUNK    = "0\r\n\r\n"  # :nodoc:
+      NATIVE_RESPONSE_WRITER = defined?(NativeSupport) &&
+        NativeSupport.respond_to?(:write_rack_response) # :nodoc:
 
       def process_request(env, connection, socket_wrapper, full_http_response)
         rewindable_input = PhusionPassenger::Utils::TeeInput.new(connection, env)
@@ -144,7 +147,7 @@ def process_request(env, connection, socket_wrapper, full_http_response)
 
           begin
             process_body(env, connection, socket_wrapper, status.to_i, is_head_request,
-              headers, body)
+              headers, body, full_http_response)
           rescue => e
             if !should_swallow_app_error?(e, socket_wrapper)
               print_exception("Rack response body object", e)
@@ -160,7 +163,8 @@ def process_request(env, connection, socket_wrapper, full_http_response)
       end
 
     private
-      def process_body(env, connection, socket_wrapper, status, is_head_request, headers, body)
+      def process_body(env, connection, socket_wrapper, status, is_head_request, headers, body,
+          full_http_response = false)
         if @ush_reporter
           ush_log_id = @ush_reporter.log_writing_rack_body_begin
         end
@@ -180,10 +184,50 @@ def process_body(env, connection, socket_wrapper, status, is_head_request, heade
           body = body.to_a
         end
 
+        if NATIVE_RESPONSE_WRITER && headers.is_a?(Hash)
+          write_response_natively(connection, status, headers, body, output_body,
+            full_http_response)
+        else
+          write_response_in_ruby(connection, status, headers, body, output_body)
+        end
+
+        signal_keep_alive_allowed!
+      ensure
+        if @ush_reporter && ush_log_id
+          @ush_reporter.log_writing_rack_body_end(ush_log_id)
+        end
+      end
+
+      # Writes the response header and body. The native extension's
+      # #write_rack_response serializes the header in C and writes it together
+      # with an Array body in a single system call. It implements the same
+      # message length logic as #write_response_in_ruby.
+      def write_response_natively(connection, status, headers, body, output_body,
+          full_http_response = false)
+        body_array = body.is_a?(Array) ? body : nil
+        result = NativeSupport.write_rack_response(connection.fileno, status,
+          headers, body_array, @can_keepalive, output_body, full_http_response)
+        @can_keepalive = (result & NativeSupport::RESPONSE_KEEPALIVE) != 0
+        if output_body && !body_array
+          case result & NativeSupport::RESPONSE_FRAMING_MASK
+          when NativeSupport::RESPONSE_CONTENT_LENGTH, NativeSupport::RESPONSE_CHUNKED_BY_APP
+            body.each do |part|
+              connection.write(part.to_s)
+            end
+          when NativeSupport::RESPONSE_NEEDS_CHUNKING
+            fd = connection.fileno
+            body.each do |part|
+              NativeSupport.write_chunk(fd, part.to_s)
+            end
+            connection.write(TERMINATION_CHUNK)
+          end
+        end
+      end
+
+      def write_response_in_ruby(connection, status, headers, body, output_body)
         # Generate preliminary headers and determine whether we need to output a body.
         headers_output = generate_headers_array(status, headers)
 
-
         # Determine how big the body is, determine whether we should try to keep-alive
         # the connection, and fix up the headers according to the situation.
         #
@@ -269,7 +313,6 @@ def process_body(env, connection, socket_wrapper, status, is_head_request, heade
           headers_output << CONNECTION_CLOSE_CRLF2
         end
 
-
         # If this is a request without body, write out headers without body.
         if !output_body
           connection.writev(headers_output)
@@ -301,12 +344,6 @@ def process_body(env, connection, socket_wrapper, status, is_head_request, heade
             connection.write(TERMINATION_CHUNK)
           end
         end
-
-        signal_keep_alive_allowed!
-      ensure
-        if @ush_reporter && ush_log_id
-          @ush_reporter.log_writing_rack_body_end(ush_log_id)
-        end
       end
 
       def close_body(body, env, socket_wrapper)
@@ -46,7 +46,6 @@ class Interrupted < StandardError
       OOBW           = 'OOBW'.freeze
       PASSENGER_CONNECT_PASSWORD  = 'PASSENGER_CONNECT_PASSWORD'.freeze
       CONTENT_LENGTH = 'CONTENT_LENGTH'.freeze
-      TRANSFER_ENCODING = 'TRANSFER_ENCODING'.freeze
 
       MAX_HEADER_SIZE = 128 * 1024
 
@@ -143,7 +142,7 @@ def accept_and_process_next_request(socket_wrapper, channel, buffer)
         if !headers
           # New socket accepted, instead of keeping-alive an old one
           channel.io = connection
-          headers = parse_request(connection, channel, buffer)
+          headers = parse_request(connection, channel, buffer, true)
         end
         if headers
           prepare_request(connection, headers)
@@ -216,12 +215,23 @@ def accept_and_process_next_request(socket_wrapper, channel, buffer)
         end
       end
 
-      def parse_session_request(connection, channel, buffer)
-        headers_data = channel.read_scalar(buffer, MAX_HEADER_SIZE)
-        if headers_data.nil?
-          return
+      def parse_session_request(connection, channel, buffer, new_connection = false)
+        if new_connection
+          # Nothing has been read from a new connection yet, so we can
+          # read and parse the header natively, straight from the socket.
+          headers, @request_body_length = Utils::NativeSupportUtils.
+            read_session_request(connection, MAX_HEADER_SIZE)
+          if headers.nil?
+            return
+          end
+        else
+          headers_data = channel.read_scalar(buffer, MAX_HEADER_SIZE)
+          if headers_data.nil?
+            return
+          end
+          headers = Utils::NativeSupportUtils.split_by_null_into_hash(headers_data)
+          @request_body_length = Utils::NativeSupportUtils.request_body_length(headers)
         end
-        headers = Utils::NativeSupportUtils.split_by_null_into_hash(headers_data)
         if @connect_password && headers[PASSENGER_CONNECT_PASSWORD] != @connect_password
           warn "*** Passenger RequestHandler warning: " <<
             "someone tried to connect with an invalid connect password."
@@ -238,7 +248,7 @@ def parse_session_request(connection, channel, buffer)
       # Like parse_session_request, but parses an HTTP request. This is a very minimalistic
       # HTTP parser and is not intended to be complete, fast or secure, since the HTTP server
       # socket is intended to be used for debugging purposes only.
-      def parse_http_request(connection, channel, buffer)
+      def parse_http_request(connection, channel, buffer, new_connection = false)
         headers = {}
 
         data = ""
@@ -285,6 +295,7 @@ def parse_http_request(connection, channel, buffer)
           end
         end
 
+        @request_body_length = Utils::NativeSupportUtils.request_body_length(headers)
         if @connect_password && headers["HTTP_X_PASSENGER_CONNECT_PASSWORD"] != @connect_password
           warn "*** Passenger RequestHandler warning: " <<
             "someone tried to connect with an invalid connect password."
@@ -310,14 +321,11 @@ def process_oobw(env, connection)
     # end
 
       def prepare_request(connection, headers)
-        transfer_encoding = headers[TRANSFER_ENCODING]
-        content_length = headers[CONTENT_LENGTH]
-        @can_keepalive = @keepalive_enabled &&
-          !transfer_encoding &&
-          !content_length
+        # @request_body_length was set by parse_request.
+        @can_keepalive = @keepalive_enabled && @request_body_length.nil?
         @keepalive_performed = false
 
-        if !transfer_encoding && !content_length
+        if @request_body_length.nil?
           connection.simulate_eof!
         end
 
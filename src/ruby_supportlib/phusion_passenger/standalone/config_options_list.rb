@@ -374,7 +374,7 @@ module Standalone
       {
         :name      => :rolling_restarts,
         :type      => :boolean,
-        :desc      => "Enable rolling restarts (Enterprise only)"
+        :desc      => "Enable rolling restarts"
       },
       {
         :name      => :resist_deployment_errors,
@@ -23,6 +23,7 @@
 #  THE SOFTWARE.
 
 PhusionPassenger.require_passenger_lib 'native_support'
+PhusionPassenger.require_passenger_lib 'message_channel'
 
 module PhusionPassenger
   module Utils
@@ -31,6 +32,22 @@ module Utils
     module NativeSupportUtils
       extend self
 
+      CONTENT_LENGTH    = 'CONTENT_LENGTH'.freeze
+      TRANSFER_ENCODING = 'TRANSFER_ENCODING'.freeze
+
+      # Describes the request body framing of the given request headers:
+      # the content length as an Integer, -1 if the body is chunked, or nil
+      # if the request has no body.
+      def request_body_length(headers)
+        if headers[TRANSFER_ENCODING]
+          return -1
+        elsif content_length = headers[CONTENT_LENGTH]
+          return content_length.to_i
+        else
+          return nil
+        end
+      end
+
       if defined?(PhusionPassenger::NativeSupport)
         # Split the given string into an hash. Keys and values are obtained by splitting the
         # string using the null character as the delimitor.
@@ -60,6 +77,28 @@ def process_times
             (times.stime * 1_000_000).to_i)
         end
       end
+
+      if defined?(PhusionPassenger::NativeSupport) &&
+         PhusionPassenger::NativeSupport.respond_to?(:read_session_request)
+        # Reads a session protocol request header from +io+ and parses it into
+        # a Rack env hash. Returns <tt>[headers, request_body_length]</tt>, or
+        # nil on EOF. Nothing may have been read from +io+ through buffered
+        # IO yet, because the native implementation reads from the file
+        # descriptor directly.
+        def read_session_request(io, max_size)
+          return PhusionPassenger::NativeSupport.read_session_request(io.fileno, max_size)
+        end
+      else
+        def read_session_request(io, max_size)
+          headers_data = MessageChannel.new(io).read_scalar('', max_size)
+          if headers_data
+            headers = split_by_null_into_hash(headers_data)
+            return [headers, request_body_length(headers)]
+          else
+            return nil
+          end
+        end
+      end
     end
 
   end # module Utils
@@ -0,0 +1,168 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * Measures the throughput with which FdSourceChannel reads a large transfer
+ * (such as a large app response) from a Unix domain socket, with single-buffer
+ * reads (maxScatterBuffers = 1) and with scatter reads of up to 2, 4 and 8
+ * mbufs per readv(). A writer thread sends the data; the data callback
+ * consumes it immediately.
+ *
+ * Run with `rake benchmark:fd_source_channel`. The first argument is the
+ * number of MB to transfer per run (default: 512).
+ */
+
+#include <boost/cstdint.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <cerrno>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <ev.h>
+
+#include <ServerKit/Context.h>
+#include <ServerKit/FdSourceChannel.h>
+
+using namespace std;
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+
+namespace {
+
+struct Transfer {
+	int fd;
+	boost::uint64_t size;
+};
+
+static struct ev_loop *loop;
+static boost::uint64_t bytesReceived;
+
+static unsigned long long
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *
+writerMain(void *arg) {
+	Transfer *transfer = (Transfer *) arg;
+	char buf[64 * 1024];
+	boost::uint64_t remaining = transfer->size;
+
+	memset(buf, 'x', sizeof(buf));
+	while (remaining > 0) {
+		size_t size = (size_t) std::min<boost::uint64_t>(remaining, sizeof(buf));
+		ssize_t ret = write(transfer->fd, buf, size);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("write");
+			abort();
+		}
+		remaining -= ret;
+	}
+	close(transfer->fd);
+	return NULL;
+}
+
+static Channel::Result
+onData(Channel *channel, const MemoryKit::mbuf &buffer, int errcode) {
+	if (errcode != 0) {
+		fprintf(stderr, "read error: %s\n", strerror(errcode));
+		abort();
+	} else if (buffer.empty()) {
+		ev_break(loop, EVBREAK_ALL);
+	} else {
+		bytesReceived += buffer.size();
+	}
+	return Channel::Result(buffer.size(), false);
+}
+
+static void
+benchmarkTransfer(unsigned int maxScatterBuffers, boost::uint64_t size) {
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		perror("socketpair");
+		abort();
+	}
+	setNonBlocking(fds[0]);
+
+	// The Context's SafeLibev takes ownership of the loop.
+	loop = ev_loop_new(EVFLAG_AUTO);
+	Context context(loop);
+	context.defaultFdSourceChannelConfig.maxScatterBuffers = maxScatterBuffers;
+	FdSourceChannel channel(&context);
+	channel.setDataCallback(onData);
+	channel.reinitialize(fds[0]);
+	bytesReceived = 0;
+
+	Transfer transfer;
+	transfer.fd = fds[1];
+	transfer.size = size;
+	pthread_t writer;
+
+	unsigned long long start = now();
+	pthread_create(&writer, NULL, writerMain, &transfer);
+	channel.startReading();
+	ev_run(loop, 0);
+	unsigned long long elapsed = now() - start;
+	pthread_join(writer, NULL);
+
+	if (bytesReceived != size) {
+		fprintf(stderr, "received %llu bytes instead of %llu\n",
+			(unsigned long long) bytesReceived, (unsigned long long) size);
+		abort();
+	}
+	printf("maxScatterBuffers = %u: %8.1f MB/s, %8u read calls\n",
+		maxScatterBuffers,
+		(double) size / 1024 / 1024 / ((double) elapsed / 1000000000),
+		channel.getReadCalls());
+
+	channel.deinitialize();
+	close(fds[0]);
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char *argv[]) {
+	boost::uint64_t size = 512;
+	if (argc > 1) {
+		size = (boost::uint64_t) atoi(argv[1]);
+	}
+	size *= 1024 * 1024;
+
+	for (unsigned int i = 1; i <= FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS; i *= 2) {
+		benchmarkTransfer(i, size);
+	}
+	return 0;
+}
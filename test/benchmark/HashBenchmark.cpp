@@ -0,0 +1,276 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * Measures the hash function that is used for header names, StringKeyTable
+ * keys and turbocache keys: raw hashing of typical keys with the current
+ * Hasher and with the old JenkinsHash, the header table inserts and lookups
+ * that happen for every request, and ResponseCache::prepareRequest(), which
+ * hashes the turbocache key.
+ *
+ * Run with `rake benchmark:hash`.
+ */
+
+#include <boost/cstdint.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <ev.h>
+
+#include <MemoryKit/palloc.h>
+#include <DataStructures/LString.h>
+#include <DataStructures/HashedStaticString.h>
+#include <ServerKit/HeaderTable.h>
+#include <Core/ResponseCache.h>
+#include <Utils/Hasher.h>
+
+namespace Passenger {
+namespace ServerKit {
+	// Normally defined in ServerKit/Implementation.cpp, which we don't link
+	// so that we don't need libev and libuv.
+	extern const HashedStaticString HTTP_COOKIE("cookie");
+	extern const HashedStaticString HTTP_SET_COOKIE("set-cookie");
+}
+}
+
+using namespace std;
+using namespace Passenger;
+
+namespace {
+
+static const char * const KEYS[] = {
+	"host", "user-agent", "accept", "accept-language", "accept-encoding",
+	"cookie", "connection", "upgrade-insecure-requests", "cache-control",
+	"!~PASSENGER_APP_GROUP_NAME",
+	"Hwww.example.com\n/articles/2016/04/a-reasonably-long-article-slug?page=2"
+};
+
+static const char * const REQUEST_HEADERS[][2] = {
+	{ "Host", "www.example.com" },
+	{ "User-Agent", "Mozilla/5.0 (X11; Linux x86_64; rv:45.0) Gecko/20100101 Firefox/45.0" },
+	{ "Accept", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8" },
+	{ "Accept-Language", "en-US,en;q=0.5" },
+	{ "Accept-Encoding", "gzip, deflate" },
+	{ "Referer", "https://www.example.com/articles" },
+	{ "Cookie", "_session_id=0123456789abcdef; locale=en" },
+	{ "Connection", "keep-alive" },
+	{ "Upgrade-Insecure-Requests", "1" },
+	{ "Cache-Control", "max-age=0" },
+	{ "X-Forwarded-For", "192.168.1.1" },
+	{ "X-Forwarded-Proto", "https" }
+};
+
+static const unsigned int NREQUEST_HEADERS =
+	sizeof(REQUEST_HEADERS) / sizeof(REQUEST_HEADERS[0]);
+
+/**
+ * Contains the subset of Core::Request that ResponseCache::prepareRequest()
+ * uses.
+ */
+struct Request {
+	psg_pool_t *pool;
+	ServerKit::HeaderTable headers;
+	ServerKit::HeaderTable secureHeaders;
+	LString path;
+	LString *host;
+	LString *varyCookie;
+	LString *cacheControl;
+	HashedStaticString cacheKey;
+	bool hasPragmaHeader;
+	bool https;
+
+	bool upgraded() const {
+		return false;
+	}
+};
+
+struct Controller {
+	StaticString defaultVaryTurbocacheByCookie;
+};
+
+static volatile boost::uint32_t sink;
+
+static unsigned long long
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+report(const char *name, unsigned long long start, unsigned int iterations,
+	unsigned int opsPerIteration)
+{
+	printf("%-48s %8.2f ns per operation\n", name,
+		double(now() - start) / iterations / opsPerIteration);
+}
+
+template<typename HasherType>
+static void
+benchmarkHasher(const char *name, unsigned int iterations) {
+	unsigned int nkeys = sizeof(KEYS) / sizeof(const char *);
+	unsigned int sizes[sizeof(KEYS) / sizeof(const char *)];
+	boost::uint32_t result = 0;
+
+	for (unsigned int i = 0; i < nkeys; i++) {
+		sizes[i] = strlen(KEYS[i]);
+	}
+
+	unsigned long long start = now();
+	for (unsigned int i = 0; i < iterations; i++) {
+		for (unsigned int j = 0; j < nkeys; j++) {
+			HasherType h;
+			h.update(KEYS[j], sizes[j]);
+			result += h.finalize();
+		}
+	}
+	report(name, start, iterations, nkeys);
+	sink = result;
+}
+
+static void
+benchmarkOneShotHasher(unsigned int iterations) {
+	unsigned int nkeys = sizeof(KEYS) / sizeof(const char *);
+	unsigned int sizes[sizeof(KEYS) / sizeof(const char *)];
+	boost::uint32_t result = 0;
+
+	for (unsigned int i = 0; i < nkeys; i++) {
+		sizes[i] = strlen(KEYS[i]);
+	}
+
+	unsigned long long start = now();
+	for (unsigned int i = 0; i < iterations; i++) {
+		for (unsigned int j = 0; j < nkeys; j++) {
+			result += Hasher::hash(KEYS[j], sizes[j]);
+		}
+	}
+	report("Hasher::hash()", start, iterations, nkeys);
+	sink = result;
+}
+
+/**
+ * Inserts the headers of a typical request into a header table, like
+ * HttpHeaderParser does, and then looks up the headers that the Core
+ * always looks up.
+ */
+static void
+benchmarkHeaderTable(unsigned int iterations) {
+	psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	ServerKit::HeaderTable table;
+	HashedStaticString lookups[] = {
+		"host", "connection", "cookie", "cache-control", "x-forwarded-proto",
+		"content-length", "transfer-encoding", "x-sendfile"
+	};
+	unsigned int nlookups = sizeof(lookups) / sizeof(HashedStaticString);
+	unsigned long long insertTime = 0, lookupTime = 0, start;
+	boost::uint32_t result = 0;
+
+	for (unsigned int i = 0; i < iterations; i++) {
+		start = now();
+		for (unsigned int j = 0; j < NREQUEST_HEADERS; j++) {
+			const char *name = REQUEST_HEADERS[j][0];
+			unsigned int nameSize = strlen(name);
+			ServerKit::Header *header = (ServerKit::Header *)
+				psg_palloc(pool, sizeof(ServerKit::Header));
+			char *downcasedName = (char *) psg_pnalloc(pool, nameSize);
+			Hasher hasher;
+
+			psg_lstr_init(&header->key);
+			psg_lstr_init(&header->origKey);
+			psg_lstr_init(&header->val);
+			psg_lstr_append(&header->origKey, pool, name, nameSize);
+			hasher.updateLowerCase(name, downcasedName, nameSize);
+			psg_lstr_append(&header->key, pool, downcasedName, nameSize);
+			header->hash = hasher.finalize();
+			psg_lstr_append(&header->val, pool, REQUEST_HEADERS[j][1]);
+			table.insert(&header, pool);
+		}
+		insertTime += now() - start;
+
+		start = now();
+		for (unsigned int j = 0; j < nlookups; j++) {
+			result += table.lookup(lookups[j]) != NULL;
+		}
+		lookupTime += now() - start;
+
+		table.clear();
+		psg_reset_pool(pool, PSG_DEFAULT_POOL_SIZE);
+	}
+
+	printf("%-48s %8.2f ns per operation\n", "HeaderTable insert (lower case + hash)",
+		double(insertTime) / iterations / NREQUEST_HEADERS);
+	printf("%-48s %8.2f ns per operation\n", "HeaderTable lookup",
+		double(lookupTime) / iterations / nlookups);
+	psg_destroy_pool(pool);
+	sink = result;
+}
+
+static void
+benchmarkPrepareRequest(unsigned int iterations) {
+	ResponseCache<Request> responseCache;
+	Controller controller;
+	Request req;
+	boost::uint32_t result = 0;
+
+	req.pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	req.https = true;
+
+	unsigned long long start = now();
+	for (unsigned int i = 0; i < iterations; i++) {
+		psg_lstr_init(&req.path);
+		psg_lstr_append(&req.path, req.pool,
+			"/articles/2016/04/a-reasonably-long-article-slug?page=2");
+		req.host = psg_lstr_create(req.pool, "www.example.com");
+		req.varyCookie = NULL;
+		req.cacheControl = NULL;
+		req.hasPragmaHeader = false;
+		responseCache.prepareRequest(&controller, &req);
+		result += req.cacheKey.hash();
+		psg_reset_pool(req.pool, PSG_DEFAULT_POOL_SIZE);
+	}
+	report("ResponseCache::prepareRequest()", start, iterations, 1);
+
+	psg_destroy_pool(req.pool);
+	sink = result;
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char *argv[]) {
+	unsigned int iterations = 1000000;
+	if (argc > 1) {
+		iterations = (unsigned int) atoi(argv[1]);
+	}
+
+	benchmarkHasher<JenkinsHash>("JenkinsHash", iterations);
+	benchmarkHasher<Hasher>("Hasher", iterations);
+	benchmarkOneShotHasher(iterations);
+	benchmarkHeaderTable(iterations);
+	benchmarkPrepareRequest(iterations);
+	return 0;
+}
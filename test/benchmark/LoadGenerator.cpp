@@ -0,0 +1,459 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * An HTTP load generator for benchmarking the Passenger Core. It opens
+ * `--concurrency` connections, each driven by its own thread, and sends
+ * requests over them for `--duration` seconds. Latencies are measured per
+ * request (including connection setup when keep-alive is disabled) and the
+ * results are printed to stdout as JSON.
+ *
+ * This is used by test/benchmark/suite.rb, which starts the Core in the
+ * various `--benchmark` modes. See `rake benchmark`.
+ */
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <signal.h>
+
+#include <jsoncpp/json.h>
+
+#include <Exceptions.h>
+#include <FileDescriptor.h>
+#include <StaticString.h>
+#include <Utils/IOUtils.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/SystemTime.h>
+
+using namespace std;
+using namespace Passenger;
+
+
+struct Config {
+	string address;
+	string path;
+	unsigned int concurrency;
+	double duration;
+	double warmup;
+	unsigned int payloadSize;
+	bool keepAlive;
+
+	Config()
+		: path("/"),
+		  concurrency(1),
+		  duration(5),
+		  warmup(1),
+		  payloadSize(0),
+		  keepAlive(true)
+		{ }
+};
+
+struct WorkerResult {
+	vector<unsigned int> latencies;
+	unsigned long long bytesReceived;
+	unsigned int non2xxResponses;
+	unsigned int errors;
+	string lastError;
+
+	WorkerResult()
+		: bytesReceived(0),
+		  non2xxResponses(0),
+		  errors(0)
+		{ }
+};
+
+class ResponseError: public std::exception {
+private:
+	string msg;
+public:
+	ResponseError(const string &_msg)
+		: msg(_msg)
+		{ }
+	virtual ~ResponseError() throw() { }
+	virtual const char *what() const throw() { return msg.c_str(); }
+};
+
+
+static Config config;
+static string request;
+static MonotonicTimeUsec measureStartTime;
+static MonotonicTimeUsec endTime;
+
+
+static void
+usage() {
+	printf("Usage: LoadGenerator --address ADDRESS [OPTIONS]\n");
+	printf("Sends HTTP requests to ADDRESS and prints latency statistics as JSON.\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("  --address ADDRESS   unix:PATH or tcp://HOST:PORT\n");
+	printf("  --path PATH         Request path. Default: /\n");
+	printf("  --concurrency N     Number of concurrent connections. Default: 1\n");
+	printf("  --duration SEC      Measurement duration. Default: 5\n");
+	printf("  --warmup SEC        Warmup duration, excluded from the results. Default: 1\n");
+	printf("  --payload BYTES     Send a POST request body of this size. Default: 0\n");
+	printf("  --no-keepalive      Open a new connection for every request\n");
+	printf("  -h, --help          Show this help\n");
+}
+
+static void
+parseOptions(int argc, char *argv[]) {
+	int i = 1;
+	while (i < argc) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--address" && hasValue) {
+			config.address = argv[i + 1];
+			i += 2;
+		} else if (arg == "--path" && hasValue) {
+			config.path = argv[i + 1];
+			i += 2;
+		} else if (arg == "--concurrency" && hasValue) {
+			config.concurrency = std::max(1, atoi(argv[i + 1]));
+			i += 2;
+		} else if (arg == "--duration" && hasValue) {
+			config.duration = atof(argv[i + 1]);
+			i += 2;
+		} else if (arg == "--warmup" && hasValue) {
+			config.warmup = atof(argv[i + 1]);
+			i += 2;
+		} else if (arg == "--payload" && hasValue) {
+			config.payloadSize = (unsigned int) atoi(argv[i + 1]);
+			i += 2;
+		} else if (arg == "--no-keepalive") {
+			config.keepAlive = false;
+			i++;
+		} else if (arg == "-h" || arg == "--help") {
+			usage();
+			exit(0);
+		} else {
+			fprintf(stderr, "ERROR: unrecognized argument %s\n", argv[i]);
+			fprintf(stderr, "Please type 'LoadGenerator --help' for usage.\n");
+			exit(1);
+		}
+	}
+
+	if (config.address.empty()) {
+		fprintf(stderr, "ERROR: please specify --address.\n");
+		exit(1);
+	}
+}
+
+static string
+createRequest() {
+	string result;
+	if (config.payloadSize > 0) {
+		result.append("POST ");
+	} else {
+		result.append("GET ");
+	}
+	result.append(config.path);
+	result.append(" HTTP/1.1\r\n");
+	result.append("Host: localhost\r\n");
+	if (config.keepAlive) {
+		result.append("Connection: keep-alive\r\n");
+	} else {
+		result.append("Connection: close\r\n");
+	}
+	if (config.payloadSize > 0) {
+		result.append("Content-Type: application/octet-stream\r\n");
+		result.append("Content-Length: " + toString(config.payloadSize) + "\r\n");
+	}
+	result.append("\r\n");
+	result.append(config.payloadSize, 'x');
+	return result;
+}
+
+
+/**
+ * Reads from a blocking socket into a buffer, keeping track of which part
+ * of the buffer has already been parsed.
+ */
+class ResponseReader {
+private:
+	int fd;
+	string buffer;
+	string::size_type pos;
+
+	bool fill() {
+		char tmp[1024 * 16];
+		ssize_t ret;
+
+		do {
+			ret = read(fd, tmp, sizeof(tmp));
+		} while (ret == -1 && errno == EINTR);
+		if (ret == -1) {
+			int e = errno;
+			throw SystemException("Cannot read from server", e);
+		} else if (ret == 0) {
+			return false;
+		} else {
+			buffer.append(tmp, ret);
+			bytesReceived += ret;
+			return true;
+		}
+	}
+
+	string readLine() {
+		string::size_type end;
+		while ((end = buffer.find("\r\n", pos)) == string::npos) {
+			if (!fill()) {
+				throw ResponseError("Unexpected EOF while reading a line");
+			}
+		}
+		string result = buffer.substr(pos, end - pos);
+		pos = end + 2;
+		return result;
+	}
+
+	void skip(unsigned long long size) {
+		while (buffer.size() - pos < size) {
+			size -= buffer.size() - pos;
+			buffer.clear();
+			pos = 0;
+			if (!fill()) {
+				throw ResponseError("Unexpected EOF while reading the response body");
+			}
+		}
+		pos += size;
+	}
+
+	void compact() {
+		buffer.erase(0, pos);
+		pos = 0;
+	}
+
+public:
+	unsigned long long bytesReceived;
+
+	ResponseReader(int _fd)
+		: fd(_fd),
+		  pos(0),
+		  bytesReceived(0)
+		{ }
+
+	/**
+	 * Reads one response. Returns its status code. Sets `connectionClosed`
+	 * if the server is going to close the connection after this response.
+	 */
+	int readResponse(bool &connectionClosed) {
+		string statusLine = readLine();
+		if (!startsWith(statusLine, "HTTP/1.") || statusLine.size() < 12) {
+			throw ResponseError("Invalid status line: " + statusLine);
+		}
+		int status = atoi(statusLine.c_str() + 9);
+		long long contentLength = -1;
+		bool chunked = false;
+		string line;
+
+		connectionClosed = false;
+		while (!(line = readLine()).empty()) {
+			string::size_type sep = line.find(':');
+			if (sep == string::npos) {
+				continue;
+			}
+			string name = line.substr(0, sep);
+			string value = line.substr(sep + 1);
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			value.erase(0, value.find_first_not_of(' '));
+			if (name == "content-length") {
+				contentLength = atoll(value.c_str());
+			} else if (name == "transfer-encoding" && value.find("chunked") != string::npos) {
+				chunked = true;
+			} else if (name == "connection" && value.find("close") != string::npos) {
+				connectionClosed = true;
+			}
+		}
+
+		if (chunked) {
+			unsigned long long size;
+			do {
+				size = strtoull(readLine().c_str(), NULL, 16);
+				skip(size);
+				readLine();
+			} while (size > 0);
+		} else if (contentLength >= 0) {
+			skip(contentLength);
+		} else {
+			while (fill()) {
+				// Read until EOF.
+			}
+			pos = buffer.size();
+			connectionClosed = true;
+		}
+
+		compact();
+		return status;
+	}
+};
+
+
+static void
+workerMain(WorkerResult *result) {
+	FileDescriptor fd;
+	ResponseReader *reader = NULL;
+
+	result->latencies.reserve(1024 * 64);
+	while (true) {
+		MonotonicTimeUsec start = SystemTime::getMonotonicUsec();
+		if (start >= endTime) {
+			break;
+		}
+
+		try {
+			if (fd == -1) {
+				fd.assign(connectToServer(config.address, __FILE__, __LINE__),
+					__FILE__, __LINE__);
+				delete reader;
+				reader = new ResponseReader(fd);
+			}
+			writeExact(fd, request);
+
+			bool connectionClosed;
+			int status = reader->readResponse(connectionClosed);
+			MonotonicTimeUsec now = SystemTime::getMonotonicUsec();
+			if (connectionClosed || !config.keepAlive) {
+				fd.close(false);
+			}
+
+			if (start >= measureStartTime) {
+				result->latencies.push_back((unsigned int) (now - start));
+				result->bytesReceived += reader->bytesReceived;
+				if (status < 200 || status >= 300) {
+					result->non2xxResponses++;
+				}
+			}
+			reader->bytesReceived = 0;
+		} catch (const std::exception &e) {
+			fd.close(false);
+			if (start >= measureStartTime) {
+				result->errors++;
+				result->lastError = e.what();
+			}
+			usleep(1000);
+		}
+	}
+
+	delete reader;
+}
+
+static unsigned int
+percentile(const vector<unsigned int> &sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	unsigned long long index = (unsigned long long) (p / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[std::min<unsigned long long>(index, sorted.size() - 1)];
+}
+
+static Json::Value
+summarize(const vector<WorkerResult> &results) {
+	Json::Value doc;
+	Json::Value latency;
+	vector<unsigned int> latencies;
+	unsigned long long bytesReceived = 0, latencySum = 0;
+	unsigned int non2xxResponses = 0, errors = 0;
+	string lastError;
+
+	for (unsigned int i = 0; i < results.size(); i++) {
+		latencies.insert(latencies.end(), results[i].latencies.begin(),
+			results[i].latencies.end());
+		bytesReceived += results[i].bytesReceived;
+		non2xxResponses += results[i].non2xxResponses;
+		errors += results[i].errors;
+		if (!results[i].lastError.empty()) {
+			lastError = results[i].lastError;
+		}
+	}
+	std::sort(latencies.begin(), latencies.end());
+	for (unsigned int i = 0; i < latencies.size(); i++) {
+		latencySum += latencies[i];
+	}
+
+	doc["address"] = config.address;
+	doc["path"] = config.path;
+	doc["concurrency"] = config.concurrency;
+	doc["keepalive"] = config.keepAlive;
+	doc["payload_size"] = config.payloadSize;
+	doc["duration"] = config.duration;
+	doc["requests"] = (Json::UInt64) latencies.size();
+	doc["requests_per_sec"] = latencies.size() / config.duration;
+	doc["bytes_received"] = (Json::UInt64) bytesReceived;
+	doc["non_2xx_responses"] = non2xxResponses;
+	doc["errors"] = errors;
+	if (!lastError.empty()) {
+		doc["last_error"] = lastError;
+	}
+
+	if (latencies.empty()) {
+		latency["min"] = 0;
+		latency["mean"] = 0;
+		latency["max"] = 0;
+	} else {
+		latency["min"] = latencies.front();
+		latency["mean"] = (double) latencySum / latencies.size();
+		latency["max"] = latencies.back();
+	}
+	latency["p50"] = percentile(latencies, 50);
+	latency["p90"] = percentile(latencies, 90);
+	latency["p99"] = percentile(latencies, 99);
+	latency["p999"] = percentile(latencies, 99.9);
+	doc["latency_usec"] = latency;
+
+	return doc;
+}
+
+int
+main(int argc, char *argv[]) {
+	parseOptions(argc, argv);
+	signal(SIGPIPE, SIG_IGN);
+	request = createRequest();
+
+	MonotonicTimeUsec now = SystemTime::getMonotonicUsec();
+	measureStartTime = now + (MonotonicTimeUsec) (config.warmup * 1000000);
+	endTime = measureStartTime + (MonotonicTimeUsec) (config.duration * 1000000);
+
+	vector<WorkerResult> results(config.concurrency);
+	boost::thread_group threads;
+	for (unsigned int i = 0; i < config.concurrency; i++) {
+		threads.create_thread(boost::bind(workerMain, &results[i]));
+	}
+	threads.join_all();
+
+	Json::Value doc = summarize(results);
+	cout << doc.toStyledString();
+	return 0;
+}
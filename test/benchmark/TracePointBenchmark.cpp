@@ -0,0 +1,179 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * Measures the cost of creating and destroying an oxt trace point, the thing
+ * that every TRACE_POINT() in the Core does. It compares the real trace
+ * points against a replica of the old implementation, which pushed trace
+ * points onto a std::vector protected by a spin lock. Both variants are
+ * measured with and without another thread that concurrently reads the
+ * backtrace, the way /backtraces.txt does.
+ *
+ * Run with `rake benchmark:trace_points`.
+ */
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include <oxt/initialize.hpp>
+#include <oxt/thread.hpp>
+#include <oxt/backtrace.hpp>
+#include <oxt/spin_lock.hpp>
+#include <oxt/detail/context.hpp>
+
+using namespace std;
+
+namespace {
+
+static const unsigned int NESTING = 4;
+
+/**
+ * Replica of the spin lock + vector shadow stack that oxt used to have. Like
+ * the real thing, it looks up the thread-local context on every push and pop.
+ */
+struct LegacyContext {
+	vector<const void *> backtraceList;
+	oxt::spin_lock backtraceLock;
+};
+
+static LegacyContext legacyContext;
+
+struct LegacyTracePoint {
+	LegacyTracePoint() {
+		if (oxt::get_thread_local_context() != NULL) {
+			oxt::spin_lock::scoped_lock l(legacyContext.backtraceLock);
+			legacyContext.backtraceList.push_back(this);
+		}
+	}
+
+	~LegacyTracePoint() {
+		if (oxt::get_thread_local_context() != NULL) {
+			oxt::spin_lock::scoped_lock l(legacyContext.backtraceLock);
+			legacyContext.backtraceList.pop_back();
+		}
+	}
+};
+
+static unsigned long long
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void __attribute__((noinline))
+legacyNested(unsigned int level) {
+	LegacyTracePoint tp;
+	if (level > 1) {
+		legacyNested(level - 1);
+	}
+}
+
+static void __attribute__((noinline))
+oxtNested(unsigned int level) {
+	TRACE_POINT();
+	if (level > 1) {
+		oxtNested(level - 1);
+	}
+}
+
+static void
+legacyReader(boost::atomic<bool> *stop) {
+	while (!stop->load(boost::memory_order_relaxed)) {
+		oxt::spin_lock::scoped_lock l(legacyContext.backtraceLock);
+		vector<const void *> copy(legacyContext.backtraceList);
+		(void) copy;
+	}
+}
+
+static void
+oxtReader(oxt::thread *thr, boost::atomic<bool> *stop) {
+	while (!stop->load(boost::memory_order_relaxed)) {
+		thr->backtrace();
+	}
+}
+
+static void
+runIterations(void (*func)(unsigned int), unsigned int iterations, double *result) {
+	unsigned long long start = now();
+	for (unsigned int i = 0; i < iterations; i++) {
+		func(NESTING);
+	}
+	*result = double(now() - start) / iterations / NESTING;
+}
+
+static double
+benchmark(const char *name, void (*func)(unsigned int), bool legacy, bool withReader,
+	unsigned int iterations)
+{
+	double result;
+	boost::atomic<bool> stop(false);
+	// Run the trace points inside an oxt::thread so that they have a
+	// thread-local context, like in the Core.
+	oxt::thread thr(boost::bind(runIterations, func, iterations, &result),
+		"Benchmark thread", 1024 * 1024);
+	boost::thread *reader = NULL;
+	if (withReader) {
+		if (legacy) {
+			reader = new boost::thread(boost::bind(legacyReader, &stop));
+		} else {
+			reader = new boost::thread(boost::bind(oxtReader, &thr, &stop));
+		}
+	}
+	thr.join();
+	if (reader != NULL) {
+		stop.store(true);
+		reader->join();
+		delete reader;
+	}
+	printf("%-40s %8.2f ns per trace point\n", name, result);
+	return result;
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char *argv[]) {
+	unsigned int iterations = 10000000;
+	if (argc > 1) {
+		iterations = (unsigned int) atoi(argv[1]);
+	}
+
+	oxt::initialize();
+	benchmark("spin lock + vector", legacyNested, true, false, iterations);
+	benchmark("lock-free shadow stack", oxtNested, false, false, iterations);
+	benchmark("spin lock + vector, with reader", legacyNested, true, true, iterations);
+	benchmark("lock-free shadow stack, with reader", oxtNested, false, true, iterations);
+	oxt::shutdown();
+	return 0;
+}
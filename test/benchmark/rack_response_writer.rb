@@ -0,0 +1,81 @@
+#!/usr/bin/env ruby
+# Microbenchmark for writing Rack responses in the Ruby request handler:
+# compares the native response writer (NativeSupport.write_rack_response)
+# with the pure Ruby implementation, by CPU time and by the number of objects
+# allocated per response. Responses are written to a Unix domain socket that
+# is drained by a separate thread.
+#
+#   ruby test/benchmark/rack_response_writer.rb [ITERATIONS]
+#
+# The native extension must have been compiled, e.g. with
+# `rake native_support`.
+
+require 'benchmark'
+require 'socket'
+
+SOURCE_ROOT = File.expand_path(File.dirname(__FILE__) + "/../..")
+$LOAD_PATH.unshift("#{SOURCE_ROOT}/src/ruby_supportlib")
+require 'phusion_passenger'
+PhusionPassenger.locate_directories
+PhusionPassenger.require_passenger_lib 'native_support'
+PhusionPassenger.require_passenger_lib 'ruby_core_io_enhancements'
+PhusionPassenger.require_passenger_lib 'rack/thread_handler_extension'
+
+if !PhusionPassenger::Rack::ThreadHandlerExtension::NATIVE_RESPONSE_WRITER
+  abort "*** ERROR: the native extension is not available."
+end
+
+class ResponseWriter
+  include PhusionPassenger::Rack::ThreadHandlerExtension
+  public :write_response_natively, :write_response_in_ruby
+
+  def write(method, connection, status, headers, body)
+    @can_keepalive = true
+    send(method, connection, status, headers, body, true)
+  end
+end
+
+RESPONSES = {
+  'small' => [200, {
+      'Content-Type' => 'text/html; charset=utf-8',
+      'Cache-Control' => 'max-age=0, private, must-revalidate',
+      'ETag' => 'W/"8d777f385d3dfec8815d20f7496026dc"',
+      'Set-Cookie' => "_session=abcdef; path=/; HttpOnly\nlocale=en; path=/",
+      'X-Request-Id' => '0f9b1c6e-7a3f-4d1b-9a2e-5c7d8e9f0a1b',
+      'X-Runtime' => '0.012345'
+    }, ['<html><body>Hello world</body></html>']],
+  'streamed' => [200, { 'Content-Type' => 'text/plain' },
+    Enumerator.new { |y| 4.times { y << 'x' * 64 } }]
+}
+
+iterations = (ARGV[0] || 100_000).to_i
+reader, writer = UNIXSocket.pair
+drainer = Thread.new do
+  buffer = ''
+  begin
+    while true
+      reader.readpartial(64 * 1024, buffer)
+    end
+  rescue EOFError
+  end
+end
+response_writer = ResponseWriter.new
+
+puts "#{iterations} iterations per run"
+RESPONSES.each_pair do |name, (status, headers, body)|
+  [:write_response_in_ruby, :write_response_natively].each do |method|
+    response_writer.write(method, writer, status, headers, body)
+    allocations = GC.stat(:total_allocated_objects)
+    time = Benchmark.realtime do
+      iterations.times do
+        response_writer.write(method, writer, status, headers, body)
+      end
+    end
+    allocations = (GC.stat(:total_allocated_objects) - allocations).to_f / iterations
+    printf("%-10s %-24s %8.2f usec/response  %6.1f objects/response\n",
+      name, method, time * 1_000_000 / iterations, allocations)
+  end
+end
+
+writer.close
+drainer.join
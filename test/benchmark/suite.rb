@@ -0,0 +1,327 @@
+#!/usr/bin/env ruby
+# Runs the Passenger Core benchmark suite and writes the results as JSON.
+#
+# For every benchmark mode (the Core's `--benchmark` modes, plus "full" for
+# full-stack runs against a stub app from test/stub), and for every Core
+# thread count, this script starts a Core that listens on both a Unix domain
+# socket and a TCP socket. It then runs the load generator
+# (test/benchmark/LoadGenerator.cpp) against it for every combination of
+# transport, keep-alive and request payload size.
+#
+# Normally invoked through `rake benchmark`. Pass `--compare OLD.json` to
+# report regressions against the results of an earlier run.
+
+require 'optparse'
+require 'json'
+require 'socket'
+require 'tmpdir'
+require 'fileutils'
+require 'timeout'
+require 'etc'
+require 'shellwords'
+
+SOURCE_ROOT = File.expand_path(File.dirname(__FILE__) + "/../..")
+$LOAD_PATH.unshift("#{SOURCE_ROOT}/src/ruby_supportlib")
+require 'phusion_passenger'
+
+ALL_MODES = %w(after_accept before_checkout after_checkout response_begin full)
+
+class BenchmarkSuite
+  def initialize(options)
+    @options = options
+  end
+
+  def run
+    runs = []
+    @options[:modes].each do |mode|
+      @options[:core_threads].each do |threads|
+        with_core(mode, threads) do |addresses|
+          @options[:transports].each do |transport|
+            @options[:keepalive].each do |keepalive|
+              @options[:payloads].each do |payload|
+                runs << run_load_generator(mode, threads, transport,
+                  addresses[transport], keepalive, payload)
+              end
+            end
+          end
+        end
+      end
+    end
+
+    result = {
+      'suite' => 'passenger-core',
+      'passenger_version' => PhusionPassenger::VERSION_STRING,
+      'git_revision' => git_revision,
+      'hostname' => Socket.gethostname,
+      'cpus' => Etc.nprocessors,
+      'started_at' => @started_at,
+      'settings' => {
+        'duration' => @options[:duration],
+        'warmup' => @options[:warmup],
+        'concurrency' => @options[:concurrency],
+        'app_root' => @options[:app_root]
+      },
+      'runs' => runs
+    }
+    File.open(@options[:output], 'w') do |f|
+      f.write(JSON.pretty_generate(result))
+    end
+    puts "Results written to #{@options[:output]}"
+    result
+  end
+
+  def started!
+    @started_at = Time.now.utc.strftime('%Y-%m-%dT%H:%M:%SZ')
+  end
+
+private
+  def with_core(mode, threads)
+    Dir.mktmpdir('passenger-benchmark.') do |dir|
+      # Work on a copy of the app, because spawning writes to its directory
+      # and the app may be run as a different user.
+      File.chmod(0755, dir)
+      app_root = "#{dir}/app"
+      FileUtils.cp_r(@options[:app_root], app_root)
+      port = find_free_port
+      addresses = {
+        'unix' => "unix:#{dir}/core.sock",
+        'tcp' => "tcp://127.0.0.1:#{port}"
+      }
+      command = [@options[:agent], 'core',
+        '--passenger-root', SOURCE_ROOT,
+        '--listen', addresses['unix'],
+        '--listen', addresses['tcp'],
+        '--threads', threads.to_s,
+        '--no-user-switching',
+        '--disable-selfchecks',
+        '--log-level', '1',
+        '--environment', 'production']
+      command.concat(['--benchmark', mode]) if mode != 'full'
+      command.concat(Shellwords.split(@options[:core_args]))
+      command << app_root
+
+      log_file = "#{dir}/core.log"
+      pid = Process.spawn(*command, :out => log_file, :err => log_file,
+        :pgroup => true)
+      begin
+        wait_until_ready(addresses['unix'], mode, log_file)
+        yield addresses
+      ensure
+        stop_core(pid)
+      end
+    end
+  end
+
+  def find_free_port
+    server = TCPServer.new('127.0.0.1', 0)
+    server.addr[1]
+  ensure
+    server.close if server
+  end
+
+  # Waits until the Core accepts connections. In modes that check out a
+  # session, also waits until the app has been spawned, so that spawning
+  # does not end up in the measurements.
+  def wait_until_ready(address, mode, log_file)
+    path = address.sub(/^unix:/, '')
+    Timeout.timeout(@options[:startup_timeout]) do
+      while true
+        begin
+          status = UNIXSocket.open(path) do |socket|
+            socket.write("GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+            socket.read.to_s[/\AHTTP\/1\.\d (\d+)/, 1].to_i
+          end
+          return if status >= 200 && status < 300
+        rescue SystemCallError
+          # Not listening yet.
+        end
+        sleep 0.1
+      end
+    end
+  rescue Timeout::Error
+    abort "*** ERROR: the Core did not become ready within " \
+      "#{@options[:startup_timeout]} seconds (mode #{mode}). Last lines of its log:\n" +
+      File.readlines(log_file).last(30).join
+  end
+
+  def stop_core(pid)
+    Process.kill('TERM', pid)
+    Timeout.timeout(15) do
+      Process.waitpid(pid)
+    end
+  rescue Timeout::Error
+    Process.kill('KILL', -pid) rescue nil
+    Process.waitpid(pid) rescue nil
+  rescue Errno::ESRCH, Errno::ECHILD
+    # Already exited.
+  end
+
+  def run_load_generator(mode, threads, transport, address, keepalive, payload)
+    command = [@options[:load_generator],
+      '--address', address,
+      '--concurrency', @options[:concurrency].to_s,
+      '--duration', @options[:duration].to_s,
+      '--warmup', @options[:warmup].to_s,
+      '--payload', payload.to_s]
+    command << '--no-keepalive' if !keepalive
+    output = IO.popen(command, 'r') { |io| io.read }
+    if !$?.success?
+      abort "*** ERROR: the load generator exited with status #{$?.exitstatus}"
+    end
+
+    result = JSON.parse(output)
+    result['mode'] = mode
+    result['core_threads'] = threads
+    result['transport'] = transport
+    result['name'] = BenchmarkSuite.run_name(result)
+    latency = result['latency_usec']
+    printf("%-56s %9.0f req/s  p50 %6d us  p99 %6d us  errors %d\n",
+      result['name'], result['requests_per_sec'], latency['p50'],
+      latency['p99'], result['errors'] + result['non_2xx_responses'])
+    result
+  end
+
+  def git_revision
+    rev = `cd #{SOURCE_ROOT} && git rev-parse HEAD 2>/dev/null`.strip
+    rev.empty? ? nil : rev
+  end
+
+public
+  def self.run_name(run)
+    "#{run['mode']}/threads=#{run['core_threads']}/#{run['transport']}/" \
+      "#{run['keepalive'] ? 'keepalive' : 'close'}/payload=#{run['payload_size']}"
+  end
+
+  # Compares two result documents. Returns the names of the runs whose
+  # throughput dropped, or whose p99 latency rose, by more than
+  # `max_regression` percent.
+  def self.compare(baseline, current, max_regression)
+    old_runs = {}
+    baseline['runs'].each { |run| old_runs[run['name']] = run }
+    regressions = []
+
+    puts
+    puts "Comparison against #{baseline['passenger_version']} " \
+      "(#{baseline['git_revision'] || 'unknown revision'}):"
+    current['runs'].each do |run|
+      old = old_runs[run['name']]
+      next if !old
+      throughput = percent_change(old['requests_per_sec'], run['requests_per_sec'])
+      p99 = percent_change(old['latency_usec']['p99'], run['latency_usec']['p99'])
+      regressed = -throughput > max_regression || p99 > max_regression
+      regressions << run['name'] if regressed
+      printf("%-56s throughput %+6.1f%%  p99 %+6.1f%%%s\n", run['name'],
+        throughput, p99, regressed ? '  REGRESSION' : '')
+    end
+    regressions
+  end
+
+  def self.percent_change(old_value, new_value)
+    if old_value.to_f == 0
+      0.0
+    else
+      (new_value.to_f - old_value.to_f) * 100 / old_value.to_f
+    end
+  end
+end
+
+options = {
+  :agent => "#{SOURCE_ROOT}/buildout/support-binaries/PassengerAgent",
+  :load_generator => "#{SOURCE_ROOT}/buildout/test/benchmark/LoadGenerator",
+  :output => 'benchmark.json',
+  :app_root => "#{SOURCE_ROOT}/test/stub/rack",
+  :modes => ALL_MODES,
+  :core_threads => [1, Etc.nprocessors].uniq,
+  :transports => %w(unix tcp),
+  :keepalive => [true, false],
+  :payloads => [0, 64 * 1024],
+  :concurrency => 32,
+  :duration => 5,
+  :warmup => 1,
+  :core_args => '',
+  :startup_timeout => 60,
+  :max_regression => 10
+}
+parser = OptionParser.new do |opts|
+  opts.banner = "Usage: ./suite.rb [options]"
+  opts.separator ""
+
+  opts.separator "Options:"
+  opts.on("--agent PATH", String, "Path to the PassengerAgent binary") do |val|
+    options[:agent] = File.expand_path(val)
+  end
+  opts.on("--load-generator PATH", String, "Path to the LoadGenerator binary") do |val|
+    options[:load_generator] = File.expand_path(val)
+  end
+  opts.on("--output PATH", String, "Write results to this file. Default: benchmark.json") do |val|
+    options[:output] = val
+  end
+  opts.on("--app-root PATH", String, "App to use for modes that check out a session.",
+    "Default: test/stub/rack") do |val|
+    options[:app_root] = File.expand_path(val)
+  end
+  opts.on("--core-args ARGS", String, "Extra arguments to pass to the Core,",
+    "e.g. '--numa-affine'") do |val|
+    options[:core_args] = val
+  end
+  opts.on("--modes LIST", Array, "Comma-separated benchmark modes. Default:",
+    ALL_MODES.join(',')) do |val|
+    invalid = val - ALL_MODES
+    abort "*** ERROR: invalid mode(s): #{invalid.join(', ')}" if !invalid.empty?
+    options[:modes] = val
+  end
+  opts.on("--core-threads LIST", Array, "Comma-separated Core thread counts.",
+    "Default: 1,#{Etc.nprocessors}") do |val|
+    options[:core_threads] = val.map { |x| x.to_i }
+  end
+  opts.on("--transports LIST", Array, "Comma-separated transports (unix, tcp).",
+    "Default: unix,tcp") do |val|
+    options[:transports] = val
+  end
+  opts.on("--keepalive LIST", Array, "Comma-separated keep-alive settings (on, off).",
+    "Default: on,off") do |val|
+    options[:keepalive] = val.map { |x| x == 'on' }.uniq
+  end
+  opts.on("--payloads LIST", Array, "Comma-separated request body sizes in bytes.",
+    "Default: 0,65536") do |val|
+    options[:payloads] = val.map { |x| x.to_i }
+  end
+  opts.on("--concurrency N", Integer, "Concurrent connections per run. Default: 32") do |val|
+    options[:concurrency] = val
+  end
+  opts.on("--duration SEC", Float, "Measurement duration per run. Default: 5") do |val|
+    options[:duration] = val
+  end
+  opts.on("--warmup SEC", Float, "Warmup duration per run. Default: 1") do |val|
+    options[:warmup] = val
+  end
+  opts.on("--compare PATH", String, "Compare against earlier results and exit",
+    "with status 2 if there are regressions") do |val|
+    options[:compare] = val
+  end
+  opts.on("--max-regression PERCENT", Float, "Regression threshold for --compare.",
+    "Default: 10") do |val|
+    options[:max_regression] = val
+  end
+end
+begin
+  parser.parse!
+rescue OptionParser::ParseError => e
+  puts e
+  puts
+  puts "Please see '--help' for valid options."
+  exit 1
+end
+
+suite = BenchmarkSuite.new(options)
+suite.started!
+result = suite.run
+if options[:compare]
+  baseline = JSON.parse(File.read(options[:compare]))
+  regressions = BenchmarkSuite.compare(baseline, result, options[:max_regression])
+  if !regressions.empty?
+    puts
+    puts "#{regressions.size} run(s) regressed by more than #{options[:max_regression]}%."
+    exit 2
+  end
+end
@@ -0,0 +1,165 @@
+#include <TestSupport.h>
+#include <Core/ApplicationPool/AffinityRing.h>
+#include <Utils/StrIntUtils.h>
+#include <vector>
+
+using namespace Passenger;
+using namespace Passenger::ApplicationPool2;
+using namespace std;
+
+namespace tut {
+	struct AcceptAll {
+		bool operator()(unsigned int node) const {
+			return true;
+		}
+	};
+
+	struct AcceptBelowBound {
+		const vector<unsigned int> &loads;
+		unsigned int bound;
+
+		AcceptBelowBound(const vector<unsigned int> &_loads, unsigned int _bound)
+			: loads(_loads),
+			  bound(_bound)
+			{ }
+
+		bool operator()(unsigned int node) const {
+			return loads[node] < bound;
+		}
+	};
+
+	struct Core_ApplicationPool_AffinityRingTest {
+		AffinityRing ring;
+		vector<string> ids;
+
+		void build(unsigned int count) {
+			ids.clear();
+			for (unsigned int i = 0; i < count; i++) {
+				ids.push_back("gupid-" + toString(i));
+			}
+			rebuild();
+		}
+
+		void rebuild() {
+			ring.clear();
+			for (unsigned int i = 0; i < ids.size(); i++) {
+				ring.add(i, ids[i]);
+			}
+			ring.finish();
+		}
+
+		static boost::uint32_t key(unsigned int i) {
+			string str = "tenant-" + toString(i);
+			return Hasher::hash(str.data(), str.size());
+		}
+
+		/** Returns the ID of the owner of each of the given number of keys. */
+		vector<string> owners(unsigned int nkeys) {
+			vector<string> result;
+			for (unsigned int i = 0; i < nkeys; i++) {
+				result.push_back(ids[ring.owner(key(i))]);
+			}
+			return result;
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_ApplicationPool_AffinityRingTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Keys are spread evenly over the nodes");
+		vector<unsigned int> counts(10, 0);
+		build(10);
+		for (unsigned int i = 0; i < 100000; i++) {
+			counts[ring.owner(key(i))]++;
+		}
+		for (unsigned int i = 0; i < counts.size(); i++) {
+			ensure("Node " + toString(i) + " owns " + toString(counts[i]) + " keys",
+				counts[i] > 6000 && counts[i] < 14000);
+		}
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Adding a node only moves keys to that node");
+		build(5);
+		vector<string> before = owners(10000);
+		ids.push_back("gupid-new");
+		rebuild();
+		vector<string> after = owners(10000);
+		unsigned int moved = 0;
+
+		for (unsigned int i = 0; i < before.size(); i++) {
+			if (before[i] != after[i]) {
+				ensure_equals(after[i], "gupid-new");
+				moved++;
+			}
+		}
+		// About 1/6 of the keys.
+		ensure("Moved " + toString(moved) + " keys", moved > 1000 && moved < 2500);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Removing a node only moves the keys of that node");
+		build(5);
+		vector<string> before = owners(10000);
+		ids.erase(ids.begin() + 2);
+		rebuild();
+		vector<string> after = owners(10000);
+
+		for (unsigned int i = 0; i < before.size(); i++) {
+			if (before[i] != "gupid-2") {
+				ensure_equals(after[i], before[i]);
+			}
+		}
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("find() returns the first accepted node on the ring, starting at the owner");
+		vector<unsigned int> loads(4, 0);
+		build(4);
+
+		for (unsigned int i = 0; i < 100; i++) {
+			unsigned int owner = ring.owner(key(i));
+			ensure_equals(ring.find(key(i), AcceptAll()), (int) owner);
+
+			loads.assign(4, 0);
+			loads[owner] = 1;
+			int next = ring.find(key(i), AcceptBelowBound(loads, 1));
+			ensure("(1)", next != -1);
+			ensure("(2)", next != (int) owner);
+
+			// The key moves to the same node every time.
+			ensure_equals(ring.find(key(i), AcceptBelowBound(loads, 1)), next);
+		}
+
+		loads.assign(4, 1);
+		ensure_equals(ring.find(key(0), AcceptBelowBound(loads, 1)), -1);
+		ensure_equals(AffinityRing().find(key(0), AcceptAll()), -1);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("affinityLoadBound() is the average load after adding a request, times the factor, rounded up");
+		ensure_equals(affinityLoadBound(0, 4), 1u);
+		ensure_equals(affinityLoadBound(3, 4), 2u);
+		ensure_equals(affinityLoadBound(7, 4), 3u);
+		ensure_equals(affinityLoadBound(7, 4, 1.0), 2u);
+		ensure_equals(affinityLoadBound(0, 1), 2u);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("A hot key does not push any node above the load bound");
+		vector<unsigned int> loads(5, 0);
+		unsigned int total = 0;
+		build(5);
+
+		for (unsigned int i = 0; i < 100; i++) {
+			unsigned int bound = affinityLoadBound(total, 5);
+			int node = ring.find(key(0), AcceptBelowBound(loads, bound));
+			ensure("(1)", node != -1);
+			loads[node]++;
+			total++;
+			for (unsigned int j = 0; j < loads.size(); j++) {
+				ensure("(2)", loads[j] <= affinityLoadBound(total - 1, 5));
+			}
+		}
+	}
+}
@@ -0,0 +1,187 @@
+#include <TestSupport.h>
+#include <Core/ApplicationPool/Autoscaler.h>
+
+using namespace Passenger;
+using namespace Passenger::ApplicationPool2;
+using namespace std;
+
+namespace tut {
+	struct Core_ApplicationPool_AutoscalerTest {
+		AutoscalerConfig config;
+		AutoscalerHostSignals host;
+		AutoscalerGroupSignals group;
+		AutoscalerGroupState state;
+		unsigned long long now;
+
+		Core_ApplicationPool_AutoscalerTest() {
+			config.growAfter = 2;
+			config.shrinkAfter = 3;
+			config.cooldown = 10000000;
+			host.cpuUsage = 20;
+			host.memoryFree = 50;
+			group.processCount = 2;
+			group.lowerBound = 1;
+			group.upperBound = 4;
+			now = 1000000000;
+		}
+
+		void overload() {
+			group.queueTime = config.targetQueueTime * 2;
+			group.queueSize = 5;
+			group.utilization = 1;
+		}
+
+		void underload() {
+			group.queueTime = 0;
+			group.queueSize = 0;
+			group.utilization = 0.1;
+		}
+
+		AutoscaleDecision evaluate() {
+			AutoscaleDecision decision = evaluateAutoscaling(config, host, group, state, now);
+			now += 5000000;
+			return decision;
+		}
+
+		void passCooldown() {
+			now += config.cooldown;
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_ApplicationPool_AutoscalerTest);
+
+	TEST_METHOD(1) {
+		set_test_name("The first evaluation starts from the current process count");
+		group.queueTime = config.targetQueueTime;
+		group.utilization = 0.5;
+		ensure_equals(evaluate(), AD_HOLD);
+		ensure_equals(state.limit, 2u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("A group is grown after being overloaded for several consecutive evaluations");
+		overload();
+		ensure_equals("(1)", evaluate(), AD_HOLD);
+		passCooldown();
+		ensure_equals("(2)", evaluate(), AD_GROW);
+		ensure_equals("(3)", state.limit, 3u);
+		ensure_equals("(4)", state.grown, 1u);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("A group is not changed again within the cooldown period");
+		config.growAfter = 1;
+		overload();
+		evaluate();
+		passCooldown();
+		ensure_equals("(1)", evaluate(), AD_GROW);
+		ensure_equals("(2)", evaluate(), AD_HOLD);
+		ensure_equals("(3)", state.limit, 3u);
+		ensure_equals("(4)", evaluate(), AD_GROW);
+		ensure_equals("(5)", state.limit, 4u);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("A group is never grown beyond its upper bound");
+		group.processCount = 4;
+		overload();
+		evaluate();
+		for (int i = 0; i < 10; i++) {
+			passCooldown();
+			ensure_equals(evaluate(), AD_HOLD);
+		}
+		ensure_equals(state.limit, 4u);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("An interruption of the overload resets the streak");
+		overload();
+		evaluate();
+		passCooldown();
+		group.queueTime = config.targetQueueTime;
+		group.queueSize = 1;
+		group.utilization = 0.5;
+		ensure_equals("(1)", evaluate(), AD_HOLD);
+		overload();
+		ensure_equals("(2)", evaluate(), AD_HOLD);
+		ensure_equals("(3)", evaluate(), AD_GROW);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("A group is shrunk after being underloaded for several consecutive evaluations,"
+			" but not below its lower bound");
+		group.processCount = 3;
+		group.lowerBound = 2;
+		underload();
+		evaluate();
+		passCooldown();
+		ensure_equals("(1)", evaluate(), AD_HOLD);
+		ensure_equals("(2)", evaluate(), AD_SHRINK);
+		ensure_equals("(3)", state.limit, 2u);
+		ensure_equals("(4)", state.shrunk, 1u);
+		for (int i = 0; i < 10; i++) {
+			passCooldown();
+			ensure_equals("(5)", evaluate(), AD_HOLD);
+		}
+		ensure_equals("(6)", state.limit, 2u);
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("A group is not shrunk while requests are queued");
+		group.processCount = 3;
+		underload();
+		group.queueSize = 1;
+		for (int i = 0; i < 10; i++) {
+			passCooldown();
+			ensure_equals(evaluate(), AD_HOLD);
+		}
+		ensure_equals(state.limit, 3u);
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("A group is not grown while the host CPUs are saturated");
+		overload();
+		host.cpuUsage = config.maxHostCpuUsage;
+		for (int i = 0; i < 10; i++) {
+			passCooldown();
+			ensure_equals("(1)", evaluate(), AD_HOLD);
+		}
+		ensure_equals("(2)", state.limit, 2u);
+
+		host.cpuUsage = 20;
+		evaluate();
+		ensure_equals("(3)", evaluate(), AD_GROW);
+	}
+
+	TEST_METHOD(9) {
+		set_test_name("A group is shrunk under host memory pressure, even when it's overloaded");
+		overload();
+		host.memoryFree = config.minHostMemoryFree / 2;
+		evaluate();
+		passCooldown();
+		evaluate();
+		ensure_equals("(1)", evaluate(), AD_SHRINK);
+		ensure_equals("(2)", state.limit, 1u);
+	}
+
+	TEST_METHOD(10) {
+		set_test_name("Unknown host signals don't prevent growing");
+		overload();
+		host = AutoscalerHostSignals();
+		evaluate();
+		passCooldown();
+		ensure_equals(evaluate(), AD_GROW);
+	}
+
+	TEST_METHOD(11) {
+		set_test_name("The limit is clamped to changed bounds");
+		evaluate();
+		group.upperBound = 1;
+		evaluate();
+		ensure_equals("(1)", state.limit, 1u);
+		group.lowerBound = 3;
+		group.upperBound = 5;
+		evaluate();
+		ensure_equals("(2)", state.limit, 3u);
+	}
+}
@@ -27,4 +27,94 @@ namespace tut {
 		ensure_equals(options2.appRoot, "appRoot");
 		ensure_equals(options2.processTitle, "processTitle");
 	}
+
+	TEST_METHOD(2) {
+		set_test_name("Persisting a copy of a persisted Options object shares the string data"
+			" that didn't change, and only copies the changed fields");
+
+		char appRoot[] = "appRoot";
+		char hostName[] = "hostName";
+		Options options2;
+		{
+			Options options;
+			options.appRoot = appRoot;
+			options2 = options.copyAndPersist();
+		}
+
+		Options options3 = options2;
+		options3.hostName = hostName;
+		Options options4 = options3.copyAndPersist();
+		hostName[0] = 'x';
+		ensure_equals(options4.appRoot, "appRoot");
+		ensure_equals(options4.hostName, "hostName");
+		ensure_equals("The unchanged field is shared",
+			options4.appRoot.data(), options2.appRoot.data());
+
+		Options options5 = options4.copyAndPersist();
+		ensure_equals("The changed field is shared with a further copy",
+			options5.hostName.data(), options4.hostName.data());
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Persisting copies fields that point into the storage area"
+			" but are not NULL-terminated");
+
+		char appRoot[] = "appRoot";
+		Options options;
+		options.appRoot = appRoot;
+		Options options2 = options.copyAndPersist();
+
+		options2.uri = options2.appRoot.substr(0, 3);
+		Options options3 = options2.copyAndPersist();
+		ensure_equals(options3.uri, "app");
+		ensure_equals(options3.uri.c_str()[3], '\0');
+		ensure_equals(options3.appRoot.data(), options2.appRoot.data());
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("RequestOptions refers to the per-group options and only"
+			" persists the overlay fields that don't live in their storage area");
+
+		char appRoot[] = "appRoot";
+		char hostName[] = "hostName";
+		Options options;
+		options.appRoot = appRoot;
+		options.environmentVariables = "FOO";
+		options.maxRequests = 10;
+		ConstOptionsPtr groupOptions = boost::make_shared<Options>(options.copyAndPersist());
+
+		RequestOptions requestOptions(groupOptions);
+		ensure_equals(requestOptions.maxRequests, 10u);
+		ensure(requestOptions.getGroupOptionsPtr() == groupOptions);
+
+		requestOptions.hostName = hostName;
+		RequestOptions requestOptions2 = requestOptions;
+		requestOptions2.persist();
+		hostName[0] = 'x';
+		ensure_equals(requestOptions2.hostName, "hostName");
+		ensure_equals("Fields from the per-group options are not copied",
+			requestOptions2.environmentVariables.data(),
+			groupOptions->environmentVariables.data());
+		ensure_equals(requestOptions2.getGroupOptions().appRoot.data(),
+			groupOptions->appRoot.data());
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("RequestOptions::toOptions() applies the overlay to a copy"
+			" of the per-group options");
+
+		Options options;
+		options.appRoot = "appRoot";
+		ConstOptionsPtr groupOptions = boost::make_shared<Options>(options.copyAndPersist());
+
+		RequestOptions requestOptions(groupOptions);
+		requestOptions.environmentVariables = "BAR";
+		requestOptions.stickySessionId = 5;
+		Options result = requestOptions.toOptions();
+		ensure_equals(result.appRoot, "appRoot");
+		ensure_equals(result.environmentVariables, "BAR");
+		ensure_equals(result.stickySessionId, 5u);
+		ensure_equals("The per-group options are unchanged",
+			groupOptions->environmentVariables, "");
+	}
 }
@@ -5,6 +5,7 @@
 #include <Utils/StrIntUtils.h>
 #include <MessageReadersWriters.h>
 #include <map>
+#include <set>
 #include <vector>
 #include <cerrno>
 #include <signal.h>
@@ -27,6 +28,14 @@ namespace tut {
 		boost::mutex syncher;
 		list<SessionPtr> sessions;
 		bool retainSessions;
+		vector<int> completedRequests;
+
+		struct QueuedRequest {
+			Core_ApplicationPool_PoolTest *self;
+			int id;
+			SessionPtr session;
+			ExceptionPtr exception;
+		};
 
 		Core_ApplicationPool_PoolTest() {
 			retainSessions = false;
@@ -108,6 +117,42 @@ namespace tut {
 			// destroy old session object outside the lock.
 		}
 
+		static void _queuedRequestCallback(const AbstractSessionPtr &session,
+			const ExceptionPtr &e, void *userData)
+		{
+			QueuedRequest *req = (QueuedRequest *) userData;
+			LockGuard l(req->self->syncher);
+			req->session = static_pointer_cast<Session>(session);
+			req->exception = e;
+			req->self->completedRequests.push_back(req->id);
+		}
+
+		void asyncGetQueued(const Options &options, QueuedRequest &req, int id) {
+			GetCallback cb;
+			req.self = this;
+			req.id = id;
+			cb.func = _queuedRequestCallback;
+			cb.userData = &req;
+			pool->asyncGet(options, cb);
+		}
+
+		void waitForCompletedRequests(unsigned int n) {
+			EVENTUALLY(5,
+				LockGuard l(syncher);
+				result = completedRequests.size() >= n;
+			);
+		}
+
+		void releaseQueuedSession(QueuedRequest &req) {
+			SessionPtr session;
+			{
+				LockGuard l(syncher);
+				session = req.session;
+				req.session.reset();
+			}
+			session.reset();
+		}
+
 		void sendHeaders(int connection, ...) {
 			va_list ap;
 			const char *arg;
@@ -1858,6 +1903,7 @@ namespace tut {
 		options.startupFile = "passenger_wsgi.py";
 		options.spawnMethod = "direct";
 		options.maxOutOfBandWorkInstances = 2;
+		pool->setOobwBudget(0);
 		initPoolDebugging();
 		debug->restarting = false;
 		debug->spawning = false;
@@ -2001,12 +2047,654 @@ namespace tut {
 		currentSession.reset();
 	}
 
+	TEST_METHOD(80) {
+		// Waiters on the getWaitlist are assigned sessions in order of
+		// priority, and in FIFO order within the same priority.
+		Options options = createOptions();
+		spawningKitConfig->concurrency = 1;
+		pool->setMax(1);
+		SessionPtr session = pool->get(options, &ticket);
+
+		QueuedRequest requests[4];
+		for (int i = 0; i < 4; i++) {
+			options.priority = (i % 2 == 0) ? 0 : 5;
+			asyncGetQueued(options, requests[i], i);
+		}
+		session.reset();
+
+		for (unsigned int i = 0; i < 4; i++) {
+			waitForCompletedRequests(i + 1);
+			int id;
+			{
+				LockGuard l(syncher);
+				id = completedRequests[i];
+				ensure(requests[id].session != NULL);
+			}
+			releaseQueuedSession(requests[id]);
+		}
+
+		LockGuard l(syncher);
+		ensure_equals(completedRequests[0], 1);
+		ensure_equals(completedRequests[1], 3);
+		ensure_equals(completedRequests[2], 0);
+		ensure_equals(completedRequests[3], 2);
+	}
+
+	TEST_METHOD(81) {
+		// Waiters whose deadline has passed are shed from the getWaitlist, which
+		// also makes room for new waiters when the queue is full.
+		Options options = createOptions();
+		options.maxRequestQueueSize = 1;
+		spawningKitConfig->concurrency = 1;
+		pool->setMax(1);
+		SessionPtr session = pool->get(options, &ticket);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		unsigned long long queued;
+		{
+			LockGuard l(pool->syncher);
+			queued = group->queueLatency.count;
+		}
+
+		QueuedRequest requests[2];
+		options.deadline = SystemTime::getUsec() + 1000;
+		asyncGetQueued(options, requests[0], 0);
+		usleep(20000);
+		options.deadline = 0;
+		asyncGetQueued(options, requests[1], 1);
+
+		waitForCompletedRequests(1);
+		{
+			LockGuard l(syncher);
+			ensure_equals(completedRequests[0], 0);
+			ensure(requests[0].session == NULL);
+			ensure(dynamic_pointer_cast<RequestQueueTimeoutException>(requests[0].exception) != NULL);
+		}
+
+		session.reset();
+		waitForCompletedRequests(2);
+		{
+			LockGuard l(syncher);
+			ensure_equals(completedRequests[1], 1);
+			ensure(requests[1].session != NULL);
+		}
+		releaseQueuedSession(requests[1]);
+
+		LockGuard l(pool->syncher);
+		ensure_equals(group->requestsShedByDeadline, 1ull);
+		ensure_equals(group->requestsShedAdaptively, 0ull);
+		ensure_equals("Only the request that got a session is counted in the queue latency",
+			group->queueLatency.count, queued + 1);
+	}
+
+	TEST_METHOD(82) {
+		// Adaptive request queue shedding allows waiters to stay queued for up to
+		// the shed interval while the getWaitlist drains regularly, but once the
+		// getWaitlist has not been empty for an entire interval, waiters that
+		// have been queued for longer than the shed target are shed.
+		Options options = createOptions();
+		spawningKitConfig->concurrency = 1;
+		pool->setMax(1);
+		pool->setRequestQueueShedding(10000, 200000);
+		SessionPtr session = pool->get(options, &ticket);
+		GroupPtr group = pool->findOrCreateGroup(options);
+
+		QueuedRequest requests[3];
+		asyncGetQueued(options, requests[0], 0);
+		usleep(50000);
+		asyncGetQueued(options, requests[1], 1);
+		SHOULD_NEVER_HAPPEN(20,
+			LockGuard l(syncher);
+			result = !completedRequests.empty();
+		);
+
+		usleep(200000);
+		asyncGetQueued(options, requests[2], 2);
+		waitForCompletedRequests(2);
+		{
+			LockGuard l(syncher);
+			ensure_equals(completedRequests[0], 0);
+			ensure_equals(completedRequests[1], 1);
+			ensure(dynamic_pointer_cast<RequestQueueTimeoutException>(requests[0].exception) != NULL);
+			ensure(dynamic_pointer_cast<RequestQueueTimeoutException>(requests[1].exception) != NULL);
+		}
+
+		session.reset();
+		waitForCompletedRequests(3);
+		{
+			LockGuard l(syncher);
+			ensure_equals(completedRequests[2], 2);
+			ensure(requests[2].session != NULL);
+		}
+		releaseQueuedSession(requests[2]);
+
+		LockGuard l(pool->syncher);
+		ensure_equals(group->requestsShedByDeadline, 0ull);
+		ensure_equals(group->requestsShedAdaptively, 2ull);
+	}
+
+	TEST_METHOD(83) {
+		// When the autoscaler raises a group's process limit because its
+		// processes are fully utilized, a new process is spawned. When it
+		// lowers the limit because the group is idle, an idle process is detached.
+		Options options = createOptions();
+		spawningKitConfig->concurrency = 1;
+		pool->setMax(3);
+		AutoscalerConfig config;
+		config.growAfter = 1;
+		config.shrinkAfter = 1;
+		config.cooldown = 0;
+		pool->setAutoscaling(true, config);
+		SessionPtr session = pool->get(options, &ticket);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		boost::container::vector<Callback> actions;
+
+		{
+			LockGuard l(pool->syncher);
+			pool->autoscale(AutoscalerHostSignals(), SystemTime::getUsec(), actions);
+			ensure_equals(group->autoscaler.limit, 2u);
+		}
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->getProcessCount() == 2 && !group->spawning();
+		);
+
+		session.reset();
+		{
+			LockGuard l(pool->syncher);
+			pool->autoscale(AutoscalerHostSignals(), SystemTime::getUsec(), actions);
+			ensure_equals(group->autoscaler.limit, 1u);
+			ensure_equals(group->getProcessCount(), 1u);
+			ensure_equals(group->detachedProcesses.size(), 1u);
+		}
+		Pool::runAllActions(actions);
+	}
+
+	TEST_METHOD(84) {
+		// The autoscaled process limit caps the number of processes
+		// that are spawned for queued requests.
+		Options options = createOptions();
+		spawningKitConfig->concurrency = 1;
+		pool->setMax(3);
+		AutoscalerConfig config;
+		config.cooldown = 60000000;
+		pool->setAutoscaling(true, config);
+		SessionPtr session = pool->get(options, &ticket);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		boost::container::vector<Callback> actions;
+
+		{
+			LockGuard l(pool->syncher);
+			pool->autoscale(AutoscalerHostSignals(), SystemTime::getUsec(), actions);
+			ensure_equals(group->autoscaler.limit, 1u);
+		}
+
+		QueuedRequest request;
+		asyncGetQueued(options, request, 0);
+		SHOULD_NEVER_HAPPEN(100,
+			LockGuard l(pool->syncher);
+			result = group->spawning() || group->getProcessCount() > 1;
+		);
+
+		session.reset();
+		waitForCompletedRequests(1);
+		releaseQueuedSession(request);
+	}
+
 	// TODO: Persistent connections.
 	// TODO: If one closes the session before it has reached EOF, and process's maximum concurrency
 	//       has already been reached, then the pool should ping the process so that it can detect
 	//       when the session's connection has been released by the app.
 
 
+	/*********** Test memory-based process recycling ***********/
+
+	TEST_METHOD(86) {
+		// A process whose private memory exceeds the group's limit is replaced:
+		// the replacement is spawned first, and only then is the process detached.
+		Options options = ensureMinProcesses(1);
+		pool->setMax(2);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		ProcessPtr process;
+		boost::container::vector<Callback> actions;
+
+		{
+			LockGuard l(pool->syncher);
+			group->options.privateMemoryLimit = 100;
+			process = group->enabledProcesses.front();
+			process->metrics.pid = process->getPid();
+			process->metrics.privateDirty = 150 * 1024;
+			group->recycleProcessesExceedingMemoryLimits(SystemTime::getUsec(), actions);
+			ensure("(1)", process->memoryRecyclePending);
+			ensure_equals("(2)", process->enabled, Process::ENABLED);
+			ensure("(3)", group->spawning());
+		}
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = !group->spawning();
+		);
+
+		LockGuard l(pool->syncher);
+		ensure_equals("(4)", process->enabled, Process::DETACHED);
+		ensure_equals("(5)", group->getProcessCount(), 1u);
+		ensure("(6)", group->enabledProcesses.front() != process);
+		ensure_equals("(7)", group->processesRecycledForMemory, 1ull);
+	}
+
+	TEST_METHOD(87) {
+		// If the pool has no room for a replacement process, then a process
+		// that exceeds the memory limit is detached right away, after which
+		// the pool spawns a new one to satisfy the minimum number of processes.
+		Options options = ensureMinProcesses(1);
+		pool->setMax(1);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		ProcessPtr process;
+		boost::container::vector<Callback> actions;
+
+		{
+			LockGuard l(pool->syncher);
+			group->options.privateMemoryLimit = 100;
+			process = group->enabledProcesses.front();
+			process->metrics.pid = process->getPid();
+			process->metrics.privateDirty = 150 * 1024;
+			group->recycleProcessesExceedingMemoryLimits(SystemTime::getUsec(), actions);
+			ensure_equals("(1)", process->enabled, Process::DETACHED);
+			ensure_equals("(2)", group->processesRecycledForMemory, 1ull);
+		}
+		Pool::runAllActions(actions);
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->enabledCount == 1 && !group->spawning();
+		);
+	}
+
+	TEST_METHOD(88) {
+		// A process whose private memory grows faster than the group's growth
+		// limit is replaced, but only once it has been observed for long enough.
+		Options options = ensureMinProcesses(2);
+		pool->setMax(3);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		unsigned long long now = SystemTime::getUsec();
+		boost::container::vector<Callback> actions;
+
+		LockGuard l(pool->syncher);
+		group->options.privateMemoryGrowthLimit = 100;
+		ProcessPtr process1 = group->enabledProcesses.front();
+		ProcessPtr process2 = group->enabledProcesses.back();
+		process1->metrics.pid = process1->getPid();
+		process1->metrics.privateDirty = 250 * 1024;
+		process1->initialRealMemory = 50 * 1024;
+		process1->initialMetricsTime = now - 60 * 1000000ULL;
+		process2->metrics.pid = process2->getPid();
+		process2->metrics.privateDirty = 250 * 1024;
+		process2->initialRealMemory = 200 * 1024;
+		process2->initialMetricsTime = now - 60 * 60 * 1000000ULL;
+
+		group->recycleProcessesExceedingMemoryLimits(now, actions);
+		ensure("(1)", !process1->memoryRecyclePending);
+		ensure("(2)", !process2->memoryRecyclePending);
+
+		process1->initialMetricsTime = now - 60 * 60 * 1000000ULL;
+		group->recycleProcessesExceedingMemoryLimits(now, actions);
+		ensure("(3)", process1->memoryRecyclePending);
+		ensure("(4)", !process2->memoryRecyclePending);
+	}
+
+	TEST_METHOD(89) {
+		// Under host memory pressure, forceFreeCapacity() detaches the idle
+		// process that uses the most private memory, instead of the least
+		// recently used one.
+		Options options = ensureMinProcesses(2);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		boost::container::vector<Callback> actions;
+
+		LockGuard l(pool->syncher);
+		ProcessPtr process1 = group->enabledProcesses.front();
+		ProcessPtr process2 = group->enabledProcesses.back();
+		process1->lastUsed = 1;
+		process2->lastUsed = 2;
+		process1->metrics.pid = process1->getPid();
+		process1->metrics.privateDirty = 50 * 1024;
+		process2->metrics.pid = process2->getPid();
+		process2->metrics.privateDirty = 150 * 1024;
+
+		ensure("(1)", pool->findOldestIdleProcess() == process1);
+		pool->hostMemoryFree = 50;
+		ensure("(2)", !pool->hostHasMemoryPressureUnlocked());
+		pool->hostMemoryFree = 5;
+		ensure("(3)", pool->hostHasMemoryPressureUnlocked());
+		ensure("(4)", pool->forceFreeCapacity(NULL, actions) == process2);
+		ensure_equals("(5)", process2->enabled, Process::DETACHED);
+	}
+
+	TEST_METHOD(90) {
+		// The durations of the spawn phases of each spawned process are
+		// recorded in its group.
+		spawningKitConfig->spawnTime = 20000;
+		Options options = ensureMinProcesses(2);
+		GroupPtr group = pool->findOrCreateGroup(options);
+
+		LockGuard l(pool->syncher);
+		ensure_equals("(1)", group->spawnPhases.count, 2u);
+		ensure_equals("(2)", group->spawnPhases.last.appLoad, 20000u);
+		ensure_equals("(3)", group->spawnPhases.average().appLoad, 20000u);
+		ensure_equals("(4)", group->enabledProcesses.front()->getSpawnPhaseDurations().appLoad, 20000u);
+		ensure_equals("(5)", group->spawnPhases.inspect(),
+			"fork 0ms, app load 20ms, socket ready 0ms");
+	}
+
+	TEST_METHOD(91) {
+		// Requests with the same affinity key go to the same process,
+		// unless that process is loaded too much.
+		Options options = ensureMinProcesses(3);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		options.affinityKey = 1234;
+
+		SessionPtr session1 = pool->get(options, &ticket);
+		pid_t owner = session1->getPid();
+		session1.reset();
+		for (int i = 0; i < 5; i++) {
+			SessionPtr session = pool->get(options, &ticket);
+			ensure_equals(("Request " + toString(i) + " goes to the owner").c_str(),
+				session->getPid(), owner);
+		}
+
+		// The owner has 1 session, which is more than its share of 2
+		// sessions over 3 processes, so the next request goes elsewhere.
+		session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		ensure_equals("(1)", session1->getPid(), owner);
+		ensure("(2)", session2->getPid() != owner);
+		session1.reset();
+		session2.reset();
+
+		LockGuard l(pool->syncher);
+		ensure_equals("(3)", group->affinityHits, 7ull);
+		ensure_equals("(4)", group->affinityRedirects, 1ull);
+		ensure_equals("(5)", group->affinitySpills, 0ull);
+	}
+
+	TEST_METHOD(92) {
+		// A rolling restart replaces the processes one batch at a time. Old
+		// processes are only disabled after their replacements have been
+		// attached, so the number of enabled processes never drops, even
+		// though the process limit has been reached. Old processes finish
+		// their sessions before they are detached.
+		Options options = createOptions();
+		options.minProcesses = 4;
+		options.maxProcesses = 4;
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 4;
+		);
+		currentSession.reset();
+		GroupPtr group = pool->findOrCreateGroup(options);
+
+		SessionPtr session = pool->get(options, &ticket);
+		set<pid_t> oldPids;
+		{
+			LockGuard l(pool->syncher);
+			foreach (const ProcessPtr &process, group->enabledProcesses) {
+				oldPids.insert(process->getPid());
+			}
+		}
+
+		Pool::RestartOptions restartOptions = Pool::RestartOptions::makeAuthorized();
+		restartOptions.method = RM_ROLLING;
+		ensure("(1)", pool->restartGroupByName(options.getAppGroupName(), restartOptions));
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->processesReplacedByRollingRestart == 3
+				&& group->disablingCount == 1;
+		);
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals("(2)", group->enabledCount, 4);
+			ensure("(3)", group->rollingRestarting());
+			ensure_equals("(4)", group->disablingProcesses[0]->getPid(), session->getPid());
+			foreach (const ProcessPtr &process, group->enabledProcesses) {
+				ensure("(5)", oldPids.find(process->getPid()) == oldPids.end());
+			}
+		}
+
+		session.reset();
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->processesReplacedByRollingRestart == 4
+				&& !group->rollingRestarting();
+		);
+		LockGuard l(pool->syncher);
+		ensure_equals("(6)", group->enabledCount, 4);
+		ensure_equals("(7)", group->disablingCount, 0);
+		ensure_equals("(8)", group->disabledCount, 0);
+	}
+
+	TEST_METHOD(93) {
+		// If a new process fails to spawn during a rolling restart, then the
+		// rolling restart is aborted and the old processes keep serving requests.
+		initPoolDebugging();
+		debug->restarting = false;
+		debug->messages->send("Proceed with spawn loop iteration 1");
+		debug->messages->send("Proceed with spawn loop iteration 2");
+
+		Options options = createOptions();
+		options.minProcesses = 2;
+		pool->get(options, &ticket).reset();
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 2;
+		);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		set<pid_t> oldPids;
+		{
+			LockGuard l(pool->syncher);
+			foreach (const ProcessPtr &process, group->enabledProcesses) {
+				oldPids.insert(process->getPid());
+			}
+		}
+
+		setLogLevel(LVL_CRIT);
+		debug->messages->send("Fail spawn loop iteration 3");
+		Pool::RestartOptions restartOptions = Pool::RestartOptions::makeAuthorized();
+		restartOptions.method = RM_ROLLING;
+		ensure("(1)", pool->restartGroupByName(options.getAppGroupName(), restartOptions));
+		debug->debugger->recv("Begin spawn loop iteration 3");
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = !group->restarting() && !group->rollingRestarting()
+				&& !group->spawning();
+		);
+
+		LockGuard l(pool->syncher);
+		ensure_equals("(2)", group->enabledCount, 2);
+		ensure_equals("(3)", group->processesReplacedByRollingRestart, 0ull);
+		foreach (const ProcessPtr &process, group->enabledProcesses) {
+			ensure("(4)", oldPids.find(process->getPid()) != oldPids.end());
+			ensure("(5)", !process->rollingRestartPending);
+		}
+	}
+
+	TEST_METHOD(94) {
+		// No more than the OOBW budget percentage of a group's processes
+		// perform out-of-band work at the same time.
+		Options options = ensureMinProcesses(4);
+		options.maxOutOfBandWorkInstances = 4;
+		pool->setOobwBudget(25);
+		initPoolDebugging();
+		debug->oobw = true;
+		// The dummy processes do not accept connections.
+		setLogLevel(LVL_CRIT);
+
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		ProcessPtr process2 = session2->getProcess()->shared_from_this();
+		session1->requestOOBW();
+		session1.reset();
+		debug->debugger->recv("OOBW request about to start");
+
+		session2->requestOOBW();
+		session2.reset();
+		SHOULD_NEVER_HAPPEN(100,
+			result = debug->debugger->peek("OOBW request about to start") != NULL;
+		);
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals("(1)", process2->oobwStatus, Process::OOBW_REQUESTED);
+			ensure_equals("(2)", process2->enabled, Process::ENABLED);
+		}
+
+		debug->messages->send("Proceed with OOBW request");
+		debug->debugger->recv("OOBW request finished");
+		debug->debugger->recv("OOBW request about to start");
+		debug->messages->send("Proceed with OOBW request");
+		debug->debugger->recv("OOBW request finished");
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = process2->oobwStatus == Process::OOBW_NOT_ACTIVE
+				&& process2->enabled == Process::ENABLED
+				&& process2->lastOobwTime > 0;
+		);
+	}
+
+	TEST_METHOD(95) {
+		// Out-of-band work is deferred while requests are waiting for a
+		// process, and is performed once they have been served.
+		pool->setMax(2);
+		Options options = ensureMinProcesses(2);
+		GroupPtr group = pool->findOrCreateGroup(options);
+		initPoolDebugging();
+		debug->oobw = true;
+		setLogLevel(LVL_CRIT);
+
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		ProcessPtr process1 = session1->getProcess()->shared_from_this();
+		pool->asyncGet(options, callback);
+		ensure_equals("(1)", group->getWaitlist.size(), 1u);
+
+		session1->requestOOBW();
+		session1.reset();
+		ensure_equals("(2)", number, 2);
+		ensure("(3)", currentSession->getProcess() == process1.get());
+		SHOULD_NEVER_HAPPEN(100,
+			result = debug->debugger->peek("OOBW request about to start") != NULL;
+		);
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals("(4)", process1->oobwStatus, Process::OOBW_REQUESTED);
+		}
+
+		currentSession.reset();
+		debug->debugger->recv("OOBW request about to start");
+		debug->messages->send("Proceed with OOBW request");
+		debug->debugger->recv("OOBW request finished");
+		session2.reset();
+	}
+
+	TEST_METHOD(96) {
+		// The process that has gone the longest without out-of-band work
+		// performs it first.
+		Options options = ensureMinProcesses(3);
+		initPoolDebugging();
+		debug->oobw = true;
+		setLogLevel(LVL_CRIT);
+
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		SessionPtr session3 = pool->get(options, &ticket);
+		ProcessPtr process1 = session1->getProcess()->shared_from_this();
+		ProcessPtr process2 = session2->getProcess()->shared_from_this();
+		session3->requestOOBW();
+		session3.reset();
+		debug->debugger->recv("OOBW request about to start");
+
+		{
+			LockGuard l(pool->syncher);
+			process1->lastOobwTime = SystemTime::getUsec();
+		}
+		session1->requestOOBW();
+		session1.reset();
+		session2->requestOOBW();
+		session2.reset();
+
+		debug->messages->send("Proceed with OOBW request");
+		debug->debugger->recv("OOBW request finished");
+		debug->debugger->recv("OOBW request about to start");
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals("(1)", process2->oobwStatus, Process::OOBW_IN_PROGRESS);
+			ensure_equals("(2)", process1->oobwStatus, Process::OOBW_REQUESTED);
+		}
+
+		debug->messages->send("Proceed with OOBW request");
+		debug->debugger->recv("OOBW request finished");
+		debug->debugger->recv("OOBW request about to start");
+		debug->messages->send("Proceed with OOBW request");
+		debug->debugger->recv("OOBW request finished");
+	}
+
+	TEST_METHOD(97) {
+		// If the restart directory can be watched, then changes to restart.txt
+		// are detected without waiting for the stat throttle rate.
+		TempDir dir("tmp.restart");
+		makeDirTree("tmp.restart/tmp");
+		Options options = createOptions();
+		options.appRoot = "tmp.restart";
+		options.statThrottleRate = 100;
+		pool->get(options, &ticket).reset();
+		GroupPtr group = pool->findOrCreateGroup(options);
+		RequestOptions requestOptions(options);
+
+		#ifdef __linux__
+			{
+				LockGuard l(pool->syncher);
+				ensure("(1)", group->restartFileSubscription != NULL);
+				ensure("(2)", !group->needsRestart(requestOptions));
+			}
+			touchFile("tmp.restart/tmp/restart.txt");
+			EVENTUALLY(5,
+				LockGuard l(pool->syncher);
+				result = group->needsRestart(requestOptions);
+			);
+			LockGuard l(pool->syncher);
+			ensure("(3)", !group->needsRestart(requestOptions));
+		#endif
+	}
+
+	TEST_METHOD(98) {
+		// A request on a get wait list refers to the caller's per-group
+		// options instead of copying them, and only persists its overlay.
+		char hostName[] = "foo.com";
+		Options options = createOptions();
+		options.appGroupName = "test";
+		ConstOptionsPtr groupOptions = boost::make_shared<Options>(options.copyAndPersist());
+		pool->setMax(1);
+		pool->asyncGet(RequestOptions(groupOptions), callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		SessionPtr session1 = currentSession;
+		currentSession.reset();
+
+		RequestOptions requestOptions(groupOptions);
+		requestOptions.hostName = hostName;
+		pool->asyncGet(requestOptions, callback);
+		hostName[0] = 'x';
+		{
+			LockGuard l(pool->syncher);
+			GroupPtr group = pool->groups.lookupCopy("test");
+			ensure_equals(group->getWaitlist.size(), 1u);
+			ensure("The per-group options are shared",
+				group->getWaitlist[0].options.getGroupOptionsPtr() == groupOptions);
+			ensure_equals(group->getWaitlist[0].options.hostName, "foo.com");
+		}
+
+		session1.reset();
+		ensure_equals(number, 2);
+	}
+
+
 	/*********** Test previously discovered bugs ***********/
 
 	TEST_METHOD(85) {
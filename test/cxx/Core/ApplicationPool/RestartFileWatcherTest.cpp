@@ -0,0 +1,100 @@
+#include <TestSupport.h>
+#include <Core/ApplicationPool/RestartFileWatcher.h>
+#include <cstdio>
+
+using namespace Passenger;
+using namespace Passenger::ApplicationPool2;
+using namespace std;
+
+namespace tut {
+	struct Core_ApplicationPool_RestartFileWatcherTest {
+		RestartFileWatcher watcher;
+		TempDir tmpDir;
+
+		Core_ApplicationPool_RestartFileWatcherTest()
+			: tmpDir("tmp.watcher")
+			{ }
+
+		static bool changed(const RestartFileWatcher::SubscriptionPtr &subscription) {
+			return subscription->changed.exchange(false);
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_ApplicationPool_RestartFileWatcherTest);
+
+	#ifdef __linux__
+		TEST_METHOD(1) {
+			set_test_name("Creating or touching restart.txt marks the subscription as changed");
+			RestartFileWatcher::SubscriptionPtr subscription = watcher.watch("tmp.watcher");
+			ensure("(1)", subscription != NULL);
+			ensure("(2)", !changed(subscription));
+
+			touchFile("tmp.watcher/restart.txt");
+			EVENTUALLY(5,
+				result = changed(subscription);
+			);
+			touchFile("tmp.watcher/restart.txt", 1);
+			EVENTUALLY(5,
+				result = changed(subscription);
+			);
+			ensure("(3)", !subscription->lost.load());
+		}
+
+		TEST_METHOD(2) {
+			set_test_name("Creating or removing always_restart.txt marks the subscription as changed");
+			RestartFileWatcher::SubscriptionPtr subscription = watcher.watch("tmp.watcher");
+			touchFile("tmp.watcher/always_restart.txt");
+			EVENTUALLY(5,
+				result = changed(subscription);
+			);
+			unlink("tmp.watcher/always_restart.txt");
+			EVENTUALLY(5,
+				result = changed(subscription);
+			);
+		}
+
+		TEST_METHOD(3) {
+			set_test_name("Changes to other files are ignored");
+			RestartFileWatcher::SubscriptionPtr subscription = watcher.watch("tmp.watcher");
+			touchFile("tmp.watcher/foo.txt");
+			SHOULD_NEVER_HAPPEN(100,
+				result = changed(subscription);
+			);
+		}
+
+		TEST_METHOD(4) {
+			set_test_name("Subscriptions to the same directory share a watch");
+			RestartFileWatcher::SubscriptionPtr subscription1 = watcher.watch("tmp.watcher");
+			RestartFileWatcher::SubscriptionPtr subscription2 = watcher.watch("tmp.watcher");
+			ensure_equals("(1)", watcher.size(), 1u);
+
+			touchFile("tmp.watcher/restart.txt");
+			EVENTUALLY(5,
+				result = subscription1->changed.load() && subscription2->changed.load();
+			);
+
+			watcher.unwatch(subscription1);
+			ensure_equals("(2)", watcher.size(), 1u);
+			watcher.unwatch(subscription2);
+			ensure_equals("(3)", watcher.size(), 0u);
+		}
+
+		TEST_METHOD(5) {
+			set_test_name("Removing the directory marks the subscription as lost");
+			makeDirTree("tmp.watcher/tmp");
+			RestartFileWatcher::SubscriptionPtr subscription = watcher.watch("tmp.watcher/tmp");
+			ensure("(1)", subscription != NULL);
+			removeDirTree("tmp.watcher/tmp");
+			EVENTUALLY(5,
+				result = subscription->lost.load() && changed(subscription);
+			);
+			ensure_equals("(2)", watcher.size(), 0u);
+		}
+	#endif
+
+	TEST_METHOD(6) {
+		set_test_name("A directory that does not exist cannot be watched");
+		ensure(watcher.watch("tmp.watcher/nonexistant") == NULL);
+		ensure_equals(watcher.size(), 0u);
+	}
+}
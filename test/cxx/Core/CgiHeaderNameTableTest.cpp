@@ -0,0 +1,158 @@
+#include <TestSupport.h>
+#include <MemoryKit/palloc.h>
+#include <ServerKit/HeaderTable.h>
+#include <Core/CgiHeaderNameTable.h>
+
+using namespace Passenger;
+using namespace Passenger::Core;
+using namespace Passenger::ServerKit;
+using namespace std;
+
+namespace tut {
+	struct Core_CgiHeaderNameTableTest {
+		CgiHeaderNameTable table;
+		psg_pool_t *pool;
+		HeaderTable headers;
+		char initialBuffer[1024];
+
+		Core_CgiHeaderNameTableTest() {
+			pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+		}
+
+		~Core_CgiHeaderNameTableTest() {
+			headers.clear();
+			psg_destroy_pool(pool);
+		}
+
+		Header *createHeader(const HashedStaticString &key, const StaticString &val) {
+			Header *header = (Header *) psg_palloc(pool, sizeof(Header));
+			psg_lstr_init(&header->key);
+			psg_lstr_init(&header->origKey);
+			psg_lstr_init(&header->val);
+			psg_lstr_append(&header->key, pool, key.data(), key.size());
+			psg_lstr_append(&header->origKey, pool, key.data(), key.size());
+			psg_lstr_append(&header->val, pool, val.data(), val.size());
+			header->hash = key.hash();
+			return header;
+		}
+
+		void insertHeader(Header *header) {
+			headers.insert(&header, pool);
+		}
+
+		string serialize() {
+			SessionProtocolBuffer buffer(pool, initialBuffer, sizeof(initialBuffer));
+			table.serialize(headers, buffer);
+			return string(buffer.start(), buffer.size());
+		}
+
+		string serializeHeader(const HashedStaticString &key, const StaticString &val) {
+			headers.clear();
+			insertHeader(createHeader(key, val));
+			return serialize();
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_CgiHeaderNameTableTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Common headers are looked up by hash and use the pre-serialized name");
+		Header *header = createHeader("accept-encoding", "gzip");
+		const CgiHeaderNameTable::Entry *entry = table.lookup(header);
+		ensure("(1)", entry != NULL);
+		ensure_equals("(2)", string(entry->cgiName),
+			string(P_STATIC_STRING_WITH_NULL("HTTP_ACCEPT_ENCODING")));
+
+		ensure_equals("(3)", serializeHeader("accept-encoding", "gzip"),
+			P_STATIC_STRING_WITH_NULL("HTTP_ACCEPT_ENCODING") + string("gzip", 5));
+		ensure_equals("(4)", serializeHeader("x-forwarded-proto", "https"),
+			P_STATIC_STRING_WITH_NULL("HTTP_X_FORWARDED_PROTO") + string("https", 6));
+		ensure_equals("(5)", serializeHeader("host", ""),
+			P_STATIC_STRING_WITH_NULL("HTTP_HOST") + string("", 1));
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Other headers are converted at runtime");
+		ensure("(1)", table.lookup(createHeader("x-my-header", "foo")) == NULL);
+		ensure_equals("(2)", serializeHeader("x-my-header", "foo"),
+			P_STATIC_STRING_WITH_NULL("HTTP_X_MY_HEADER") + string("foo", 4));
+		ensure_equals("(3)", serializeHeader("x-4chan-id", "1"),
+			P_STATIC_STRING_WITH_NULL("HTTP_X_4CHAN_ID") + string("1", 2));
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Header names that consist of multiple parts are converted correctly");
+		Header *header = (Header *) psg_palloc(pool, sizeof(Header));
+		psg_lstr_init(&header->key);
+		psg_lstr_init(&header->origKey);
+		psg_lstr_init(&header->val);
+		psg_lstr_append(&header->key, pool, "x-my-");
+		psg_lstr_append(&header->key, pool, "header");
+		psg_lstr_append(&header->val, pool, "f");
+		psg_lstr_append(&header->val, pool, "oo");
+		header->hash = HashedStaticString("x-my-header").hash();
+		insertHeader(header);
+
+		ensure_equals(serialize(),
+			P_STATIC_STRING_WITH_NULL("HTTP_X_MY_HEADER") + string("foo", 4));
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Headers that the session protocol passes in another way are skipped");
+		ensure("(1)", table.lookup(createHeader("content-length", "1")) != NULL);
+		ensure_equals("(2)", serializeHeader("content-length", "1"), "");
+		ensure_equals("(3)", serializeHeader("content-type", "text/plain"), "");
+		ensure_equals("(4)", serializeHeader("connection", "close"), "");
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Header names with characters other than alphanumerics and dashes are skipped");
+		ensure_equals("(1)", serializeHeader("x_my_header", "foo"), "");
+		ensure_equals("(2)", serializeHeader("x.my.header", "foo"), "");
+		ensure_equals("(3)", serializeHeader("x-my-header!", "foo"), "");
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("A header with the hash of a common header but a different name is converted at runtime");
+		Header *header = createHeader("x-not-accept", "foo");
+		header->hash = HashedStaticString("accept").hash();
+		ensure("(1)", table.lookup(header) == NULL);
+		insertHeader(header);
+		ensure_equals("(2)", serialize(),
+			P_STATIC_STRING_WITH_NULL("HTTP_X_NOT_ACCEPT") + string("foo", 4));
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("All headers are serialized");
+		insertHeader(createHeader("host", "foo.com"));
+		insertHeader(createHeader("content-type", "text/plain"));
+		insertHeader(createHeader("x-my-header", "bar"));
+
+		string result = serialize();
+		ensure_equals("(1)", result.size(),
+			sizeof("HTTP_HOST") + sizeof("foo.com")
+			+ sizeof("HTTP_X_MY_HEADER") + sizeof("bar"));
+		ensure("(2)", result.find(P_STATIC_STRING_WITH_NULL("HTTP_HOST")
+			+ string("foo.com", 8)) != string::npos);
+		ensure("(3)", result.find(P_STATIC_STRING_WITH_NULL("HTTP_X_MY_HEADER")
+			+ string("bar", 4)) != string::npos);
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("SessionProtocolBuffer moves to a larger buffer when the initial one is full");
+		char small[8];
+		SessionProtocolBuffer buffer(pool, small, sizeof(small));
+
+		buffer.append("hello", 5);
+		ensure("(1)", !buffer.grown());
+		ensure("(2)", buffer.start() == small);
+
+		char *pos = buffer.appendUninitialized(4);
+		memcpy(pos, "1234", 4);
+		buffer.append(P_STATIC_STRING(" world, this does not fit"));
+		ensure("(3)", buffer.grown());
+		ensure("(4)", buffer.start() != small);
+		ensure_equals("(5)", string(buffer.start(), buffer.size()),
+			"hello1234 world, this does not fit");
+	}
+}
@@ -1,4 +1,6 @@
 #include <TestSupport.h>
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <Constants.h>
 #include <Utils/IOUtils.h>
 #include <Utils/BufferedIO.h>
@@ -19,11 +21,13 @@ namespace tut {
 				ApplicationPool2::GetCallback callback)
 			{
 				callback(sessionToReturn, exceptionToReturn);
-				sessionToReturn.reset();
+				sessionToReturn = nextSessionToReturn;
+				nextSessionToReturn.reset();
 			}
 
 		public:
 			ApplicationPool2::AbstractSessionPtr sessionToReturn;
+			ApplicationPool2::AbstractSessionPtr nextSessionToReturn;
 			ApplicationPool2::ExceptionPtr exceptionToReturn;
 
 			MyController(ServerKit::Context *context, const VariantMap *agentsOptions)
@@ -32,11 +36,13 @@ namespace tut {
 		};
 
 		BackgroundEventLoop bg;
+		boost::scoped_ptr<ServerKit::FileBufferedChannelAccount> responseBufferAccount;
 		ServerKit::Context context;
 		MyController *controller;
 		VariantMap options;
 		int serverSocket;
 		TestSession testSession;
+		TestSession testSession2;
 		FileDescriptor clientConnection;
 		BufferedIO clientConnectionIO;
 		string peerRequestHeader;
@@ -136,6 +142,35 @@ namespace tut {
 			controller->sessionToReturn.reset(&testSession, false);
 		}
 
+		void useTestSessionObjects() {
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_setTestSessionObjects, this));
+		}
+
+		void _setTestSessionObjects() {
+			controller->sessionToReturn.reset(&testSession, false);
+			controller->nextSessionToReturn.reset(&testSession2, false);
+		}
+
+		void setResponseBufferLimit(unsigned int limit) {
+			responseBufferAccount.reset(new ServerKit::FileBufferedChannelAccount(limit));
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_setResponseBufferAccount, this));
+		}
+
+		void _setResponseBufferAccount() {
+			controller->responseBufferAccount = responseBufferAccount.get();
+		}
+
+		Json::Value inspectController() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_inspectController,
+				this, &result));
+			return result;
+		}
+
+		void _inspectController(Json::Value *result) {
+			*result = controller->inspectStateAsJson();
+		}
+
 		MyController::State getServerState() {
 			Controller::State result;
 			bg.safe->runSync(boost::bind(&Core_ControllerTest::_getServerState,
@@ -246,9 +281,60 @@ namespace tut {
 		string readResponseBody() {
 			return clientConnectionIO.readAll();
 		}
+
+		void beginUpgradedConnection(const StaticString &dataAfterResponseHeader = StaticString()) {
+			connectToServer();
+			sendRequest(
+				"GET /hello HTTP/1.1\r\n"
+				"Host: localhost\r\n"
+				"Connection: upgrade\r\n"
+				"Upgrade: text\r\n"
+				"\r\n");
+			waitUntilSessionInitiated();
+			readPeerRequestHeader();
+
+			writeExact(testSession.peerFd(),
+				"HTTP/1.1 101 Switching Protocols\r\n"
+				"Connection: upgrade\r\n"
+				"Upgrade: text\r\n\r\n"
+				+ string(dataAfterResponseHeader));
+			string header = readResponseHeader();
+			ensure("HTTP response OK", containsSubstring(header,
+				"HTTP/1.1 101 Switching Protocols\r\n"));
+		}
+
+		string readFromClientConnection(unsigned int size) {
+			string result(size, '\0');
+			unsigned long long timeout = 5000000;
+			ensure_equals(clientConnectionIO.read(&result[0], size, &timeout), size);
+			return result;
+		}
+
+		string readFromPeerConnection(unsigned int size) {
+			string result(size, '\0');
+			unsigned long long timeout = 5000000;
+			readExact(testSession.peerFd(), &result[0], size, &timeout);
+			return result;
+		}
+
+		void exchangeUpgradedData() {
+			writeExact(clientConnection, "ping");
+			ensure_equals(readFromPeerConnection(4), "ping");
+			writeExact(testSession.peerFd(), "pong");
+			ensure_equals(readFromClientConnection(4), "pong");
+
+			shutdown(clientConnection, SHUT_WR);
+			ensure_equals("The app receives the end of the stream",
+				readAll(testSession.peerFd()), "");
+			testSession.closePeerFd();
+			ensure_equals("The client receives the end of the stream",
+				readResponseBody(), "");
+			waitUntilSessionClosed();
+			ensure("The session is successful", testSession.isSuccessful());
+		}
 	};
 
-	DEFINE_TEST_GROUP(Core_ControllerTest);
+	DEFINE_TEST_GROUP_WITH_LIMIT(Core_ControllerTest, 70);
 
 
 	/***** Passing request information to the app *****/
@@ -408,6 +494,50 @@ namespace tut {
 	}
 
 
+	/***** Upgraded connections *****/
+
+	TEST_METHOD(14) {
+		set_test_name("Upgraded connections are relayed with splice() once no data is buffered");
+
+		init();
+		useTestSessionObject();
+		beginUpgradedConnection();
+		if (ServerKit::SpliceTunnel::isSupported()) {
+			EVENTUALLY(5,
+				result = inspectController()["splice_tunnels"].asUInt() == 1;
+			);
+		}
+		exchangeUpgradedData();
+	}
+
+	TEST_METHOD(15) {
+		set_test_name("Data that the app sends along with the upgrade response is"
+			" forwarded before switching to splice()");
+
+		init();
+		useTestSessionObject();
+		beginUpgradedConnection("hello");
+		ensure_equals(readFromClientConnection(5), "hello");
+		if (ServerKit::SpliceTunnel::isSupported()) {
+			EVENTUALLY(5,
+				result = inspectController()["splice_tunnels"].asUInt() == 1;
+			);
+		}
+		exchangeUpgradedData();
+	}
+
+	TEST_METHOD(16) {
+		set_test_name("Upgraded connections are relayed through channels if"
+			" splice tunneling is disabled");
+
+		options.setBool("core_splice_tunneling", false);
+		init();
+		useTestSessionObject();
+		beginUpgradedConnection();
+		exchangeUpgradedData();
+		ensure_equals(inspectController()["splice_tunnels"].asUInt(), 0u);
+	}
+
 	/***** Application connection keep-alive *****/
 
 	TEST_METHOD(20) {
@@ -853,4 +983,147 @@ namespace tut {
 		string header = readResponseHeader();
 		ensure(containsSubstring(header, "HTTP/1.1 502"));
 	}
+
+
+	/***** Response buffering *****/
+
+	static void writeResponseInBackground(int fd, string data) {
+		writeExact(fd, data);
+	}
+
+	TEST_METHOD(50) {
+		set_test_name("If the global response buffer limit is reached, then the application"
+			" socket of a client that buffers more than its fair share is throttled"
+			" until the client has received all buffered data");
+
+		options.setInt("response_buffer_high_watermark", 0);
+		init();
+		setResponseBufferLimit(64 * 1024);
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+
+		string body(4 * 1024 * 1024, 'x');
+		boost::thread writer(boost::bind(writeResponseInBackground,
+			testSession.peerFd(),
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Content-Length: " + toString(body.size()) + "\r\n\r\n"
+			+ body));
+		EVENTUALLY(5,
+			result = inspectController()["response_buffer"]["fair_share_throttles"].asUInt() > 0;
+		);
+		ensure(responseBufferAccount->getBytesBuffered() > 0);
+
+		string header = readResponseHeader();
+		string receivedBody = readResponseBody();
+		writer.join();
+		ensure(containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure_equals(receivedBody.size(), body.size());
+		EVENTUALLY(5,
+			result = responseBufferAccount->getBytesBuffered() == 0;
+		);
+	}
+
+
+	/***** Idle client parking *****/
+
+	TEST_METHOD(60) {
+		set_test_name("Idle keep-alive clients are parked and /server.json reports "
+			"the memory used per idle client");
+
+		init();
+		bg.safe->runSync(boost::bind(&MyController::setClientParkingDelay,
+			controller, 0.01));
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"ok");
+		string header = readResponseHeader();
+		ensure("(1)", !containsSubstring(header, "Connection: close"));
+		ensure_equals("(2)", readFromClientConnection(2), "ok");
+
+		EVENTUALLY(5,
+			result = inspectController()["parked_client_count"].asUInt() == 1;
+		);
+		Json::Value doc = inspectController();
+		ensure_equals("(3)", doc["active_client_count"].asUInt(), 0u);
+		ensure("(4)", doc["idle_client_memory"]["per_unparked_client"]["bytes"].asUInt()
+			> 10 * doc["idle_client_memory"]["per_parked_client"]["bytes"].asUInt());
+
+		// The Controller handles the next request after unparking the client.
+		sendRequest("invalid\r\n\r\n");
+		header = readResponseHeader();
+		ensure("(5)", containsSubstring(header, " 400 Bad Request\r\n"));
+		ensure_equals("(6)", inspectController()["total_clients_unparked"].asUInt(), 1u);
+	}
+
+
+	/***** Pipelined request handling *****/
+
+	TEST_METHOD(65) {
+		set_test_name("Pipelined requests are forwarded to the application concurrently, "
+			"each with its own session, and responses are sent in request order");
+
+		init();
+		controller->pipelineDepth = 4;
+		useTestSessionObjects();
+		testSession.setProtocol("http_session");
+		testSession2.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"GET /one HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n"
+			"GET /two HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		EVENTUALLY(5,
+			result = testSession2.fd() != -1;
+		);
+		ensure("(1)", startsWith(readHeader(testSession.getPeerBufferedIO()), "GET /one "));
+		ensure("(2)", startsWith(readHeader(testSession2.getPeerBufferedIO()), "GET /two "));
+
+		writeExact(testSession2.peerFd(),
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 3\r\n\r\n"
+			"two");
+		testSession2.closePeerFd();
+		SHOULD_NEVER_HAPPEN(100,
+			unsigned long long timeout = 0;
+			result = waitUntilReadable(clientConnection, &timeout);
+		);
+
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 3\r\n\r\n"
+			"one");
+		string data = readAll(clientConnection);
+		string::size_type pos1 = data.find("\r\n\r\none");
+		string::size_type pos2 = data.find("\r\n\r\ntwo");
+		ensure("(3)", pos1 != string::npos);
+		ensure("(4)", pos2 != string::npos);
+		ensure("(5)", pos1 < pos2);
+		ensure_equals("(6)", inspectController()["total_requests_pipelined"].asUInt(), 1u);
+	}
 }
@@ -69,6 +69,60 @@
 		return getgrgid(gid)->gr_name;
 	}
 
+	struct AsyncSpawnOutcomes {
+		boost::mutex syncher;
+		vector<Result> results;
+		vector<SpawnException::ErrorKind> errors;
+		bool calledOnCallerThread;
+
+		AsyncSpawnOutcomes()
+			: calledOnCallerThread(false)
+			{ }
+
+		unsigned int count() {
+			boost::lock_guard<boost::mutex> l(syncher);
+			return results.size() + errors.size();
+		}
+	};
+
+	static void storeAsyncSpawnOutcome(AsyncSpawnOutcomes *outcomes, pthread_t callerThread,
+		const Result &result, const SpawnException *e)
+	{
+		boost::lock_guard<boost::mutex> l(outcomes->syncher);
+		if (e == NULL) {
+			outcomes->results.push_back(result);
+		} else {
+			outcomes->errors.push_back(e->getErrorKind());
+		}
+		if (pthread_equal(pthread_self(), callerThread)) {
+			outcomes->calledOnCallerThread = true;
+		}
+	}
+
+	struct CancellationGate {
+		boost::mutex syncher;
+		boost::condition_variable cond;
+		bool spawnScheduled;
+		bool cancelled;
+
+		CancellationGate()
+			: spawnScheduled(false),
+			  cancelled(false)
+			{ }
+	};
+
+	// Runs on the negotiation loop, so the negotiation that is scheduled
+	// in the meantime can't begin until this returns.
+	static void cancelOnceSpawnScheduled(CancellationGate *gate, Spawner *spawner) {
+		boost::unique_lock<boost::mutex> l(gate->syncher);
+		while (!gate->spawnScheduled) {
+			gate->cond.wait(l);
+		}
+		spawner->cancelAsyncSpawns();
+		gate->cancelled = true;
+		gate->cond.notify_all();
+	}
+
 	TEST_METHOD(1) {
 		set_test_name("Basic spawning test");
 		Options options = createOptions();
@@ -316,6 +370,113 @@
 		ensure_equals(result["code_revision"].asString(), "today");
 	}
 
+	TEST_METHOD(13) {
+		set_test_name("It reports the durations of the spawn phases");
+		Options options = createOptions();
+		options.appRoot      = "stub/rack";
+		options.startCommand = "ruby\t" "start.rb";
+		options.startupFile  = "start.rb";
+		SpawnerPtr spawner = createSpawner(options);
+		unsigned long long startTime = SystemTime::getUsec();
+		result = spawner->spawn(options);
+		unsigned long long endTime = SystemTime::getUsec();
+
+		ensure("(1)", result.isMember("spawn_fork_duration"));
+		ensure("(2)", result.isMember("spawn_app_load_duration"));
+		ensure("(3)", result.isMember("spawn_socket_ready_duration"));
+		ensure("(4)", result["spawn_start_time"].asUInt64() >= startTime);
+		ensure("(5)", result["spawn_app_load_duration"].asUInt64() > 0);
+		ensure("(6)", result["spawn_fork_duration"].asUInt64()
+			+ result["spawn_app_load_duration"].asUInt64()
+			+ result["spawn_socket_ready_duration"].asUInt64()
+			<= endTime - startTime);
+	}
+
+	TEST_METHOD(14) {
+		set_test_name("Asynchronous spawns are negotiated concurrently on the "
+			"negotiation loop");
+		Options options = createOptions();
+		options.appRoot      = "stub/rack";
+		options.startCommand = "ruby\t" "start.rb";
+		options.startupFile  = "start.rb";
+		SpawnerPtr spawner = createSpawner(options);
+		AsyncSpawnOutcomes outcomes;
+
+		for (unsigned int i = 0; i < 3; i++) {
+			spawner->asyncSpawn(options, boost::bind(storeAsyncSpawnOutcome,
+				&outcomes, pthread_self(), _1, _2));
+		}
+		EVENTUALLY(15,
+			result = outcomes.count() == 3;
+		);
+
+		boost::lock_guard<boost::mutex> l(outcomes.syncher);
+		ensure_equals("(1)", outcomes.errors.size(), 0u);
+		ensure("(2)", !outcomes.calledOnCallerThread);
+		set<int> pids;
+		foreach (const Result &asyncResult, outcomes.results) {
+			ensure("(3)", asyncResult.isMember("spawn_app_load_duration"));
+			pids.insert(asyncResult["pid"].asInt());
+			FileDescriptor fd(connectToServer(asyncResult["sockets"][0]["address"].asCString(),
+				__FILE__, __LINE__), NULL, 0);
+			writeExact(fd, "ping\n");
+			ensure_equals("(4)", readAll(fd), "pong\n");
+		}
+		ensure_equals("(5)", pids.size(), 3u);
+	}
+
+	TEST_METHOD(15) {
+		set_test_name("Asynchronous spawns report errors through the callback");
+		Options options = createOptions();
+		options.appRoot      = "stub";
+		options.startCommand = "perl\t" "start_error.pl";
+		options.startupFile  = "start_error.pl";
+		SpawnerPtr spawner = createSpawner(options);
+		AsyncSpawnOutcomes outcomes;
+		setLogLevel(LVL_CRIT);
+
+		spawner->asyncSpawn(options, boost::bind(storeAsyncSpawnOutcome,
+			&outcomes, pthread_self(), _1, _2));
+		EVENTUALLY(5,
+			result = outcomes.count() == 1;
+		);
+
+		boost::lock_guard<boost::mutex> l(outcomes.syncher);
+		ensure_equals(outcomes.errors.size(), 1u);
+		ensure_equals(outcomes.errors[0], SpawnException::APP_STARTUP_EXPLAINABLE_ERROR);
+	}
+
+	TEST_METHOD(16) {
+		set_test_name("Cancelling asynchronous spawns also cancels negotiations that"
+			" haven't begun yet, and doesn't call their callbacks");
+		Options options = createOptions();
+		options.appRoot      = "stub/rack";
+		options.startCommand = "ruby\t" "start.rb";
+		options.startupFile  = "start.rb";
+		SpawnerPtr spawner = createSpawner(options);
+		AsyncSpawnOutcomes outcomes;
+		CancellationGate gate;
+
+		config->negotiationLoop->get()->safe->runLater(
+			boost::bind(cancelOnceSpawnScheduled, &gate, spawner.get()));
+		spawner->asyncSpawn(options, boost::bind(storeAsyncSpawnOutcome,
+			&outcomes, pthread_self(), _1, _2));
+		{
+			boost::unique_lock<boost::mutex> l(gate.syncher);
+			gate.spawnScheduled = true;
+			gate.cond.notify_all();
+			while (!gate.cancelled) {
+				gate.cond.wait(l);
+			}
+		}
+		// The cancelled negotiation must not refer to the spawner anymore.
+		spawner.reset();
+
+		SHOULD_NEVER_HAPPEN(1000,
+			result = outcomes.count() > 0;
+		);
+	}
+
 	/******* User switching tests *******/
 
 	// If 'user' is set
@@ -120,4 +120,22 @@ namespace tut {
 			ensure(swap < 10000 || swap == -1);
 		#endif
 	}
+
+	TEST_METHOD(4) {
+		// Measuring shared and private memory usage works.
+		ProcessMetrics metrics;
+		child = spawnChild(50);
+		usleep(500000);
+		collector.measureRealMemory(child, metrics);
+		#ifdef __linux__
+			ensure("Shared memory is measured", metrics.sharedMemory() >= 0);
+			ensure("Private memory is measured",
+				metrics.privateMemory() > 50000 && metrics.privateMemory() < 70000);
+			ensure("Private memory includes private dirty memory",
+				metrics.privateMemory() >= metrics.privateDirty);
+		#else
+			ensure(metrics.sharedMemory() >= 0 || metrics.sharedMemory() == -1);
+			ensure(metrics.privateMemory() >= 0 || metrics.privateMemory() == -1);
+		#endif
+	}
 }
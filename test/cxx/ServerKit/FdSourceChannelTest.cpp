@@ -0,0 +1,280 @@
+#include <TestSupport.h>
+#include <boost/thread.hpp>
+#include <string>
+#include <BackgroundEventLoop.h>
+#include <Constants.h>
+#include <Logging.h>
+#include <StaticString.h>
+#include <FileDescriptor.h>
+#include <ServerKit/FdSourceChannel.h>
+#include <Utils/IOUtils.h>
+#include <Utils/StrIntUtils.h>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace Passenger::MemoryKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_FdSourceChannelTest: public ServerKit::Hooks {
+		BackgroundEventLoop bg;
+		ServerKit::Context context;
+		FdSourceChannel channel;
+		SocketPair sockets;
+		boost::mutex syncher;
+		string received;
+		unsigned int counter;
+		bool consumeAsynchronously;
+		bool eof;
+
+		ServerKit_FdSourceChannelTest()
+			: bg(false, true),
+			  context(bg.safe, bg.libuv_loop),
+			  channel(&context),
+			  counter(0),
+			  consumeAsynchronously(false),
+			  eof(false)
+		{
+			channel.setDataCallback(dataCallback);
+			channel.setHooks(this);
+			Hooks::impl = NULL;
+			Hooks::userData = NULL;
+			sockets = createUnixSocketPair(__FILE__, __LINE__);
+			setNonBlocking(sockets.first);
+		}
+
+		~ServerKit_FdSourceChannelTest() {
+			if (!bg.isStarted()) {
+				bg.start();
+			}
+			bg.safe->runSync(boost::bind(&ServerKit_FdSourceChannelTest::deinitializeChannel,
+				this));
+			bg.stop();
+			setLogLevel(DEFAULT_LOG_LEVEL);
+		}
+
+		void deinitializeChannel() {
+			channel.deinitialize();
+		}
+
+		static Channel::Result dataCallback(Channel *_channel, const mbuf &buffer, int errcode) {
+			FdSourceChannel *channel = reinterpret_cast<FdSourceChannel *>(_channel);
+			ServerKit_FdSourceChannelTest *self = (ServerKit_FdSourceChannelTest *)
+				channel->getHooks();
+			boost::lock_guard<boost::mutex> l(self->syncher);
+			if (errcode == 0) {
+				if (buffer.empty()) {
+					self->eof = true;
+				} else {
+					self->counter++;
+					self->received.append(buffer.start, buffer.size());
+				}
+			}
+			if (self->consumeAsynchronously && !buffer.empty()) {
+				self->bg.safe->runLater(boost::bind(
+					&ServerKit_FdSourceChannelTest::consumeLater, self,
+					(unsigned int) buffer.size()));
+				return Channel::Result(-1, false);
+			} else {
+				return Channel::Result(buffer.size(), false);
+			}
+		}
+
+		void consumeLater(unsigned int size) {
+			channel.consumed(size, false);
+		}
+
+		void startReading(unsigned int maxScatterBuffers) {
+			context.defaultFdSourceChannelConfig.maxScatterBuffers = maxScatterBuffers;
+			bg.start();
+			bg.safe->runSync(boost::bind(&ServerKit_FdSourceChannelTest::_startReading,
+				this));
+		}
+
+		void _startReading() {
+			channel.reinitialize(sockets.first);
+			channel.startReading();
+		}
+
+		unsigned int getReadCalls() {
+			unsigned int result;
+			bg.safe->runSync(boost::bind(&ServerKit_FdSourceChannelTest::_getReadCalls,
+				this, &result));
+			return result;
+		}
+
+		void _getReadCalls(unsigned int *result) {
+			*result = channel.getReadCalls();
+		}
+
+		Json::Value inspectChannel() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&ServerKit_FdSourceChannelTest::_inspectChannel,
+				this, &result));
+			return result;
+		}
+
+		void _inspectChannel(Json::Value *result) {
+			*result = channel.inspectAsJson();
+		}
+
+		string generateData(unsigned int size) {
+			string result;
+			result.reserve(size);
+			for (unsigned int i = 0; i < size; i++) {
+				result.append(1, (char) ('a' + i % 26));
+			}
+			return result;
+		}
+
+		void transfer(const string &data) {
+			writeExact(sockets.second, data);
+			sockets.second.close();
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_FdSourceChannelTest);
+
+	#define LOCK() boost::unique_lock<boost::mutex> l(syncher)
+
+
+	TEST_METHOD(1) {
+		set_test_name("It passes data read from the file descriptor to the callback, followed by EOF");
+
+		startReading(FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS);
+		writeExact(sockets.second, "hello");
+		EVENTUALLY(5,
+			LOCK();
+			result = received == "hello";
+		);
+		sockets.second.close();
+		EVENTUALLY(5,
+			LOCK();
+			result = eof;
+		);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("In scatter mode, it fills multiple mbufs per read call");
+
+		string data = generateData(1024 * 1024);
+		startReading(FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS);
+		transfer(data);
+		EVENTUALLY(5,
+			LOCK();
+			result = eof;
+		);
+
+		unsigned int readCalls = getReadCalls();
+		LOCK();
+		ensure("All data is received in order", received == data);
+		ensure("Fewer read calls than buffers passed to the callback",
+			readCalls < counter);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("When scatter reads are disabled, it reads one mbuf per read call");
+
+		string data = generateData(64 * 1024);
+		startReading(1);
+		transfer(data);
+		EVENTUALLY(5,
+			LOCK();
+			result = eof;
+		);
+
+		unsigned int readCalls = getReadCalls();
+		LOCK();
+		ensure("All data is received in order", received == data);
+		ensure("At least one read call per buffer passed to the callback",
+			readCalls >= counter);
+		ensure_equals(inspectChannel()["scatter_buffers"].asUInt(), 1u);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Scatter mode needs fewer read calls than single-buffer mode for bulk transfers");
+
+		string data = generateData(1024 * 1024);
+		startReading(1);
+		transfer(data);
+		EVENTUALLY(5,
+			LOCK();
+			result = eof;
+		);
+		unsigned int singleReadCalls = getReadCalls();
+
+		bg.safe->runSync(boost::bind(&ServerKit_FdSourceChannelTest::deinitializeChannel,
+			this));
+		sockets = createUnixSocketPair(__FILE__, __LINE__);
+		setNonBlocking(sockets.first);
+		{
+			LOCK();
+			received.clear();
+			counter = 0;
+			eof = false;
+		}
+		context.defaultFdSourceChannelConfig.maxScatterBuffers =
+			FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS;
+		bg.safe->runSync(boost::bind(&ServerKit_FdSourceChannelTest::_startReading,
+			this));
+		transfer(data);
+		EVENTUALLY(5,
+			LOCK();
+			result = eof;
+		);
+		unsigned int scatterReadCalls = getReadCalls();
+
+		LOCK();
+		ensure("All data is received in order", received == data);
+		ensure("Scatter mode makes at most half as many read calls (" +
+			toString(scatterReadCalls) + " vs " + toString(singleReadCalls) + ")",
+			scatterReadCalls * 2 <= singleReadCalls);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("If the callback consumes asynchronously, then the remainder of a scatter"
+			" read is fed after consumption, even if no more data arrives on the file descriptor");
+
+		string data = generateData(32 * 1024);
+		consumeAsynchronously = true;
+		startReading(FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS);
+		writeExact(sockets.second, data);
+		EVENTUALLY(5,
+			LOCK();
+			result = received == data;
+		);
+		sockets.second.close();
+		EVENTUALLY(5,
+			LOCK();
+			result = eof;
+		);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("The number of scatter buffers grows during bulk transfers"
+			" and shrinks again when only small messages arrive");
+
+		string data = generateData(256 * 1024);
+		startReading(FD_SOURCE_CHANNEL_MAX_SCATTER_BUFFERS);
+		writeExact(sockets.second, data);
+		EVENTUALLY(5,
+			LOCK();
+			result = received.size() == data.size();
+		);
+		ensure(inspectChannel()["scatter_buffers"].asUInt() > 1);
+
+		for (unsigned int i = 0; i < 10; i++) {
+			unsigned int size;
+			{
+				LOCK();
+				size = received.size();
+			}
+			writeExact(sockets.second, "x");
+			EVENTUALLY(5,
+				LOCK();
+				result = received.size() == size + 1;
+			);
+		}
+		ensure_equals(inspectChannel()["scatter_buffers"].asUInt(), 1u);
+	}
+}
@@ -1,5 +1,6 @@
 #include <TestSupport.h>
 #include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <string>
 #include <BackgroundEventLoop.h>
 #include <Constants.h>
@@ -18,6 +19,7 @@ namespace tut {
 
 	struct ServerKit_FileBufferedChannelTest: public ServerKit::Hooks {
 		BackgroundEventLoop bg;
+		boost::scoped_ptr<FileBufferedChannelMemoryTier> memoryTier;
 		ServerKit::Context context;
 		FileBufferedChannel channel;
 		boost::mutex syncher;
@@ -178,6 +180,47 @@ namespace tut {
 			*result = channel.getBytesBuffered();
 		}
 
+		Json::Value inspectContext() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&ServerKit_FileBufferedChannelTest::_inspectContext,
+				this, &result));
+			return result;
+		}
+
+		void _inspectContext(Json::Value *result) {
+			*result = context.inspectStateAsJson();
+		}
+
+		void feedDeinitializeAndShutdownIoUring(const string &data) {
+			bg.safe->runSync(boost::bind(
+				&ServerKit_FileBufferedChannelTest::_feedDeinitializeAndShutdownIoUring,
+				this, data));
+		}
+
+		void _feedDeinitializeAndShutdownIoUring(string data) {
+			_feedChannel(data);
+			channel.deinitialize();
+			if (context.getIoUring() != NULL) {
+				context.getIoUring()->shutdown();
+			}
+		}
+
+		void setChannelAccount(FileBufferedChannelAccount *account) {
+			bg.safe->runSync(boost::bind(&FileBufferedChannel::setAccount, &channel, account));
+		}
+
+		void enableMemoryTier(unsigned int limit) {
+			memoryTier.reset(new FileBufferedChannelMemoryTier(limit));
+			context.defaultFileBufferedChannelConfig.memoryTier = memoryTier.get();
+		}
+
+		void _feedSecondChannel(FileBufferedChannel *channel2) {
+			channel2->setDataCallback(dataCallback);
+			channel2->setHooks(this);
+			channel2->feed("x");
+			channel2->feed("abc");
+		}
+
 		void channelEnableAutoStartMover(bool enabled) {
 			bg.safe->runSync(boost::bind(&ServerKit_FileBufferedChannelTest::_channelEnableAutoStartMover,
 				this, enabled));
@@ -609,6 +652,7 @@ namespace tut {
 		// Setup a FileBufferedChannel in the in-file mode.
 		toConsume = -1;
 		context.defaultFileBufferedChannelConfig.threshold = 1;
+		context.defaultFileBufferedChannelConfig.useIoUring = false;
 		startLoop();
 		feedChannel("hello");
 		feedChannel("world!");
@@ -995,4 +1039,289 @@ namespace tut {
 			ensure_equals(counter, 2u);
 		}
 	}
+
+
+	/***** Buffer file I/O *****/
+
+	TEST_METHOD(50) {
+		set_test_name("If io_uring is available, buffer file I/O is performed through it");
+
+		toConsume = -1;
+		context.defaultFileBufferedChannelConfig.threshold = 1;
+		startLoop();
+
+		feedChannel("hello");
+		feedChannel("world!");
+		EVENTUALLY(5,
+			result = getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+		);
+		channelConsumed(sizeof("hello") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = log ==
+				"Data: hello\n"
+				"Data: world!\n";
+		);
+
+		Json::Value doc = inspectContext();
+		ensure("The io_uring was set up", doc.isMember("io_uring"));
+		if (doc["io_uring"]["available"].asBool()) {
+			EVENTUALLY(5,
+				result = inspectContext()["io_uring"]["completions"].asUInt64() > 0;
+			);
+		}
+	}
+
+	TEST_METHOD(51) {
+		set_test_name("If io_uring is disabled, buffer file I/O is performed through libuv");
+
+		toConsume = -1;
+		context.defaultFileBufferedChannelConfig.threshold = 1;
+		context.defaultFileBufferedChannelConfig.useIoUring = false;
+		startLoop();
+
+		feedChannel("hello");
+		feedChannel("world!");
+		EVENTUALLY(5,
+			result = getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+		);
+		channelConsumed(sizeof("hello") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = log ==
+				"Data: hello\n"
+				"Data: world!\n";
+		);
+		ensure("The io_uring was never set up", !inspectContext().isMember("io_uring"));
+	}
+
+	TEST_METHOD(52) {
+		set_test_name("Shutting down the io_uring waits for in-flight operations"
+			" and releases their buffers");
+
+		toConsume = -1;
+		context.defaultFileBufferedChannelConfig.threshold = 1;
+		startLoop();
+
+		feedChannel("hello");
+		EVENTUALLY(5,
+			result = getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+		);
+		// Queues a write to the buffer file, which is then canceled.
+		feedDeinitializeAndShutdownIoUring("world");
+
+		Json::Value doc = inspectContext();
+		ensure("The io_uring was shut down", !doc["io_uring"]["available"].asBool());
+		ensure_equals("No mbuf blocks are held by operations",
+			doc["mbuf_pool"]["active_blocks"].asUInt(), 0u);
+	}
+
+	TEST_METHOD(53) {
+		set_test_name("Test 34, but with buffer file I/O performed through io_uring");
+
+		// Setup a FileBufferedChannel in the in-file mode.
+		toConsume = -1;
+		context.defaultFileBufferedChannelConfig.threshold = 1;
+		startLoop();
+		feedChannel("hello");
+		feedChannel("world!");
+		EVENTUALLY(5,
+			result = getChannelMode() == FileBufferedChannel::IN_FILE_MODE;
+		);
+		EVENTUALLY(5,
+			result = getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+		);
+		ensure_equals(getChannelBytesBuffered(), 0u);
+		{
+			LOCK();
+			ensure_equals(log, "Data: hello\n");
+		}
+
+		// Consume the initial "hello" so that the FileBufferedChannel starts
+		// reading "world" from disk.
+		context.defaultFileBufferedChannelConfig.maxDiskChunkReadSize = sizeof("world") - 1;
+		channelConsumed(sizeof("hello") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = log ==
+				"Data: hello\n"
+				"Data: world\n";
+		);
+		// We haven't consumed "world" yet, so the FileBufferedChannel should
+		// be waiting for it to become idle.
+		EVENTUALLY(5,
+			result = getChannelReaderState() == FileBufferedChannel::RS_WAITING_FOR_CHANNEL_IDLE;
+		);
+
+		// Now consume "world".
+		channelConsumed(sizeof("world") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = log ==
+				"Data: hello\n"
+				"Data: world\n"
+				"Data: !\n";
+		);
+		// We haven't consumed "!" yet, so the FileBufferedChannel should
+		// be waiting for it to become idle.
+		EVENTUALLY(5,
+			result = getChannelReaderState() == FileBufferedChannel::RS_WAITING_FOR_CHANNEL_IDLE;
+		);
+
+		// Now consume "!".
+		channelConsumed(sizeof("!") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = log ==
+				"Data: hello\n"
+				"Data: world\n"
+				"Data: !\n";
+		);
+	}
+
+
+	/***** Memory tier *****/
+
+	TEST_METHOD(55) {
+		set_test_name("If a memory tier is configured, then data beyond the threshold"
+			" is buffered in memory for as long as the memory tier's budget permits");
+
+		toConsume = -1;
+		context.defaultFileBufferedChannelConfig.threshold = 1;
+		enableMemoryTier(1024);
+		startLoop();
+
+		feedChannel("hello");
+		feedChannel("world");
+		EVENTUALLY(5,
+			result = getChannelBytesBuffered() == sizeof("world") - 1;
+		);
+		ensure_equals(getChannelMode(), FileBufferedChannel::IN_MEMORY_MODE);
+		ensure_equals("The bytes beyond the threshold are charged to the memory tier",
+			memoryTier->getUsed(), sizeof("world") - 1 - 1);
+		ensure_equals(inspectContext()["file_buffer_memory_tier"]["used"]["bytes"].asUInt(),
+			sizeof("world") - 1 - 1);
+
+		channelConsumed(sizeof("hello") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = log ==
+				"Data: hello\n"
+				"Data: world\n";
+		);
+		ensure_equals("The charges are released when the buffers are consumed",
+			memoryTier->getUsed(), 0u);
+		ensure_equals(getChannelMode(), FileBufferedChannel::IN_MEMORY_MODE);
+	}
+
+	TEST_METHOD(56) {
+		set_test_name("If the memory tier's budget is exhausted, then it switches to the in-file mode");
+
+		toConsume = -1;
+		context.defaultFileBufferedChannelConfig.threshold = 1;
+		enableMemoryTier(sizeof("world") - 1 - 1);
+		startLoop();
+
+		feedChannel("hello");
+		feedChannel("world");
+		EVENTUALLY(5,
+			result = getChannelBytesBuffered() == sizeof("world") - 1;
+		);
+		ensure_equals(getChannelMode(), FileBufferedChannel::IN_MEMORY_MODE);
+
+		feedChannel("!");
+		EVENTUALLY(5,
+			result = getChannelMode() == FileBufferedChannel::IN_FILE_MODE;
+		);
+		EVENTUALLY(5,
+			result = getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+		);
+		ensure_equals("The charges are released when the buffers are moved to disk",
+			memoryTier->getUsed(), 0u);
+		ensure(inspectContext()["file_buffer_memory_tier"]["exhausted"].asUInt() > 0);
+
+		channelConsumed(sizeof("hello") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = log ==
+				"Data: hello\n"
+				"Data: world!\n";
+		);
+	}
+
+	TEST_METHOD(57) {
+		set_test_name("The memory tier's budget is shared by all channels");
+
+		FileBufferedChannel channel2(&context);
+		toConsume = -1;
+		context.defaultFileBufferedChannelConfig.threshold = 1;
+		enableMemoryTier(sizeof("world") - 1);
+		startLoop();
+
+		feedChannel("hello");
+		feedChannel("world");
+		EVENTUALLY(5,
+			result = memoryTier->getUsed() == sizeof("world") - 1 - 1;
+		);
+
+		bg.safe->runSync(boost::bind(&ServerKit_FileBufferedChannelTest::_feedSecondChannel,
+			this, &channel2));
+		ensure_equals("The second channel cannot charge beyond the remaining budget",
+			channel2.getMode(), FileBufferedChannel::IN_FILE_MODE);
+		bg.safe->runSync(boost::bind(&FileBufferedChannel::deinitialize, &channel2));
+	}
+
+
+	/***** Accounting *****/
+
+	TEST_METHOD(60) {
+		set_test_name("It reports the bytes that it buffers in memory and on disk to its account");
+
+		FileBufferedChannelAccount account;
+		toConsume = -1;
+		context.defaultFileBufferedChannelConfig.threshold = 1;
+		startLoop();
+		setChannelAccount(&account);
+
+		feedChannel("hello");
+		feedChannel("world");
+		EVENTUALLY(5,
+			result = getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+		);
+		ensure_equals("'world' is buffered on disk",
+			account.getBytesBuffered(), sizeof("world") - 1u);
+		ensure_equals(account.getBufferingChannels(), 1u);
+
+		channelConsumed(sizeof("hello") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = log ==
+				"Data: hello\n"
+				"Data: world\n";
+		);
+		ensure_equals(account.getBytesBuffered(), 0u);
+		ensure_equals(account.getBufferingChannels(), 0u);
+	}
+
+	TEST_METHOD(61) {
+		set_test_name("Upon deinitialization, it removes its buffered bytes from its account");
+
+		FileBufferedChannelAccount account(1);
+		toConsume = -1;
+		startLoop();
+		setChannelAccount(&account);
+
+		feedChannel("hello");
+		feedChannel("world");
+		EVENTUALLY(5,
+			result = account.getBytesBuffered() == sizeof("world") - 1;
+		);
+		ensure("The account is under pressure", account.isUnderPressure());
+
+		bg.safe->runSync(boost::bind(&ServerKit_FileBufferedChannelTest::deinitializeChannel,
+			this));
+		ensure_equals(account.getBytesBuffered(), 0u);
+		ensure_equals(account.getBufferingChannels(), 0u);
+		ensure(!account.isUnderPressure());
+	}
 }
@@ -0,0 +1,413 @@
+#include <TestSupport.h>
+#include <BackgroundEventLoop.h>
+#include <ServerKit/Context.h>
+#include <ServerKit/HttpRequest.h>
+#include <ServerKit/HttpHeaderParser.h>
+#include <ServerKit/HttpHeaderScanner.h>
+#include <Utils/StrIntUtils.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace Passenger::MemoryKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_HttpHeaderParserTest {
+		BackgroundEventLoop bg;
+		ServerKit::Context context;
+		vector<const HttpHeaderScanner *> scanners;
+		unsigned int randomState;
+		bool usedFastPath;
+
+		ServerKit_HttpHeaderParserTest()
+			: bg(false, true),
+			  context(bg.safe, bg.libuv_loop),
+			  randomState(1234)
+		{
+			context.secureModePassword = "secret";
+			scanners.push_back(HttpHeaderScanner::scalar());
+			if (HttpHeaderScanner::sse42() != NULL) {
+				scanners.push_back(HttpHeaderScanner::sse42());
+			}
+			if (HttpHeaderScanner::avx2() != NULL) {
+				scanners.push_back(HttpHeaderScanner::avx2());
+			}
+		}
+
+		static string lstrToString(const LString *str) {
+			string result;
+			const LString::Part *part = str->start;
+			while (part != NULL) {
+				result.append(part->data, part->size);
+				part = part->next;
+			}
+			return result;
+		}
+
+		static string describeHeaders(const HeaderTable &table) {
+			vector<string> headers;
+			HeaderTable::ConstIterator it(table);
+			while (*it != NULL) {
+				const Header *header = it->header;
+				headers.push_back(
+					lstrToString(&header->origKey) + "|" +
+					lstrToString(&header->key) + "|" +
+					lstrToString(&header->val) + "|" +
+					toString(header->hash));
+				it.next();
+			}
+			std::sort(headers.begin(), headers.end());
+
+			string result;
+			for (unsigned int i = 0; i < headers.size(); i++) {
+				result.append("  ");
+				result.append(headers[i]);
+				result.append("\n");
+			}
+			return result;
+		}
+
+		static void deinitializeHeaders(HeaderTable &table) {
+			HeaderTable::Iterator it(table);
+			while (*it != NULL) {
+				psg_lstr_deinit(&it->header->key);
+				psg_lstr_deinit(&it->header->origKey);
+				psg_lstr_deinit(&it->header->val);
+				it.next();
+			}
+		}
+
+		/**
+		 * Parses the given data as a request header with the given scanner
+		 * (or with http_parser only, if NULL), and returns a description
+		 * of everything that the parser produced.
+		 */
+		string parse(const string &data, const HttpHeaderScanner *scanner) {
+			HttpRequest req;
+			HttpHeaderParserState state;
+			stringstream result;
+
+			req.httpMajor = 1;
+			req.httpMinor = 0;
+			req.httpState = HttpRequest::PARSING_HEADERS;
+			req.bodyType = HttpRequest::RBT_NO_BODY;
+			req.method = HTTP_GET;
+			req.wantKeepAlive = false;
+			req.queryStringIndex = -1;
+			req.pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+
+			context.httpHeaderScanner = scanner;
+			HttpHeaderParser<HttpRequest> parser(&context, &state, &req, req.pool);
+			parser.initialize();
+			state.parser.index = 255;
+
+			mbuf buffer(mbuf_get_with_size(&context.mbuf_pool, data.size()));
+			memcpy(buffer.start, data.data(), data.size());
+			size_t ret = parser.feed(buffer);
+
+			// The fast path doesn't run http_parser at all, while http_parser
+			// overwrites `index` as soon as it sees the first method character.
+			usedFastPath = state.parser.index == 255;
+
+			result << "state=" << req.getHttpStateString() << "\n";
+			if (req.httpState == HttpRequest::ERROR) {
+				result << "error=" << req.aux.parseError << "\n";
+			} else if (req.httpState != HttpRequest::PARSING_HEADERS) {
+				result << "ret=" << ret << "\n";
+				result << "method=" << http_method_str(req.method) << "\n";
+				result << "version=" << (int) req.httpMajor << "." << (int) req.httpMinor << "\n";
+				result << "keepAlive=" << req.wantKeepAlive << "\n";
+				result << "bodyType=" << req.getBodyTypeString() << "\n";
+				if (req.bodyType == HttpRequest::RBT_CONTENT_LENGTH) {
+					result << "contentLength=" << req.aux.bodyInfo.contentLength << "\n";
+				}
+				result << "path=" << lstrToString(&req.path) << "\n";
+				result << "queryStringIndex=" << req.queryStringIndex << "\n";
+				result << "headers=\n" << describeHeaders(req.headers);
+				result << "secureHeaders=\n" << describeHeaders(req.secureHeaders);
+			}
+
+			deinitializeHeaders(req.headers);
+			deinitializeHeaders(req.secureHeaders);
+			psg_lstr_deinit(&req.path);
+			psg_destroy_pool(req.pool);
+			return result.str();
+		}
+
+		void ensureSameResult(const string &data) {
+			string expected = parse(data, NULL);
+			for (unsigned int i = 0; i < scanners.size(); i++) {
+				string actual = parse(data, scanners[i]);
+				if (actual != expected) {
+					fail(("Parsing with the " + string(scanners[i]->name) +
+						" scanner gives a different result for request " +
+						cEscapeString(data) + "\nExpected:\n" + expected +
+						"\nActual:\n" + actual).c_str());
+				}
+			}
+		}
+
+		unsigned int random(unsigned int max) {
+			// xorshift32, so that the test is deterministic.
+			randomState ^= randomState << 13;
+			randomState ^= randomState >> 17;
+			randomState ^= randomState << 5;
+			return randomState % max;
+		}
+
+		template<size_t size>
+		const char *pick(const char * const (&choices)[size]) {
+			return choices[random(size)];
+		}
+
+		string randomString(unsigned int maxSize, const char *alphabet) {
+			unsigned int size = random(maxSize + 1);
+			unsigned int alphabetSize = strlen(alphabet);
+			string result;
+			for (unsigned int i = 0; i < size; i++) {
+				if (random(50) == 0) {
+					// Occasionally use any byte.
+					result.append(1, (char) random(256));
+				} else {
+					result.append(1, alphabet[random(alphabetSize)]);
+				}
+			}
+			return result;
+		}
+
+		string randomRequest() {
+			static const char * const methods[] = {
+				"GET", "GET", "GET", "POST", "HEAD", "PUT", "DELETE", "OPTIONS",
+				"PATCH", "CONNECT", "PROPFIND", "MKCOL", "get", "GETS", ""
+			};
+			static const char * const versions[] = {
+				"HTTP/1.1", "HTTP/1.1", "HTTP/1.0", "HTTP/2.0", "HTTP/1.10",
+				"HTTP/0.9", "HTTP/1.x", "HTTP/1.1 ", "HTTp/1.1"
+			};
+			static const char * const newlines[] = {
+				"\r\n", "\r\n", "\r\n", "\r\n", "\r\n", "\r\n", "\r\n", "\n", "\r"
+			};
+			static const char * const names[] = {
+				"Host", "Accept", "User-Agent", "Cookie", "cookie", "X-Foo", "x-foo",
+				"Content-Length", "content-length", "CONTENT-LENGTH", "Content-Lengthx",
+				"Transfer-Encoding", "transfer-encoding", "Connection", "connection",
+				"Proxy-Connection", "Upgrade", "!~", "!~", "!~FOO", "!~Bar", "!x",
+				"X|Y~Z", "X Y", "X\tY", "", "A-Very-Long-Header-Name-That-Spans-Vectors"
+			};
+			static const char * const values[] = {
+				"", " ", "chunked", "Chunked", "chunked ", "chunked\t", "gzip, chunked",
+				"keep-alive", "Keep-Alive", "close", "CLOSE", "close ", "upgrade",
+				"0", "5", "12", "12 3", "-1", "99999999999999999999", "007",
+				"secret", "wrong", "localhost", "text/html; q=0.9", "a\tb", "b "
+			};
+			static const char * const separators[] = {
+				": ", ": ", ": ", ":", ":  ", ":\t", " : ", "; "
+			};
+			const char *newline = pick(newlines);
+			string result;
+
+			result.append(pick(methods));
+			result.append(random(10) == 0 ? "  " : " ");
+			switch (random(10)) {
+			case 0:
+				result.append("*");
+				break;
+			case 1:
+				result.append("http://example.com/");
+				break;
+			default:
+				result.append("/");
+				break;
+			}
+			result.append(randomString(40, "abcABC019/.-_~%?&=#+!$'()*,;:@\"<>[]\\^`{|}"));
+			result.append(" ");
+			result.append(pick(versions));
+			result.append(newline);
+
+			unsigned int nheaders = random(12);
+			for (unsigned int i = 0; i < nheaders; i++) {
+				if (random(3) == 0) {
+					result.append(randomString(20, "abcdefXYZ-_!~|0123"));
+				} else {
+					result.append(pick(names));
+				}
+				result.append(pick(separators));
+				if (random(3) == 0) {
+					result.append(randomString(60, "abc ABC\t0123;,=/\"'()<>@"));
+				} else {
+					result.append(pick(values));
+				}
+				if (random(30) == 0) {
+					// Obsolete line folding.
+					result.append(newline);
+					result.append(random(2) == 0 ? " " : "\t");
+					result.append(pick(values));
+				}
+				result.append(random(20) == 0 ? pick(newlines) : newline);
+			}
+			result.append(newline);
+			if (random(4) == 0) {
+				result.append("body data");
+			}
+
+			switch (random(20)) {
+			case 0:
+				// Truncate.
+				result.resize(random(result.size() + 1));
+				break;
+			case 1:
+				// Change a random byte.
+				if (!result.empty()) {
+					result[random(result.size())] = (char) random(256);
+				}
+				break;
+			default:
+				break;
+			}
+			return result;
+		}
+
+		static bool isTokenChar(unsigned char ch) {
+			return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')
+				|| (ch >= '0' && ch <= '9') || (ch != 0 && strchr("!#$%&'*+-.^_`|~", ch) != NULL);
+		}
+
+		static bool isUrlChar(unsigned char ch) {
+			return ch >= 0x21 && ch <= 0x7e;
+		}
+
+		static bool isValueChar(unsigned char ch) {
+			return ch == '\t' || (ch >= 0x20 && ch != 0x7f);
+		}
+
+		void testScanFunction(const HttpHeaderScanner *scanner,
+			HttpHeaderScanner::ScanFunction func, bool (*isMember)(unsigned char))
+		{
+			char buf[80];
+			for (unsigned int size = 0; size < sizeof(buf); size += 7) {
+				for (unsigned int pos = 0; pos < size; pos++) {
+					for (unsigned int ch = 0; ch < 256; ch++) {
+						memset(buf, 'a', sizeof(buf));
+						buf[pos] = (char) ch;
+						const char *result = func(buf, buf + size);
+						const char *expected = isMember(ch) ? buf + size : buf + pos;
+						if (result != expected) {
+							fail(("The " + string(scanner->name) + " scanner stops at "
+								+ toString(result - buf) + " instead of "
+								+ toString(expected - buf) + " for byte "
+								+ toString(ch) + " at " + toString(pos)
+								+ " in a buffer of size " + toString(size)).c_str());
+						}
+					}
+				}
+			}
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_HttpHeaderParserTest);
+
+	TEST_METHOD(1) {
+		set_test_name("The scanners stop at the first byte outside their character class");
+		for (unsigned int i = 0; i < scanners.size(); i++) {
+			testScanFunction(scanners[i], scanners[i]->scanToken, isTokenChar);
+			testScanFunction(scanners[i], scanners[i]->scanUrl, isUrlChar);
+			testScanFunction(scanners[i], scanners[i]->scanValue, isValueChar);
+		}
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Typical requests are parsed by the fast path, with the same result as http_parser");
+		const char *requests[] = {
+			"GET /foo?bar=baz HTTP/1.1\r\n"
+			"Host: www.example.com\r\n"
+			"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:45.0) Gecko/20100101 Firefox/45.0\r\n"
+			"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+			"Cookie: a=b\r\n"
+			"Cookie: c=d\r\n"
+			"Connection: keep-alive\r\n"
+			"\r\n",
+
+			"POST /upload HTTP/1.0\r\n"
+			"Content-Length: 9\r\n"
+			"Connection: Keep-Alive\r\n"
+			"\r\n"
+			"body data",
+
+			"PUT /upload HTTP/1.1\r\n"
+			"Transfer-Encoding: chunked\r\n"
+			"Connection: close\r\n"
+			"\r\n",
+
+			"GET / HTTP/1.1\r\n"
+			"!~: secret\r\n"
+			"!~FOO: bar\r\n"
+			"!~: \r\n"
+			"Host: foo\r\n"
+			"\r\n"
+		};
+
+		for (unsigned int i = 0; i < sizeof(requests) / sizeof(const char *); i++) {
+			ensureSameResult(requests[i]);
+			for (unsigned int j = 0; j < scanners.size(); j++) {
+				parse(requests[i], scanners[j]);
+				ensure("Request " + toString(i) + " is parsed by the fast path", usedFastPath);
+			}
+		}
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Requests that the fast path doesn't support are left to http_parser");
+		const char *requests[] = {
+			// Incomplete
+			"GET / HTTP/1.1\r\nHost: foo\r\n",
+			// Upgrade
+			"GET / HTTP/1.1\r\nConnection: upgrade\r\nUpgrade: websocket\r\n\r\n",
+			// Line folding
+			"GET / HTTP/1.1\r\nX-Foo: a\r\n b\r\n\r\n",
+			// Bare LF
+			"GET / HTTP/1.1\nHost: foo\n\n",
+			// Invalid header name
+			"GET / HTTP/1.1\r\nX Foo: a\r\n\r\n",
+			// Secure header without password
+			"GET / HTTP/1.1\r\n!~FOO: bar\r\n\r\n",
+			// Wrong password
+			"GET / HTTP/1.1\r\n!~: wrong\r\n\r\n",
+			// Normal header between secure headers
+			"GET / HTTP/1.1\r\n!~: secret\r\nHost: foo\r\n\r\n",
+			// Invalid content length
+			"POST / HTTP/1.1\r\nContent-Length: abc\r\n\r\n"
+		};
+
+		for (unsigned int i = 0; i < sizeof(requests) / sizeof(const char *); i++) {
+			ensureSameResult(requests[i]);
+			for (unsigned int j = 0; j < scanners.size(); j++) {
+				parse(requests[i], scanners[j]);
+				ensure("Request " + toString(i) + " is not parsed by the fast path",
+					!usedFastPath);
+			}
+		}
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Differential fuzzing: random requests give the same result"
+			" with and without the fast path");
+		unsigned int fastPathCount = 0;
+		const unsigned int iterations = 20000;
+
+		for (unsigned int i = 0; i < iterations; i++) {
+			string request = randomRequest();
+			ensureSameResult(request);
+			parse(request, scanners.back());
+			if (usedFastPath) {
+				fastPathCount++;
+			}
+		}
+
+		// Make sure that the fuzzer exercises both paths.
+		ensure("Fast path used: " + toString(fastPathCount), fastPathCount > iterations / 20);
+		ensure("Fast path not used: " + toString(iterations - fastPathCount),
+			fastPathCount < iterations - iterations / 20);
+	}
+}
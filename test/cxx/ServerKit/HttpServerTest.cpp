@@ -82,14 +82,14 @@ namespace tut {
 				}
 			}
 
-			writeSimpleResponse(client, 200, &headers,
+			writeSimpleResponse(client, req, 200, &headers,
 				StaticString(response, pos - response));
 			endRequest(&client, &req);
 		}
 
 		void testBody(MyClient *client, MyRequest *req) {
 			if (!req->hasBody() && !req->upgraded()) {
-				writeSimpleResponse(client, 422, NULL, "Body required");
+				writeSimpleResponse(client, req, 422, NULL, "Body required");
 				if (!req->ended()) {
 					endRequest(&client, &req);
 				}
@@ -98,7 +98,7 @@ namespace tut {
 
 		void testBodyStop(MyClient *client, MyRequest *req) {
 			if (!req->hasBody() && !req->upgraded()) {
-				writeSimpleResponse(client, 422, NULL, "Body required");
+				writeSimpleResponse(client, req, 422, NULL, "Body required");
 				if (!req->ended()) {
 					endRequest(&client, &req);
 				}
@@ -121,7 +121,7 @@ namespace tut {
 			unsigned int size = stringToUint(StaticString(value->start->data, value->size));
 			char *body = (char *) psg_pnalloc(req->pool, size);
 			memset(body, 'x', size);
-			writeSimpleResponse(client, 200, NULL, StaticString(body, size));
+			writeSimpleResponse(client, req, 200, NULL, StaticString(body, size));
 			if (!req->ended()) {
 				endRequest(&client, &req);
 			}
@@ -129,9 +129,9 @@ namespace tut {
 
 		void testPath(MyClient *client, MyRequest *req) {
 			if (req->path.start->next == NULL) {
-				writeSimpleResponse(client, 200, NULL, "Contiguous: 1");
+				writeSimpleResponse(client, req, 200, NULL, "Contiguous: 1");
 			} else {
-				writeSimpleResponse(client, 500, NULL, "Contiguous: 0");
+				writeSimpleResponse(client, req, 500, NULL, "Contiguous: 0");
 			}
 			if (!req->ended()) {
 				endRequest(&client, &req);
@@ -143,9 +143,15 @@ namespace tut {
 			// Continues in onRequestEarlyHalfClose()
 		}
 
+		void testWait(MyClient *client, MyRequest *req) {
+			refRequest(req, __FILE__, __LINE__);
+			requestsWaitingToRespond.push_back(req);
+			// Continues in respondToWaitingRequest()
+		}
+
 		void testEarlyReadErrorDetection(MyClient *client, MyRequest *req) {
 			req->nextRequestEarlyReadError = ENOSPC;
-			writeSimpleResponse(client, 200, NULL, "OK");
+			writeSimpleResponse(client, req, 200, NULL, "OK");
 			endRequest(&client, &req);
 		}
 
@@ -174,6 +180,8 @@ namespace tut {
 				testHalfClose(client, req);
 			} else if (psg_lstr_cmp(&req->path, "/early_read_error_detection_test")) {
 				testEarlyReadErrorDetection(client, req);
+			} else if (psg_lstr_cmp(&req->path, P_STATIC_STRING("/wait_test?"), 11)) {
+				testWait(client, req);
 			} else {
 				testRequest(client, req);
 			}
@@ -190,7 +198,7 @@ namespace tut {
 				// EOF
 				req->body.insert(0, toString(req->body.size()) + " bytes: ");
 				if (!req->testingHalfClose) {
-					writeSimpleResponse(client, 200, NULL, req->body);
+					writeSimpleResponse(client, req, 200, NULL, req->body);
 					endRequest(&client, &req);
 				}
 			} else {
@@ -198,7 +206,7 @@ namespace tut {
 				req->body.insert(0, string("Request body error: ") +
 					getErrorDesc(errcode) + "\n" +
 					toString(req->body.size()) + " bytes: ");
-				writeSimpleResponse(client, 422, NULL, req->body);
+				writeSimpleResponse(client, req, 422, NULL, req->body);
 				if (!req->ended()) {
 					endRequest(&client, &req);
 				}
@@ -233,6 +241,13 @@ namespace tut {
 					break;
 				}
 			}
+			for (i = 0; i < requestsWaitingToRespond.size(); i++) {
+				if (requestsWaitingToRespond[i] == req) {
+					requestsWaitingToRespond.erase(requestsWaitingToRespond.begin() + i);
+					unrefRequest(req, __FILE__, __LINE__);
+					break;
+				}
+			}
 			ParentClass::deinitializeRequest(client, req);
 		}
 
@@ -244,6 +259,7 @@ namespace tut {
 		bool allowUpgrades;
 
 		vector<MyRequest *> requestsWaitingToStartAcceptingBody;
+		vector<MyRequest *> requestsWaitingToRespond;
 		unsigned int bodyBytesRead;
 		unsigned int halfCloseDetected;
 		unsigned int clientDataErrors;
@@ -268,6 +284,31 @@ namespace tut {
 				unrefRequest(req, __FILE__, __LINE__);
 			}
 		}
+
+		void respondToWaitingRequest(const string &path, bool keepAlive) {
+			unsigned int i;
+
+			for (i = 0; i < requestsWaitingToRespond.size(); i++) {
+				MyRequest *req = requestsWaitingToRespond[i];
+				if (psg_lstr_cmp(&req->path, path)) {
+					MyClient *client = static_cast<MyClient *>(req->client);
+					HeaderTable headers;
+					string body = "hello " + path;
+					char *data = (char *) psg_pnalloc(req->pool, body.size());
+
+					memcpy(data, body.data(), body.size());
+					if (!keepAlive) {
+						headers.insert(req->pool, "connection", "close");
+					}
+					// endRequest() removes the request from `requestsWaitingToRespond`.
+					RequestRef ref(req, __FILE__, __LINE__);
+					writeSimpleResponse(client, req, 200, &headers,
+						StaticString(data, body.size()));
+					endRequest(&client, &req);
+					return;
+				}
+			}
+		}
 	};
 
 	struct ServerKit_HttpServerTest {
@@ -375,6 +416,17 @@ namespace tut {
 			*result = server->totalRequestsBegun;
 		}
 
+		unsigned long getTotalRequestsPipelined() {
+			unsigned long result;
+			bg.safe->runSync(boost::bind(&ServerKit_HttpServerTest::_getTotalRequestsPipelined,
+				this, &result));
+			return result;
+		}
+
+		void _getTotalRequestsPipelined(unsigned long *result) {
+			*result = server->totalRequestsPipelined;
+		}
+
 		unsigned int getBodyBytesRead() {
 			unsigned int result;
 			bg.safe->runSync(boost::bind(&ServerKit_HttpServerTest::_getBodyBytesRead,
@@ -397,6 +449,21 @@ namespace tut {
 			*result = server->activeClientCount;
 		}
 
+		Json::Value inspectServerState() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&ServerKit_HttpServerTest::_inspectServerState,
+				this, &result));
+			return result;
+		}
+
+		void _inspectServerState(Json::Value *result) {
+			*result = server->inspectStateAsJson();
+		}
+
+		unsigned int getParkedClientCount() {
+			return inspectServerState()["parked_client_count"].asUInt();
+		}
+
 		unsigned int getNumRequestsWaitingToStartAcceptingBody() {
 			unsigned int result;
 			bg.safe->runSync(boost::bind(
@@ -442,6 +509,11 @@ namespace tut {
 			server->startAcceptingBody();
 		}
 
+		void respondToWaitingRequest(const string &path, bool keepAlive = true) {
+			bg.safe->runSync(boost::bind(&MyServer::respondToWaitingRequest,
+				server.get(), path, keepAlive));
+		}
+
 		void shutdownServer() {
 			bg.safe->runLater(boost::bind(&ServerKit_HttpServerTest::_shutdownServer,
 				this));
@@ -478,9 +550,31 @@ namespace tut {
 			} while (true);
 			return result;
 		}
+
+		/** Reads the response to a `GET /` request on a keep-alive connection. */
+		string readKeepAliveResponse() {
+			string header = readResponseHeader();
+			char body[sizeof("hello /") - 1];
+			unsigned long long timeout = 5000000;
+			io.read(body, sizeof(body), &timeout);
+			return header + string(body, sizeof(body));
+		}
+
+		void parkClient() {
+			server->setClientParkingDelay(0.01);
+			connectToServer();
+			sendRequest(
+				"GET / HTTP/1.1\r\n"
+				"Connection: keep-alive\r\n\r\n");
+			ensure(containsSubstring(readKeepAliveResponse(), "hello /"));
+			EVENTUALLY(5,
+				result = getParkedClientCount() == 1;
+			);
+			ensure_equals(getActiveClientCount(), 0u);
+		}
 	};
 
-	DEFINE_TEST_GROUP_WITH_LIMIT(ServerKit_HttpServerTest, 100);
+	DEFINE_TEST_GROUP_WITH_LIMIT(ServerKit_HttpServerTest, 110);
 
 
 	/***** Valid HTTP header parsing *****/
@@ -1431,6 +1525,76 @@ namespace tut {
 		);
 	}
 
+	TEST_METHOD(66) {
+		set_test_name("If pipelining is enabled, there is unflushed output data, and keep-alive "
+			"is possible, it handles the next request before all output data is flushed");
+
+		server->pipelineDepth = 1;
+		connectToServer();
+		sendRequest(
+			"GET /large_response HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n"
+			"Size: 1000000\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"Host: foo\r\n\r\n");
+		EVENTUALLY(5,
+			result = getTotalRequestsBegun() == 2;
+		);
+		ensure_equals(getTotalRequestsPipelined(), 1u);
+
+		string data = readAll(fd);
+		string response2 =
+			"HTTP/1.1 200 OK\r\n"
+			"Status: 200 OK\r\n"
+			"Content-Type: text/plain\r\n"
+			"Date: Thu, 11 Sep 2014 12:54:09 GMT\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 10\r\n\r\n"
+			"hello /foo";
+
+		string body = stripHeaders(data);
+		ensure(startsWith(data, "HTTP/1.1 200 OK\r\n"));
+		ensure_equals(body.size(), 1000000u + response2.size());
+		ensure_equals(body.substr(0, 1000000), string(1000000, 'x'));
+		ensure_equals(body.substr(1000000), response2);
+	}
+
+	TEST_METHOD(67) {
+		set_test_name("If pipelining is enabled, it handles no more requests ahead "
+			"than the configured pipeline depth");
+
+		server->pipelineDepth = 1;
+		connectToServer();
+		sendRequest(
+			"GET /large_response HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n"
+			"Size: 1000000\r\n\r\n"
+			"GET /large_response HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n"
+			"Size: 1000000\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"Host: foo\r\n\r\n");
+		EVENTUALLY(5,
+			result = getTotalRequestsBegun() == 2;
+		);
+		SHOULD_NEVER_HAPPEN(100,
+			result = getTotalRequestsBegun() > 2;
+		);
+
+		string data = readAll(fd);
+		string::size_type pos = data.find("HTTP/1.1 200 OK\r\n", 1000000);
+		ensure("(1)", pos != string::npos);
+		pos = data.find("HTTP/1.1 200 OK\r\n", pos + 1000000);
+		ensure("(2)", pos != string::npos);
+		ensure_equals("(3)", data.substr(data.size() - 10), "hello /foo");
+		ensure_equals("(4)", getTotalRequestsBegun(), 3u);
+	}
+
 
 	/***** Early half-close detection *****/
 
@@ -1727,4 +1891,247 @@ namespace tut {
 			result = getActiveClientCount() == 0;
 		);
 	}
+
+
+	/***** Idle client parking *****/
+
+	TEST_METHOD(100) {
+		set_test_name("Idle keep-alive clients are parked, and unparked when they "
+			"send the next request");
+
+		parkClient();
+		Json::Value doc = inspectServerState();
+		ensure_equals("(1)", doc["total_clients_parked"].asUInt(), 1u);
+		ensure("(2)", doc["idle_client_memory"]["per_parked_client"]["bytes"].asUInt()
+			< doc["idle_client_memory"]["per_unparked_client"]["bytes"].asUInt());
+
+		// Prevent the client from being parked again.
+		bg.safe->runSync(boost::bind(&MyServer::setClientParkingDelay, server.get(), 0.0));
+		sendRequest(
+			"GET / HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n\r\n");
+		string response = readKeepAliveResponse();
+		ensure("(3)", startsWith(response, "HTTP/1.1 200 OK\r\n"));
+		ensure("(4)", containsSubstring(response, "hello /"));
+
+		doc = inspectServerState();
+		ensure_equals("(5)", doc["total_clients_unparked"].asUInt(), 1u);
+		ensure_equals("(6)", doc["total_clients_accepted"].asUInt(), 1u);
+		ensure_equals("(7)", getTotalRequestsBegun(), 2u);
+		ensure("The client keeps its number", doc["active_clients"].isMember("1"));
+	}
+
+	TEST_METHOD(101) {
+		set_test_name("Clients that have sent part of a request are not parked");
+
+		server->setClientParkingDelay(0.01);
+		connectToServer();
+		sendRequestAndWait("GET / HTTP/1.1\r\n");
+		SHOULD_NEVER_HAPPEN(100,
+			result = getParkedClientCount() > 0;
+		);
+
+		sendRequest(
+			"Connection: close\r\n\r\n");
+		ensure(containsSubstring(readAll(fd), "hello /"));
+	}
+
+	TEST_METHOD(102) {
+		set_test_name("Parked clients that close the connection are cleaned up");
+
+		parkClient();
+		fd.close();
+		EVENTUALLY(5,
+			result = getParkedClientCount() == 0;
+		);
+		ensure_equals(getActiveClientCount(), 0u);
+	}
+
+	TEST_METHOD(103) {
+		set_test_name("Parked clients are disconnected upon shutting down the server");
+
+		parkClient();
+		shutdownServer();
+		ensure_equals(readAll(fd), "");
+		EVENTUALLY(5,
+			result = getServerState() == MyServer::FINISHED_SHUTDOWN;
+		);
+	}
+
+
+	/***** Pipelined request handling *****/
+
+	TEST_METHOD(104) {
+		set_test_name("If pipelining is enabled, it handles pipelined requests concurrently "
+			"and sends their responses in request order");
+
+		server->pipelineDepth = 4;
+		connectToServer();
+		sendRequest(
+			"GET /wait_test?1 HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n"
+			"GET /wait_test?2 HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n"
+			"GET /wait_test?3 HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"Host: foo\r\n\r\n");
+		EVENTUALLY(5,
+			result = getTotalRequestsBegun() == 3;
+		);
+		ensure_equals(getTotalRequestsPipelined(), 2u);
+
+		respondToWaitingRequest("/wait_test?3");
+		respondToWaitingRequest("/wait_test?2");
+		SHOULD_NEVER_HAPPEN(100,
+			result = hasResponseData();
+		);
+
+		respondToWaitingRequest("/wait_test?1");
+		string data = readAll(fd);
+		string::size_type pos1 = data.find("hello /wait_test?1");
+		string::size_type pos2 = data.find("hello /wait_test?2");
+		string::size_type pos3 = data.find("hello /wait_test?3");
+		ensure("(1)", startsWith(data, "HTTP/1.1 200 OK\r\n"));
+		ensure("(2)", pos1 != string::npos);
+		ensure("(3)", pos2 != string::npos);
+		ensure("(4)", pos3 != string::npos);
+		ensure("(5)", pos1 < pos2);
+		ensure("(6)", pos2 < pos3);
+	}
+
+	TEST_METHOD(105) {
+		set_test_name("If pipelining is enabled, it defers requests with unsafe methods "
+			"until the requests before them have ended");
+
+		server->pipelineDepth = 4;
+		connectToServer();
+		sendRequest(
+			"GET /wait_test?1 HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n"
+			"POST /foo HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"Host: foo\r\n\r\n");
+		EVENTUALLY(5,
+			result = getTotalRequestsPipelined() == 1;
+		);
+		SHOULD_NEVER_HAPPEN(100,
+			result = getTotalRequestsBegun() > 1;
+		);
+
+		respondToWaitingRequest("/wait_test?1");
+		string data = readAll(fd);
+		string::size_type pos1 = data.find("hello /wait_test?1");
+		string::size_type pos2 = data.find("hello /foo");
+		ensure("(1)", pos1 != string::npos);
+		ensure("(2)", pos2 != string::npos);
+		ensure("(3)", pos1 < pos2);
+		ensure_equals("(4)", getTotalRequestsBegun(), 2u);
+	}
+
+	TEST_METHOD(106) {
+		set_test_name("If pipelining is enabled, it handles no more requests concurrently "
+			"than the configured pipeline depth allows");
+
+		server->pipelineDepth = 2;
+		connectToServer();
+		sendRequest(
+			"GET /wait_test?1 HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n"
+			"GET /wait_test?2 HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n"
+			"GET /wait_test?3 HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n"
+			"GET /wait_test?4 HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"Host: foo\r\n\r\n");
+		EVENTUALLY(5,
+			result = getTotalRequestsBegun() == 3;
+		);
+		SHOULD_NEVER_HAPPEN(100,
+			result = getTotalRequestsBegun() > 3;
+		);
+
+		respondToWaitingRequest("/wait_test?1");
+		EVENTUALLY(5,
+			result = getTotalRequestsBegun() == 4;
+		);
+		respondToWaitingRequest("/wait_test?2");
+		respondToWaitingRequest("/wait_test?3");
+		respondToWaitingRequest("/wait_test?4");
+		string data = readAll(fd);
+		ensure("(1)", data.find("hello /wait_test?1") < data.find("hello /wait_test?2"));
+		ensure("(2)", data.find("hello /wait_test?2") < data.find("hello /wait_test?3"));
+		ensure("(3)", data.find("hello /wait_test?3") < data.find("hello /wait_test?4"));
+		ensure("(4)", data.find("hello /wait_test?4") != string::npos);
+	}
+
+	TEST_METHOD(107) {
+		set_test_name("If pipelining is enabled and the client half-closes the connection, "
+			"then it disconnects the client after sending all responses");
+
+		server->pipelineDepth = 4;
+		connectToServer();
+		sendRequest(
+			"GET /wait_test?1 HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n");
+		syscalls::shutdown(fd, SHUT_WR);
+		EVENTUALLY(5,
+			result = getTotalRequestsBegun() == 2;
+		);
+		SHOULD_NEVER_HAPPEN(100,
+			result = hasResponseData();
+		);
+
+		respondToWaitingRequest("/wait_test?1");
+		string data = readAll(fd);
+		string::size_type pos1 = data.find("hello /wait_test?1");
+		string::size_type pos2 = data.find("hello /foo");
+		ensure("(1)", pos1 != string::npos);
+		ensure("(2)", pos2 != string::npos);
+		ensure("(3)", pos1 < pos2);
+		EVENTUALLY(5,
+			result = getActiveClientCount() == 0;
+		);
+	}
+
+	TEST_METHOD(108) {
+		set_test_name("If pipelining is enabled and a response does not allow keep-alive, "
+			"then it discards the responses to the requests after it");
+
+		server->pipelineDepth = 4;
+		connectToServer();
+		sendRequest(
+			"GET /wait_test?1 HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n"
+			"GET /wait_test?2 HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n");
+		EVENTUALLY(5,
+			result = getTotalRequestsBegun() == 3;
+		);
+
+		respondToWaitingRequest("/wait_test?2");
+		respondToWaitingRequest("/wait_test?1", false);
+		string data = readAll(fd);
+		ensure("(1)", containsSubstring(data, "hello /wait_test?1"));
+		ensure("(2)", !containsSubstring(data, "hello /wait_test?2"));
+		ensure("(3)", !containsSubstring(data, "hello /foo"));
+		EVENTUALLY(5,
+			result = getActiveClientCount() == 0;
+		);
+	}
 }
@@ -0,0 +1,201 @@
+#include <TestSupport.h>
+#include <boost/thread.hpp>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include <BackgroundEventLoop.h>
+#include <FileDescriptor.h>
+#include <ServerKit/SpliceTunnel.h>
+#include <Utils/IOUtils.h>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_SpliceTunnelTest: public ServerKit::Hooks {
+		struct Event {
+			SpliceTunnel::Direction direction;
+			SpliceTunnel::Event event;
+			int errcode;
+		};
+
+		BackgroundEventLoop bg;
+		ServerKit::Context context;
+		SpliceTunnel *tunnel;
+		SocketPair clientSockets;
+		SocketPair peerSockets;
+		boost::mutex syncher;
+		vector<Event> events;
+
+		ServerKit_SpliceTunnelTest()
+			: bg(false, true),
+			  context(bg.safe, bg.libuv_loop),
+			  tunnel(NULL)
+		{
+			Hooks::impl = NULL;
+			Hooks::userData = this;
+			// The first socket of each pair is the one that the tunnel uses.
+			clientSockets = createUnixSocketPair(__FILE__, __LINE__);
+			peerSockets = createUnixSocketPair(__FILE__, __LINE__);
+			setNonBlocking(clientSockets.first);
+			setNonBlocking(peerSockets.first);
+		}
+
+		~ServerKit_SpliceTunnelTest() {
+			if (!bg.isStarted()) {
+				bg.start();
+			}
+			bg.safe->runSync(boost::bind(&ServerKit_SpliceTunnelTest::destroyTunnel,
+				this));
+			bg.stop();
+		}
+
+		void destroyTunnel() {
+			delete tunnel;
+			tunnel = NULL;
+		}
+
+		static void callback(SpliceTunnel *tunnel, SpliceTunnel::Direction direction,
+			SpliceTunnel::Event event, int errcode)
+		{
+			ServerKit_SpliceTunnelTest *self = static_cast<ServerKit_SpliceTunnelTest *>(
+				tunnel->getHooks()->userData);
+			boost::lock_guard<boost::mutex> l(self->syncher);
+			Event e;
+			e.direction = direction;
+			e.event = event;
+			e.errcode = errcode;
+			self->events.push_back(e);
+		}
+
+		void startTunnel() {
+			bg.start();
+			bg.safe->runSync(boost::bind(&ServerKit_SpliceTunnelTest::_startTunnel,
+				this));
+		}
+
+		void _startTunnel() {
+			tunnel = new SpliceTunnel(&context, this, callback);
+			ensure(tunnel->initialize(clientSockets.first, peerSockets.first));
+			tunnel->start();
+		}
+
+		boost::uint64_t getBytesTransferred(SpliceTunnel::Direction direction) {
+			boost::uint64_t result;
+			bg.safe->runSync(boost::bind(&ServerKit_SpliceTunnelTest::_getBytesTransferred,
+				this, direction, &result));
+			return result;
+		}
+
+		void _getBytesTransferred(SpliceTunnel::Direction direction, boost::uint64_t *result) {
+			*result = tunnel->getBytesTransferred(direction);
+		}
+
+		bool hasEvent(SpliceTunnel::Direction direction, SpliceTunnel::Event event,
+			int errcode = 0)
+		{
+			boost::lock_guard<boost::mutex> l(syncher);
+			for (unsigned int i = 0; i < events.size(); i++) {
+				if (events[i].direction == direction && events[i].event == event
+				 && (errcode == 0 || events[i].errcode == errcode))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		unsigned int eventCount() {
+			boost::lock_guard<boost::mutex> l(syncher);
+			return events.size();
+		}
+
+		string readString(int fd, unsigned int size) {
+			string result(size, '\0');
+			unsigned long long timeout = 5000000;
+			readExact(fd, &result[0], size, &timeout);
+			return result;
+		}
+	};
+
+	static void writeInBackground(int fd, string data) {
+		writeExact(fd, data);
+	}
+
+	DEFINE_TEST_GROUP(ServerKit_SpliceTunnelTest);
+
+	TEST_METHOD(1) {
+		set_test_name("It relays data in both directions");
+		if (!SpliceTunnel::isSupported()) {
+			return;
+		}
+		startTunnel();
+
+		writeExact(clientSockets.second, "hello");
+		ensure_equals(readString(peerSockets.second, 5), "hello");
+		writeExact(peerSockets.second, "world!");
+		ensure_equals(readString(clientSockets.second, 6), "world!");
+
+		ensure_equals(getBytesTransferred(SpliceTunnel::CLIENT_TO_PEER), 5u);
+		ensure_equals(getBytesTransferred(SpliceTunnel::PEER_TO_CLIENT), 6u);
+		ensure_equals(eventCount(), 0u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("It stops reading from the source while the sink cannot take more data");
+		if (!SpliceTunnel::isSupported()) {
+			return;
+		}
+		startTunnel();
+
+		string data(4 * 1024 * 1024, 'x');
+		for (unsigned int i = 0; i < data.size(); i += 4096) {
+			data[i] = 'a' + (i / 4096) % 26;
+		}
+		boost::thread writer(boost::bind(writeInBackground,
+			(int) clientSockets.second, data));
+		SHOULD_NEVER_HAPPEN(200,
+			result = getBytesTransferred(SpliceTunnel::CLIENT_TO_PEER) == data.size();
+		);
+
+		string received = readString(peerSockets.second, data.size());
+		writer.join();
+		ensure("All data is received in order", received == data);
+		ensure_equals(getBytesTransferred(SpliceTunnel::CLIENT_TO_PEER), data.size());
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("It reports the end of a stream after all data has been written,"
+			" while the other direction keeps running");
+		if (!SpliceTunnel::isSupported()) {
+			return;
+		}
+		startTunnel();
+
+		writeExact(clientSockets.second, "abc");
+		shutdown(clientSockets.second, SHUT_WR);
+		ensure_equals(readString(peerSockets.second, 3), "abc");
+		EVENTUALLY(5,
+			result = hasEvent(SpliceTunnel::CLIENT_TO_PEER, SpliceTunnel::END_OF_STREAM);
+		);
+
+		writeExact(peerSockets.second, "def");
+		ensure_equals(readString(clientSockets.second, 3), "def");
+		ensure_equals(eventCount(), 1u);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("It reports errors while writing to the sink");
+		if (!SpliceTunnel::isSupported()) {
+			return;
+		}
+		startTunnel();
+
+		peerSockets.second.close();
+		writeExact(clientSockets.second, "abc");
+		EVENTUALLY(5,
+			result = hasEvent(SpliceTunnel::CLIENT_TO_PEER, SpliceTunnel::WRITE_ERROR, EPIPE);
+		);
+	}
+}
@@ -0,0 +1,256 @@
+#include <TestSupport.h>
+#include <Utils/Hasher.h>
+#include <Utils/StrIntUtils.h>
+#include <DataStructures/HashedStaticString.h>
+#include <boost/cstdint.hpp>
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	// Header names seen in real traffic: the standard request and response
+	// headers, common non-standard ones, and the secure headers that the
+	// web server modules send to the Passenger Core.
+	static const char * const HEADER_NAMES[] = {
+		"Accept", "Accept-Charset", "Accept-Datetime", "Accept-Encoding",
+		"Accept-Language", "Accept-Patch", "Accept-Ranges",
+		"Access-Control-Allow-Credentials", "Access-Control-Allow-Headers",
+		"Access-Control-Allow-Methods", "Access-Control-Allow-Origin",
+		"Access-Control-Expose-Headers", "Access-Control-Max-Age",
+		"Access-Control-Request-Headers", "Access-Control-Request-Method",
+		"Age", "Allow", "Alt-Svc", "Authorization", "Cache-Control", "Connection",
+		"Content-Disposition", "Content-Encoding", "Content-Language",
+		"Content-Length", "Content-Location", "Content-MD5", "Content-Range",
+		"Content-Security-Policy", "Content-Security-Policy-Report-Only",
+		"Content-Type", "Cookie", "DNT", "Date", "ETag", "Expect", "Expires",
+		"Forwarded", "From", "Front-End-Https", "Host", "If-Match",
+		"If-Modified-Since", "If-None-Match", "If-Range", "If-Unmodified-Since",
+		"Keep-Alive", "Last-Modified", "Link", "Location", "Max-Forwards",
+		"Origin", "P3P", "Pragma", "Proxy-Authenticate", "Proxy-Authorization",
+		"Proxy-Connection", "Public-Key-Pins", "Range", "Referer", "Refresh",
+		"Retry-After", "Save-Data", "Server", "Set-Cookie", "Status",
+		"Strict-Transport-Security", "TE", "Timing-Allow-Origin", "Trailer",
+		"Transfer-Encoding", "Upgrade", "Upgrade-Insecure-Requests",
+		"User-Agent", "Vary", "Via", "WWW-Authenticate", "Warning",
+		"X-ATT-DeviceId", "X-Accel-Buffering", "X-Accel-Redirect",
+		"X-Content-Duration", "X-Content-Type-Options", "X-Correlation-ID",
+		"X-Csrf-Token", "X-Forwarded-For", "X-Forwarded-Host",
+		"X-Forwarded-Port", "X-Forwarded-Proto", "X-Frame-Options",
+		"X-Http-Method-Override", "X-Powered-By", "X-Request-ID",
+		"X-Request-Start", "X-Requested-With", "X-Runtime", "X-Sendfile",
+		"X-UA-Compatible", "X-UIDH", "X-Wap-Profile", "X-WebKit-CSP",
+		"X-XSS-Protection", "X-Real-IP", "X-Cache", "X-Cache-Hits",
+		"X-Served-By", "X-Timer", "X-Amz-Cf-Id", "X-Amz-Request-Id",
+		"X-Request-Id", "X-Rack-Cache", "CF-Ray", "CF-Connecting-IP",
+		"CF-IPCountry", "CF-Visitor", "True-Client-IP", "Fastly-Client-IP",
+		"X-Cluster-Client-IP", "X-Original-URL", "X-Rewrite-URL",
+		"X-Passenger-Request-Start", "X-Passenger-Connect-Password",
+		"!~", "!~DOCUMENT_ROOT", "!~REMOTE_ADDR", "!~REMOTE_PORT", "!~REMOTE_USER",
+		"!~SERVER_NAME", "!~SERVER_PORT", "!~SERVER_SOFTWARE", "!~HTTPS",
+		"!~SCRIPT_NAME", "!~PASSENGER_APP_ROOT", "!~PASSENGER_APP_GROUP_NAME",
+		"!~PASSENGER_APP_TYPE", "!~PASSENGER_START_COMMAND",
+		"!~PASSENGER_ENV", "!~PASSENGER_SPAWN_METHOD", "!~PASSENGER_USER",
+		"!~PASSENGER_GROUP", "!~PASSENGER_MIN_PROCESSES",
+		"!~PASSENGER_MAX_PROCESSES", "!~PASSENGER_MAX_REQUESTS",
+		"!~PASSENGER_MAX_REQUEST_QUEUE_SIZE", "!~PASSENGER_STICKY_SESSIONS",
+		"!~PASSENGER_STICKY_SESSIONS_COOKIE_NAME", "!~PASSENGER_FRIENDLY_ERROR_PAGES",
+		"!~PASSENGER_LOAD_SHELL_ENVVARS", "!~PASSENGER_BUFFER_RESPONSE",
+		"!~PASSENGER_ENV_VARS", "!~PASSENGER_STARTUP_FILE",
+		"!~PASSENGER_VARY_TURBOCACHE_BY_COOKIE", "!~UNION_STATION_SUPPORT",
+		"!~UNION_STATION_KEY", "!~FLAGS"
+	};
+
+	struct HasherTest {
+		vector<string> corpus;
+		unsigned int randomState;
+
+		HasherTest()
+			: randomState(42)
+		{
+			unsigned int count = sizeof(HEADER_NAMES) / sizeof(const char *);
+			for (unsigned int i = 0; i < count; i++) {
+				string name = HEADER_NAMES[i];
+				corpus.push_back(name);
+				if (name[0] != '!') {
+					corpus.push_back(toLower(name));
+					corpus.push_back(cgiName(name));
+				}
+			}
+		}
+
+		static string toLower(const string &str) {
+			string result = str;
+			for (unsigned int i = 0; i < result.size(); i++) {
+				result[i] = tolower(result[i]);
+			}
+			return result;
+		}
+
+		static string cgiName(const string &str) {
+			string result = "HTTP_";
+			for (unsigned int i = 0; i < str.size(); i++) {
+				result.append(1, (str[i] == '-') ? '_' : toupper(str[i]));
+			}
+			return result;
+		}
+
+		static boost::uint32_t hash(const string &str) {
+			Hasher h;
+			h.update(str.data(), str.size());
+			return h.finalize();
+		}
+
+		unsigned int random(unsigned int max) {
+			randomState ^= randomState << 13;
+			randomState ^= randomState >> 17;
+			randomState ^= randomState << 5;
+			return randomState % max;
+		}
+
+		string randomString(unsigned int size) {
+			string result;
+			for (unsigned int i = 0; i < size; i++) {
+				result.append(1, (char) random(256));
+			}
+			return result;
+		}
+
+		/**
+		 * Distributes the keys over `nbuckets` buckets by their low hash
+		 * bits, like HeaderTable and StringKeyTable do, and returns how far
+		 * the chi-squared statistic is from its expected value, in
+		 * standard deviations.
+		 */
+		static double bucketDeviation(const vector<string> &keys, unsigned int nbuckets) {
+			vector<unsigned int> buckets(nbuckets, 0);
+			for (unsigned int i = 0; i < keys.size(); i++) {
+				buckets[hash(keys[i]) & (nbuckets - 1)]++;
+			}
+
+			double expected = double(keys.size()) / nbuckets;
+			double chiSquared = 0;
+			for (unsigned int i = 0; i < nbuckets; i++) {
+				chiSquared += (buckets[i] - expected) * (buckets[i] - expected) / expected;
+			}
+			return (chiSquared - (nbuckets - 1)) / sqrt(2.0 * (nbuckets - 1));
+		}
+
+		void ensureUniformlyDistributed(const string &what, const vector<string> &keys) {
+			for (unsigned int nbuckets = 16; nbuckets <= keys.size() / 4; nbuckets *= 2) {
+				double deviation = bucketDeviation(keys, nbuckets);
+				ensure(what + " over " + toString(nbuckets) + " buckets: "
+					+ toString(deviation) + " standard deviations",
+					deviation < 5);
+			}
+		}
+	};
+
+	DEFINE_TEST_GROUP(HasherTest);
+
+	TEST_METHOD(1) {
+		set_test_name("EMPTY_STRING_HASH is the hash of the empty string");
+		ensure_equals(hash(""), (boost::uint32_t) Hasher::EMPTY_STRING_HASH);
+		ensure_equals(HashedStaticString().hash(), HashedStaticString("").hash());
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("The result doesn't depend on how the data is split over update() calls");
+		for (unsigned int i = 0; i < 2000; i++) {
+			string data = randomString(random(100));
+			Hasher h;
+			unsigned int pos = 0;
+
+			while (pos < data.size()) {
+				unsigned int size = std::min<unsigned int>(random(20), data.size() - pos);
+				h.update(data.data() + pos, size);
+				pos += size;
+			}
+			ensure_equals(("(" + cEscapeString(data) + ")").c_str(), h.finalize(), hash(data));
+		}
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("updateLowerCase() lower cases the data and hashes the result");
+		for (unsigned int i = 0; i < 2000; i++) {
+			string data = randomString(random(100));
+			string lowerCased = data;
+			char output[100];
+			Hasher h;
+			unsigned int pos = 0;
+
+			for (unsigned int j = 0; j < lowerCased.size(); j++) {
+				if (lowerCased[j] >= 'A' && lowerCased[j] <= 'Z') {
+					lowerCased[j] += 'a' - 'A';
+				}
+			}
+			while (pos < data.size()) {
+				unsigned int size = std::min<unsigned int>(random(40), data.size() - pos);
+				h.updateLowerCase(data.data() + pos, output + pos, size);
+				pos += size;
+			}
+			ensure_equals(("(" + cEscapeString(data) + ")").c_str(),
+				string(output, data.size()), lowerCased);
+			ensure_equals(("(" + cEscapeString(data) + ")").c_str(), h.finalize(), hash(lowerCased));
+		}
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Real header names don't collide");
+		set<boost::uint32_t> hashes;
+		set<string> names(corpus.begin(), corpus.end());
+		set<string>::const_iterator it;
+
+		for (it = names.begin(); it != names.end(); it++) {
+			ensure("Hash of " + *it + " is unique", hashes.insert(hash(*it)).second);
+		}
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Hashes are uniformly distributed over hash table buckets");
+		vector<string> headerNames, customHeaderNames, paths;
+
+		// Header names in all the forms that are hashed.
+		for (unsigned int i = 0; i < 20; i++) {
+			for (unsigned int j = 0; j < corpus.size(); j++) {
+				headerNames.push_back(corpus[j] + (i == 0 ? "" : toString(i)));
+			}
+		}
+		for (unsigned int i = 0; i < 10000; i++) {
+			customHeaderNames.push_back("x-custom-header-" + toString(i));
+			// Like turbocache keys, which consist of the host and the path.
+			paths.push_back("www.example.com\n/articles/" + toString(i * 7) + "?page=" +
+				toString(i % 13));
+		}
+
+		ensureUniformlyDistributed("Header names", headerNames);
+		ensureUniformlyDistributed("Custom header names", customHeaderNames);
+		ensureUniformlyDistributed("Paths", paths);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("Flipping an input bit flips half of the output bits on average");
+		unsigned long long flippedBits = 0, samples = 0;
+
+		for (unsigned int i = 0; i < 300; i++) {
+			string data = randomString(1 + random(40));
+			boost::uint32_t original = hash(data);
+			for (unsigned int bit = 0; bit < data.size() * 8; bit++) {
+				string changed = data;
+				changed[bit / 8] ^= 1 << (bit % 8);
+				boost::uint32_t diff = original ^ hash(changed);
+				while (diff != 0) {
+					flippedBits += diff & 1;
+					diff >>= 1;
+				}
+				samples++;
+			}
+		}
+
+		double average = double(flippedBits) / samples;
+		ensure("Average number of flipped bits: " + toString(average),
+			average > 15.5 && average < 16.5);
+	}
+}
@@ -0,0 +1,134 @@
+#include <TestSupport.h>
+#include <Utils/NumaTopology.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct NumaTopologyTest {
+		vector<unsigned int> cpus(unsigned int first, unsigned int last) {
+			vector<unsigned int> result;
+			for (unsigned int i = first; i <= last; i++) {
+				result.push_back(i);
+			}
+			return result;
+		}
+
+		NumaNode node(unsigned int id, unsigned int firstCpu, unsigned int lastCpu) {
+			NumaNode result;
+			result.id = id;
+			result.cpus = cpus(firstCpu, lastCpu);
+			return result;
+		}
+	};
+
+	DEFINE_TEST_GROUP(NumaTopologyTest);
+
+	TEST_METHOD(1) {
+		set_test_name("parseCpuList() parses single CPUs and ranges");
+		ensure(parseCpuList("").empty());
+		ensure(parseCpuList("\n").empty());
+		ensure_equals(formatCpuList(parseCpuList("3\n")), "3");
+		ensure_equals(formatCpuList(parseCpuList("0-3")), "0-3");
+
+		ensure_equals(formatCpuList(parseCpuList("0-1,4,8-9\n")), "0-1,4,8-9");
+		ensure_equals("Results are sorted and unique",
+			formatCpuList(parseCpuList("8-9,0,1,0-1,4")), "0-1,4,8-9");
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("parseCpuList() rejects malformed lists");
+		const char *invalid[] = { "a", "1-", "3-1", "1;2", "1,,2", NULL };
+		for (unsigned int i = 0; invalid[i] != NULL; i++) {
+			try {
+				parseCpuList(invalid[i]);
+				fail((string("ArgumentException expected for: ") + invalid[i]).c_str());
+			} catch (const ArgumentException &) {
+				// Pass.
+			}
+		}
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("formatCpuList() is the inverse of parseCpuList()");
+		ensure_equals(formatCpuList(vector<unsigned int>()), "");
+		ensure_equals(formatCpuList(parseCpuList("5")), "5");
+		ensure_equals(formatCpuList(parseCpuList("0-3,8-11")), "0-3,8-11");
+		ensure_equals(formatCpuList(parseCpuList("0,2,4-5")), "0,2,4-5");
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("discoverNumaTopology() reads the CPU lists of all nodes with CPUs, sorted by ID");
+		TempDir tempDir("tmp.numa");
+		makeDirTree("tmp.numa/node0");
+		makeDirTree("tmp.numa/node1");
+		makeDirTree("tmp.numa/node10");
+		makeDirTree("tmp.numa/node2");
+		makeDirTree("tmp.numa/power");
+		createFile("tmp.numa/node0/cpulist", "0-3,8-11\n");
+		createFile("tmp.numa/node1/cpulist", "4-7,12-15\n");
+		createFile("tmp.numa/node10/cpulist", "16\n");
+		// A memory-only node.
+		createFile("tmp.numa/node2/cpulist", "\n");
+		createFile("tmp.numa/online", "0-2,10\n");
+
+		vector<NumaNode> nodes = discoverNumaTopology("tmp.numa");
+		ensure_equals(nodes.size(), 3u);
+		ensure_equals(nodes[0].id, 0u);
+		ensure_equals(formatCpuList(nodes[0].cpus), "0-3,8-11");
+		ensure_equals(nodes[1].id, 1u);
+		ensure_equals(formatCpuList(nodes[1].cpus), "4-7,12-15");
+		ensure_equals(nodes[2].id, 10u);
+		ensure_equals(formatCpuList(nodes[2].cpus), "16");
+
+		ensure("A nonexistent sysfs directory results in an empty topology",
+			discoverNumaTopology("tmp.numa/nonexistent").empty());
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("computeNumaThreadPlacement() keeps consecutive threads on the same node,"
+			" in proportion to the number of CPUs per node");
+		vector<NumaNode> nodes;
+		nodes.push_back(node(0, 0, 3));
+		nodes.push_back(node(1, 4, 7));
+
+		vector<NumaThreadPlacement> placement = computeNumaThreadPlacement(4, nodes, false);
+		ensure_equals(placement.size(), 4u);
+		ensure_equals(placement[0].node, 0u);
+		ensure_equals(placement[1].node, 0u);
+		ensure_equals(placement[2].node, 1u);
+		ensure_equals(placement[3].node, 1u);
+		ensure_equals(formatCpuList(placement[0].cpus), "0-3");
+		ensure_equals(formatCpuList(placement[3].cpus), "4-7");
+
+		nodes[1] = node(1, 4, 15);
+		placement = computeNumaThreadPlacement(4, nodes, false);
+		ensure_equals(placement[0].node, 0u);
+		ensure_equals(placement[1].node, 1u);
+		ensure_equals(placement[2].node, 1u);
+		ensure_equals(placement[3].node, 1u);
+
+		placement = computeNumaThreadPlacement(1, nodes, false);
+		ensure_equals(placement.size(), 1u);
+
+		ensure(computeNumaThreadPlacement(4, vector<NumaNode>(), false).empty());
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("computeNumaThreadPlacement() can pin each thread to a single CPU within its node");
+		vector<NumaNode> nodes;
+		nodes.push_back(node(0, 0, 1));
+		nodes.push_back(node(1, 2, 3));
+
+		vector<NumaThreadPlacement> placement = computeNumaThreadPlacement(6, nodes, true);
+		ensure_equals(placement.size(), 6u);
+		ensure_equals(placement[0].node, 0u);
+		ensure_equals(formatCpuList(placement[0].cpus), "0");
+		ensure_equals(formatCpuList(placement[1].cpus), "1");
+		ensure_equals("CPUs are reused round-robin", formatCpuList(placement[2].cpus), "0");
+		ensure_equals(placement[3].node, 1u);
+		ensure_equals(formatCpuList(placement[3].cpus), "2");
+		ensure_equals(formatCpuList(placement[4].cpus), "3");
+		ensure_equals(formatCpuList(placement[5].cpus), "2");
+	}
+}
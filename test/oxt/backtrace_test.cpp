@@ -3,6 +3,9 @@
 #include <oxt/backtrace.hpp>
 #include <oxt/tracable_exception.hpp>
 #include <oxt/thread.hpp>
+#include <boost/atomic.hpp>
+#include <cstdio>
+#include <cstdlib>
 
 using namespace oxt;
 using namespace std;
@@ -84,5 +87,75 @@ namespace tut {
 		foo_thread.join();
 		bar_thread.join();
 	}
-}
 
+	static string nested(unsigned int levels) {
+		TRACE_POINT();
+		if (levels == 1) {
+			return oxt::thread::current_backtrace();
+		} else {
+			return nested(levels - 1);
+		}
+	}
+
+	TEST_METHOD(3) {
+		// Trace points that are nested too deeply to be recorded are
+		// counted, and don't disturb the recorded ones.
+		string backtrace = nested(thread_local_context::MAX_BACKTRACE_DEPTH + 10);
+		ensure("The unrecorded trace points are mentioned",
+			backtrace.find("(10 more deeply nested trace points not recorded)") != string::npos);
+		ensure("The recorded trace points are reported",
+			backtrace.find("nested") != string::npos);
+		ensure("The stack is unwound afterwards",
+			nested(1).find("not recorded") == string::npos);
+	}
+
+	static void push_and_pop(unsigned int level) {
+		char data[16];
+		snprintf(data, sizeof(data), "level %u", level);
+		TRACE_POINT_WITH_DATA(data);
+		if (level < 6) {
+			push_and_pop(level + 1);
+			push_and_pop(level + 1);
+		}
+	}
+
+	static void push_and_pop_until_stopped(CounterPtr child_counter, boost::atomic<bool> *stop) {
+		TRACE_POINT_WITH_NAME("push_and_pop_until_stopped");
+		child_counter->increment();
+		while (!stop->load()) {
+			push_and_pop(0);
+		}
+	}
+
+	TEST_METHOD(4) {
+		// The backtrace of a thread that is concurrently pushing and popping
+		// trace points can be read, and always shows a consistent stack.
+		CounterPtr child_counter = Counter::create_ptr();
+		boost::atomic<bool> stop(false);
+		oxt::thread thr(boost::bind(push_and_pop_until_stopped, child_counter, &stop));
+		child_counter->wait_until(1);
+
+		for (int i = 0; i < 2000; i++) {
+			string backtrace = thr.backtrace();
+			ensure("The outermost trace point is always included",
+				backtrace.find("push_and_pop_until_stopped") != string::npos);
+
+			// Trace points are listed innermost first, so the levels must
+			// count down to 0.
+			string::size_type pos = 0;
+			int lastLevel = -1;
+			while ((pos = backtrace.find("-- level ", pos)) != string::npos) {
+				int level = atoi(backtrace.c_str() + pos + sizeof("-- level ") - 1);
+				ensure("Levels are in range", level >= 0 && level <= 6);
+				ensure("Levels are consecutive", lastLevel == -1 || level == lastLevel - 1);
+				lastLevel = level;
+				pos++;
+			}
+			ensure("The backtrace ends at the outermost level",
+				lastLevel == -1 || lastLevel == 0);
+		}
+
+		stop.store(true);
+		thr.join();
+	}
+}
@@ -43,6 +43,40 @@ def start(options = {})
       "end of startup file\n" +
       "worker_process_started: forked=true\n"
   end
+
+  it "calls the preloader_warmup event before forking if preloader_warmup is set" do
+    File.prepend(@stub.startup_file, %q{
+      history_file = "history.txt"
+      PhusionPassenger.on_event(:preloader_warmup) do
+        ::File.open(history_file, 'a') do |f|
+          f.puts "preloader_warmup: pid=#{Process.pid}\n"
+        end
+      end
+      PhusionPassenger.on_event(:starting_worker_process) do |forked|
+        ::File.open(history_file, 'a') do |f|
+          f.puts "worker_process_started: forked=#{forked}\n"
+        end
+      end
+    })
+    result = start("preloader_warmup" => "true")
+    result[:status].should == "Ready"
+    File.read("#{@stub.app_root}/history.txt").should ==
+      "preloader_warmup: pid=#{@preloader.pid}\n" +
+      "worker_process_started: forked=true\n"
+  end
+
+  it "doesn't call the preloader_warmup event if preloader_warmup is not set" do
+    File.prepend(@stub.startup_file, %q{
+      PhusionPassenger.on_event(:preloader_warmup) do
+        ::File.open("history.txt", 'a') do |f|
+          f.puts "preloader_warmup\n"
+        end
+      end
+    })
+    result = start
+    result[:status].should == "Ready"
+    File.exist?("#{@stub.app_root}/history.txt").should be_false
+  end
 end
 
 end # module PhusionPassenger
@@ -3,6 +3,7 @@
 require 'fileutils'
 require 'stringio'
 require 'etc'
+require 'socket'
 PhusionPassenger.require_passenger_lib 'message_channel'
 PhusionPassenger.require_passenger_lib 'platform_info/ruby'
 PhusionPassenger.require_passenger_lib 'loader_shared_helpers'
@@ -35,6 +36,52 @@ module PhusionPassenger
     split_by_null_into_hash("\0\0").should == { "" => "" }
   end
 
+  describe "#read_session_request" do
+    before :each do
+      @reader, @writer = UNIXSocket.pair
+    end
+
+    after :each do
+      @reader.close if !@reader.closed?
+      @writer.close if !@writer.closed?
+    end
+
+    def write_session_request(headers)
+      data = ""
+      headers.each_pair do |key, value|
+        data << key << "\0" << value << "\0"
+      end
+      @writer.write([data.size].pack('N') << data)
+    end
+
+    it "parses the headers and determines the request body length" do
+      write_session_request("REQUEST_METHOD" => "POST",
+        "CONTENT_LENGTH" => "12", "HTTP_X_FOO" => "bar")
+      headers, body_length = read_session_request(@reader, 1024)
+      headers.should == { "REQUEST_METHOD" => "POST",
+        "CONTENT_LENGTH" => "12", "HTTP_X_FOO" => "bar" }
+      body_length.should == 12
+    end
+
+    it "returns -1 as body length for chunked requests, and nil for requests without a body" do
+      write_session_request("REQUEST_METHOD" => "POST",
+        "TRANSFER_ENCODING" => "chunked")
+      write_session_request("REQUEST_METHOD" => "GET")
+      read_session_request(@reader, 1024)[1].should == -1
+      read_session_request(@reader, 1024)[1].should be_nil
+    end
+
+    it "raises SecurityError if the headers are larger than the given maximum" do
+      write_session_request("REQUEST_METHOD" => "GET", "PATH_INFO" => "/" * 100)
+      lambda { read_session_request(@reader, 32) }.should raise_error(SecurityError)
+    end
+
+    it "returns nil on EOF" do
+      @writer.close
+      read_session_request(@reader, 1024).should be_nil
+    end
+  end
+
   ######################
 end
 